@@ -30,13 +30,18 @@
 #include "absl/flags/parse.h"
 #include "absl/status/status.h"
 #include "common_cpp/protobuf_util/riegeli_io.h"
+#include "common_cpp/protobuf_util/textproto_io.h"
 #include "glog/logging.h"
 #include "wfa/virtual_people/common/model.pb.h"
 #include "wfa/virtual_people/training/model_checker/model_names_checker.h"
 #include "wfa/virtual_people/training/model_checker/model_seeds_checker.h"
+#include "wfa/virtual_people/training/node_name_map.pb.h"
 
 ABSL_FLAG(std::string, model_path, "",
           "Path to the input CompiledNode Riegeli file.");
+ABSL_FLAG(std::string, node_name_map_path, "",
+          "Path to the NodeNameMap textproto, if the model is compiled with "
+          "compact node names.");
 
 int main(int argc, char** argv) {
   absl::ParseCommandLine(argc, argv);
@@ -55,6 +60,17 @@ int main(int argc, char** argv) {
   absl::Status names_status = wfa_virtual_people::CheckNodeNames(nodes);
   CHECK(names_status.ok()) << names_status;
 
+  std::string node_name_map_path = absl::GetFlag(FLAGS_node_name_map_path);
+  if (!node_name_map_path.empty()) {
+    wfa_virtual_people::NodeNameMap name_map;
+    absl::Status read_name_map_status =
+        wfa::ReadTextProtoFile(node_name_map_path, name_map);
+    CHECK(read_name_map_status.ok()) << read_name_map_status;
+    absl::Status name_map_status =
+        wfa_virtual_people::CheckNodeNameMap(nodes, name_map);
+    CHECK(name_map_status.ok()) << name_map_status;
+  }
+
   absl::Status seeds_status = wfa_virtual_people::CheckNodeSeeds(nodes);
   CHECK(seeds_status.ok()) << seeds_status;
 
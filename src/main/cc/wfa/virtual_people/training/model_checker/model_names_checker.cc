@@ -21,6 +21,7 @@
 #include "absl/status/status.h"
 #include "absl/strings/str_cat.h"
 #include "wfa/virtual_people/common/model.pb.h"
+#include "wfa/virtual_people/training/node_name_map.pb.h"
 
 namespace wfa_virtual_people {
 
@@ -37,4 +38,27 @@ absl::Status CheckNodeNames(const std::vector<CompiledNode>& nodes) {
   return absl::OkStatus();
 }
 
+absl::Status CheckNodeNameMap(const std::vector<CompiledNode>& nodes,
+                              const NodeNameMap& name_map) {
+  absl::flat_hash_set<std::string> compact_names;
+  absl::flat_hash_set<std::string> names;
+  for (const NodeNameMap::Entry& entry : name_map.entries()) {
+    if (!compact_names.insert(entry.compact_name()).second) {
+      return absl::InvalidArgumentError(absl::StrCat(
+          "Duplicated compact names in the name map: ", entry.compact_name()));
+    }
+    if (!names.insert(entry.name()).second) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("Duplicated names in the name map: ", entry.name()));
+    }
+  }
+  for (const CompiledNode& node : nodes) {
+    if (!node.name().empty() && !compact_names.contains(node.name())) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("Node name is not in the name map: ", node.name()));
+    }
+  }
+  return absl::OkStatus();
+}
+
 }  // namespace wfa_virtual_people
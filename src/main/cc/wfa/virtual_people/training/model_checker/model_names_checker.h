@@ -19,6 +19,7 @@
 
 #include "absl/status/status.h"
 #include "wfa/virtual_people/common/model.pb.h"
+#include "wfa/virtual_people/training/node_name_map.pb.h"
 
 namespace wfa_virtual_people {
 
@@ -28,6 +29,12 @@ namespace wfa_virtual_people {
 // CompiledNode object in @nodes.
 absl::Status CheckNodeNames(const std::vector<CompiledNode>& nodes);
 
+// Check the names of @nodes are compact names in @name_map, and @name_map is a
+// one-to-one mapping. Combined with CheckNodeNames, this ensures the original
+// node names are unique.
+absl::Status CheckNodeNameMap(const std::vector<CompiledNode>& nodes,
+                              const NodeNameMap& name_map);
+
 }  // namespace wfa_virtual_people
 
 #endif  // SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_CHECKER_MODEL_NAMES_CHECKER_H_
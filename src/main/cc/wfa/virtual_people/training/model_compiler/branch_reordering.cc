@@ -0,0 +1,202 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "wfa/virtual_people/training/model_compiler/branch_reordering.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/container/flat_hash_set.h"
+#include "absl/status/statusor.h"
+#include "wfa/virtual_people/common/field_filter.pb.h"
+#include "wfa/virtual_people/common/model.pb.h"
+#include "wfa/virtual_people/training/model_compiler/field_filter_utils.h"
+#include "wfa/virtual_people/training/model_compiler/labeling_cost.h"
+#include "wfa/virtual_people/training/model_compiler/node_profile.h"
+
+namespace wfa_virtual_people {
+
+namespace {
+
+// The normalized values of the EQUAL filters required by a condition, keyed by
+// field name. A field can have multiple values, in which case the condition
+// never matches.
+using RequiredValues =
+    absl::flat_hash_map<std::string, absl::flat_hash_set<std::string>>;
+
+// Return std::nullopt if any value cannot be normalized by
+// NormalizeEqualFilterValue, in which case the condition is not known to be
+// exclusive with any other.
+std::optional<RequiredValues> GetRequiredValues(
+    const FieldFilterProto& filter) {
+  RequiredValues required_values;
+  for (auto& [name, value] : GetRequiredEqualFilters(filter)) {
+    absl::StatusOr<std::string> normalized =
+        NormalizeEqualFilterValue(name, value);
+    if (!normalized.ok()) {
+      return std::nullopt;
+    }
+    required_values[name].insert(*std::move(normalized));
+  }
+  return required_values;
+}
+
+bool AreMutuallyExclusive(const RequiredValues& values1,
+                          const RequiredValues& values2) {
+  for (const auto& [name, set1] : values1) {
+    if (set1.size() > 1) {
+      // @values1 never matches.
+      return true;
+    }
+    auto it = values2.find(name);
+    if (it == values2.end()) {
+      continue;
+    }
+    if (it->second.size() > 1 || !it->second.contains(*set1.begin())) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Return true if all the conditions require a single value of the same field,
+// and the values are all different. This is the common case, like the country
+// and region conditions, and is checked in linear time.
+bool AllDifferentOnSameField(const std::vector<RequiredValues>& conditions) {
+  for (const auto& [name, values] : conditions[0]) {
+    absl::flat_hash_set<std::string> seen_values;
+    bool all_different = true;
+    for (const RequiredValues& condition : conditions) {
+      auto it = condition.find(name);
+      if (it == condition.end() || it->second.size() != 1 ||
+          !seen_values.insert(*it->second.begin()).second) {
+        all_different = false;
+        break;
+      }
+    }
+    if (all_different) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool ArePairwiseMutuallyExclusive(
+    const std::vector<RequiredValues>& conditions) {
+  if (AllDifferentOnSameField(conditions)) {
+    return true;
+  }
+  for (int i = 0; i < conditions.size(); ++i) {
+    for (int j = i + 1; j < conditions.size(); ++j) {
+      if (!AreMutuallyExclusive(conditions[i], conditions[j])) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// Reorder the branches of @branch_node if they are pairwise mutually
+// exclusive. Return true if the order is changed.
+bool ReorderBranchNode(BranchNode& branch_node,
+                       const NodeHitCounts* hit_counts) {
+  if (branch_node.branches_size() < 2) {
+    return false;
+  }
+  std::vector<RequiredValues> conditions;
+  // The sort keys are the hit counts and the populations of the child nodes.
+  std::vector<std::pair<std::pair<int64_t, uint64_t>, int>> weights;
+  for (int i = 0; i < branch_node.branches_size(); ++i) {
+    const BranchNode::Branch& branch = branch_node.branches(i);
+    if (!branch.has_condition() || !branch.has_node()) {
+      return false;
+    }
+    std::optional<RequiredValues> condition =
+        GetRequiredValues(branch.condition());
+    if (!condition.has_value()) {
+      return false;
+    }
+    conditions.push_back(*std::move(condition));
+    int64_t hit_count =
+        hit_counts ? GetHitCount(branch.node(), *hit_counts) : 0;
+    weights.emplace_back(
+        std::make_pair(hit_count, GetPopulation(branch.node())), i);
+  }
+  if (!ArePairwiseMutuallyExclusive(conditions)) {
+    return false;
+  }
+
+  std::stable_sort(weights.begin(), weights.end(),
+                   [](const auto& a, const auto& b) {
+                     return a.first > b.first;
+                   });
+  bool changed = false;
+  for (int i = 0; i < weights.size(); ++i) {
+    changed |= weights[i].second != i;
+  }
+  if (!changed) {
+    return false;
+  }
+
+  google::protobuf::RepeatedPtrField<BranchNode::Branch> original_branches;
+  original_branches.Swap(branch_node.mutable_branches());
+  for (const auto& [weight, index] : weights) {
+    branch_node.add_branches()->Swap(&original_branches[index]);
+  }
+  return true;
+}
+
+void ReorderRecursively(CompiledNode& node, const NodeHitCounts* hit_counts,
+                        BranchReorderingReport& report) {
+  if (!node.has_branch_node()) {
+    return;
+  }
+  for (BranchNode::Branch& branch :
+       *node.mutable_branch_node()->mutable_branches()) {
+    if (branch.has_node()) {
+      ReorderRecursively(*branch.mutable_node(), hit_counts, report);
+    }
+  }
+  if (ReorderBranchNode(*node.mutable_branch_node(), hit_counts)) {
+    ++report.reordered_node_count;
+  }
+}
+
+}  // namespace
+
+bool AreMutuallyExclusive(const FieldFilterProto& filter1,
+                          const FieldFilterProto& filter2) {
+  std::optional<RequiredValues> values1 = GetRequiredValues(filter1);
+  std::optional<RequiredValues> values2 = GetRequiredValues(filter2);
+  return values1.has_value() && values2.has_value() &&
+         AreMutuallyExclusive(*values1, *values2);
+}
+
+BranchReorderingReport ReorderExclusiveBranches(
+    CompiledNode& node, const NodeHitCounts* hit_counts) {
+  BranchReorderingReport report;
+  report.expected_filter_evaluations_before =
+      GetExpectedFilterEvaluations(node, hit_counts);
+  ReorderRecursively(node, hit_counts, report);
+  report.expected_filter_evaluations_after =
+      GetExpectedFilterEvaluations(node, hit_counts);
+  return report;
+}
+
+}  // namespace wfa_virtual_people
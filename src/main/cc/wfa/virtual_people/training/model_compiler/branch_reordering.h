@@ -0,0 +1,60 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_COMPILER_BRANCH_REORDERING_H_
+#define SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_COMPILER_BRANCH_REORDERING_H_
+
+#include "wfa/virtual_people/common/field_filter.pb.h"
+#include "wfa/virtual_people/common/model.pb.h"
+#include "wfa/virtual_people/training/model_compiler/node_profile.h"
+
+namespace wfa_virtual_people {
+
+struct BranchReorderingReport {
+  // The count of BranchNodes whose branches are reordered.
+  int reordered_node_count = 0;
+  // The expected number of FieldFilterProto evaluations per event, before and
+  // after reordering. See GetExpectedFilterEvaluations.
+  double expected_filter_evaluations_before = 0.0;
+  double expected_filter_evaluations_after = 0.0;
+};
+
+// Return true if no event can match both @filter1 and @filter2, because they
+// require different values of the same field.
+// The required values are as returned by GetRequiredEqualFilters, and are
+// compared after NormalizeEqualFilterValue, so "18" and "018" of an integer
+// field are the same value. If any required value cannot be normalized, the
+// filters are not considered mutually exclusive. Filters that are mutually
+// exclusive for any other reason are not detected.
+bool AreMutuallyExclusive(const FieldFilterProto& filter1,
+                          const FieldFilterProto& filter2);
+
+// Reorder the branches of the BranchNodes in @node and all its descendants, by
+// the populations of the child nodes in descending order, as returned by
+// GetPopulation. If @hit_counts is set, the branches are ordered by the hit
+// counts of the child nodes first, as returned by GetHitCount, and the
+// populations break the ties.
+//
+// Only the BranchNodes, whose branches are selected by condition and the
+// conditions are pairwise mutually exclusive, are reordered. For these nodes,
+// at most one branch matches any event, so the order does not change the
+// labeling results, but the most populous branches are checked first. Branches
+// with the same population keep their relative order.
+// The expected filter evaluations in the report are weighted by @hit_counts.
+BranchReorderingReport ReorderExclusiveBranches(
+    CompiledNode& node, const NodeHitCounts* hit_counts = nullptr);
+
+}  // namespace wfa_virtual_people
+
+#endif  // SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_COMPILER_BRANCH_REORDERING_H_
@@ -43,6 +43,7 @@ inline constexpr double kKappaAllowedError = 0.0001;
 // This stores some information that will be used when building child nodes.
 struct CompilerContext {
   const CensusRecordsSpecification* census = nullptr;
+  CompilerOptions options;
 };
 
 // Indicates whether the child node is selected by chance or condition.
@@ -303,6 +304,9 @@ std::vector<uint64_t> SplitPopulationByAlphas(const uint64_t population_sum,
 // The VirtualPersonPools are grouped based on @delta_pool_sizes. For the i-th
 // group of VirtualPersonPools, the total populaton equals to the i-th value of
 // @delta_pool_sizes.
+// Within a group, a range of ids that starts right after the previous
+// VirtualPersonPool is merged into it, so contiguous records do not produce
+// fragmented pools.
 absl::StatusOr<std::vector<std::vector<PopulationNode::VirtualPersonPool>>>
 SplitRecordsByDeltaPools(const std::vector<uint64_t>& delta_pool_sizes,
                          const std::vector<CensusRecord*>& records) {
@@ -331,10 +335,21 @@ SplitRecordsByDeltaPools(const std::vector<uint64_t>& delta_pool_sizes,
         continue;
       }
       uint64_t fill_amount = std::min(need_to_fill, current_record_remaining);
-      PopulationNode::VirtualPersonPool& virtual_person_pool =
-          delta_pool.emplace_back();
-      virtual_person_pool.set_population_offset(current_record_start);
-      virtual_person_pool.set_total_population(fill_amount);
+      if (!delta_pool.empty() &&
+          delta_pool.back().population_offset() +
+                  delta_pool.back().total_population() ==
+              current_record_start) {
+        // Adjacent to the previous pool.
+        PopulationNode::VirtualPersonPool& virtual_person_pool =
+            delta_pool.back();
+        virtual_person_pool.set_total_population(
+            virtual_person_pool.total_population() + fill_amount);
+      } else {
+        PopulationNode::VirtualPersonPool& virtual_person_pool =
+            delta_pool.emplace_back();
+        virtual_person_pool.set_population_offset(current_record_start);
+        virtual_person_pool.set_total_population(fill_amount);
+      }
       need_to_fill -= fill_amount;
       current_record_remaining -= fill_amount;
       current_record_start += fill_amount;
@@ -528,6 +543,13 @@ absl::StatusOr<BranchNode> CompilePopulationPool(
         ASSIGN_OR_RETURN(
             std::vector<CensusRecord*> multipool_census,
             GetMatchingRecords(census, multipool_record->condition()));
+        if (context.options.sort_census_records_by_offset) {
+          std::stable_sort(multipool_census.begin(), multipool_census.end(),
+                           [](const CensusRecord* a, const CensusRecord* b) {
+                             return a->population_offset() <
+                                    b->population_offset();
+                           });
+        }
 
         RETURN_IF_ERROR(CompileAdf(adf, multipool_census, *pool_node));
       }
@@ -605,9 +627,11 @@ absl::StatusOr<SelectBy> CompileNode(const ModelNodeConfig& config,
 
 }  // namespace
 
-absl::StatusOr<CompiledNode> CompileModel(const ModelNodeConfig& config) {
+absl::StatusOr<CompiledNode> CompileModel(const ModelNodeConfig& config,
+                                          const CompilerOptions& options) {
   CompiledNode node;
   CompilerContext context;
+  context.options = options;
   RETURN_IF_ERROR(CompileNode(config, context, node).status());
   return node;
 }
@@ -21,13 +21,23 @@
 
 namespace wfa_virtual_people {
 
+struct CompilerOptions {
+  // Whether to sort the census records matching each multipool record by
+  // population_offset before splitting them into delta pools. Adjacent id
+  // ranges are always coalesced into a single VirtualPersonPool, and sorting
+  // makes more ranges adjacent when the census records are not listed in id
+  // order. Note that sorting changes the ids assigned to each delta pool.
+  bool sort_census_records_by_offset = false;
+};
+
 // Converts @config to CompiledNode recursively.
 //
 // In a CompiledNode, any child node can be referenced by a CompiledNode
 // sub-message, or an index which refers to another CompiledNode. For the
 // CompiledNode returned by this function, all child nodes are referenced by
 // CompiledNode.
-absl::StatusOr<CompiledNode> CompileModel(const ModelNodeConfig& config);
+absl::StatusOr<CompiledNode> CompileModel(
+    const ModelNodeConfig& config, const CompilerOptions& options = {});
 
 }  // namespace wfa_virtual_people
 
@@ -24,7 +24,11 @@
 // --input_path=/tmp/model_compiler/model_config.textproto \
 // --output_path=/tmp/model_compiler/model.textproto
 
+#include <cstdint>
+#include <fstream>
+#include <memory>
 #include <string>
+#include <vector>
 
 #include "absl/flags/flag.h"
 #include "absl/flags/parse.h"
@@ -33,15 +37,105 @@
 #include "common_cpp/protobuf_util/textproto_io.h"
 #include "glog/logging.h"
 #include "wfa/virtual_people/common/model.pb.h"
+#include "wfa/virtual_people/training/model_compiler/branch_reordering.h"
 #include "wfa/virtual_people/training/model_compiler/compiler.h"
 #include "wfa/virtual_people/training/model_compiler/comprehension/comprehension_method.h"
 #include "wfa/virtual_people/training/model_compiler/comprehension/contextual_boolean_expression.h"
+#include "wfa/virtual_people/training/model_compiler/comprehension/spec_util.h"
+#include "wfa/virtual_people/training/model_compiler/condition_hoisting.h"
+#include "wfa/virtual_people/training/model_compiler/csv_field.h"
+#include "wfa/virtual_people/training/model_compiler/labeling_cost.h"
+#include "wfa/virtual_people/training/model_compiler/model_flattening.h"
+#include "wfa/virtual_people/training/model_compiler/node_name_compaction.h"
+#include "wfa/virtual_people/training/model_compiler/node_profile.h"
+#include "wfa/virtual_people/training/model_compiler/parallel_textproto_writer.h"
+#include "wfa/virtual_people/training/model_compiler/pool_fragmentation.h"
+#include "wfa/virtual_people/training/model_compiler/update_matrix_sparsification.h"
+#include "wfa/virtual_people/training/model_compiler/vid_pool_index.h"
 #include "wfa/virtual_people/training/model_config.pb.h"
+#include "wfa/virtual_people/training/model_file/indexed_model_file.h"
+#include "wfa/virtual_people/training/model_image/model_image_writer.h"
+#include "wfa/virtual_people/training/node_name_map.pb.h"
+#include "wfa/virtual_people/training/vid_pool_index.pb.h"
 
 ABSL_FLAG(std::string, input_path, "",
           "Path to the input ModelNodeConfig textproto.");
 ABSL_FLAG(std::string, output_path, "",
           "Path to the output CompiledNode textproto.");
+ABSL_FLAG(int, comprehension_thread_count, 1,
+          "The count of the threads comprehending the input config. The "
+          "output is the same for any count.");
+ABSL_FLAG(bool, fail_on_unknown_placeholders, false,
+          "Whether a placeholder left in a node after all its comprehension "
+          "methods are applied is an error.");
+ABSL_FLAG(int64_t, comprehension_max_node_count, 0,
+          "If positive, fail as soon as the comprehension produces more nodes "
+          "than this.");
+ABSL_FLAG(int64_t, comprehension_max_byte_count, 0,
+          "If positive, fail as soon as the sum of the serialized sizes of the "
+          "comprehended nodes, without their child nodes, exceeds this.");
+ABSL_FLAG(std::string, comprehension_report_path, "",
+          "If set, only do a dry run of the comprehension, and write the "
+          "count of comprehended nodes of each node of the input config, and "
+          "of each type of method applied to it, to this path, as CSV. The "
+          "node paths are quoted if they contain commas or quotes. Nothing is "
+          "compiled, and --output_path is not used.");
+ABSL_FLAG(bool, sort_census_records_by_offset, false,
+          "Whether to sort the census records by population_offset before "
+          "splitting them into delta pools, so that more adjacent id ranges "
+          "are coalesced.");
+ABSL_FLAG(std::string, pool_fragmentation_report_path, "",
+          "If set, write the pool count and average pool size of each "
+          "population node to this path, as CSV.");
+ABSL_FLAG(std::string, profile_path, "",
+          "If set, read the hit count of each node from this CSV, as written "
+          "by event_replay_main --visit_counts_path, and use them instead of "
+          "census populations to reorder branches, choose conditions to "
+          "hoist, and lay out the flattened output. The node names must be "
+          "the uncompacted names. The model may have attribute updates and "
+          "multiplicity, and the clones of the events are counted as "
+          "events.");
+ABSL_FLAG(bool, sparsify_update_matrices, false,
+          "Whether to convert UpdateMatrix to SparseUpdateMatrix when the "
+          "sparse form is smaller. The attributes are sampled from the same "
+          "distributions, but the choices are renumbered, so the output of "
+          "individual events, including the VIDs, changes compared with the "
+          "dense model. Do not set it when recompiling a model already in "
+          "production.");
+ABSL_FLAG(bool, hoist_conditions, false,
+          "Whether to factor shared EQUAL conditions out of sibling branches "
+          "into intermediate nodes.");
+ABSL_FLAG(bool, reorder_exclusive_branches, false,
+          "Whether to order mutually exclusive condition branches by census "
+          "population, most populous first.");
+ABSL_FLAG(std::string, vid_pool_index_path, "",
+          "If set, write the VidPoolIndex textproto of the output model to "
+          "this path. The index has the full node names, even if the output "
+          "has compact names.");
+ABSL_FLAG(std::string, node_name_map_path, "",
+          "If set, replace the node names with compact names in the output, "
+          "and write the NodeNameMap textproto to this path. This applies to "
+          "all the outputs except --vid_pool_index_path, including "
+          "--flattened_output_path.");
+ABSL_FLAG(std::string, flattened_output_path, "",
+          "If set, also write the model as a riegeli file of CompiledNode "
+          "list, with the child nodes before their parents, laid out in the "
+          "order of --flattened_node_order. The nodes have compact names if "
+          "--node_name_map_path is set. The record positions of the nodes "
+          "are written to a ModelRecordIndex at the same path with suffix "
+          ".index.");
+ABSL_FLAG(std::string, flattened_node_order, "",
+          "The node layout of --flattened_output_path. One of dfs, bfs and "
+          "hot_path. hot_path lays out the most likely path from the root "
+          "contiguously, weighted by --profile_path if set, and by census "
+          "populations otherwise. Defaults to hot_path if --profile_path is "
+          "set, and dfs otherwise.");
+ABSL_FLAG(int, textproto_thread_count, 1,
+          "The count of the threads printing the output textproto. The output "
+          "is the same for any count.");
+ABSL_FLAG(std::string, model_image_path, "",
+          "If set, also write the model as a memory-mappable model image to "
+          "this path.");
 
 int main(int argc, char** argv) {
   absl::ParseCommandLine(argc, argv);
@@ -50,26 +144,224 @@ int main(int argc, char** argv) {
   std::string input_path = absl::GetFlag(FLAGS_input_path);
   CHECK(!input_path.empty()) << "input_path is not set.";
 
+  std::string comprehension_report_path =
+      absl::GetFlag(FLAGS_comprehension_report_path);
   std::string output_path = absl::GetFlag(FLAGS_output_path);
-  CHECK(!output_path.empty()) << "output_path is not set.";
+  CHECK(!output_path.empty() || !comprehension_report_path.empty())
+      << "output_path is not set.";
 
   wfa_virtual_people::ModelNodeConfig config;
   absl::Status read_status = wfa::ReadTextProtoFile(input_path, config);
   CHECK(read_status.ok()) << read_status;
 
   wfa_virtual_people::ContextMap context_map;
+  wfa_virtual_people::ComprehensionOptions comprehension_options;
+  comprehension_options.thread_count =
+      absl::GetFlag(FLAGS_comprehension_thread_count);
+  comprehension_options.fail_on_unknown_placeholders =
+      absl::GetFlag(FLAGS_fail_on_unknown_placeholders);
+  comprehension_options.max_node_count =
+      absl::GetFlag(FLAGS_comprehension_max_node_count);
+  comprehension_options.max_byte_count =
+      absl::GetFlag(FLAGS_comprehension_max_byte_count);
+
+  if (!comprehension_report_path.empty()) {
+    absl::StatusOr<wfa_virtual_people::ComprehensionReport> report =
+        wfa_virtual_people::ComprehensionMethod::EstimateComprehension(
+            config, context_map, comprehension_options);
+    CHECK(report.ok()) << report.status();
+    LOG(INFO) << "Comprehension produces " << report->node_count
+              << " nodes of " << report->byte_count << " bytes.";
+    wfa_virtual_people::CsvCacheStats csv_cache_stats =
+        wfa_virtual_people::GetCsvCacheStats();
+    LOG(INFO) << "Comprehension read the CSV cache " << csv_cache_stats.hits
+              << " times, and parsed " << csv_cache_stats.misses
+              << " files.";
+    std::ofstream report_file(comprehension_report_path);
+    CHECK(report_file.is_open())
+        << "Failed to open " << comprehension_report_path;
+    // The counts of each node have an empty method.
+    report_file << "path,method,input_count,output_count,byte_count\n";
+    for (const wfa_virtual_people::NodeExpansion& node : report->nodes) {
+      std::string path = wfa_virtual_people::ToCsvField(node.path);
+      report_file << path << ",," << node.input_count << ","
+                  << node.output_count << "," << node.byte_count << "\n";
+      for (const wfa_virtual_people::NodeExpansion::MethodExpansion& method :
+           node.methods) {
+        report_file << path << "," << method.method << ","
+                    << method.input_count << "," << method.output_count
+                    << ",\n";
+      }
+    }
+    report_file.close();
+    CHECK(!report_file.fail())
+        << "Failed to write " << comprehension_report_path;
+    return 0;
+  }
   absl::StatusOr<wfa_virtual_people::ModelNodeConfig> comprehended =
       wfa_virtual_people::ComprehensionMethod::ComprehendAndCleanModel(
-          config, context_map);
+          config, context_map, comprehension_options);
   CHECK(comprehended.status().ok()) << comprehended.status();
   config = *comprehended;
+  wfa_virtual_people::CsvCacheStats csv_cache_stats =
+      wfa_virtual_people::GetCsvCacheStats();
+  LOG(INFO) << "Comprehension read the CSV cache " << csv_cache_stats.hits
+            << " times, and parsed " << csv_cache_stats.misses << " files.";
 
+  wfa_virtual_people::CompilerOptions options;
+  options.sort_census_records_by_offset =
+      absl::GetFlag(FLAGS_sort_census_records_by_offset);
   absl::StatusOr<wfa_virtual_people::CompiledNode> model =
-      wfa_virtual_people::CompileModel(config);
+      wfa_virtual_people::CompileModel(config, options);
   CHECK(model.ok()) << model.status();
 
-  absl::Status write_status = wfa::WriteTextProtoFile(output_path, *model);
+  std::unique_ptr<wfa_virtual_people::NodeHitCounts> hit_counts;
+  std::string profile_path = absl::GetFlag(FLAGS_profile_path);
+  if (!profile_path.empty()) {
+    absl::StatusOr<wfa_virtual_people::NodeHitCounts> read_hit_counts =
+        wfa_virtual_people::ReadNodeHitCounts(profile_path);
+    CHECK(read_hit_counts.ok()) << read_hit_counts.status();
+    hit_counts = std::make_unique<wfa_virtual_people::NodeHitCounts>(
+        *std::move(read_hit_counts));
+    LOG(INFO) << "Read hit counts of " << hit_counts->size() << " nodes.";
+  }
+  const double expected_filter_evaluations_before =
+      wfa_virtual_people::GetExpectedFilterEvaluations(*model,
+                                                       hit_counts.get());
+
+  std::string pool_fragmentation_report_path =
+      absl::GetFlag(FLAGS_pool_fragmentation_report_path);
+  if (!pool_fragmentation_report_path.empty()) {
+    wfa_virtual_people::PoolFragmentationReport report =
+        wfa_virtual_people::GetPoolFragmentationReport(*model);
+    LOG(INFO) << report.pool_count << " pools in " << report.nodes.size()
+              << " population nodes. Average pools per node: "
+              << report.GetAveragePoolsPerNode()
+              << ", average pool size: " << report.GetAveragePoolSize();
+    std::ofstream report_file(pool_fragmentation_report_path);
+    CHECK(report_file.is_open())
+        << "Failed to open " << pool_fragmentation_report_path;
+    report_file << "name,pool_count,total_population,average_pool_size\n";
+    for (const wfa_virtual_people::PopulationNodeFragmentation& node :
+         report.nodes) {
+      report_file << wfa_virtual_people::ToCsvField(node.name) << ","
+                  << node.pool_count << "," << node.total_population << ","
+                  << node.GetAveragePoolSize() << "\n";
+    }
+    report_file.close();
+    CHECK(!report_file.fail())
+        << "Failed to write " << pool_fragmentation_report_path;
+  }
+
+  if (absl::GetFlag(FLAGS_sparsify_update_matrices)) {
+    absl::StatusOr<wfa_virtual_people::UpdateMatrixSparsificationReport>
+        report = wfa_virtual_people::SparsifyUpdateMatrices(*model);
+    CHECK(report.ok()) << report.status();
+    if (report->converted_count > 0) {
+      LOG(WARNING) << "The sparse update matrices change the per-event "
+                      "output, including the VIDs, compared with the dense "
+                      "model.";
+    }
+    LOG(INFO) << "Converted " << report->converted_count << " of "
+              << report->update_matrix_count
+              << " update matrices to sparse. Size in bytes: "
+              << report->bytes_before << " -> " << report->bytes_after;
+  }
+
+  if (absl::GetFlag(FLAGS_hoist_conditions)) {
+    wfa_virtual_people::ConditionHoistingOptions hoisting_options;
+    hoisting_options.hit_counts = hit_counts.get();
+    wfa_virtual_people::ConditionHoistingReport report =
+        wfa_virtual_people::HoistConditions(*model, hoisting_options);
+    LOG(INFO) << "Hoisted " << report.hoisted_node_count
+              << " intermediate nodes. Expected filter evaluations per event: "
+              << report.expected_filter_evaluations_before << " -> "
+              << report.expected_filter_evaluations_after;
+  }
+
+  if (absl::GetFlag(FLAGS_reorder_exclusive_branches)) {
+    wfa_virtual_people::BranchReorderingReport report =
+        wfa_virtual_people::ReorderExclusiveBranches(*model,
+                                                     hit_counts.get());
+    LOG(INFO) << "Reordered " << report.reordered_node_count
+              << " branch nodes. Expected filter evaluations per event: "
+              << report.expected_filter_evaluations_before << " -> "
+              << report.expected_filter_evaluations_after;
+  }
+
+  LOG(INFO) << "Expected filter evaluations per event after all passes"
+            << (hit_counts ? ", weighted by the profile: " : ": ")
+            << expected_filter_evaluations_before << " -> "
+            << wfa_virtual_people::GetExpectedFilterEvaluations(
+                   *model, hit_counts.get());
+
+  std::string flattened_output_path =
+      absl::GetFlag(FLAGS_flattened_output_path);
+  if (!flattened_output_path.empty()) {
+    std::string node_order = absl::GetFlag(FLAGS_flattened_node_order);
+    if (node_order.empty()) {
+      node_order = hit_counts ? "hot_path" : "dfs";
+    }
+    wfa_virtual_people::FlatteningOptions flattening_options;
+    absl::StatusOr<wfa_virtual_people::NodeOrder> parsed_node_order =
+        wfa_virtual_people::ParseNodeOrder(node_order);
+    CHECK(parsed_node_order.ok()) << parsed_node_order.status();
+    flattening_options.node_order = *parsed_node_order;
+    flattening_options.hit_counts = hit_counts.get();
+    absl::StatusOr<std::vector<wfa_virtual_people::CompiledNode>> nodes =
+        wfa_virtual_people::FlattenModel(*model, flattening_options);
+    CHECK(nodes.ok()) << nodes.status();
+    // The profile is keyed by the full names, so the names are compacted only
+    // after flattening. The mapping is the same as the one of the tree written
+    // to --node_name_map_path below.
+    if (!absl::GetFlag(FLAGS_node_name_map_path).empty()) {
+      absl::StatusOr<wfa_virtual_people::NodeNameMap> flattened_name_map =
+          wfa_virtual_people::CompactNodeNames(*nodes);
+      CHECK(flattened_name_map.ok()) << flattened_name_map.status();
+    }
+    absl::Status flattened_status =
+        wfa_virtual_people::WriteIndexedModelFile(flattened_output_path,
+                                                  *nodes);
+    CHECK(flattened_status.ok()) << flattened_status;
+  }
+
+  std::string vid_pool_index_path = absl::GetFlag(FLAGS_vid_pool_index_path);
+  if (!vid_pool_index_path.empty()) {
+    absl::StatusOr<wfa_virtual_people::VidPoolIndex> index =
+        wfa_virtual_people::BuildVidPoolIndex(*model);
+    CHECK(index.ok()) << index.status();
+    LOG(INFO) << "Indexed " << index->entries_size() << " pools in "
+              << index->node_paths_size() << " population nodes.";
+    absl::Status index_status =
+        wfa::WriteTextProtoFile(vid_pool_index_path, *index);
+    CHECK(index_status.ok()) << index_status;
+  }
+
+  std::string node_name_map_path = absl::GetFlag(FLAGS_node_name_map_path);
+  if (!node_name_map_path.empty()) {
+    absl::StatusOr<wfa_virtual_people::NodeNameMap> name_map =
+        wfa_virtual_people::CompactNodeNames(*model);
+    CHECK(name_map.ok()) << name_map.status();
+    absl::Status name_map_status =
+        wfa::WriteTextProtoFile(node_name_map_path, *name_map);
+    CHECK(name_map_status.ok()) << name_map_status;
+  }
+
+  wfa_virtual_people::ParallelTextProtoOptions textproto_options;
+  textproto_options.thread_count = absl::GetFlag(FLAGS_textproto_thread_count);
+  absl::Status write_status =
+      textproto_options.thread_count > 1
+          ? wfa_virtual_people::WriteTextProtoFileInParallel(
+                output_path, *model, textproto_options)
+          : wfa::WriteTextProtoFile(output_path, *model);
   CHECK(write_status.ok()) << write_status;
 
+  std::string model_image_path = absl::GetFlag(FLAGS_model_image_path);
+  if (!model_image_path.empty()) {
+    absl::Status image_status =
+        wfa_virtual_people::WriteModelImageFile(model_image_path, *model);
+    CHECK(image_status.ok()) << image_status;
+  }
+
   return 0;
 }
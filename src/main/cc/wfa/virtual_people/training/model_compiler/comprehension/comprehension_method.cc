@@ -15,26 +15,38 @@
 #include "wfa/virtual_people/training/model_compiler/comprehension/comprehension_method.h"
 
 #include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <limits>
 #include <memory>
+#include <optional>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include "absl/base/call_once.h"
+#include "absl/base/thread_annotations.h"
 #include "absl/container/flat_hash_map.h"
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/str_format.h"
-#include "absl/strings/str_replace.h"
-#include "absl/strings/str_split.h"
 #include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
 #include "common_cpp/macros/macros.h"
 #include "google/protobuf/descriptor.h"
 #include "google/protobuf/message.h"
-#include "google/protobuf/reflection.h"
+#include "google/protobuf/repeated_field.h"
 #include "wfa/virtual_people/training/comprehend.pb.h"
 #include "wfa/virtual_people/training/model_compiler/comprehension/contextual_boolean_expression.h"
+#include "wfa/virtual_people/training/model_compiler/comprehension/contextual_boolean_program.h"
+#include "wfa/virtual_people/training/model_compiler/comprehension/formatting_plan.h"
+#include "wfa/virtual_people/training/model_compiler/comprehension/placeholder_substitution.h"
 #include "wfa/virtual_people/training/model_compiler/comprehension/spec_util.h"
+#include "wfa/virtual_people/training/model_compiler/comprehension/work_stealing_pool.h"
 #include "wfa/virtual_people/training/model_config.pb.h"
 
 namespace wfa_virtual_people {
@@ -43,70 +55,62 @@ namespace {
 
 // Forward declaration.
 absl::Status FormatStringsInMessage(
-    google::protobuf::Message& message, const ContextMap& context_map,
-    const std::vector<std::string>& exclude_fields);
-absl::StatusOr<std::vector<ModelNodeConfig>> ComprehendRecursively(
-    ModelNodeConfig& node_config);
-
-// Parse context config into a map.
-// If add_braces = true, surround key with {}.
-ContextMap ContextAsMap(const Comprehend::Context& config, bool add_braces) {
-  ContextMap context_map;
-  for (Comprehend::Context::KeyValue kv : config.items()) {
-    if (add_braces) {
-      context_map[absl::StrCat("{", kv.key(), "}")] = kv.value();
-    } else {
-      context_map[kv.key()] = kv.value();
-    }
-  }
-  return context_map;
-}
-
-// Use context map to create a Context proto.
-Comprehend::Context MapAsContext(const ContextMap& context_map) {
-  Comprehend::Context context;
-  for (auto& key_value : context_map) {
-    auto item = context.add_items();
-    item->set_key(key_value.first);
-    item->set_value(key_value.second);
-  }
-  return context;
-}
+    google::protobuf::Message& message, const ContextScope& scope,
+    const std::vector<std::string>& exclude_fields,
+    UnknownPlaceholderPolicy policy = UnknownPlaceholderPolicy::kKeep);
+
+// Receives the nodes produced by comprehension, one at a time.
+using NodeConsumer = std::function<absl::Status(ModelNodeConfig&)>;
+
+// A node config with its child nodes split off. The child nodes are kept as
+// templates, and only copied when the node is instantiated, so that copying
+// a node while applying the comprehension methods does not copy its
+// unexpanded descendants.
+struct NodeTemplate {
+  // The node config with empty @branches.nodes.
+  ModelNodeConfig shell;
+  std::vector<NodeTemplate> children;
+};
 
-// Compute a set of fields to exclude for child message.
-// For example: if the fields we exclude in the parent are
-//     ['a', 'a.w', 'b.x', 'b.y', 'b.z.t', 'c']
-// then for child message 'b' we will exclude
-//     ['x', 'y', 'z.t']
-std::vector<std::string> GetFieldsToExcludeInSubMessage(
-    const std::vector<std::string>& parent_exclude_fields,
-    absl::string_view child_name) {
-  std::vector<std::string> result;
-  for (const std::string& field : parent_exclude_fields) {
-    std::vector<std::string> path = absl::StrSplit(field, '.');
-    if (path.size() > 1 && path[0] == child_name) {
-      uint64_t pos = field.find('.', 0);
-      result.emplace_back(field.substr(pos + 1));
+// Move the content of @node_config into a template.
+NodeTemplate SplitIntoTemplate(ModelNodeConfig& node_config) {
+  NodeTemplate node_template;
+  if (node_config.has_branches()) {
+    for (ModelNodeConfig& child :
+         *node_config.mutable_branches()->mutable_nodes()) {
+      node_template.children.emplace_back(SplitIntoTemplate(child));
     }
+    node_config.mutable_branches()->clear_nodes();
   }
-  return result;
+  node_template.shell.Swap(&node_config);
+  return node_template;
 }
 
-// Copy context to all child nodes.
-void PassContextToChildren(ModelNodeConfig& node_config) {
-  if (!node_config.has_branches()) {
-    return;
+// Copy the child node templates back into @node_config.
+void MaterializeChildren(const std::vector<NodeTemplate>& children,
+                         ModelNodeConfig& node_config) {
+  for (const NodeTemplate& child : children) {
+    ModelNodeConfig& child_config =
+        *node_config.mutable_branches()->add_nodes();
+    child_config = child.shell;
+    MaterializeChildren(child.children, child_config);
   }
+}
 
-  for (auto& child : *node_config.mutable_branches()->mutable_nodes()) {
-    child.mutable_comprehend()->mutable_context()->MergeFrom(
-        node_config.comprehend().context());
+// Whether applying the method formats the child nodes.
+bool FormatsChildNodes(const Comprehend::Method& method_config) {
+  if (!method_config.has_format_text_fields()) {
+    return false;
   }
+  const auto& exclude_fields =
+      method_config.format_text_fields().exclude_fields();
+  return std::find(exclude_fields.begin(), exclude_fields.end(), "branches") ==
+         exclude_fields.end();
 }
 
 // Extract the next comprehension method.
 std::unique_ptr<Comprehend::Method> ExtractInnerMethod(
-    ModelNodeConfig& node_config) {
+    ModelNodeConfig& node_config, const ComprehensionOptions& options) {
   // Take the 0-th method and remove from config.
   if (node_config.has_comprehend() &&
       node_config.comprehend().methods().size() > 0) {
@@ -123,6 +127,10 @@ std::unique_ptr<Comprehend::Method> ExtractInnerMethod(
     auto method = absl::make_unique<Comprehend::Method>();
     // Exclude child nodes. They will be processed later.
     method->mutable_format_text_fields()->add_exclude_fields("branches");
+    if (options.fail_on_unknown_placeholders) {
+      method->mutable_format_text_fields()->set_fail_on_unknown_placeholders(
+          true);
+    }
     // Only need to do it once.
     node_config.mutable_comprehend()->set_dont_apply_format_text_fields(true);
     return method;
@@ -131,161 +139,645 @@ std::unique_ptr<Comprehend::Method> ExtractInnerMethod(
   return std::unique_ptr<Comprehend::Method>();
 }
 
-// Apply the comprehension method on node to produce a list of nodes.
-absl::StatusOr<std::vector<ModelNodeConfig>> ComprehendNode(
-    ModelNodeConfig& node_config, Comprehend::Method& method_config) {
+// The comprehension methods built during a comprehension, by their formatted
+// configs. The instances of a node mostly format its methods to the same
+// configs, e.g. when they only differ by keys the methods do not use, and each
+// distinct method is built once and shared by the instances.
+class MethodCache {
+ public:
+  absl::StatusOr<std::shared_ptr<const ComprehensionMethod>> GetOrBuild(
+      const Comprehend::Method& method_config) {
+    Entry* entry;
+    {
+      absl::MutexLock lock(&mutex_);
+      std::unique_ptr<Entry>& slot =
+          methods_[method_config.SerializeAsString()];
+      if (slot == nullptr) {
+        slot = std::make_unique<Entry>();
+      }
+      entry = slot.get();
+    }
+    // Build outside the lock of the cache, as it may read files. The other
+    // threads getting the same method wait for it. A failure is kept as well,
+    // as the same config fails the same way.
+    absl::call_once(entry->once, [entry, &method_config]() {
+      entry->method = Build(method_config);
+    });
+    return entry->method;
+  }
+
+ private:
+  struct Entry {
+    absl::once_flag once;
+    absl::StatusOr<std::shared_ptr<const ComprehensionMethod>> method;
+  };
+
+  static absl::StatusOr<std::shared_ptr<const ComprehensionMethod>> Build(
+      const Comprehend::Method& method_config) {
+    ASSIGN_OR_RETURN(std::unique_ptr<ComprehensionMethod> method,
+                     ComprehensionMethod::Build(method_config));
+    if (method == nullptr) {
+      return absl::InternalError(
+          absl::StrCat("ComprehensionMethod::Build should never return null.",
+                       method_config.DebugString()));
+    }
+    return method;
+  }
+
+  absl::Mutex mutex_;
+  absl::flat_hash_map<std::string, std::unique_ptr<Entry>> methods_
+      ABSL_GUARDED_BY(mutex_);
+};
+
+// Format the method config with the context of the node, and build the
+// comprehension method, or get it from @method_cache.
+absl::StatusOr<std::shared_ptr<const ComprehensionMethod>> BuildMethodForNode(
+    const ContextScope& scope, Comprehend::Method& method_config,
+    MethodCache& method_cache) {
   // Format method config with context.
-  bool add_braces = true;                   // For string format.
   std::vector<std::string> exclude_fields;  // No field to exclude here.
-  ContextMap context_map =
-      ContextAsMap(node_config.comprehend().context(), add_braces);
-  RETURN_IF_ERROR(
-      FormatStringsInMessage(method_config, context_map, exclude_fields));
+  RETURN_IF_ERROR(FormatStringsInMessage(method_config, scope, exclude_fields));
+  return method_cache.GetOrBuild(method_config);
+}
 
-  // Apply the method.
-  ASSIGN_OR_RETURN(std::unique_ptr<ComprehensionMethod> method,
-                   ComprehensionMethod::Build(method_config));
-  if (method == nullptr) {
-    return absl::InternalError(
-        absl::StrCat("ComprehensionMethod::Build should never return null.",
-                     method_config.DebugString()));
+// Evaluate @program with the context in @scope.
+absl::StatusOr<bool> EvaluateInScope(const ContextualBooleanProgram& program,
+                                     const ContextScope& scope) {
+  return program.Evaluate(
+      [&scope](absl::string_view key) { return scope.Find(key); });
+}
+
+// A Filter, or an ApplyIf whose methods are Filters, applied right after a
+// ForEach. It is evaluated on the context of each value of the ForEach before
+// the node is copied, so that the filtered out values cost no copy.
+class ScopeFilter {
+ public:
+  // Compile @method_config, formatted with @scope, the context of the node
+  // before the ForEach of @entity.
+  // Returns nullopt if the method is not a filter, if its formatting depends on
+  // @entity, or if it is invalid. It is then applied to each copy as usual, and
+  // reports its own errors.
+  static std::optional<ScopeFilter> Compile(Comprehend::Method method_config,
+                                            const ContextScope& scope,
+                                            absl::string_view entity) {
+    bool uses_entity = false;
+    auto format = [&scope, entity, &uses_entity](
+                      google::protobuf::Message& message) {
+      return FormattingPlan::Get(message.GetDescriptor(), {})
+          .Format(message, [&scope, entity,
+                            &uses_entity](absl::string_view key) {
+            uses_entity |= key == entity;
+            return scope.Find(key);
+          });
+    };
+    if (!format(method_config).ok() || uses_entity) {
+      return std::nullopt;
+    }
+
+    if (method_config.has_filter()) {
+      std::optional<ContextualBooleanProgram> filter =
+          CompileFilter(method_config);
+      if (!filter.has_value()) {
+        return std::nullopt;
+      }
+      return ScopeFilter(std::nullopt, *std::move(filter), std::nullopt);
+    }
+
+    if (!method_config.has_apply_if() ||
+        !method_config.apply_if().has_condition()) {
+      return std::nullopt;
+    }
+    Comprehend::Method::ApplyIf& apply_if =
+        *method_config.mutable_apply_if();
+    absl::StatusOr<ContextualBooleanProgram> condition =
+        ContextualBooleanProgram::Compile(apply_if.condition());
+    if (!condition.ok()) {
+      return std::nullopt;
+    }
+    // The chosen method is formatted again when it is applied.
+    if (!format(*apply_if.mutable_if_method()).ok() ||
+        (apply_if.has_else_method() &&
+         !format(*apply_if.mutable_else_method()).ok()) ||
+        uses_entity) {
+      return std::nullopt;
+    }
+    std::optional<ContextualBooleanProgram> if_filter =
+        CompileFilter(apply_if.if_method());
+    if (!if_filter.has_value()) {
+      return std::nullopt;
+    }
+    std::optional<ContextualBooleanProgram> else_filter;
+    if (apply_if.has_else_method()) {
+      else_filter = CompileFilter(apply_if.else_method());
+      if (!else_filter.has_value()) {
+        return std::nullopt;
+      }
+    }
+    return ScopeFilter(*std::move(condition), *std::move(if_filter),
+                       std::move(else_filter));
   }
 
-  return method->Apply(node_config);
-}
+  // Whether the node with the context @scope is kept.
+  absl::StatusOr<bool> Evaluate(const ContextScope& scope) const {
+    if (condition_.has_value()) {
+      ASSIGN_OR_RETURN(bool condition, EvaluateInScope(*condition_, scope));
+      if (!condition) {
+        // Without else method, the node is kept as is.
+        if (!else_filter_.has_value()) {
+          return true;
+        }
+        return EvaluateInScope(*else_filter_, scope);
+      }
+    }
+    return EvaluateInScope(filter_, scope);
+  }
 
-// Comprehend a list of nodes and produce a new list.
-// The vector concat is not efficient, but we expect that the total
-// number of nodes is small and performance is not critical.
-absl::StatusOr<std::vector<ModelNodeConfig>> ComprehendNodesRecursively(
-    std::vector<ModelNodeConfig>& nodes) {
-  std::vector<ModelNodeConfig> result;
-  for (ModelNodeConfig& node : nodes) {
-    ASSIGN_OR_RETURN(std::vector<ModelNodeConfig> current,
-                     ComprehendRecursively(node));
-    result.insert(result.end(), current.begin(), current.end());
+ private:
+  static std::optional<ContextualBooleanProgram> CompileFilter(
+      const Comprehend::Method& method_config) {
+    if (!method_config.has_filter() ||
+        !method_config.filter().has_expression()) {
+      return std::nullopt;
+    }
+    absl::StatusOr<ContextualBooleanProgram> filter =
+        ContextualBooleanProgram::Compile(method_config.filter().expression());
+    if (!filter.ok()) {
+      return std::nullopt;
+    }
+    return *std::move(filter);
   }
-  return result;
-}
 
-// Comprehend a node and its children.
-absl::StatusOr<std::vector<ModelNodeConfig>> ComprehendRecursively(
-    ModelNodeConfig& node_config) {
-  std::unique_ptr<Comprehend::Method> method_config =
-      ExtractInnerMethod(node_config);
-  if (method_config == nullptr) {
-    // No more comprehension method here. Comprehend child nodes.
-    if (node_config.has_branches()) {
-      PassContextToChildren(node_config);
-      std::vector<ModelNodeConfig> children(
-          node_config.branches().nodes().begin(),
-          node_config.branches().nodes().end());
-      ASSIGN_OR_RETURN(std::vector<ModelNodeConfig> result,
-                       ComprehendNodesRecursively(children));
-      // Replace child nodes.
-      node_config.mutable_branches()->mutable_nodes()->Assign(result.begin(),
-                                                              result.end());
-    }
-    return std::vector<ModelNodeConfig>{node_config};
-  } else {
-    ASSIGN_OR_RETURN(std::vector<ModelNodeConfig> result,
-                     ComprehendNode(node_config, *method_config));
-    // Empty list is a valid result of comprehension.
-    return ComprehendNodesRecursively(result);
+  ScopeFilter(std::optional<ContextualBooleanProgram> condition,
+              ContextualBooleanProgram filter,
+              std::optional<ContextualBooleanProgram> else_filter)
+      : condition_(std::move(condition)),
+        filter_(std::move(filter)),
+        else_filter_(std::move(else_filter)) {}
+
+  // Set for an ApplyIf. Then @filter_ is applied if it is true, and
+  // @else_filter_ otherwise.
+  std::optional<ContextualBooleanProgram> condition_;
+  ContextualBooleanProgram filter_;
+  std::optional<ContextualBooleanProgram> else_filter_;
+};
+
+// Extract the filters immediately following the ForEach of @entity in
+// @node_config, which can be evaluated before the nodes are copied.
+std::vector<ScopeFilter> ExtractFiltersAfterForEach(
+    ModelNodeConfig& node_config, const ContextScope& scope,
+    absl::string_view entity) {
+  std::vector<ScopeFilter> filters;
+  google::protobuf::RepeatedPtrField<Comprehend::Method>& methods =
+      *node_config.mutable_comprehend()->mutable_methods();
+  while (!methods.empty()) {
+    std::optional<ScopeFilter> filter =
+        ScopeFilter::Compile(methods.Get(0), scope, entity);
+    if (!filter.has_value()) {
+      break;
+    }
+    filters.emplace_back(*std::move(filter));
+    methods.erase(methods.begin());
   }
+  return filters;
 }
 
-// Format string fields in message recursively using context map.
-// Skip fields in exclude_fields.
-absl::Status FormatStringsInMessage(
-    google::protobuf::Message& message, const ContextMap& context_map,
-    const std::vector<std::string>& exclude_fields) {
-  const google::protobuf::Reflection* reflection = message.GetReflection();
-  std::vector<const google::protobuf::FieldDescriptor*> field_descriptors;
-  reflection->ListFields(message, &field_descriptors);
-
-  for (const google::protobuf::FieldDescriptor* field_descriptor :
-       field_descriptors) {
-    const std::string& field_name = field_descriptor->name();
-    if (std::find(exclude_fields.begin(), exclude_fields.end(),
-                  field_descriptor->name()) != exclude_fields.end()) {
-      continue;
-    }
-
-    std::vector<std::string> submessage_fields_to_exclude;
-    if (field_descriptor->cpp_type() ==
-        google::protobuf::FieldDescriptor::CPPTYPE_MESSAGE) {
-      submessage_fields_to_exclude =
-          GetFieldsToExcludeInSubMessage(exclude_fields, field_name);
-    }
-
-    if (field_descriptor->is_optional()) {
-      if (field_descriptor->cpp_type() ==
-          google::protobuf::FieldDescriptor::CPPTYPE_STRING) {
-        std::string current_value =
-            reflection->GetString(message, field_descriptor);
-        reflection->SetString(&message, field_descriptor,
-                              absl::StrReplaceAll(current_value, context_map));
-      } else if (field_descriptor->cpp_type() ==
-                 google::protobuf::FieldDescriptor::CPPTYPE_MESSAGE) {
-        RETURN_IF_ERROR(FormatStringsInMessage(
-            *reflection->MutableMessage(&message, field_descriptor),
-            context_map, submessage_fields_to_exclude));
-      } else {
-        // Do nothing for other fields.
+// Forward declaration.
+// Apply @for_each, which is built from a ForEach config, skipping the values
+// whose context any of @filters evaluates to false.
+absl::Status ApplyForEachWithFilters(
+    const ComprehensionMethod& for_each, ModelNodeConfig& node_config,
+    const ContextScopePtr& scope, const std::vector<ScopeFilter>& filters,
+    const ComprehensionMethod::ScopedNodeConsumer& output);
+
+// The oneof of the methods in Comprehend.Method.
+const google::protobuf::OneofDescriptor& MethodOneof() {
+  return *Comprehend::Method::descriptor()->FindOneofByName("method");
+}
+
+// The counters of the comprehension of a node template, over all its
+// instances. Updated concurrently by the threads comprehending the instances.
+struct TemplateStats {
+  explicit TemplateStats(std::string path)
+      : path(std::move(path)),
+        method_inputs(MethodOneof().field_count()),
+        method_outputs(MethodOneof().field_count()) {}
+
+  std::string path;
+  std::atomic<int64_t> input_count{0};
+  std::atomic<int64_t> output_count{0};
+  std::atomic<int64_t> byte_count{0};
+  // Indexed by the index of the method in the oneof.
+  std::vector<std::atomic<int64_t>> method_inputs;
+  std::vector<std::atomic<int64_t>> method_outputs;
+  // In the order of the child node templates.
+  std::vector<std::unique_ptr<TemplateStats>> children;
+};
+
+// The counters of the comprehension of a model, for each node template, and
+// the limits of the comprehended model.
+class ExpansionStats {
+ public:
+  // If @count_bytes is false, the sizes of the nodes are only computed to
+  // enforce the max_byte_count of @options.
+  ExpansionStats(const NodeTemplate& root, const ComprehensionOptions& options,
+                 bool count_bytes)
+      : root_(NewTemplateStats(root, NodeLabel(root.shell, 0))),
+        max_node_count_(options.max_node_count),
+        max_byte_count_(options.max_byte_count),
+        count_bytes_(count_bytes || options.max_byte_count > 0) {
+    root_->input_count = 1;
+  }
+
+  TemplateStats& root() { return *root_; }
+
+  // Count @node_config, a comprehended node without child nodes, of the
+  // template of @stats.
+  absl::Status CountNode(TemplateStats& stats,
+                         const ModelNodeConfig& node_config) {
+    ++stats.output_count;
+    int64_t node_count = ++node_count_;
+    if (max_node_count_ > 0 && node_count > max_node_count_) {
+      return absl::ResourceExhaustedError(
+          absl::StrCat("Comprehension exceeds max_node_count ",
+                       max_node_count_, " at ", stats.path));
+    }
+    if (!count_bytes_) {
+      return absl::OkStatus();
+    }
+    int64_t bytes = node_config.ByteSizeLong();
+    stats.byte_count += bytes;
+    int64_t byte_count = byte_count_ += bytes;
+    if (max_byte_count_ > 0 && byte_count > max_byte_count_) {
+      return absl::ResourceExhaustedError(
+          absl::StrCat("Comprehension exceeds max_byte_count ",
+                       max_byte_count_, " at ", stats.path));
+    }
+    return absl::OkStatus();
+  }
+
+  ComprehensionReport GetReport() const {
+    ComprehensionReport report;
+    AddToReport(*root_, report);
+    return report;
+  }
+
+ private:
+  static std::string NodeLabel(const ModelNodeConfig& shell, int index) {
+    return shell.name().empty() ? absl::StrCat("#", index) : shell.name();
+  }
+
+  static std::unique_ptr<TemplateStats> NewTemplateStats(
+      const NodeTemplate& node_template, std::string path) {
+    auto stats = std::make_unique<TemplateStats>(std::move(path));
+    for (int i = 0; i < node_template.children.size(); ++i) {
+      const NodeTemplate& child = node_template.children[i];
+      stats->children.push_back(NewTemplateStats(
+          child, absl::StrCat(stats->path, "/", NodeLabel(child.shell, i))));
+    }
+    return stats;
+  }
+
+  static void AddToReport(const TemplateStats& stats,
+                          ComprehensionReport& report) {
+    NodeExpansion& node = report.nodes.emplace_back();
+    node.path = stats.path;
+    node.input_count = stats.input_count;
+    node.output_count = stats.output_count;
+    node.byte_count = stats.byte_count;
+    for (int i = 0; i < stats.method_inputs.size(); ++i) {
+      if (stats.method_inputs[i] > 0) {
+        node.methods.push_back({MethodOneof().field(i)->name(),
+                                stats.method_inputs[i],
+                                stats.method_outputs[i]});
       }
-    } else if (field_descriptor->is_repeated()) {
-      if (field_descriptor->cpp_type() ==
-          google::protobuf::FieldDescriptor::CPPTYPE_STRING) {
-        auto field_ref = reflection->GetMutableRepeatedFieldRef<std::string>(
-            &message, field_descriptor);
-        for (int i = 0; i < field_ref.size(); ++i) {
-          const std::string& current_value = field_ref.Get(i);
-          field_ref.Set(i, absl::StrReplaceAll(current_value, context_map));
+    }
+    report.node_count += node.output_count;
+    report.byte_count += node.byte_count;
+    for (const std::unique_ptr<TemplateStats>& child : stats.children) {
+      AddToReport(*child, report);
+    }
+  }
+
+  std::unique_ptr<TemplateStats> root_;
+  int64_t max_node_count_;
+  int64_t max_byte_count_;
+  bool count_bytes_;
+  std::atomic<int64_t> node_count_{0};
+  std::atomic<int64_t> byte_count_{0};
+};
+
+// Receives a node to comprehend, its context, its child nodes and the counters
+// of its template. If @children is null, the child nodes are still in
+// @node_config.
+using InstanceConsumer = std::function<absl::Status(
+    ModelNodeConfig& node_config, const ContextScopePtr& scope,
+    const std::vector<NodeTemplate>* children, TemplateStats& stats)>;
+
+// Passes the nodes to comprehend to its argument, one at a time.
+using InstanceGenerator = std::function<absl::Status(const InstanceConsumer&)>;
+
+// Comprehends nodes depth first.
+// If a pool is set, the sibling nodes are comprehended in parallel on the
+// threads of the pool. Their outputs are passed on in the same order, and the
+// same error is returned, as when comprehended sequentially.
+// In a dry run, the comprehended nodes are counted but not added to their
+// parents.
+class Comprehender {
+ public:
+  Comprehender(const ComprehensionOptions& options, MethodCache* method_cache,
+               ExpansionStats* expansion_stats, bool dry_run,
+               WorkStealingPool* pool)
+      : options_(options),
+        method_cache_(method_cache),
+        expansion_stats_(expansion_stats),
+        dry_run_(dry_run),
+        pool_(pool) {}
+
+  // Comprehend a node and its children, and pass each comprehended node to
+  // @output. @node_config has no child nodes, its child nodes are @children.
+  // @scope is the context of the parent node, and the key-values added by the
+  // methods already applied to @node_config. @stats are the counters of the
+  // template of the node.
+  absl::Status ComprehendNode(ModelNodeConfig& node_config,
+                              ContextScopePtr scope,
+                              const std::vector<NodeTemplate>& children,
+                              TemplateStats& stats,
+                              const NodeConsumer& output) const {
+    if (node_config.has_comprehend() &&
+        node_config.comprehend().context().items_size() > 0) {
+      // The context set in the config is moved into the scope of the node.
+      scope = ContextScope::WithNodeContext(
+          std::move(scope), node_config.comprehend().context());
+      node_config.mutable_comprehend()->clear_context();
+    }
+
+    std::unique_ptr<Comprehend::Method> method_config =
+        ExtractInnerMethod(node_config, options_);
+    if (method_config == nullptr) {
+      // The comprehension is complete, drop it to save memory.
+      node_config.clear_comprehend();
+      RETURN_IF_ERROR(expansion_stats_->CountNode(stats, node_config));
+      if (!node_config.has_branches()) {
+        return output(node_config);
+      }
+      // No more comprehension method here. Instantiate child nodes with the
+      // context of this node, and comprehend them.
+      google::protobuf::RepeatedPtrField<ModelNodeConfig>*
+          comprehended_children =
+              node_config.mutable_branches()->mutable_nodes();
+      RETURN_IF_ERROR(ComprehendEach(
+          [&scope, &children, &stats](const InstanceConsumer& consumer) {
+            for (int i = 0; i < children.size(); ++i) {
+              const NodeTemplate& child = children[i];
+              TemplateStats& child_stats = *stats.children[i];
+              ++child_stats.input_count;
+              ModelNodeConfig child_config(child.shell);
+              RETURN_IF_ERROR(consumer(child_config, scope, &child.children,
+                                       child_stats));
+            }
+            return absl::OkStatus();
+          },
+          [this, comprehended_children](ModelNodeConfig& comprehended) {
+            if (!dry_run_) {
+              comprehended_children->Add(std::move(comprehended));
+            }
+            return absl::OkStatus();
+          }));
+      return output(node_config);
+    }
+
+    ASSIGN_OR_RETURN(
+        std::shared_ptr<const ComprehensionMethod> method,
+        BuildMethodForNode(*scope, *method_config, *method_cache_));
+    const std::vector<NodeTemplate>* produced_children = &children;
+    if (!children.empty() && FormatsChildNodes(*method_config)) {
+      // The method also formats the unexpanded child nodes, so they must be
+      // part of the node it is applied on.
+      MaterializeChildren(children, node_config);
+      produced_children = nullptr;
+    }
+    std::vector<ScopeFilter> filters;
+    if (method_config->has_for_each()) {
+      filters = ExtractFiltersAfterForEach(node_config, *scope,
+                                           method_config->for_each().entity());
+    }
+    int method_index =
+        Comprehend::Method::descriptor()
+            ->FindFieldByNumber(method_config->method_case())
+            ->index_in_oneof();
+    ++stats.method_inputs[method_index];
+    std::atomic<int64_t>& method_outputs = stats.method_outputs[method_index];
+    // Empty output is a valid result of comprehension.
+    return ComprehendEach(
+        [&method, &node_config, &scope, &filters, &stats, &method_outputs,
+         produced_children](const InstanceConsumer& consumer) {
+          ComprehensionMethod::ScopedNodeConsumer produce =
+              [&consumer, &stats, &method_outputs, produced_children](
+                  ModelNodeConfig& produced,
+                  const ContextScopePtr& produced_scope) {
+                ++method_outputs;
+                return consumer(produced, produced_scope, produced_children,
+                                stats);
+              };
+          if (filters.empty()) {
+            return method->ApplyInScope(node_config, scope, produce);
+          }
+          return ApplyForEachWithFilters(*method, node_config, scope, filters,
+                                         produce);
+        },
+        output);
+  }
+
+ private:
+  // The comprehension of one generated node, in parallel mode.
+  struct Instance {
+    ModelNodeConfig node_config;
+    ContextScopePtr scope;
+    const std::vector<NodeTemplate>* children;
+    TemplateStats* stats;
+    std::vector<ModelNodeConfig> outputs;
+    absl::Status status;
+  };
+
+  absl::Status ComprehendInstance(ModelNodeConfig& node_config,
+                                  const ContextScopePtr& scope,
+                                  const std::vector<NodeTemplate>* children,
+                                  TemplateStats& stats,
+                                  const NodeConsumer& output) const {
+    if (children != nullptr) {
+      return ComprehendNode(node_config, scope, *children, stats, output);
+    }
+    NodeTemplate node_template = SplitIntoTemplate(node_config);
+    return ComprehendNode(node_template.shell, scope, node_template.children,
+                          stats, output);
+  }
+
+  void ComprehendInstance(Instance& instance) const {
+    instance.status = ComprehendInstance(
+        instance.node_config, instance.scope, instance.children,
+        *instance.stats, [&instance](ModelNodeConfig& comprehended) {
+          instance.outputs.emplace_back(std::move(comprehended));
+          return absl::OkStatus();
+        });
+    instance.node_config.Clear();
+    instance.scope.reset();
+  }
+
+  // Comprehend each node generated by @generate, and pass the comprehended
+  // nodes to @output.
+  absl::Status ComprehendEach(const InstanceGenerator& generate,
+                              const NodeConsumer& output) const {
+    if (pool_ == nullptr) {
+      return generate([this, &output](
+                          ModelNodeConfig& node_config,
+                          const ContextScopePtr& scope,
+                          const std::vector<NodeTemplate>* children,
+                          TemplateStats& stats) {
+        return ComprehendInstance(node_config, scope, children, stats, output);
+      });
+    }
+
+    // A deque keeps the instances in place while new ones are added.
+    std::deque<Instance> instances;
+    // The index of the first failed instance. The instances after it are not
+    // comprehended, as their outputs would be discarded.
+    std::atomic<size_t> first_failure = std::numeric_limits<size_t>::max();
+    WorkStealingPool::TaskGroup group;
+    auto schedule = [this, &group, &first_failure](Instance* instance,
+                                                   size_t index) {
+      pool_->Schedule(group, [this, &first_failure, instance, index]() {
+        if (index > first_failure) {
+          return;
         }
-      } else if (field_descriptor->cpp_type() ==
-                 google::protobuf::FieldDescriptor::CPPTYPE_MESSAGE) {
-        int size = reflection
-                       ->GetMutableRepeatedFieldRef<google::protobuf::Message>(
-                           &message, field_descriptor)
-                       .size();
-        for (int i = 0; i < size; ++i) {
-          auto submessage =
-              reflection->MutableRepeatedMessage(&message, field_descriptor, i);
-          RETURN_IF_ERROR(FormatStringsInMessage(*submessage, context_map,
-                                                 submessage_fields_to_exclude));
+        ComprehendInstance(*instance);
+        if (!instance->status.ok()) {
+          size_t failure = first_failure;
+          while (index < failure &&
+                 !first_failure.compare_exchange_weak(failure, index)) {
+          }
         }
-      } else {
-        // Do nothing for other fields.
-      }
+      });
+    };
+
+    absl::Status generate_status = generate(
+        [&instances, &first_failure, &schedule](
+            ModelNodeConfig& node_config, const ContextScopePtr& scope,
+            const std::vector<NodeTemplate>* children, TemplateStats& stats) {
+          if (first_failure != std::numeric_limits<size_t>::max()) {
+            // The error of the failed instance is returned.
+            return absl::CancelledError("Comprehension failed.");
+          }
+          instances.push_back(
+              {std::move(node_config), scope, children, &stats});
+          // A single node is comprehended on the current thread.
+          if (instances.size() == 2) {
+            schedule(&instances[0], 0);
+          }
+          if (instances.size() >= 2) {
+            schedule(&instances.back(), instances.size() - 1);
+          }
+          return absl::OkStatus();
+        });
+    if (instances.size() == 1) {
+      ComprehendInstance(instances[0]);
     } else {
-      return absl::InternalError(absl::StrCat("Unsupported type.", field_name));
+      pool_->Wait(group);
     }
+
+    for (Instance& instance : instances) {
+      RETURN_IF_ERROR(instance.status);
+      for (ModelNodeConfig& comprehended : instance.outputs) {
+        RETURN_IF_ERROR(output(comprehended));
+      }
+    }
+    return generate_status;
   }
 
-  return absl::OkStatus();
+  const ComprehensionOptions& options_;
+  MethodCache* method_cache_;
+  ExpansionStats* expansion_stats_;
+  bool dry_run_;
+  WorkStealingPool* pool_;
+};
+
+// Format string fields in message recursively using the context in @scope.
+// Skip fields in exclude_fields.
+absl::Status FormatStringsInMessage(
+    google::protobuf::Message& message, const ContextScope& scope,
+    const std::vector<std::string>& exclude_fields,
+    UnknownPlaceholderPolicy policy) {
+  return FormattingPlan::Get(message.GetDescriptor(), exclude_fields)
+      .Format(
+          message,
+          [&scope](absl::string_view key) { return scope.Find(key); },
+          policy);
 }
 
 // Use this to comprehend the top-level node, i.e. the root node.
-absl::StatusOr<ModelNodeConfig> ComprehendModel(ModelNodeConfig& node_config) {
-  ASSIGN_OR_RETURN(std::vector<ModelNodeConfig> res,
-                   ComprehendRecursively(node_config));
+// @scope is the context of the root node.
+// If @report is set, this is a dry run, and the counts of the comprehended
+// nodes are written to @report. The returned root node has no child nodes.
+absl::StatusOr<ModelNodeConfig> ComprehendModel(
+    ModelNodeConfig& node_config, ContextScopePtr scope,
+    const ComprehensionOptions& options, WorkStealingPool* pool,
+    ComprehensionReport* report) {
+  NodeTemplate root = SplitIntoTemplate(node_config);
+  MethodCache method_cache;
+  bool dry_run = report != nullptr;
+  ExpansionStats expansion_stats(root, options, /*count_bytes=*/dry_run);
+  Comprehender comprehender(options, &method_cache, &expansion_stats, dry_run,
+                            pool);
+  std::vector<ModelNodeConfig> res;
+  RETURN_IF_ERROR(comprehender.ComprehendNode(
+      root.shell, std::move(scope), root.children, expansion_stats.root(),
+      [&res](ModelNodeConfig& comprehended) {
+        res.emplace_back(std::move(comprehended));
+        return absl::OkStatus();
+      }));
   if (res.size() != 1) {
     return absl::InvalidArgumentError(absl::StrCat(
         "Expects exactly 1 node after comprehending the root node. Get ",
         res.size()));
   }
-  return res[0];
+  if (dry_run) {
+    *report = expansion_stats.GetReport();
+  }
+  return std::move(res[0]);
 }
 
-// Clear comprehension recursively.
-void ClearComprehension(ModelNodeConfig& node_config) {
-  node_config.clear_comprehend();
-  if (node_config.has_branches()) {
-    for (auto& child : *node_config.mutable_branches()->mutable_nodes()) {
-      ClearComprehension(child);
+// Comprehend @node_config with the context @context_map. If @report is set,
+// this is a dry run. See ComprehendModel.
+absl::StatusOr<ModelNodeConfig> RunComprehension(
+    ModelNodeConfig& node_config, const ContextMap& context_map,
+    const ComprehensionOptions& options, ComprehensionReport* report) {
+  if (options.thread_count < 1) {
+    return absl::InvalidArgumentError("thread_count must be positive.");
+  }
+  if (options.max_node_count < 0 || options.max_byte_count < 0) {
+    return absl::InvalidArgumentError(
+        "max_node_count and max_byte_count must not be negative.");
+  }
+
+  // Update context using @context_map. The last value of a key is used.
+  ContextScope::Items items;
+  if (node_config.has_comprehend()) {
+    for (const Comprehend::Context::KeyValue& kv :
+         node_config.comprehend().context().items()) {
+      items.emplace_back(kv.key(), kv.value());
     }
+    node_config.mutable_comprehend()->clear_context();
   }
+  items.insert(items.end(), context_map.begin(), context_map.end());
+  ContextScopePtr scope =
+      ContextScope::WithNodeContext(/*parent=*/nullptr, std::move(items));
+
+  if (options.thread_count == 1) {
+    return ComprehendModel(node_config, std::move(scope), options,
+                           /*pool=*/nullptr, report);
+  }
+  WorkStealingPool pool(options.thread_count);
+  return ComprehendModel(node_config, std::move(scope), options, &pool,
+                         report);
 }
 
 // Create a list of nodes, one for each value in the list.
@@ -311,27 +803,42 @@ class ForEach : public ComprehensionMethod {
   explicit ForEach(absl::string_view entity, std::vector<std::string> values)
       : entity_(entity), values_(std::move(values)) {}
 
-  absl::StatusOr<std::vector<ModelNodeConfig>> Apply(
-      ModelNodeConfig& node_config) const {
-    bool add_braces = false;  // Not for string format.
-    ContextMap context =
-        ContextAsMap(node_config.comprehend().context(), add_braces);
-    if (context.find(entity_) != context.end()) {
+  // Create the nodes one at a time.
+  absl::Status ApplyInScope(ModelNodeConfig& node_config,
+                            const ContextScopePtr& scope,
+                            const ScopedNodeConsumer& output) const override {
+    return ApplyInScopeWithFilters(node_config, scope, /*filters=*/{}, output);
+  }
+
+  // Same as above, but only the values whose context passes all @filters are
+  // copied into nodes.
+  absl::Status ApplyInScopeWithFilters(
+      ModelNodeConfig& node_config, const ContextScopePtr& scope,
+      const std::vector<ScopeFilter>& filters,
+      const ScopedNodeConsumer& output) const {
+    if (scope->Contains(entity_)) {
       return absl::InvalidArgumentError(absl::StrCat(
           "ForEach method entity is already in context map.", entity_));
     }
 
-    std::vector<ModelNodeConfig> result;
     for (const std::string& value : values_) {
-      result.emplace_back(node_config);
-
       // Add entity to context.
-      Comprehend::Context::KeyValue& keyvalue =
-          *result.back().mutable_comprehend()->mutable_context()->add_items();
-      keyvalue.set_key(entity_);
-      keyvalue.set_value(value);
+      ContextScopePtr value_scope =
+          ContextScope::WithBindings(scope, {{entity_, value}});
+      bool keep = true;
+      for (const ScopeFilter& filter : filters) {
+        ASSIGN_OR_RETURN(keep, filter.Evaluate(*value_scope));
+        if (!keep) {
+          break;
+        }
+      }
+      if (!keep) {
+        continue;
+      }
+      ModelNodeConfig new_config(node_config);
+      RETURN_IF_ERROR(output(new_config, value_scope));
     }
-    return result;
+    return absl::OkStatus();
   }
 
  private:
@@ -339,6 +846,14 @@ class ForEach : public ComprehensionMethod {
   std::vector<std::string> values_;
 };
 
+absl::Status ApplyForEachWithFilters(
+    const ComprehensionMethod& for_each, ModelNodeConfig& node_config,
+    const ContextScopePtr& scope, const std::vector<ScopeFilter>& filters,
+    const ComprehensionMethod::ScopedNodeConsumer& output) {
+  return static_cast<const ForEach&>(for_each).ApplyInScopeWithFilters(
+      node_config, scope, filters, output);
+}
+
 // Set values in the context.
 class SetValues : public ComprehensionMethod {
  public:
@@ -389,15 +904,11 @@ class SetValues : public ComprehensionMethod {
         keys_to_assign_values_(std::move(keys_to_assign_values)),
         mapping_(std::move(mapping)) {}
 
-  absl::StatusOr<std::vector<ModelNodeConfig>> Apply(
-      ModelNodeConfig& node_config) const {
-    ModelNodeConfig new_config(node_config);
-    bool add_braces = false;  // Not for string format.
-    ContextMap context_map =
-        ContextAsMap(node_config.comprehend().context(), add_braces);
-
-    for (std::string key : keys_to_assign_values_) {
-      if (context_map.find(key) != context_map.end()) {
+  absl::Status ApplyInScope(ModelNodeConfig& node_config,
+                            const ContextScopePtr& scope,
+                            const ScopedNodeConsumer& output) const override {
+    for (const std::string& key : keys_to_assign_values_) {
+      if (scope->Contains(key)) {
         return absl::InvalidArgumentError(absl::StrCat(
             "SetValues keys_to_assign_values_ ", key, " already in context."));
       }
@@ -405,34 +916,35 @@ class SetValues : public ComprehensionMethod {
 
     std::string target;
     if (!key_to_retrieve_values_.empty()) {
-      if (context_map.find(key_to_retrieve_values_) == context_map.end()) {
+      const std::string* value = scope->Find(key_to_retrieve_values_);
+      if (value == nullptr) {
         return absl::InvalidArgumentError(
             absl::StrCat("SetValues key_to_retrieve_values ",
                          key_to_retrieve_values_, " not in context."));
       }
-      target = context_map[key_to_retrieve_values_];
+      target = *value;
     }
 
-    if (mapping_.find(target) == mapping_.end()) {
+    auto mapping_it = mapping_.find(target);
+    if (mapping_it == mapping_.end()) {
       return absl::InvalidArgumentError(
           absl::StrCat("SetValues target ", target, " not in mapping."));
     }
 
-    const std::vector<std::string>& values = mapping_.at(target);
+    const std::vector<std::string>& values = mapping_it->second;
     if (values.size() != keys_to_assign_values_.size()) {
       return absl::InvalidArgumentError(
           absl::StrCat("SetValues value size for ", target,
                        " != size of keys_to_assign_values."));
     }
 
+    ContextScope::Items items;
+    items.reserve(values.size());
     for (int i = 0; i < values.size(); ++i) {
-      auto new_item =
-          new_config.mutable_comprehend()->mutable_context()->add_items();
-      new_item->set_key(keys_to_assign_values_[i]);
-      new_item->set_value(values[i]);
+      items.emplace_back(keys_to_assign_values_[i], values[i]);
     }
-
-    return std::vector<ModelNodeConfig>{new_config};
+    return output(node_config,
+                  ContextScope::WithBindings(scope, std::move(items)));
   }
 
  private:
@@ -448,25 +960,56 @@ class FormatTextFields : public ComprehensionMethod {
       const Comprehend::Method::FormatTextFields& config) {
     std::vector<std::string> exclude_fields(config.exclude_fields().begin(),
                                             config.exclude_fields().end());
-    return absl::make_unique<FormatTextFields>(std::move(exclude_fields));
+    return absl::make_unique<FormatTextFields>(
+        std::move(exclude_fields), config.fail_on_unknown_placeholders()
+                                       ? UnknownPlaceholderPolicy::kFail
+                                       : UnknownPlaceholderPolicy::kKeep);
   }
 
-  explicit FormatTextFields(std::vector<std::string> exclude_fields)
-      : exclude_fields_(std::move(exclude_fields)) {}
+  explicit FormatTextFields(std::vector<std::string> exclude_fields,
+                            UnknownPlaceholderPolicy policy)
+      : exclude_fields_(std::move(exclude_fields)), policy_(policy) {}
 
-  absl::StatusOr<std::vector<ModelNodeConfig>> Apply(
-      ModelNodeConfig& node_config) const {
-    ModelNodeConfig new_config(node_config);
-    bool add_braces = true;  // For string format.
-    ContextMap context_map =
-        ContextAsMap(node_config.comprehend().context(), add_braces);
+  absl::Status ApplyInScope(ModelNodeConfig& node_config,
+                            const ContextScopePtr& scope,
+                            const ScopedNodeConsumer& output) const override {
     RETURN_IF_ERROR(
-        FormatStringsInMessage(new_config, context_map, exclude_fields_));
-    return std::vector<ModelNodeConfig>{new_config};
+        FormatStringsInMessage(node_config, *scope, exclude_fields_, policy_));
+    ASSIGN_OR_RETURN(ContextScopePtr formatted_scope, FormatContext(scope));
+    return output(node_config, formatted_scope);
   }
 
  private:
+  // The context is part of the node config, and is formatted as well unless
+  // excluded. Returns a scope with the formatted context, or @scope if the
+  // formatting changes nothing.
+  absl::StatusOr<ContextScopePtr> FormatContext(
+      const ContextScopePtr& scope) const {
+    if (!scope->has_braces()) {
+      return scope;
+    }
+    ModelNodeConfig context_config;
+    Comprehend::Context& context =
+        *context_config.mutable_comprehend()->mutable_context();
+    std::vector<std::pair<std::string, std::string>> items(
+        scope->AsMap().begin(), scope->AsMap().end());
+    std::sort(items.begin(), items.end());
+    for (const auto& [key, value] : items) {
+      Comprehend::Context::KeyValue& kv = *context.add_items();
+      kv.set_key(key);
+      kv.set_value(value);
+    }
+    std::string unformatted = context.SerializeAsString();
+    RETURN_IF_ERROR(
+        FormatStringsInMessage(context_config, *scope, exclude_fields_));
+    if (context.SerializeAsString() == unformatted) {
+      return scope;
+    }
+    return ContextScope::WithNodeContext(nullptr, context);
+  }
+
   std::vector<std::string> exclude_fields_;
+  UnknownPlaceholderPolicy policy_;
 };
 
 // Filter out if the given boolean expression evaluates to false.
@@ -479,35 +1022,26 @@ class Filter : public ComprehensionMethod {
           "Filter method must set expression.", config.DebugString()));
     }
 
-    ASSIGN_OR_RETURN(std::unique_ptr<ContextualBooleanExpression> expression,
-                     ContextualBooleanExpression::Build(config.expression()));
+    ASSIGN_OR_RETURN(ContextualBooleanProgram expression,
+                     ContextualBooleanProgram::Compile(config.expression()));
     return absl::make_unique<Filter>(std::move(expression));
   }
 
-  explicit Filter(std::unique_ptr<ContextualBooleanExpression> expression)
+  explicit Filter(ContextualBooleanProgram expression)
       : expression_(std::move(expression)) {}
 
-  absl::StatusOr<std::vector<ModelNodeConfig>> Apply(
-      ModelNodeConfig& node_config) const {
-    if (expression_ == nullptr) {
-      return absl::InvalidArgumentError(
-          absl::StrCat("Filter.Apply() is called but expression is null."));
-    }
-
-    bool add_braces = false;  // Not for string format.
-    ContextMap context =
-        ContextAsMap(node_config.comprehend().context(), add_braces);
-    ASSIGN_OR_RETURN(bool eval_result, expression_->Evaluate(context));
-
-    std::vector<ModelNodeConfig> result;
-    if (eval_result) {
-      result.emplace_back(node_config);
+  absl::Status ApplyInScope(ModelNodeConfig& node_config,
+                            const ContextScopePtr& scope,
+                            const ScopedNodeConsumer& output) const override {
+    ASSIGN_OR_RETURN(bool eval_result, EvaluateInScope(expression_, *scope));
+    if (!eval_result) {
+      return absl::OkStatus();
     }
-    return result;
+    return output(node_config, scope);
   }
 
  private:
-  std::unique_ptr<ContextualBooleanExpression> expression_;
+  ContextualBooleanProgram expression_;
 };
 
 // Apply one or the other method depending on a condition.
@@ -524,48 +1058,38 @@ class ApplyIf : public ComprehensionMethod {
           "ApplyIf method must set if_method.", config.DebugString()));
     }
 
-    ASSIGN_OR_RETURN(std::unique_ptr<ContextualBooleanExpression> condition,
-                     ContextualBooleanExpression::Build(config.condition()));
+    ASSIGN_OR_RETURN(ContextualBooleanProgram condition,
+                     ContextualBooleanProgram::Compile(config.condition()));
     return absl::make_unique<ApplyIf>(std::move(condition), config);
   }
 
-  explicit ApplyIf(std::unique_ptr<ContextualBooleanExpression> condition,
+  explicit ApplyIf(ContextualBooleanProgram condition,
                    const Comprehend::Method::ApplyIf& config)
       : condition_(std::move(condition)),
         if_method_(config.if_method()),
         else_method_(config.else_method()),
         has_else_method_(config.has_else_method()) {}
 
-  absl::StatusOr<std::vector<ModelNodeConfig>> Apply(
-      ModelNodeConfig& node_config) const {
-    if (condition_ == nullptr) {
-      return absl::InvalidArgumentError(
-          absl::StrCat("ApplyIf.Apply() is called but condition is null."));
+  absl::Status ApplyInScope(ModelNodeConfig& node_config,
+                            const ContextScopePtr& scope,
+                            const ScopedNodeConsumer& output) const override {
+    ASSIGN_OR_RETURN(bool eval_result, EvaluateInScope(condition_, *scope));
+    if (!eval_result && !has_else_method_) {
+      return output(node_config, scope);
     }
 
-    bool add_braces = false;  // Not for string format.
-    ContextMap context =
-        ContextAsMap(node_config.comprehend().context(), add_braces);
-    ASSIGN_OR_RETURN(bool eval_result, condition_->Evaluate(context));
-
-    std::vector<ModelNodeConfig> result{node_config};
-    ModelNodeConfig& new_config = result.back();
     // Insert the appropriate method at the beginning.
-    new_config.mutable_comprehend()->clear_methods();
-    if (eval_result) {
-      *new_config.mutable_comprehend()->mutable_methods()->Add() = if_method_;
-    } else if (has_else_method_) {
-      *new_config.mutable_comprehend()->mutable_methods()->Add() = else_method_;
+    google::protobuf::RepeatedPtrField<Comprehend::Method>& methods =
+        *node_config.mutable_comprehend()->mutable_methods();
+    *methods.Add() = eval_result ? if_method_ : else_method_;
+    for (int i = methods.size() - 1; i > 0; --i) {
+      methods.SwapElements(i, i - 1);
     }
-
-    new_config.mutable_comprehend()->mutable_methods()->Add(
-        node_config.comprehend().methods().begin(),
-        node_config.comprehend().methods().end());
-    return result;
+    return output(node_config, scope);
   }
 
  private:
-  std::unique_ptr<ContextualBooleanExpression> condition_;
+  ContextualBooleanProgram condition_;
   Comprehend::Method if_method_;
   Comprehend::Method else_method_;
   bool has_else_method_;
@@ -598,26 +1122,61 @@ absl::StatusOr<std::unique_ptr<ComprehensionMethod>> ComprehensionMethod::Build(
 }
 
 absl::StatusOr<ModelNodeConfig> ComprehensionMethod::ComprehendAndCleanModel(
-    ModelNodeConfig& node_config, const ContextMap& context_map) {
-  // Update context using @context_map.
-  bool add_braces = false;
-  ContextMap new_context =
-      ContextAsMap(node_config.comprehend().context(), add_braces);
-  for (auto& key_value : context_map) {
-    new_context[key_value.first] = key_value.second;
-  }
-  node_config.mutable_comprehend()->mutable_context()->CopyFrom(
-      MapAsContext(new_context));
-
-  ASSIGN_OR_RETURN(ModelNodeConfig result, ComprehendModel(node_config));
-  ClearComprehension(result);
-  return result;
+    ModelNodeConfig& node_config, const ContextMap& context_map,
+    const ComprehensionOptions& options) {
+  return RunComprehension(node_config, context_map, options,
+                          /*report=*/nullptr);
+}
+
+absl::StatusOr<ComprehensionReport> ComprehensionMethod::EstimateComprehension(
+    ModelNodeConfig& node_config, const ContextMap& context_map,
+    const ComprehensionOptions& options) {
+  ComprehensionReport report;
+  RETURN_IF_ERROR(
+      RunComprehension(node_config, context_map, options, &report).status());
+  return report;
 }
 
 ComprehensionMethod::ComprehensionMethod() {}
 
 absl::StatusOr<std::vector<ModelNodeConfig>> ComprehensionMethod::Apply(
     ModelNodeConfig& node_config) const {
+  ContextScopePtr scope = ContextScope::WithNodeContext(
+      /*parent=*/nullptr, node_config.comprehend().context());
+  ModelNodeConfig input(node_config);
+  std::vector<ModelNodeConfig> result;
+  RETURN_IF_ERROR(ApplyInScope(
+      input, scope,
+      [&scope, &result](ModelNodeConfig& new_config,
+                        const ContextScopePtr& new_scope) {
+        // Add the key-values added by the method to the context.
+        std::vector<const ContextScope*> added;
+        const ContextScope* added_scope = new_scope.get();
+        for (; added_scope != nullptr && added_scope != scope.get();
+             added_scope = added_scope->parent()) {
+          added.push_back(added_scope);
+        }
+        // Otherwise the method replaced the context, which is also formatted
+        // in @new_config.
+        if (added_scope == scope.get()) {
+          for (auto it = added.rbegin(); it != added.rend(); ++it) {
+            for (const auto& [key, value] : (*it)->items()) {
+              Comprehend::Context::KeyValue& kv = *new_config
+                  .mutable_comprehend()->mutable_context()->add_items();
+              kv.set_key(key);
+              kv.set_value(value);
+            }
+          }
+        }
+        result.emplace_back(std::move(new_config));
+        return absl::OkStatus();
+      }));
+  return result;
+}
+
+absl::Status ComprehensionMethod::ApplyInScope(
+    ModelNodeConfig& node_config, const ContextScopePtr& scope,
+    const ScopedNodeConsumer& output) const {
   return absl::InternalError(
       "ComprehensionMethod: Cannot use baseclass for Apply.");
 }
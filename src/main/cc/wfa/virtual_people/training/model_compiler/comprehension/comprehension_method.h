@@ -15,18 +15,24 @@
 #ifndef SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_COMPILER_COMPREHENSION_COMPREHENSION_METHOD_H_
 #define SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_COMPILER_COMPREHENSION_COMPREHENSION_METHOD_H_
 
+#include <cstdint>
+#include <functional>
 #include <memory>
+#include <string>
 #include <vector>
 
+#include "absl/status/status.h"
 #include "absl/status/statusor.h"
 #include "wfa/virtual_people/training/comprehend.pb.h"
+#include "wfa/virtual_people/training/model_compiler/comprehension/context_scope.h"
 #include "wfa/virtual_people/training/model_compiler/comprehension/contextual_boolean_expression.h"
 #include "wfa/virtual_people/training/model_config.pb.h"
 
 namespace wfa_virtual_people {
 
 // Each ModelNodeConfig has a context ModelNodeConfig.comprehend.context,
-// which is a string-to-string mapping.
+// which is a string-to-string mapping. During comprehension, the context of a
+// node is a ContextScope, on top of the context of its parent node.
 //
 // Apply a comprehension method to a MondelNodeConfig to produce a list of
 // ModelNodeConfig, using context of the input node.
@@ -98,13 +104,86 @@ namespace wfa_virtual_people {
 // Returns a list of one node:
 // {name: "v1 {x} ya"}, with "y" -> "ya" added to context
 
+struct ComprehensionOptions {
+  // The count of the threads comprehending the model. Sibling nodes are
+  // comprehended in parallel. The result is the same for any count.
+  int thread_count = 1;
+
+  // If true, the default FormatTextFields, applied after all the methods of a
+  // node, returns an error for a placeholder whose key is not in the context.
+  bool fail_on_unknown_placeholders = false;
+
+  // The limits of the comprehended model, or 0 for no limit. The comprehension
+  // returns a ResourceExhausted error as soon as the count of the comprehended
+  // nodes, or the sum of their sizes, exceeds the limit. The size of a node is
+  // its serialized size, without its child nodes.
+  int64_t max_node_count = 0;
+  int64_t max_byte_count = 0;
+};
+
+// The comprehension of a node of the model config, over all its instances.
+struct NodeExpansion {
+  // The names of the node and its ancestors in the model config, before
+  // formatting, separated by "/". A node without name is named "#<index>",
+  // with its index in the child nodes of its parent.
+  std::string path;
+  // The count of instances to comprehend, i.e. the count of comprehended
+  // parent nodes. 1 for the root node.
+  int64_t input_count = 0;
+  // The count of comprehended nodes, and the sum of their sizes.
+  int64_t output_count = 0;
+  int64_t byte_count = 0;
+
+  // The nodes passed to, and produced by, the methods of a type.
+  struct MethodExpansion {
+    // The name of the method in Comprehend.Method, e.g. "for_each".
+    std::string method;
+    int64_t input_count = 0;
+    int64_t output_count = 0;
+  };
+  // The types of methods applied to the node, in the order of the fields of
+  // Comprehend.Method.
+  std::vector<MethodExpansion> methods;
+};
+
+struct ComprehensionReport {
+  // One entry for each node of the model config, in depth-first order.
+  std::vector<NodeExpansion> nodes;
+  // The count of comprehended nodes, and the sum of their sizes.
+  int64_t node_count = 0;
+  int64_t byte_count = 0;
+};
+
 // The baseclass for comprehension methods.
 class ComprehensionMethod {
  public:
   // Comprehend @node_config and return the comprehended config.
   // May override context in @node_config(including children) with @context_map.
+  // The content of @node_config is moved into the comprehension and is not
+  // usable afterwards.
+  //
+  // The model is comprehended depth first, one instantiated subtree at a time:
+  // the child nodes of a node are only copied after all the methods of the node
+  // are applied, and each instance is comprehended and added to its parent
+  // before the next one is created. The working memory, aside from the output,
+  // is proportional to the depth of the model and not to the size of the
+  // comprehended model. The Filters, and the ApplyIfs choosing between Filters,
+  // right after a ForEach are evaluated on the context of each value before
+  // the node is copied, so the values they filter out are never copied.
+  // Returns error status if @options is invalid.
   static absl::StatusOr<ModelNodeConfig> ComprehendAndCleanModel(
-      ModelNodeConfig& node_config, const ContextMap& context_map);
+      ModelNodeConfig& node_config, const ContextMap& context_map,
+      const ComprehensionOptions& options = ComprehensionOptions());
+
+  // Dry run of ComprehendAndCleanModel, to know the size of the comprehended
+  // model before comprehending it. @node_config is comprehended the same way,
+  // and the same errors are returned, but each comprehended node is dropped as
+  // soon as it is counted, so the memory used does not grow with the
+  // comprehended model.
+  // The Filters applied by a ForEach, see above, are counted as part of it.
+  static absl::StatusOr<ComprehensionReport> EstimateComprehension(
+      ModelNodeConfig& node_config, const ContextMap& context_map,
+      const ComprehensionOptions& options = ComprehensionOptions());
 
   // Always use ComprehensionMethod::Build to get a
   // ComprehensionMethod object. Users should never call the factory
@@ -118,9 +197,23 @@ class ComprehensionMethod {
   ComprehensionMethod(const ComprehensionMethod&) = delete;
   ComprehensionMethod& operator=(const ComprehensionMethod&) = delete;
 
+  // Receives a node produced by a comprehension method, with its context.
+  using ScopedNodeConsumer = std::function<absl::Status(
+      ModelNodeConfig& node_config, const ContextScopePtr& scope)>;
+
   // Apply comprehension method to @node_config to produce a list of nodes.
-  virtual absl::StatusOr<std::vector<ModelNodeConfig>> Apply(
+  // The context is read from, and the added key-values are written to,
+  // @node_config.comprehend.context.
+  absl::StatusOr<std::vector<ModelNodeConfig>> Apply(
       ModelNodeConfig& node_config) const;
+
+  // Apply comprehension method to @node_config, which has the context @scope,
+  // and pass each produced node and its context to @output as soon as it is
+  // created. The key-values added by the method are only in the scope passed
+  // to @output. Stops at the first error returned by @output.
+  virtual absl::Status ApplyInScope(ModelNodeConfig& node_config,
+                                    const ContextScopePtr& scope,
+                                    const ScopedNodeConsumer& output) const;
 };
 
 }  // namespace wfa_virtual_people
@@ -0,0 +1,161 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "wfa/virtual_people/training/model_compiler/comprehension/context_scope.h"
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/base/call_once.h"
+#include "absl/strings/match.h"
+#include "absl/strings/string_view.h"
+#include "wfa/virtual_people/training/comprehend.pb.h"
+#include "wfa/virtual_people/training/model_compiler/comprehension/contextual_boolean_expression.h"
+
+namespace wfa_virtual_people {
+
+namespace {
+
+bool ItemsHaveBraces(const ContextScope::Items& items) {
+  for (const auto& [key, value] : items) {
+    if (absl::StrContains(key, '{') || absl::StrContains(value, '{')) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Scopes with more items are indexed.
+constexpr int kMinItemsToIndex = 8;
+
+}  // namespace
+
+ContextScopePtr ContextScope::WithNodeContext(ContextScopePtr parent,
+                                              Items items) {
+  if (items.empty() && parent != nullptr) {
+    return parent;
+  }
+  return std::make_shared<const ContextScope>(
+      std::move(parent), /*is_binding=*/false, std::move(items));
+}
+
+ContextScopePtr ContextScope::WithNodeContext(
+    ContextScopePtr parent, const Comprehend::Context& context) {
+  Items items;
+  items.reserve(context.items_size());
+  for (const Comprehend::Context::KeyValue& kv : context.items()) {
+    items.emplace_back(kv.key(), kv.value());
+  }
+  return WithNodeContext(std::move(parent), std::move(items));
+}
+
+ContextScopePtr ContextScope::WithBindings(ContextScopePtr parent,
+                                           Items items) {
+  if (items.empty() && parent != nullptr) {
+    return parent;
+  }
+  return std::make_shared<const ContextScope>(
+      std::move(parent), /*is_binding=*/true, std::move(items));
+}
+
+ContextScope::ContextScope(ContextScopePtr parent, bool is_binding,
+                           Items items)
+    : parent_(std::move(parent)),
+      is_binding_(is_binding),
+      items_(std::move(items)),
+      has_braces_((parent_ != nullptr && parent_->has_braces()) ||
+                  ItemsHaveBraces(items_)) {
+  if (items_.size() >= kMinItemsToIndex) {
+    index_.reserve(items_.size());
+    for (const auto& [key, value] : items_) {
+      index_.insert_or_assign(key, &value);
+    }
+  }
+}
+
+const std::string* ContextScope::FindInItems(absl::string_view key) const {
+  if (!index_.empty()) {
+    auto it = index_.find(key);
+    return it == index_.end() ? nullptr : it->second;
+  }
+  for (auto it = items_.rbegin(); it != items_.rend(); ++it) {
+    if (it->first == key) {
+      return &it->second;
+    }
+  }
+  return nullptr;
+}
+
+const std::string* ContextScope::Find(absl::string_view key) const {
+  // A value set in the configs is overridden by the ancestors.
+  const std::string* found = nullptr;
+  for (const ContextScope* scope = this; scope != nullptr;
+       scope = scope->parent()) {
+    if (scope->has_map_.load(std::memory_order_acquire)) {
+      // The cached map holds the resolved context of @scope, which takes
+      // precedence over the values set in the configs of its descendants.
+      auto it = scope->map_.find(key);
+      return it == scope->map_.end() ? found : &it->second;
+    }
+    const std::string* value = scope->FindInItems(key);
+    if (value == nullptr) {
+      continue;
+    }
+    if (scope->is_binding_) {
+      return value;
+    }
+    found = value;
+  }
+  return found;
+}
+
+const ContextMap& ContextScope::AsMap() const {
+  absl::call_once(map_once_, [this]() {
+    // Collect the scopes down from the closest ancestor with a built map.
+    std::vector<const ContextScope*> scopes;
+    const ContextScope* scope = this;
+    for (; scope != nullptr &&
+           !scope->has_map_.load(std::memory_order_acquire);
+         scope = scope->parent()) {
+      scopes.push_back(scope);
+    }
+    if (scope != nullptr) {
+      map_ = scope->map_;
+    }
+    for (auto it = scopes.rbegin(); it != scopes.rend(); ++it) {
+      (*it)->ApplyItems(map_);
+    }
+    has_map_.store(true, std::memory_order_release);
+  });
+  return map_;
+}
+
+void ContextScope::ApplyItems(ContextMap& context_map) const {
+  if (is_binding_) {
+    for (const auto& [key, value] : items_) {
+      context_map[key] = value;
+    }
+    return;
+  }
+  // The values set by the ancestors are kept, and the last value of a key in
+  // this scope is used.
+  for (auto it = items_.rbegin(); it != items_.rend(); ++it) {
+    context_map.try_emplace(it->first, it->second);
+  }
+}
+
+}  // namespace wfa_virtual_people
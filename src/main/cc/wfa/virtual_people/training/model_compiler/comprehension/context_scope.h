@@ -0,0 +1,115 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_COMPILER_COMPREHENSION_CONTEXT_SCOPE_H_
+#define SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_COMPILER_COMPREHENSION_CONTEXT_SCOPE_H_
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/base/call_once.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/strings/string_view.h"
+#include "wfa/virtual_people/training/comprehend.pb.h"
+#include "wfa/virtual_people/training/model_compiler/comprehension/contextual_boolean_expression.h"
+
+namespace wfa_virtual_people {
+
+class ContextScope;
+using ContextScopePtr = std::shared_ptr<const ContextScope>;
+
+// The comprehension context of a node, as an immutable chain of scopes.
+//
+// Each scope adds a few key-values to its parent scope, which is shared and
+// never copied, so creating the scope of a child node or of a comprehension
+// method does not depend on the size of the context.
+//
+// There are two kinds of scopes, to keep the semantics of the context lists in
+// Comprehend.context:
+// - The context set in the config of a node. The values set by the ancestors
+//   take precedence, so that the context of the root node, and the context map
+//   given to ComprehendAndCleanModel, override the context of the descendants.
+//   Within a scope, the last value of a key is used.
+// - The key-values added by comprehension methods, i.e. bindings. They take
+//   precedence over any context set in the configs. The methods never add a
+//   key already in the context.
+//
+// Finding a key looks it up in each scope of the chain, which is indexed when
+// it has many items, so the cost does not depend on the size of the context.
+// The context as a map is built on first use and cached in the scope, starting
+// from the closest ancestor with a cached map. Scopes are safe to share between
+// threads.
+class ContextScope {
+ public:
+  using Items = std::vector<std::pair<std::string, std::string>>;
+
+  // Returns a scope with the context set in the config of a node, on top of
+  // @parent. If @parent is null, returns a root scope.
+  // Returns @parent if there is no item.
+  static ContextScopePtr WithNodeContext(ContextScopePtr parent, Items items);
+  static ContextScopePtr WithNodeContext(ContextScopePtr parent,
+                                         const Comprehend::Context& context);
+
+  // Returns a scope with key-values added by a comprehension method, on top of
+  // @parent. Returns @parent if there is no item.
+  static ContextScopePtr WithBindings(ContextScopePtr parent, Items items);
+
+  // Use the factory functions above.
+  ContextScope(ContextScopePtr parent, bool is_binding, Items items);
+
+  ContextScope(const ContextScope&) = delete;
+  ContextScope& operator=(const ContextScope&) = delete;
+
+  // Returns the value of @key, or null if @key is not in the context.
+  const std::string* Find(absl::string_view key) const;
+
+  bool Contains(absl::string_view key) const { return Find(key) != nullptr; }
+
+  // Returns the context as a map.
+  const ContextMap& AsMap() const;
+
+  // Whether any key or value in the context contains '{'.
+  bool has_braces() const { return has_braces_; }
+
+  const ContextScope* parent() const { return parent_.get(); }
+  bool is_binding() const { return is_binding_; }
+  const Items& items() const { return items_; }
+
+ private:
+  // Returns the value of the last item with @key in this scope, or null.
+  const std::string* FindInItems(absl::string_view key) const;
+
+  // Apply the items of this scope to @context_map, which holds the context of
+  // the parent scope.
+  void ApplyItems(ContextMap& context_map) const;
+
+  const ContextScopePtr parent_;
+  const bool is_binding_;
+  const Items items_;
+  const bool has_braces_;
+  // The index of the last item of each key, if there are many items.
+  absl::flat_hash_map<absl::string_view, const std::string*> index_;
+
+  mutable absl::once_flag map_once_;
+  mutable std::atomic<bool> has_map_ = false;
+  mutable ContextMap map_;
+};
+
+}  // namespace wfa_virtual_people
+
+#endif  // SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_COMPILER_COMPREHENSION_CONTEXT_SCOPE_H_
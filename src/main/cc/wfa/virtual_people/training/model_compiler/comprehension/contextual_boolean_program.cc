@@ -0,0 +1,234 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "wfa/virtual_people/training/model_compiler/comprehension/contextual_boolean_program.h"
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/container/inlined_vector.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "common_cpp/macros/macros.h"
+#include "wfa/virtual_people/training/comprehend.pb.h"
+#include "wfa/virtual_people/training/model_compiler/comprehension/contextual_boolean_expression.h"
+
+namespace wfa_virtual_people {
+
+class ContextualBooleanProgram::Compiler {
+ public:
+  explicit Compiler(ContextualBooleanProgram& program) : program_(program) {}
+
+  // Append the instructions of @config. If @config is folded to a constant,
+  // nothing is appended and the constant is returned.
+  absl::StatusOr<std::optional<bool>> CompileExpression(
+      const Comprehend::ContextualBooleanExpression& config);
+
+ private:
+  // Compile AND or OR. The @jump opcode skips the rest of the expressions when
+  // the result is decided, which is @decisive.
+  absl::StatusOr<std::optional<bool>> CompileConnective(
+      const google::protobuf::RepeatedPtrField<
+          Comprehend::ContextualBooleanExpression>& expressions,
+      Opcode jump, bool decisive);
+
+  // Return the index of @key in the keys of the program, adding it if not
+  // found.
+  uint32_t InternKey(absl::string_view key);
+
+  void Emit(Opcode opcode, uint32_t key = 0, uint32_t operand = 0) {
+    program_.instructions_.push_back({opcode, key, operand});
+  }
+
+  ContextualBooleanProgram& program_;
+  absl::flat_hash_map<std::string, uint32_t> key_indexes_;
+};
+
+absl::StatusOr<std::optional<bool>>
+ContextualBooleanProgram::Compiler::CompileExpression(
+    const Comprehend::ContextualBooleanExpression& config) {
+  switch (config.expression_case()) {
+    case Comprehend::ContextualBooleanExpression::ExpressionCase::kEquality: {
+      const auto& equality = config.equality();
+      if (!equality.has_left_key() || !equality.has_right_key()) {
+        return absl::InvalidArgumentError(
+            absl::StrCat("Equality expression must set left_key and right_key.",
+                         equality.DebugString()));
+      }
+      uint32_t left = InternKey(equality.left_key());
+      uint32_t right = InternKey(equality.right_key());
+      if (left == right) {
+        return true;
+      }
+      Emit(Opcode::kEqual, left, right);
+      return std::nullopt;
+    }
+
+    case Comprehend::ContextualBooleanExpression::ExpressionCase::
+        kNotExpression: {
+      const auto& not_expression = config.not_expression();
+      if (!not_expression.has_expression()) {
+        return absl::InvalidArgumentError(
+            absl::StrCat("NotExpression must set expression.",
+                         not_expression.DebugString()));
+      }
+      ASSIGN_OR_RETURN(std::optional<bool> constant,
+                       CompileExpression(not_expression.expression()));
+      if (constant.has_value()) {
+        return !*constant;
+      }
+      Emit(Opcode::kNot);
+      return std::nullopt;
+    }
+
+    case Comprehend::ContextualBooleanExpression::ExpressionCase::
+        kAndExpression:
+      return CompileConnective(config.and_expression().expressions(),
+                               Opcode::kJumpIfFalse, /*decisive=*/false);
+
+    case Comprehend::ContextualBooleanExpression::ExpressionCase::kOrExpression:
+      return CompileConnective(config.or_expression().expressions(),
+                               Opcode::kJumpIfTrue, /*decisive=*/true);
+
+    default:
+      // No expression is set.
+      return absl::InvalidArgumentError(
+          "ContextualBooleanExpression must set expression.");
+  }
+}
+
+absl::StatusOr<std::optional<bool>>
+ContextualBooleanProgram::Compiler::CompileConnective(
+    const google::protobuf::RepeatedPtrField<
+        Comprehend::ContextualBooleanExpression>& expressions,
+    Opcode jump, bool decisive) {
+  const uint32_t start = program_.instructions_.size();
+  std::vector<uint32_t> jumps;
+  bool decided = false;
+  for (const Comprehend::ContextualBooleanExpression& expression :
+       expressions) {
+    // The remaining expressions are still compiled, for their errors and keys.
+    ASSIGN_OR_RETURN(std::optional<bool> constant,
+                     CompileExpression(expression));
+    if (decided) {
+      program_.instructions_.resize(start);
+    } else if (!constant.has_value()) {
+      jumps.push_back(program_.instructions_.size());
+      Emit(jump);
+    } else if (*constant == decisive) {
+      decided = true;
+      program_.instructions_.resize(start);
+    }
+    // A non-decisive constant does not change the result.
+  }
+  if (decided) {
+    return decisive;
+  }
+  if (jumps.empty()) {
+    // Empty AND is true, and empty OR is false.
+    return !decisive;
+  }
+  // The last expression decides the result, so it does not need to jump.
+  program_.instructions_.pop_back();
+  jumps.pop_back();
+  for (uint32_t index : jumps) {
+    program_.instructions_[index].operand = program_.instructions_.size();
+  }
+  return std::nullopt;
+}
+
+uint32_t ContextualBooleanProgram::Compiler::InternKey(absl::string_view key) {
+  auto [it, inserted] =
+      key_indexes_.try_emplace(key, program_.keys_.size());
+  if (inserted) {
+    program_.keys_.emplace_back(key);
+  }
+  return it->second;
+}
+
+absl::StatusOr<ContextualBooleanProgram> ContextualBooleanProgram::Compile(
+    const Comprehend::ContextualBooleanExpression& config) {
+  ContextualBooleanProgram program;
+  Compiler compiler(program);
+  ASSIGN_OR_RETURN(std::optional<bool> constant,
+                   compiler.CompileExpression(config));
+  if (constant.has_value()) {
+    program.instructions_.push_back(
+        {Opcode::kConstant, 0, static_cast<uint32_t>(*constant)});
+  }
+  return program;
+}
+
+absl::StatusOr<bool> ContextualBooleanProgram::Evaluate(
+    ContextLookup lookup) const {
+  // All the keys must be in the context, even if they do not decide the
+  // result.
+  absl::InlinedVector<const std::string*, 8> values(keys_.size());
+  for (int i = 0; i < keys_.size(); ++i) {
+    values[i] = lookup(keys_[i]);
+    if (values[i] == nullptr) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("Key is not found in context map:", keys_[i]));
+    }
+  }
+
+  bool result = false;
+  const uint32_t size = instructions_.size();
+  uint32_t pc = 0;
+  while (pc < size) {
+    const Instruction& instruction = instructions_[pc];
+    switch (instruction.opcode) {
+      case Opcode::kConstant:
+        result = instruction.operand != 0;
+        break;
+      case Opcode::kEqual:
+        result = *values[instruction.key] == *values[instruction.operand];
+        break;
+      case Opcode::kNot:
+        result = !result;
+        break;
+      case Opcode::kJumpIfFalse:
+        if (!result) {
+          pc = instruction.operand;
+          continue;
+        }
+        break;
+      case Opcode::kJumpIfTrue:
+        if (result) {
+          pc = instruction.operand;
+          continue;
+        }
+        break;
+    }
+    ++pc;
+  }
+  return result;
+}
+
+absl::StatusOr<bool> ContextualBooleanProgram::Evaluate(
+    const ContextMap& context_map) const {
+  return Evaluate([&context_map](absl::string_view key) -> const std::string* {
+    auto it = context_map.find(key);
+    return it == context_map.end() ? nullptr : &it->second;
+  });
+}
+
+}  // namespace wfa_virtual_people
@@ -0,0 +1,100 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_COMPILER_COMPREHENSION_CONTEXTUAL_BOOLEAN_PROGRAM_H_
+#define SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_COMPILER_COMPREHENSION_CONTEXTUAL_BOOLEAN_PROGRAM_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "absl/functional/function_ref.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+#include "wfa/virtual_people/training/comprehend.pb.h"
+#include "wfa/virtual_people/training/model_compiler/comprehension/contextual_boolean_expression.h"
+
+namespace wfa_virtual_people {
+
+// Returns the value of @key, or null if @key is not in the context.
+using ContextLookup =
+    absl::FunctionRef<const std::string*(absl::string_view key)>;
+
+// A Comprehend.ContextualBooleanExpression compiled to a flat bytecode.
+//
+// The keys are interned when compiling, and each key is looked up once per
+// evaluation, before running the bytecode. The bytecode runs on a single
+// boolean accumulator, and AND / OR short-circuit by jumping to the end of the
+// expression when the accumulator decides the result. Sub-expressions that do
+// not depend on the values are folded to constants, e.g. the equality of a key
+// with itself, or an AND containing a false constant.
+//
+// The semantics are the same as ContextualBooleanExpression, including the
+// errors: Compile returns the same errors as
+// ContextualBooleanExpression::Build, and Evaluate returns error if any key of
+// the expression is not in the context, even if it is in a sub-expression
+// that is skipped or folded.
+//
+// Example usage:
+//   ASSIGN_OR_RETURN(ContextualBooleanProgram program,
+//                    ContextualBooleanProgram::Compile(config));
+//   ASSIGN_OR_RETURN(bool result, program.Evaluate(context_map));
+class ContextualBooleanProgram {
+ public:
+  static absl::StatusOr<ContextualBooleanProgram> Compile(
+      const Comprehend::ContextualBooleanExpression& config);
+
+  // Evaluates the expression with the values returned by @lookup.
+  absl::StatusOr<bool> Evaluate(ContextLookup lookup) const;
+
+  // Evaluates the expression using @context_map.
+  absl::StatusOr<bool> Evaluate(const ContextMap& context_map) const;
+
+  int instruction_count() const { return instructions_.size(); }
+  const std::vector<std::string>& keys() const { return keys_; }
+
+ private:
+  enum class Opcode : uint8_t {
+    // Set the accumulator to the operand.
+    kConstant,
+    // Set the accumulator to whether the values of two keys are equal.
+    kEqual,
+    kNot,
+    // Jump to the target if the accumulator is false, or true.
+    kJumpIfFalse,
+    kJumpIfTrue,
+  };
+
+  struct Instruction {
+    Opcode opcode;
+    // For kEqual, the index of the left key in keys_.
+    uint32_t key;
+    // For kEqual, the index of the right key in keys_. For jumps, the target
+    // instruction. For kConstant, the value.
+    uint32_t operand;
+  };
+
+  class Compiler;
+
+  ContextualBooleanProgram() = default;
+
+  std::vector<Instruction> instructions_;
+  std::vector<std::string> keys_;
+};
+
+}  // namespace wfa_virtual_people
+
+#endif  // SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_COMPILER_COMPREHENSION_CONTEXTUAL_BOOLEAN_PROGRAM_H_
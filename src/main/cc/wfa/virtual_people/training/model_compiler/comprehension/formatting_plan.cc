@@ -0,0 +1,257 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "wfa/virtual_people/training/model_compiler/comprehension/formatting_plan.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/container/flat_hash_set.h"
+#include "absl/memory/memory.h"
+#include "absl/status/status.h"
+#include "absl/strings/match.h"
+#include "absl/strings/str_join.h"
+#include "absl/strings/str_split.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "common_cpp/macros/macros.h"
+#include "google/protobuf/descriptor.h"
+#include "google/protobuf/message.h"
+#include "wfa/virtual_people/training/model_compiler/comprehension/placeholder_substitution.h"
+
+namespace wfa_virtual_people {
+
+namespace {
+
+// Compute a set of fields to exclude for child message.
+// For example: if the fields we exclude in the parent are
+//     ['a', 'a.w', 'b.x', 'b.y', 'b.z.t', 'c']
+// then for child message 'b' we will exclude
+//     ['x', 'y', 'z.t']
+std::vector<std::string> GetFieldsToExcludeInSubMessage(
+    const std::vector<std::string>& parent_exclude_fields,
+    absl::string_view child_name) {
+  std::vector<std::string> result;
+  for (const std::string& field : parent_exclude_fields) {
+    std::vector<std::string> path = absl::StrSplit(field, '.');
+    if (path.size() > 1 && path[0] == child_name) {
+      uint64_t pos = field.find('.', 0);
+      result.emplace_back(field.substr(pos + 1));
+    }
+  }
+  return result;
+}
+
+// Sort and deduplicate @exclude_fields, so that equivalent exclude fields share
+// the plan.
+std::vector<std::string> Normalize(std::vector<std::string> exclude_fields) {
+  std::sort(exclude_fields.begin(), exclude_fields.end());
+  exclude_fields.erase(
+      std::unique(exclude_fields.begin(), exclude_fields.end()),
+      exclude_fields.end());
+  return exclude_fields;
+}
+
+}  // namespace
+
+// Owns all the plans of the process.
+class FormattingPlanRegistry {
+ public:
+  static FormattingPlanRegistry& Get() {
+    static FormattingPlanRegistry* const registry =
+        new FormattingPlanRegistry();
+    return *registry;
+  }
+
+  const FormattingPlan& GetPlan(
+      const google::protobuf::Descriptor* descriptor,
+      const std::vector<std::string>& exclude_fields) {
+    absl::MutexLock lock(&mutex_);
+    std::vector<FormattingPlan*> built;
+    const FormattingPlan* plan =
+        GetOrBuild(descriptor, Normalize(exclude_fields), built);
+    Prune(built);
+    return *plan;
+  }
+
+ private:
+  FormattingPlanRegistry() = default;
+
+  // Returns the plan for @descriptor and the normalized @exclude_fields.
+  // The plans built are added to @built. Message types can be recursive, so
+  // a plan is registered before the plans of its message fields are built.
+  FormattingPlan* GetOrBuild(const google::protobuf::Descriptor* descriptor,
+                             const std::vector<std::string>& exclude_fields,
+                             std::vector<FormattingPlan*>& built)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_) {
+    std::pair<const google::protobuf::Descriptor*, std::string> key(
+        descriptor, absl::StrJoin(exclude_fields, ","));
+    auto it = plans_.find(key);
+    if (it != plans_.end()) {
+      return it->second.get();
+    }
+    FormattingPlan* plan = new FormattingPlan();
+    plans_.emplace(std::move(key), absl::WrapUnique(plan));
+    built.push_back(plan);
+
+    for (int i = 0; i < descriptor->field_count(); ++i) {
+      const google::protobuf::FieldDescriptor* field = descriptor->field(i);
+      if (std::find(exclude_fields.begin(), exclude_fields.end(),
+                    field->name()) != exclude_fields.end()) {
+        continue;
+      }
+      if (field->cpp_type() ==
+          google::protobuf::FieldDescriptor::CPPTYPE_STRING) {
+        plan->string_fields_.push_back(field);
+      } else if (field->cpp_type() ==
+                 google::protobuf::FieldDescriptor::CPPTYPE_MESSAGE) {
+        const FormattingPlan* field_plan = GetOrBuild(
+            field->message_type(),
+            Normalize(GetFieldsToExcludeInSubMessage(exclude_fields,
+                                                     field->name())),
+            built);
+        plan->message_fields_.emplace_back(field, field_plan);
+      } else {
+        // Do nothing for other fields.
+      }
+    }
+    return plan;
+  }
+
+  // Drop the message fields of the @built plans whose plans cannot format any
+  // string. The plans built before are already pruned.
+  void Prune(const std::vector<FormattingPlan*>& built) {
+    absl::flat_hash_set<const FormattingPlan*> pending(built.begin(),
+                                                       built.end());
+    absl::flat_hash_set<const FormattingPlan*> formats_strings;
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      for (const FormattingPlan* plan : built) {
+        if (formats_strings.contains(plan)) {
+          continue;
+        }
+        bool formats = !plan->string_fields_.empty();
+        for (const auto& [field, field_plan] : plan->message_fields_) {
+          formats = formats || formats_strings.contains(field_plan) ||
+                    (!pending.contains(field_plan) && !field_plan->empty());
+        }
+        if (formats) {
+          formats_strings.insert(plan);
+          changed = true;
+        }
+      }
+    }
+
+    for (FormattingPlan* plan : built) {
+      auto& message_fields = plan->message_fields_;
+      message_fields.erase(
+          std::remove_if(message_fields.begin(), message_fields.end(),
+                         [&](const auto& message_field) {
+                           const FormattingPlan* field_plan =
+                               message_field.second;
+                           return pending.contains(field_plan)
+                                      ? !formats_strings.contains(field_plan)
+                                      : field_plan->empty();
+                         }),
+          message_fields.end());
+    }
+  }
+
+  absl::Mutex mutex_;
+  absl::flat_hash_map<std::pair<const google::protobuf::Descriptor*,
+                                std::string>,
+                      std::unique_ptr<FormattingPlan>>
+      plans_ ABSL_GUARDED_BY(mutex_);
+};
+
+const FormattingPlan& FormattingPlan::Get(
+    const google::protobuf::Descriptor* descriptor,
+    const std::vector<std::string>& exclude_fields) {
+  return FormattingPlanRegistry::Get().GetPlan(descriptor, exclude_fields);
+}
+
+absl::Status FormattingPlan::Format(google::protobuf::Message& message,
+                                    PlaceholderLookup lookup,
+                                    UnknownPlaceholderPolicy policy) const {
+  const google::protobuf::Reflection* reflection = message.GetReflection();
+  std::string scratch;
+  for (const google::protobuf::FieldDescriptor* field : string_fields_) {
+    if (field->is_repeated()) {
+      int size = reflection->FieldSize(message, field);
+      for (int i = 0; i < size; ++i) {
+        const std::string& value =
+            reflection->GetRepeatedStringReference(message, field, i, &scratch);
+        if (!absl::StrContains(value, '{')) {
+          continue;
+        }
+        std::string formatted(value);
+        ASSIGN_OR_RETURN(bool changed,
+                         SubstitutePlaceholders(lookup, policy, formatted));
+        if (changed) {
+          reflection->SetRepeatedString(&message, field, i,
+                                        std::move(formatted));
+        }
+      }
+    } else if (reflection->HasField(message, field)) {
+      const std::string& value =
+          reflection->GetStringReference(message, field, &scratch);
+      if (!absl::StrContains(value, '{')) {
+        continue;
+      }
+      std::string formatted(value);
+      ASSIGN_OR_RETURN(bool changed,
+                       SubstitutePlaceholders(lookup, policy, formatted));
+      if (changed) {
+        reflection->SetString(&message, field, std::move(formatted));
+      }
+    }
+  }
+
+  for (const auto& [field, field_plan] : message_fields_) {
+    if (field->is_repeated()) {
+      int size = reflection->FieldSize(message, field);
+      for (int i = 0; i < size; ++i) {
+        RETURN_IF_ERROR(field_plan->Format(
+            *reflection->MutableRepeatedMessage(&message, field, i), lookup,
+            policy));
+      }
+    } else if (reflection->HasField(message, field)) {
+      RETURN_IF_ERROR(field_plan->Format(
+          *reflection->MutableMessage(&message, field), lookup, policy));
+    }
+  }
+  return absl::OkStatus();
+}
+
+absl::Status FormattingPlan::Format(google::protobuf::Message& message,
+                                    const ContextMap& context_map,
+                                    UnknownPlaceholderPolicy policy) const {
+  return Format(
+      message,
+      [&context_map](absl::string_view key) -> const std::string* {
+        auto it = context_map.find(key);
+        return it == context_map.end() ? nullptr : &it->second;
+      },
+      policy);
+}
+
+}  // namespace wfa_virtual_people
@@ -0,0 +1,87 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_COMPILER_COMPREHENSION_FORMATTING_PLAN_H_
+#define SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_COMPILER_COMPREHENSION_FORMATTING_PLAN_H_
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "google/protobuf/descriptor.h"
+#include "google/protobuf/message.h"
+#include "wfa/virtual_people/training/model_compiler/comprehension/contextual_boolean_expression.h"
+#include "wfa/virtual_people/training/model_compiler/comprehension/placeholder_substitution.h"
+
+namespace wfa_virtual_people {
+
+// The string fields to format in a message type, when some fields are
+// excluded.
+//
+// Each entry of the exclude fields is a path of field names separated by '.',
+// for example "branches.nodes.name". A field is excluded with all its
+// sub-messages if its path is in the exclude fields.
+//
+// A plan only lists the string fields that are not excluded, and the message
+// fields that can contain such string fields. Message fields of types without
+// any string field, directly or in sub-messages, are never visited.
+//
+// Plans are built once per message type and exclude fields, and shared by all
+// threads for the lifetime of the process.
+class FormattingPlan {
+ public:
+  // Returns the plan for messages of type @descriptor, excluding
+  // @exclude_fields. The order of @exclude_fields does not matter.
+  static const FormattingPlan& Get(
+      const google::protobuf::Descriptor* descriptor,
+      const std::vector<std::string>& exclude_fields);
+
+  FormattingPlan(const FormattingPlan&) = delete;
+  FormattingPlan& operator=(const FormattingPlan&) = delete;
+
+  // Returns true if no string field can be formatted.
+  bool empty() const {
+    return string_fields_.empty() && message_fields_.empty();
+  }
+
+  // Replace the placeholders "{key}" in all the string fields of @message in
+  // the plan, with the values returned by @lookup. See SubstitutePlaceholders.
+  // Returns error if a key is not in the context and @policy is kFail.
+  absl::Status Format(google::protobuf::Message& message,
+                      PlaceholderLookup lookup,
+                      UnknownPlaceholderPolicy policy =
+                          UnknownPlaceholderPolicy::kKeep) const;
+
+  // Same as above, with the values in @context_map.
+  absl::Status Format(google::protobuf::Message& message,
+                      const ContextMap& context_map,
+                      UnknownPlaceholderPolicy policy =
+                          UnknownPlaceholderPolicy::kKeep) const;
+
+ private:
+  friend class FormattingPlanRegistry;
+
+  FormattingPlan() = default;
+
+  std::vector<const google::protobuf::FieldDescriptor*> string_fields_;
+  std::vector<std::pair<const google::protobuf::FieldDescriptor*,
+                        const FormattingPlan*>>
+      message_fields_;
+};
+
+}  // namespace wfa_virtual_people
+
+#endif  // SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_COMPILER_COMPREHENSION_FORMATTING_PLAN_H_
@@ -0,0 +1,71 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "wfa/virtual_people/training/model_compiler/comprehension/placeholder_substitution.h"
+
+#include <cstddef>
+#include <string>
+#include <utility>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+
+namespace wfa_virtual_people {
+
+absl::StatusOr<bool> SubstitutePlaceholders(PlaceholderLookup lookup,
+                                            UnknownPlaceholderPolicy policy,
+                                            std::string& text) {
+  size_t open = text.find('{');
+  if (open == std::string::npos) {
+    return false;
+  }
+
+  std::string result;
+  // The text before this position is already in @result.
+  size_t copied = 0;
+  while (open != std::string::npos) {
+    size_t close = text.find_first_of("{}", open + 1);
+    if (close == std::string::npos) {
+      break;
+    }
+    if (text[close] == '{') {
+      // The placeholder starts at the last '{'.
+      open = close;
+      continue;
+    }
+    absl::string_view key(text.data() + open + 1, close - open - 1);
+    const std::string* value = lookup(key);
+    if (value != nullptr) {
+      result.append(text, copied, open - copied);
+      result.append(*value);
+      copied = close + 1;
+    } else if (policy == UnknownPlaceholderPolicy::kFail) {
+      return absl::InvalidArgumentError(absl::StrCat(
+          "Placeholder {", key, "} is not in context. Text: ", text));
+    }
+    open = text.find('{', close + 1);
+  }
+
+  if (copied == 0) {
+    return false;
+  }
+  result.append(text, copied, std::string::npos);
+  text = std::move(result);
+  return true;
+}
+
+}  // namespace wfa_virtual_people
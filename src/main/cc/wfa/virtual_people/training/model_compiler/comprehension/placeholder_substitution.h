@@ -0,0 +1,56 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_COMPILER_COMPREHENSION_PLACEHOLDER_SUBSTITUTION_H_
+#define SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_COMPILER_COMPREHENSION_PLACEHOLDER_SUBSTITUTION_H_
+
+#include <string>
+
+#include "absl/functional/function_ref.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+
+namespace wfa_virtual_people {
+
+// What to do with a placeholder whose key is not in the context.
+enum class UnknownPlaceholderPolicy {
+  // Leave the placeholder in place. It can be formatted later, when the key
+  // is added to the context.
+  kKeep,
+  // Return an error.
+  kFail,
+};
+
+// Returns the value of @key, or null if @key is not in the context.
+using PlaceholderLookup =
+    absl::FunctionRef<const std::string*(absl::string_view key)>;
+
+// Replace each placeholder "{key}" in @text with the value of key.
+//
+// @text is scanned once, and each placeholder is looked up on its own, so the
+// cost does not depend on the size of the context. A placeholder is the
+// shortest text between '{' and '}', so keys cannot contain braces. The
+// substituted values are not scanned again. Strings without '{' are returned
+// as is.
+//
+// Returns whether @text is changed, or an error if a key is not in the context
+// and @policy is kFail.
+absl::StatusOr<bool> SubstitutePlaceholders(PlaceholderLookup lookup,
+                                            UnknownPlaceholderPolicy policy,
+                                            std::string& text);
+
+}  // namespace wfa_virtual_people
+
+#endif  // SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_COMPILER_COMPREHENSION_PLACEHOLDER_SUBSTITUTION_H_
@@ -15,11 +15,15 @@
 #include "wfa/virtual_people/training/model_compiler/comprehension/spec_util.h"
 
 #include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <memory>
 #include <sstream>
 #include <string>
+#include <system_error>
 #include <utility>
 #include <vector>
 
@@ -29,6 +33,8 @@
 #include "absl/status/statusor.h"
 #include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "common_cpp/fingerprinters/fingerprinters.h"
 #include "common_cpp/macros/macros.h"
 #include "riegeli/bytes/string_reader.h"
 #include "riegeli/csv/csv_reader.h"
@@ -51,6 +57,132 @@ absl::StatusOr<std::string> GetFileContent(const std::string& filename) {
   return output.str();
 }
 
+// The modification time and the size of a file. The file is read again only
+// if either changed.
+struct FileStat {
+  std::filesystem::file_time_type modified;
+  uintmax_t size;
+
+  bool operator==(const FileStat& other) const {
+    return modified == other.modified && size == other.size;
+  }
+};
+
+absl::StatusOr<FileStat> GetFileStat(const std::string& filename) {
+  std::error_code error;
+  FileStat stat;
+  stat.modified = std::filesystem::last_write_time(filename, error);
+  if (!error) {
+    stat.size = std::filesystem::file_size(filename, error);
+  }
+  if (error) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Cannot open file ", filename));
+  }
+  return stat;
+}
+
+// A parsed CSV file.
+struct CsvTable {
+  std::vector<std::string> header;
+  std::vector<std::vector<std::string>> records;
+};
+
+absl::StatusOr<CsvTable> ParseCsv(absl::string_view content,
+                                  absl::string_view filename) {
+  riegeli::CsvReader<riegeli::StringReader<absl::string_view>> csv_reader{
+      riegeli::StringReader<absl::string_view>(content),
+      riegeli::CsvReaderBase::Options().set_comment('#')};
+
+  CsvTable table;
+  if (!csv_reader.ReadRecord(table.header)) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Failed to read header: ", filename));
+  }
+  std::vector<std::string> record;
+  while (csv_reader.ReadRecord(record)) {
+    table.records.emplace_back(std::move(record));
+  }
+  return table;
+}
+
+// The process-wide cache of parsed CSV files.
+// Only the latest content of each file is kept. A file whose modification
+// time and size are unchanged is not read. Otherwise it is read, and parsed
+// only if its size or its Fingerprint64 changed.
+class CsvCache {
+ public:
+  static CsvCache& Get() {
+    static CsvCache* const cache = new CsvCache();
+    return *cache;
+  }
+
+  // Returns the parsed content of @filename.
+  absl::StatusOr<std::shared_ptr<const CsvTable>> Read(
+      const std::string& filename) {
+    // The stat is taken before reading, so a file changed while being read
+    // has a newer stat than the cached one, and is read again next time.
+    ASSIGN_OR_RETURN(FileStat stat, GetFileStat(filename));
+    {
+      absl::MutexLock lock(&mutex_);
+      auto it = tables_.find(filename);
+      if (it != tables_.end() && it->second.stat == stat) {
+        ++stats_.hits;
+        return it->second.table;
+      }
+    }
+
+    ASSIGN_OR_RETURN(std::string content, GetFileContent(filename));
+    const uint64_t fingerprint =
+        wfa::GetFarmFingerprinter().Fingerprint(content);
+    {
+      absl::MutexLock lock(&mutex_);
+      auto it = tables_.find(filename);
+      if (it != tables_.end() && it->second.size == content.size() &&
+          it->second.fingerprint == fingerprint) {
+        // Touched, but not changed.
+        it->second.stat = stat;
+        ++stats_.hits;
+        return it->second.table;
+      }
+      ++stats_.misses;
+    }
+
+    // Parse without holding the lock. Concurrent reads of the same new file
+    // may all parse it, and the last one is kept.
+    ASSIGN_OR_RETURN(CsvTable table, ParseCsv(content, filename));
+    auto shared_table = std::make_shared<const CsvTable>(std::move(table));
+    absl::MutexLock lock(&mutex_);
+    tables_[filename] = {stat, content.size(), fingerprint, shared_table};
+    return shared_table;
+  }
+
+  CsvCacheStats GetStats() {
+    absl::MutexLock lock(&mutex_);
+    return stats_;
+  }
+
+  void Clear() {
+    absl::MutexLock lock(&mutex_);
+    tables_.clear();
+    stats_ = CsvCacheStats();
+  }
+
+ private:
+  struct Entry {
+    FileStat stat;
+    size_t size;
+    uint64_t fingerprint;
+    std::shared_ptr<const CsvTable> table;
+  };
+
+  CsvCache() = default;
+
+  absl::Mutex mutex_;
+  absl::flat_hash_map<std::string, Entry> tables_ ABSL_GUARDED_BY(mutex_);
+  CsvCacheStats stats_ ABSL_GUARDED_BY(mutex_);
+};
+
 // Get index of @column_name in @header.
 absl::StatusOr<int> GetColumnIndex(absl::string_view column_name,
                                    const std::vector<std::string>& header) {
@@ -94,21 +226,13 @@ absl::StatusOr<int> GetColumnIndex(const ListSpec::ListFromCSV& csv_spec,
 // Read string list from file as specified in @csv_spec.
 absl::StatusOr<std::vector<std::string>> ReadListFromCsv(
     const ListSpec::ListFromCSV& csv_spec) {
-  ASSIGN_OR_RETURN(std::string content, GetFileContent(csv_spec.filename()));
-  riegeli::CsvReader<riegeli::StringReader<std::string>> csv_reader{
-      riegeli::StringReader<std::string>(content),
-      riegeli::CsvReaderBase::Options().set_comment('#')};
-
-  std::vector<std::string> header;
-  if (!csv_reader.ReadRecord(header)) {
-    return absl::InvalidArgumentError(
-        absl::StrCat("Failed to read header: ", csv_spec.filename()));
-  }
+  ASSIGN_OR_RETURN(std::shared_ptr<const CsvTable> table,
+                   CsvCache::Get().Read(csv_spec.filename()));
+  const std::vector<std::string>& header = table->header;
   ASSIGN_OR_RETURN(int column_index, GetColumnIndex(csv_spec, header));
 
-  std::vector<std::string> record;
   std::vector<std::string> result;
-  while (csv_reader.ReadRecord(record)) {
+  for (const std::vector<std::string>& record : table->records) {
     if (record.size() <= column_index) {
       return absl::InvalidArgumentError(
           absl::StrCat("column index ", column_index,
@@ -137,16 +261,9 @@ absl::StatusOr<std::vector<std::string>> ReadListFromCsv(
 // Read string-to-strings-map from file as specified in @csv_spec.
 absl::StatusOr<StringToStringsMap> ReadMapFromCsv(
     const MapSpec::TableFromCSV& csv_spec) {
-  ASSIGN_OR_RETURN(std::string content, GetFileContent(csv_spec.filename()));
-  riegeli::CsvReader<riegeli::StringReader<std::string>> csv_reader{
-      riegeli::StringReader<std::string>(content),
-      riegeli::CsvReaderBase::Options().set_comment('#')};
-
-  std::vector<std::string> header;
-  if (!csv_reader.ReadRecord(header)) {
-    return absl::InvalidArgumentError(
-        absl::StrCat("Failed to read header: ", csv_spec.filename()));
-  }
+  ASSIGN_OR_RETURN(std::shared_ptr<const CsvTable> table,
+                   CsvCache::Get().Read(csv_spec.filename()));
+  const std::vector<std::string>& header = table->header;
 
   if (!csv_spec.has_key_column_name()) {
     return absl::InvalidArgumentError(absl::StrCat(
@@ -175,9 +292,8 @@ absl::StatusOr<StringToStringsMap> ReadMapFromCsv(
     max_index_used = key_column_index;
   }
 
-  std::vector<std::string> record;
   StringToStringsMap result;
-  while (csv_reader.ReadRecord(record)) {
+  for (const std::vector<std::string>& record : table->records) {
     if (record.size() <= max_index_used) {
       return absl::InvalidArgumentError(
           absl::StrCat("column index ", max_index_used,
@@ -229,4 +345,8 @@ absl::StatusOr<StringToStringsMap> ReadMapFromSpec(const MapSpec& spec) {
       absl::StrCat("MapSpec must set map_spec.", spec.DebugString()));
 }
 
+CsvCacheStats GetCsvCacheStats() { return CsvCache::Get().GetStats(); }
+
+void ClearCsvCache() { CsvCache::Get().Clear(); }
+
 }  // namespace wfa_virtual_people
@@ -15,6 +15,7 @@
 #ifndef SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_COMPILER_COMPREHENSION_SPEC_UTIL_H_
 #define SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_COMPILER_COMPREHENSION_SPEC_UTIL_H_
 
+#include <cstdint>
 #include <string>
 #include <vector>
 
@@ -28,6 +29,11 @@ namespace wfa_virtual_people {
 // ListSpec proto is specification for a list of strings.
 // MapSpec proto is specification for a string-to-strings map.
 
+// CSV files are parsed once per process. The parsed files are cached by file
+// name and content fingerprint, and shared by all ListSpec and MapSpec reads,
+// from any thread. A file is read again only if its modification time or size
+// changed, and parsed again only if its content changed.
+
 // Map from a string to a list of strings.
 typedef absl::flat_hash_map<std::string, std::vector<std::string>>
     StringToStringsMap;
@@ -40,6 +46,20 @@ absl::StatusOr<std::vector<std::string>> ReadListFromSpec(const ListSpec& spec);
 // Returns error if @spec is invalid, or encounter any error during read.
 absl::StatusOr<StringToStringsMap> ReadMapFromSpec(const MapSpec& spec);
 
+// Counters of the process-wide cache of parsed CSV files.
+struct CsvCacheStats {
+  // The count of reads using an already parsed file.
+  int64_t hits = 0;
+  // The count of reads parsing the file.
+  int64_t misses = 0;
+};
+
+// Returns the counters of the CSV cache.
+CsvCacheStats GetCsvCacheStats();
+
+// Drops all the parsed CSV files and resets the counters.
+void ClearCsvCache();
+
 }  // namespace wfa_virtual_people
 
 #endif  // SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_COMPILER_COMPREHENSION_SPEC_UTIL_H_
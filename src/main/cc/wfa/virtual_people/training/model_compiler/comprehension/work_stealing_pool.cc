@@ -0,0 +1,151 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "wfa/virtual_people/training/model_compiler/comprehension/work_stealing_pool.h"
+
+#include <functional>
+#include <memory>
+#include <thread>
+#include <utility>
+
+#include "absl/synchronization/mutex.h"
+#include "glog/logging.h"
+
+namespace wfa_virtual_people {
+
+namespace {
+
+// The pool and the queue index of the current thread, if it is a thread
+// started by a pool.
+thread_local const WorkStealingPool* current_pool = nullptr;
+thread_local int current_queue_index = 0;
+
+}  // namespace
+
+WorkStealingPool::WorkStealingPool(int thread_count) {
+  CHECK_GT(thread_count, 0) << "thread_count must be positive.";
+  for (int i = 0; i < thread_count; ++i) {
+    queues_.emplace_back(std::make_unique<Queue>());
+  }
+  // Queue 0 belongs to the threads not started by the pool.
+  for (int i = 1; i < thread_count; ++i) {
+    threads_.emplace_back(&WorkStealingPool::RunWorker, this, i);
+  }
+}
+
+WorkStealingPool::~WorkStealingPool() {
+  {
+    absl::MutexLock lock(&mutex_);
+    stopping_ = true;
+  }
+  for (std::thread& thread : threads_) {
+    thread.join();
+  }
+}
+
+int WorkStealingPool::GetQueueIndex() const {
+  return current_pool == this ? current_queue_index : 0;
+}
+
+void WorkStealingPool::Schedule(TaskGroup& group, std::function<void()> task) {
+  Queue& queue = *queues_[GetQueueIndex()];
+  absl::MutexLock queue_lock(&queue.mutex);
+  queue.tasks.push_back({&group, std::move(task)});
+  absl::MutexLock lock(&mutex_);
+  ++group.pending_;
+  ++queued_count_;
+}
+
+bool WorkStealingPool::TakeTask(int index, Task& task) {
+  {
+    Queue& queue = *queues_[index];
+    absl::MutexLock lock(&queue.mutex);
+    if (!queue.tasks.empty()) {
+      task = std::move(queue.tasks.back());
+      queue.tasks.pop_back();
+      absl::MutexLock lock(&mutex_);
+      --queued_count_;
+      return true;
+    }
+  }
+  for (int i = 1; i < queues_.size(); ++i) {
+    Queue& queue = *queues_[(index + i) % queues_.size()];
+    absl::MutexLock lock(&queue.mutex);
+    if (!queue.tasks.empty()) {
+      task = std::move(queue.tasks.front());
+      queue.tasks.pop_front();
+      absl::MutexLock lock(&mutex_);
+      --queued_count_;
+      return true;
+    }
+  }
+  return false;
+}
+
+void WorkStealingPool::RunTask(Task& task) {
+  task.function();
+  // Release what the task holds before the waiting thread can return.
+  task.function = nullptr;
+  absl::MutexLock lock(&mutex_);
+  --task.group->pending_;
+}
+
+void WorkStealingPool::Wait(TaskGroup& group) {
+  const int index = GetQueueIndex();
+  while (true) {
+    {
+      absl::MutexLock lock(&mutex_);
+      if (group.pending_ == 0) {
+        return;
+      }
+    }
+    Task task;
+    if (TakeTask(index, task)) {
+      RunTask(task);
+      continue;
+    }
+    // The tasks of the group are running on other threads. Wait for them, or
+    // for new tasks to help with.
+    auto done_or_queued = [this, &group]() {
+      mutex_.AssertHeld();
+      return group.pending_ == 0 || queued_count_ > 0;
+    };
+    absl::MutexLock lock(&mutex_);
+    mutex_.Await(absl::Condition(&done_or_queued));
+  }
+}
+
+void WorkStealingPool::RunWorker(int index) {
+  current_pool = this;
+  current_queue_index = index;
+  while (true) {
+    Task task;
+    if (TakeTask(index, task)) {
+      RunTask(task);
+      continue;
+    }
+    auto stopping_or_queued = [this]() {
+      mutex_.AssertHeld();
+      return stopping_ || queued_count_ > 0;
+    };
+    absl::MutexLock lock(&mutex_);
+    mutex_.Await(absl::Condition(&stopping_or_queued));
+    if (stopping_ && queued_count_ == 0) {
+      return;
+    }
+  }
+}
+
+}  // namespace wfa_virtual_people
@@ -0,0 +1,111 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_COMPILER_COMPREHENSION_WORK_STEALING_POOL_H_
+#define SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_COMPILER_COMPREHENSION_WORK_STEALING_POOL_H_
+
+#include <deque>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/synchronization/mutex.h"
+
+namespace wfa_virtual_people {
+
+// A fixed set of threads running fork-join tasks.
+//
+// Each thread has its own queue of tasks. A thread runs the newest task of its
+// own queue first, which keeps the work depth first, and steals the oldest
+// task of another queue when its own queue is empty.
+//
+// The thread creating the pool counts as one of the threads: it runs tasks
+// only while waiting in Wait. Tasks can schedule and wait for other tasks.
+// A thread waiting for a group runs other tasks until the group is done, so
+// nested waits do not deadlock.
+class WorkStealingPool {
+ public:
+  // A set of tasks to wait for.
+  class TaskGroup {
+   public:
+    TaskGroup() = default;
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+
+   private:
+    friend class WorkStealingPool;
+    // The count of the scheduled tasks not done yet. Guarded by the mutex of
+    // the pool.
+    int pending_ = 0;
+  };
+
+  // Start @thread_count - 1 threads. @thread_count must be positive.
+  explicit WorkStealingPool(int thread_count);
+
+  // Stop and join the threads. All the task groups must have been waited for.
+  ~WorkStealingPool();
+
+  WorkStealingPool(const WorkStealingPool&) = delete;
+  WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+  int thread_count() const { return static_cast<int>(queues_.size()); }
+
+  // Add @task to @group, and queue it on the current thread.
+  void Schedule(TaskGroup& group, std::function<void()> task);
+
+  // Run tasks until all the tasks in @group are done.
+  void Wait(TaskGroup& group);
+
+ private:
+  struct Task {
+    TaskGroup* group;
+    std::function<void()> function;
+  };
+
+  struct Queue {
+    // Acquired before the mutex of the pool.
+    absl::Mutex mutex;
+    std::deque<Task> tasks ABSL_GUARDED_BY(mutex);
+  };
+
+  // The index of the queue of the current thread.
+  int GetQueueIndex() const;
+
+  // Take the newest task of queue @index, or the oldest task of another
+  // queue. Return false if all queues are empty.
+  bool TakeTask(int index, Task& task);
+
+  // Run @task and mark it done.
+  void RunTask(Task& task);
+
+  void RunWorker(int index);
+
+  std::vector<std::unique_ptr<Queue>> queues_;
+  std::vector<std::thread> threads_;
+
+  absl::Mutex mutex_;
+  // The count of the tasks in all queues. Updated in the critical section of
+  // the push or pop on the queue, so it never goes negative, and a thread
+  // woken by a queued task finds nothing to take only if another thread took
+  // the task first.
+  int queued_count_ ABSL_GUARDED_BY(mutex_) = 0;
+  bool stopping_ ABSL_GUARDED_BY(mutex_) = false;
+};
+
+}  // namespace wfa_virtual_people
+
+#endif  // SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_COMPILER_COMPREHENSION_WORK_STEALING_POOL_H_
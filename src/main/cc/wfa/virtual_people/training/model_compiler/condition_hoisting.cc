@@ -0,0 +1,243 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "wfa/virtual_people/training/model_compiler/condition_hoisting.h"
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/container/flat_hash_set.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "wfa/virtual_people/common/field_filter.pb.h"
+#include "wfa/virtual_people/common/model.pb.h"
+#include "wfa/virtual_people/training/model_compiler/field_filter_utils.h"
+#include "wfa/virtual_people/training/model_compiler/labeling_cost.h"
+#include "wfa/virtual_people/training/model_compiler/node_profile.h"
+
+namespace wfa_virtual_people {
+
+namespace {
+
+// Hoisting is applied only if it reduces the expected number of filter
+// evaluations by more than this.
+inline constexpr double kMinImprovement = 1e-9;
+
+// The branches that require the same value of the hoisted field.
+struct BranchGroup {
+  // The value as written in the condition of the first branch of the group.
+  std::string value;
+  std::vector<int> branch_indexes;
+};
+
+// A candidate field to hoist, with the branches grouped by the required value
+// of the field. The groups are in the order of their first branches.
+struct HoistingCandidate {
+  std::string field;
+  std::vector<BranchGroup> groups;
+  double expected_evaluations = 0.0;
+};
+
+// Return true if all branches of @branch_node are selected by condition, and
+// all child nodes are CompiledNode sub-messages.
+bool AllBranchesByConditionWithNode(const BranchNode& branch_node) {
+  for (const BranchNode::Branch& branch : branch_node.branches()) {
+    if (!branch.has_condition() || !branch.has_node()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Return the expected number of filter evaluations to select a branch of a
+// flat list of branches, with the given @probabilities.
+double GetFlatEvaluations(const std::vector<double>& probabilities) {
+  double evaluations = 0.0;
+  for (int i = 0; i < probabilities.size(); ++i) {
+    evaluations += probabilities[i] * (i + 1);
+  }
+  return evaluations;
+}
+
+// Group the branches of @branch_node by the value of @field, normalized by
+// NormalizeEqualFilterValue. Return false if any branch does not require
+// exactly one normalized value of @field, or any value of @field cannot be
+// normalized.
+bool GroupBranchesByField(const BranchNode& branch_node,
+                          const std::string& field,
+                          std::vector<BranchGroup>& groups) {
+  absl::flat_hash_map<std::string, int> group_index_by_value;
+  for (int i = 0; i < branch_node.branches_size(); ++i) {
+    std::vector<std::pair<std::string, std::string>> required_filters =
+        GetRequiredEqualFilters(branch_node.branches(i).condition());
+    const std::string* value = nullptr;
+    std::string normalized_value;
+    for (const auto& [name, required_value] : required_filters) {
+      if (name != field) {
+        continue;
+      }
+      absl::StatusOr<std::string> normalized =
+          NormalizeEqualFilterValue(name, required_value);
+      if (!normalized.ok() || (value && normalized_value != *normalized)) {
+        return false;
+      }
+      value = &required_value;
+      normalized_value = *std::move(normalized);
+    }
+    if (!value) {
+      return false;
+    }
+    auto [it, inserted] =
+        group_index_by_value.try_emplace(normalized_value, groups.size());
+    if (inserted) {
+      groups.push_back({*value, {}});
+    }
+    groups[it->second].branch_indexes.push_back(i);
+  }
+  return true;
+}
+
+// Return the expected number of filter evaluations to select a branch, after
+// hoisting by @groups.
+// A group with a single branch is not wrapped in an intermediate node.
+double GetHoistedEvaluations(const std::vector<BranchGroup>& groups,
+                             const std::vector<double>& probabilities) {
+  double evaluations = 0.0;
+  for (int i = 0; i < groups.size(); ++i) {
+    const std::vector<int>& branch_indexes = groups[i].branch_indexes;
+    for (int j = 0; j < branch_indexes.size(); ++j) {
+      double branch_evaluations =
+          branch_indexes.size() == 1 ? i + 1 : i + j + 2;
+      evaluations += probabilities[branch_indexes[j]] * branch_evaluations;
+    }
+  }
+  return evaluations;
+}
+
+// Return the field that is best to hoist from @branch_node. Return false if
+// hoisting any field does not reduce the expected number of filter
+// evaluations.
+bool GetBestHoistingCandidate(const BranchNode& branch_node,
+                              const NodeHitCounts* hit_counts,
+                              HoistingCandidate& best) {
+  std::vector<double> probabilities =
+      GetBranchProbabilities(branch_node, hit_counts);
+  best.expected_evaluations =
+      GetFlatEvaluations(probabilities) - kMinImprovement;
+  bool found = false;
+  absl::flat_hash_set<std::string> visited_fields;
+  // Any field to hoist must be required by the first branch.
+  for (const auto& [field, value] :
+       GetRequiredEqualFilters(branch_node.branches(0).condition())) {
+    if (!visited_fields.insert(field).second) {
+      continue;
+    }
+    std::vector<BranchGroup> groups;
+    if (!GroupBranchesByField(branch_node, field, groups)) {
+      continue;
+    }
+    // With a single group, or one group for each branch, nothing is
+    // factored out.
+    if (groups.size() <= 1 || groups.size() == branch_node.branches_size()) {
+      continue;
+    }
+    double evaluations = GetHoistedEvaluations(groups, probabilities);
+    if (evaluations < best.expected_evaluations) {
+      best.field = field;
+      best.groups = std::move(groups);
+      best.expected_evaluations = evaluations;
+      found = true;
+    }
+  }
+  return found;
+}
+
+// Hoist conditions of the BranchNode of @node. The child nodes are not
+// visited, except the intermediate nodes added here.
+void HoistConditionsForNode(CompiledNode& node,
+                            const ConditionHoistingOptions& options,
+                            ConditionHoistingReport& report) {
+  if (!node.has_branch_node()) {
+    return;
+  }
+  BranchNode& branch_node = *node.mutable_branch_node();
+  if (branch_node.branches_size() < options.min_branches ||
+      !AllBranchesByConditionWithNode(branch_node)) {
+    return;
+  }
+  HoistingCandidate candidate;
+  if (!GetBestHoistingCandidate(branch_node, options.hit_counts, candidate)) {
+    return;
+  }
+
+  google::protobuf::RepeatedPtrField<BranchNode::Branch> original_branches;
+  original_branches.Swap(branch_node.mutable_branches());
+  for (const BranchGroup& group : candidate.groups) {
+    if (group.branch_indexes.size() == 1) {
+      branch_node.add_branches()->Swap(
+          &original_branches[group.branch_indexes[0]]);
+      continue;
+    }
+    BranchNode::Branch* group_branch = branch_node.add_branches();
+    FieldFilterProto* condition = group_branch->mutable_condition();
+    condition->set_op(FieldFilterProto::EQUAL);
+    condition->set_name(candidate.field);
+    condition->set_value(group.value);
+    CompiledNode* group_node = group_branch->mutable_node();
+    group_node->set_name(absl::StrCat(node.name(), "_hoisted_",
+                                      candidate.field, "_", group.value));
+    for (int index : group.branch_indexes) {
+      BranchNode::Branch* branch =
+          group_node->mutable_branch_node()->add_branches();
+      branch->Swap(&original_branches[index]);
+      RemoveEqualFilter(*branch->mutable_condition(), candidate.field);
+    }
+    ++report.hoisted_node_count;
+    HoistConditionsForNode(*group_node, options, report);
+  }
+}
+
+// Hoist conditions of @node and all its descendants. The descendants are
+// restructured first.
+void HoistConditionsRecursively(CompiledNode& node,
+                                const ConditionHoistingOptions& options,
+                                ConditionHoistingReport& report) {
+  if (!node.has_branch_node()) {
+    return;
+  }
+  for (BranchNode::Branch& branch :
+       *node.mutable_branch_node()->mutable_branches()) {
+    if (branch.has_node()) {
+      HoistConditionsRecursively(*branch.mutable_node(), options, report);
+    }
+  }
+  HoistConditionsForNode(node, options, report);
+}
+
+}  // namespace
+
+ConditionHoistingReport HoistConditions(
+    CompiledNode& node, const ConditionHoistingOptions& options) {
+  ConditionHoistingReport report;
+  report.expected_filter_evaluations_before =
+      GetExpectedFilterEvaluations(node, options.hit_counts);
+  HoistConditionsRecursively(node, options, report);
+  report.expected_filter_evaluations_after =
+      GetExpectedFilterEvaluations(node, options.hit_counts);
+  return report;
+}
+
+}  // namespace wfa_virtual_people
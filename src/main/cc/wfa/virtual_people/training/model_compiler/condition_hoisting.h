@@ -0,0 +1,109 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_COMPILER_CONDITION_HOISTING_H_
+#define SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_COMPILER_CONDITION_HOISTING_H_
+
+#include "wfa/virtual_people/common/model.pb.h"
+#include "wfa/virtual_people/training/model_compiler/node_profile.h"
+
+namespace wfa_virtual_people {
+
+struct ConditionHoistingOptions {
+  // Only the BranchNodes with at least this many branches are restructured.
+  int min_branches = 4;
+  // If set, the candidate fields are compared, and the report is computed,
+  // with the branch probabilities weighted by these hit counts instead of the
+  // populations. See GetBranchProbabilities.
+  const NodeHitCounts* hit_counts = nullptr;
+};
+
+struct ConditionHoistingReport {
+  // The count of intermediate nodes added.
+  int hoisted_node_count = 0;
+  // The expected number of FieldFilterProto evaluations per event, before and
+  // after hoisting. See GetExpectedFilterEvaluations.
+  double expected_filter_evaluations_before = 0.0;
+  double expected_filter_evaluations_after = 0.0;
+};
+
+// Restructure the BranchNodes in @node and all its descendants, whose branches
+// are selected by condition, by factoring shared EQUAL conditions out of the
+// sibling branches into intermediate nodes.
+//
+// A field is hoisted from a BranchNode only if the condition of each branch
+// requires exactly one value of the field, as returned by
+// GetRequiredEqualFilters. The values are compared after
+// NormalizeEqualFilterValue, so "18" and "018" of an integer field are the
+// same value, and a field with any value that cannot be normalized is not
+// hoisted. Each event matches the branches of at most one value, so grouping
+// the branches by normalized value, keeping the order of the branches within
+// each group, does not change which branch is the first match for any event.
+// The condition of each intermediate node uses the value as written in the
+// first branch of its group.
+// Among all such fields, the one that minimizes the expected number of filter
+// evaluations is hoisted, if it improves over the flat list. The intermediate
+// nodes are restructured recursively.
+//
+// Example:
+// Writing an EQUAL filter as name == value, if node is
+//   name: "region"
+//   branch_node {
+//     branches {
+//       node { name: "pool_1" ... }
+//       condition { gender == FEMALE AND age == 18 }
+//     }
+//     branches {
+//       node { name: "pool_2" ... }
+//       condition { gender == MALE AND age == 18 }
+//     }
+//     branches {
+//       node { name: "pool_3" ... }
+//       condition { gender == FEMALE AND age == 25 }
+//     }
+//     branches {
+//       node { name: "pool_4" ... }
+//       condition { gender == MALE AND age == 25 }
+//     }
+//   }
+// The node will be
+//   name: "region"
+//   branch_node {
+//     branches {
+//       node {
+//         name: "region_hoisted_gender_FEMALE"
+//         branch_node {
+//           branches { node { name: "pool_1" ... } condition { age == 18 } }
+//           branches { node { name: "pool_3" ... } condition { age == 25 } }
+//         }
+//       }
+//       condition { gender == FEMALE }
+//     }
+//     branches {
+//       node {
+//         name: "region_hoisted_gender_MALE"
+//         branch_node {
+//           branches { node { name: "pool_2" ... } condition { age == 18 } }
+//           branches { node { name: "pool_4" ... } condition { age == 25 } }
+//         }
+//       }
+//       condition { gender == MALE }
+//     }
+//   }
+ConditionHoistingReport HoistConditions(
+    CompiledNode& node, const ConditionHoistingOptions& options = {});
+
+}  // namespace wfa_virtual_people
+
+#endif  // SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_COMPILER_CONDITION_HOISTING_H_
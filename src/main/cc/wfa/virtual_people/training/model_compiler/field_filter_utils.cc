@@ -15,15 +15,41 @@
 #include "wfa/virtual_people/training/model_compiler/field_filter_utils.h"
 
 #include <algorithm>
+#include <cstdint>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/str_split.h"
 #include "absl/strings/string_view.h"
+#include "google/protobuf/descriptor.h"
+#include "wfa/virtual_people/common/event.pb.h"
 #include "wfa/virtual_people/common/field_filter.pb.h"
 
 namespace wfa_virtual_people {
 
+namespace {
+
+void AppendRequiredEqualFilters(
+    const FieldFilterProto& filter,
+    std::vector<std::pair<std::string, std::string>>& output) {
+  if (filter.op() == FieldFilterProto::EQUAL) {
+    output.emplace_back(filter.name(), filter.value());
+  }
+  if (filter.op() == FieldFilterProto::AND) {
+    for (const FieldFilterProto& sub_filter : filter.sub_filters()) {
+      AppendRequiredEqualFilters(sub_filter, output);
+    }
+  }
+}
+
+}  // namespace
+
 FieldFilterProto CreateTrueFilter() {
   FieldFilterProto filter;
   filter.set_op(FieldFilterProto::TRUE);
@@ -79,4 +105,94 @@ void RemoveEqualFilter(FieldFilterProto& filter, absl::string_view name) {
   }
 }
 
+std::vector<std::pair<std::string, std::string>> GetRequiredEqualFilters(
+    const FieldFilterProto& filter) {
+  std::vector<std::pair<std::string, std::string>> output;
+  AppendRequiredEqualFilters(filter, output);
+  return output;
+}
+
+absl::StatusOr<std::string> NormalizeEqualFilterValue(
+    absl::string_view name, absl::string_view value) {
+  using ::google::protobuf::FieldDescriptor;
+  const google::protobuf::Descriptor* descriptor = LabelerEvent::descriptor();
+  const FieldDescriptor* field = nullptr;
+  for (absl::string_view part : absl::StrSplit(name, '.')) {
+    if (!descriptor) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("The field ", name, " is not in a message."));
+    }
+    field = descriptor->FindFieldByName(std::string(part));
+    if (!field) {
+      return absl::InvalidArgumentError(absl::StrCat(
+          "The field ", part, " is not found in ", descriptor->full_name()));
+    }
+    if (field->is_repeated()) {
+      return absl::UnimplementedError(absl::StrCat(
+          "Repeated field is not supported: ", field->full_name()));
+    }
+    descriptor = field->message_type();
+  }
+
+  absl::Status parse_error = absl::InvalidArgumentError(
+      absl::StrCat("Invalid value ", value, " for ", field->full_name()));
+  switch (field->cpp_type()) {
+    case FieldDescriptor::CPPTYPE_INT32: {
+      int32_t parsed;
+      if (!absl::SimpleAtoi(value, &parsed)) return parse_error;
+      return absl::StrCat(parsed);
+    }
+    case FieldDescriptor::CPPTYPE_INT64: {
+      int64_t parsed;
+      if (!absl::SimpleAtoi(value, &parsed)) return parse_error;
+      return absl::StrCat(parsed);
+    }
+    case FieldDescriptor::CPPTYPE_UINT32: {
+      uint32_t parsed;
+      if (!absl::SimpleAtoi(value, &parsed)) return parse_error;
+      return absl::StrCat(parsed);
+    }
+    case FieldDescriptor::CPPTYPE_UINT64: {
+      uint64_t parsed;
+      if (!absl::SimpleAtoi(value, &parsed)) return parse_error;
+      return absl::StrCat(parsed);
+    }
+    case FieldDescriptor::CPPTYPE_FLOAT: {
+      float parsed;
+      if (!absl::SimpleAtof(value, &parsed) || parsed != parsed) {
+        return parse_error;
+      }
+      // Adding 0 turns -0 to 0, which compares equal to it.
+      return absl::StrFormat("%.9g", parsed + 0.0f);
+    }
+    case FieldDescriptor::CPPTYPE_DOUBLE: {
+      double parsed;
+      if (!absl::SimpleAtod(value, &parsed) || parsed != parsed) {
+        return parse_error;
+      }
+      return absl::StrFormat("%.17g", parsed + 0.0);
+    }
+    case FieldDescriptor::CPPTYPE_BOOL: {
+      bool parsed;
+      if (!absl::SimpleAtob(value, &parsed)) return parse_error;
+      return parsed ? "true" : "false";
+    }
+    case FieldDescriptor::CPPTYPE_ENUM: {
+      const google::protobuf::EnumValueDescriptor* enum_value =
+          field->enum_type()->FindValueByName(std::string(value));
+      int number;
+      if (!enum_value && absl::SimpleAtoi(value, &number)) {
+        enum_value = field->enum_type()->FindValueByNumber(number);
+      }
+      if (!enum_value) return parse_error;
+      return absl::StrCat(enum_value->number());
+    }
+    case FieldDescriptor::CPPTYPE_STRING:
+      return std::string(value);
+    default:
+      return absl::InvalidArgumentError(absl::StrCat(
+          "Cannot compare the value of ", field->full_name()));
+  }
+}
+
 }  // namespace wfa_virtual_people
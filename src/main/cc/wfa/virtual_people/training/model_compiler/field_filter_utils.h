@@ -16,6 +16,8 @@
 #define SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_COMPILER_FIELD_FILTER_UTILS_H_
 
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "absl/status/statusor.h"
 #include "absl/strings/string_view.h"
@@ -132,6 +134,45 @@ absl::StatusOr<std::string> GetValueOfEqualFilter(
 //   op: TRUE
 void RemoveEqualFilter(FieldFilterProto& filter, absl::string_view name);
 
+// Return the name-value pairs of all the EQUAL filters that must hold for
+// @filter to match.
+// If @filter.op is EQUAL, return the name and value of @filter.
+// If @filter.op is AND, apply the check to each of the @filter.sub_filters
+// recursively.
+// The pairs are returned in the order they appear in @filter. Other ops do not
+// contribute any pair.
+//
+// Example:
+// If filter is
+//   op: AND
+//   sub_filters {
+//     op: EQUAL
+//     name: "a"
+//     value: "1"
+//   }
+//   sub_filters {
+//     op: OR
+//     sub_filters {
+//       op: EQUAL
+//       name: "b"
+//       value: "2"
+//     }
+//   }
+// Return [("a", "1")]
+std::vector<std::pair<std::string, std::string>> GetRequiredEqualFilters(
+    const FieldFilterProto& filter);
+
+// Return @value of an EQUAL filter on the field @name of LabelerEvent, parsed
+// to the type of the field and printed in a canonical form. Two values of the
+// same field match the same events if and only if their normalized values are
+// equal. For example, "18" and "018" of an int32 field are both normalized to
+// "18", and an enum value is normalized to its number, whether it is given by
+// name or by number.
+// Return error status if the field is not found or is repeated, or if @value
+// cannot be parsed to the type of the field.
+absl::StatusOr<std::string> NormalizeEqualFilterValue(absl::string_view name,
+                                                      absl::string_view value);
+
 }  // namespace wfa_virtual_people
 
 #endif  // SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_COMPILER_FIELD_FILTER_UTILS_H_
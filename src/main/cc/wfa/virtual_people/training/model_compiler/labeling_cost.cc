@@ -0,0 +1,241 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "wfa/virtual_people/training/model_compiler/labeling_cost.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "wfa/virtual_people/common/field_filter.pb.h"
+#include "wfa/virtual_people/common/model.pb.h"
+#include "wfa/virtual_people/training/model_compiler/constants.h"
+#include "wfa/virtual_people/training/model_compiler/node_profile.h"
+
+namespace wfa_virtual_people {
+
+uint64_t GetPopulation(const CompiledNode& node) {
+  uint64_t population = 0;
+  if (node.has_population_node()) {
+    for (const PopulationNode::VirtualPersonPool& pool :
+         node.population_node().pools()) {
+      if (pool.population_offset() < kCookieMonsterOffset) {
+        population += pool.total_population();
+      }
+    }
+  } else if (node.has_branch_node()) {
+    for (const BranchNode::Branch& branch : node.branch_node().branches()) {
+      if (branch.has_node()) {
+        population += GetPopulation(branch.node());
+      }
+    }
+  }
+  return population;
+}
+
+namespace {
+
+// Return the weights of the branches of @branch_node, and set @total to their
+// sum. Branches selected by condition are weighted by the hit counts of the
+// child nodes if @hit_counts is set, and by the populations otherwise.
+std::vector<double> GetBranchWeights(const BranchNode& branch_node,
+                                     const NodeHitCounts* hit_counts,
+                                     double& total) {
+  std::vector<double> weights;
+  total = 0.0;
+  for (const BranchNode::Branch& branch : branch_node.branches()) {
+    double weight = 0.0;
+    if (branch.has_chance()) {
+      weight = branch.chance();
+    } else if (branch.has_node()) {
+      weight = static_cast<double>(hit_counts
+                                       ? GetHitCount(branch.node(), *hit_counts)
+                                       : GetPopulation(branch.node()));
+    }
+    weights.push_back(weight);
+    total += weight;
+  }
+  return weights;
+}
+
+}  // namespace
+
+std::vector<double> GetBranchProbabilities(const BranchNode& branch_node,
+                                           const NodeHitCounts* hit_counts) {
+  double total = 0.0;
+  std::vector<double> probabilities =
+      GetBranchWeights(branch_node, hit_counts, total);
+  if (hit_counts && total <= 0.0) {
+    // No recorded traffic through the node.
+    probabilities = GetBranchWeights(branch_node, nullptr, total);
+  }
+  for (double& probability : probabilities) {
+    probability = total > 0.0 ? probability / total
+                              : 1.0 / static_cast<double>(probabilities.size());
+  }
+  return probabilities;
+}
+
+double GetExpectedFilterEvaluations(const CompiledNode& node,
+                                    const NodeHitCounts* hit_counts) {
+  if (!node.has_branch_node()) {
+    return 0.0;
+  }
+  const BranchNode& branch_node = node.branch_node();
+  std::vector<double> probabilities =
+      GetBranchProbabilities(branch_node, hit_counts);
+  double evaluations = 0.0;
+  for (int i = 0; i < branch_node.branches_size(); ++i) {
+    const BranchNode::Branch& branch = branch_node.branches(i);
+    double branch_evaluations = branch.has_condition() ? i + 1 : 0;
+    if (branch.has_node()) {
+      branch_evaluations +=
+          GetExpectedFilterEvaluations(branch.node(), hit_counts);
+    }
+    evaluations += probabilities[i] * branch_evaluations;
+  }
+  return evaluations;
+}
+
+namespace {
+
+int GetFilterTermCount(const FieldFilterProto& filter) {
+  switch (filter.op()) {
+    case FieldFilterProto::AND:
+    case FieldFilterProto::OR:
+    case FieldFilterProto::NOT:
+    case FieldFilterProto::PARTIAL: {
+      int count = 0;
+      for (const FieldFilterProto& sub_filter : filter.sub_filters()) {
+        count += GetFilterTermCount(sub_filter);
+      }
+      return count;
+    }
+    default:
+      return 1;
+  }
+}
+
+double GetExpectedCostPerEvent(const CompiledNode& node,
+                               const NodeHitCounts* hit_counts);
+
+double GetUpdaterWork(const BranchNode::AttributesUpdater& updater,
+                      const NodeHitCounts* hit_counts) {
+  if (updater.has_update_matrix()) {
+    return updater.update_matrix().columns_size();
+  }
+  if (updater.has_sparse_update_matrix()) {
+    return updater.sparse_update_matrix().columns_size();
+  }
+  if (updater.has_conditional_merge()) {
+    double work = 0.0;
+    for (const ConditionalMerge::ConditionalMergeNode& merge_node :
+         updater.conditional_merge().nodes()) {
+      work += GetFilterTermCount(merge_node.condition());
+    }
+    return work;
+  }
+  if (updater.has_update_tree()) {
+    return GetExpectedCostPerEvent(updater.update_tree().root(), hit_counts);
+  }
+  if (updater.has_conditional_assignment()) {
+    const ConditionalAssignment& assignment = updater.conditional_assignment();
+    return GetFilterTermCount(assignment.condition()) +
+           assignment.assignments_size();
+  }
+  // GeometricShredder.
+  return 1.0;
+}
+
+void AddLabelingCosts(const CompiledNode& node, int depth,
+                      double traffic_fraction, const NodeHitCounts* hit_counts,
+                      LabelingCostReport& report) {
+  const int position = report.nodes.size();
+  NodeLabelingCost& cost = report.nodes.emplace_back();
+  cost.name = node.name();
+  cost.depth = depth;
+  cost.traffic_fraction = traffic_fraction;
+  if (node.has_population_node()) {
+    cost.pool_count = node.population_node().pools_size();
+    return;
+  }
+  if (!node.has_branch_node()) {
+    return;
+  }
+  const BranchNode& branch_node = node.branch_node();
+  if (branch_node.has_updates()) {
+    for (const BranchNode::AttributesUpdater& updater :
+         branch_node.updates().updates()) {
+      cost.updater_work += GetUpdaterWork(updater, hit_counts);
+    }
+  } else if (branch_node.has_multiplicity()) {
+    cost.updater_work = 1.0;
+  }
+  std::vector<double> probabilities =
+      GetBranchProbabilities(branch_node, hit_counts);
+  // The conditions are evaluated in order until the first match.
+  double evaluated_terms = 0.0;
+  double filter_terms = 0.0;
+  for (int i = 0; i < branch_node.branches_size(); ++i) {
+    const BranchNode::Branch& branch = branch_node.branches(i);
+    if (branch.has_condition()) {
+      evaluated_terms += GetFilterTermCount(branch.condition());
+    }
+    filter_terms += probabilities[i] * evaluated_terms;
+    if (branch.has_node()) {
+      AddLabelingCosts(branch.node(), depth + 1,
+                       traffic_fraction * probabilities[i], hit_counts,
+                       report);
+    }
+  }
+  // @cost may be invalidated by adding the descendants.
+  report.nodes[position].filter_terms = filter_terms;
+}
+
+double GetExpectedCostPerEvent(const CompiledNode& node,
+                               const NodeHitCounts* hit_counts) {
+  return GetLabelingCostReport(node, hit_counts).GetExpectedCostPerEvent();
+}
+
+}  // namespace
+
+double LabelingCostReport::GetExpectedCostPerEvent() const {
+  double cost = 0.0;
+  for (const NodeLabelingCost& node : nodes) {
+    cost += node.GetWeightedCost();
+  }
+  return cost;
+}
+
+std::vector<NodeLabelingCost> LabelingCostReport::GetHotSpots(
+    int count) const {
+  std::vector<NodeLabelingCost> hot_spots = nodes;
+  std::stable_sort(hot_spots.begin(), hot_spots.end(),
+                   [](const NodeLabelingCost& a, const NodeLabelingCost& b) {
+                     return a.GetWeightedCost() > b.GetWeightedCost();
+                   });
+  if (hot_spots.size() > count) {
+    hot_spots.resize(std::max(count, 0));
+  }
+  return hot_spots;
+}
+
+LabelingCostReport GetLabelingCostReport(const CompiledNode& node,
+                                         const NodeHitCounts* hit_counts) {
+  LabelingCostReport report;
+  AddLabelingCosts(node, 0, 1.0, hit_counts, report);
+  return report;
+}
+
+}  // namespace wfa_virtual_people
@@ -0,0 +1,100 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_COMPILER_LABELING_COST_H_
+#define SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_COMPILER_LABELING_COST_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "wfa/virtual_people/common/model.pb.h"
+#include "wfa/virtual_people/training/model_compiler/node_profile.h"
+
+namespace wfa_virtual_people {
+
+// Return the total population of the population pools in @node and all its
+// descendants. The cookie monster pools are not counted.
+// Child nodes referenced by index are not counted.
+uint64_t GetPopulation(const CompiledNode& node);
+
+// Return the probabilities that an event reaching @branch_node selects each of
+// its branches.
+// * For branches selected by chance, the chances are normalized.
+// * For branches selected by condition, if @hit_counts is set and the total
+//   hit count of the child nodes is positive, the probabilities are
+//   proportional to the hit counts of the child nodes, as returned by
+//   GetHitCount. Otherwise, the probabilities are proportional to the
+//   populations of the child nodes, as returned by GetPopulation. If the total
+//   population is also zero, all branches have the same probability.
+std::vector<double> GetBranchProbabilities(
+    const BranchNode& branch_node, const NodeHitCounts* hit_counts = nullptr);
+
+// Return the expected number of FieldFilterProto evaluations needed to select
+// the branches from @node down to a leaf node, for one event.
+//
+// The branches selected by condition are selected by the first matching
+// condition, so selecting the k-th branch (1-based) costs k evaluations. The
+// traffic is assumed to be distributed as returned by GetBranchProbabilities
+// with @hit_counts.
+double GetExpectedFilterEvaluations(const CompiledNode& node,
+                                    const NodeHitCounts* hit_counts = nullptr);
+
+// The static estimate of the labeling cost of a single node.
+struct NodeLabelingCost {
+  std::string name;
+  // The depth of the node, where the root has depth 0.
+  int depth = 0;
+  // The fraction of the events reaching the node.
+  double traffic_fraction = 0.0;
+  // The expected number of FieldFilterProto terms evaluated to select a
+  // branch, for one event reaching the node. A term is a filter other than
+  // AND, OR, NOT and PARTIAL.
+  double filter_terms = 0.0;
+  // The number of matrix columns, conditional merge nodes, assignments and
+  // other items the attribute updaters or multiplicity go through, for one
+  // event reaching the node. An UpdateTree costs its expected cost per event.
+  double updater_work = 0.0;
+  // The length of the pool list of a population node.
+  int pool_count = 0;
+
+  // The cost for one event reaching the node.
+  double GetCost() const { return filter_terms + updater_work + pool_count; }
+  // The contribution of the node to the expected cost per event of the model.
+  double GetWeightedCost() const { return traffic_fraction * GetCost(); }
+};
+
+struct LabelingCostReport {
+  // One entry for each node, in depth-first order.
+  std::vector<NodeLabelingCost> nodes;
+
+  // The expected cost per event of the whole model.
+  double GetExpectedCostPerEvent() const;
+
+  // Return at most @count nodes with the highest weighted costs, in
+  // descending order of weighted cost.
+  std::vector<NodeLabelingCost> GetHotSpots(int count) const;
+};
+
+// Estimate the labeling cost of each node in @node and all its descendants,
+// without labeling any event. The traffic fractions are derived from the
+// probabilities returned by GetBranchProbabilities with @hit_counts.
+// Child nodes referenced by index are not included. The nodes of UpdateTrees
+// are not included, but counted in the updater_work of their parents.
+LabelingCostReport GetLabelingCostReport(
+    const CompiledNode& node, const NodeHitCounts* hit_counts = nullptr);
+
+}  // namespace wfa_virtual_people
+
+#endif  // SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_COMPILER_LABELING_COST_H_
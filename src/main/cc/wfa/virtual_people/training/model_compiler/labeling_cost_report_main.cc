@@ -0,0 +1,109 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// This is a tool to estimate the labeling cost of a compiled model without
+// labeling any event. For each node, it estimates the fraction of the events
+// reaching the node, from census populations and branch chances, and the cost
+// for one event reaching the node, in filter terms evaluated, updater work and
+// pool list length. The nodes with the highest weighted costs are logged, and
+// all nodes are written as CSV, in descending order of weighted cost.
+// Example usage:
+// bazel build -c opt \
+// //src/main/cc/wfa/virtual_people/training/model_compiler:labeling_cost_report_main
+// bazel-bin/src/main/cc/wfa/virtual_people/training/model_compiler/\
+// labeling_cost_report_main \
+// --model_path=/tmp/model_compiler/model.textproto \
+// --report_path=/tmp/model_compiler/labeling_cost.csv
+
+#include <fstream>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "common_cpp/protobuf_util/textproto_io.h"
+#include "glog/logging.h"
+#include "wfa/virtual_people/common/model.pb.h"
+#include "wfa/virtual_people/training/model_compiler/csv_field.h"
+#include "wfa/virtual_people/training/model_compiler/labeling_cost.h"
+#include "wfa/virtual_people/training/model_compiler/node_profile.h"
+
+ABSL_FLAG(std::string, model_path, "",
+          "Path to the CompiledNode textproto of the model root.");
+ABSL_FLAG(std::string, profile_path, "",
+          "If set, read the hit count of each node from this CSV, as written "
+          "by event_replay_main --visit_counts_path, and use them instead of "
+          "census populations to estimate the traffic of condition branches.");
+ABSL_FLAG(std::string, report_path, "",
+          "If set, write the cost of each node to this path, as CSV.");
+ABSL_FLAG(int, hot_spot_count, 10, "The number of hot spots to log.");
+
+int main(int argc, char** argv) {
+  absl::ParseCommandLine(argc, argv);
+  google::InitGoogleLogging(argv[0]);
+
+  std::string model_path = absl::GetFlag(FLAGS_model_path);
+  CHECK(!model_path.empty()) << "model_path is not set.";
+
+  wfa_virtual_people::CompiledNode model;
+  absl::Status read_status = wfa::ReadTextProtoFile(model_path, model);
+  CHECK(read_status.ok()) << read_status;
+
+  std::unique_ptr<wfa_virtual_people::NodeHitCounts> hit_counts;
+  std::string profile_path = absl::GetFlag(FLAGS_profile_path);
+  if (!profile_path.empty()) {
+    absl::StatusOr<wfa_virtual_people::NodeHitCounts> read_hit_counts =
+        wfa_virtual_people::ReadNodeHitCounts(profile_path);
+    CHECK(read_hit_counts.ok()) << read_hit_counts.status();
+    hit_counts = std::make_unique<wfa_virtual_people::NodeHitCounts>(
+        *std::move(read_hit_counts));
+  }
+
+  wfa_virtual_people::LabelingCostReport report =
+      wfa_virtual_people::GetLabelingCostReport(model, hit_counts.get());
+  LOG(INFO) << report.nodes.size()
+            << " nodes. Expected cost per event: "
+            << report.GetExpectedCostPerEvent();
+  for (const wfa_virtual_people::NodeLabelingCost& node :
+       report.GetHotSpots(absl::GetFlag(FLAGS_hot_spot_count))) {
+    LOG(INFO) << node.name << ": weighted cost " << node.GetWeightedCost()
+              << ", traffic " << node.traffic_fraction << ", filter terms "
+              << node.filter_terms << ", updater work " << node.updater_work
+              << ", pools " << node.pool_count;
+  }
+
+  std::string report_path = absl::GetFlag(FLAGS_report_path);
+  if (!report_path.empty()) {
+    std::ofstream report_file(report_path);
+    CHECK(report_file.is_open()) << "Failed to open " << report_path;
+    report_file << "name,depth,traffic_fraction,filter_terms,updater_work,"
+                   "pool_count,cost,weighted_cost\n";
+    for (const wfa_virtual_people::NodeLabelingCost& node :
+         report.GetHotSpots(report.nodes.size())) {
+      report_file << wfa_virtual_people::ToCsvField(node.name) << ","
+                  << node.depth << ","
+                  << node.traffic_fraction << "," << node.filter_terms << ","
+                  << node.updater_work << "," << node.pool_count << ","
+                  << node.GetCost() << "," << node.GetWeightedCost() << "\n";
+    }
+    report_file.close();
+    CHECK(!report_file.fail()) << "Failed to write " << report_path;
+  }
+
+  return 0;
+}
@@ -0,0 +1,150 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "wfa/virtual_people/training/model_compiler/model_flattening.h"
+
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <numeric>
+#include <utility>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "common_cpp/macros/macros.h"
+#include "wfa/virtual_people/common/model.pb.h"
+#include "wfa/virtual_people/training/model_compiler/labeling_cost.h"
+#include "wfa/virtual_people/training/model_compiler/node_profile.h"
+
+namespace wfa_virtual_people {
+
+namespace {
+
+// Return the nested child nodes of @node, in the order they are visited.
+absl::StatusOr<std::vector<CompiledNode*>> GetChildNodes(
+    CompiledNode& node, const FlatteningOptions& options) {
+  std::vector<CompiledNode*> children;
+  if (!node.has_branch_node()) {
+    return children;
+  }
+  BranchNode& branch_node = *node.mutable_branch_node();
+  for (BranchNode::Branch& branch : *branch_node.mutable_branches()) {
+    if (!branch.has_node()) {
+      return absl::InvalidArgumentError(absl::StrCat(
+          "The model is already flattened at node ", node.name()));
+    }
+    children.push_back(branch.mutable_node());
+  }
+  if (options.node_order == NodeOrder::kHotPathFirst) {
+    std::vector<double> probabilities =
+        GetBranchProbabilities(branch_node, options.hit_counts);
+    std::vector<int> order(children.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+      return probabilities[a] > probabilities[b];
+    });
+    std::vector<CompiledNode*> sorted;
+    for (int i : order) {
+      sorted.push_back(children[i]);
+    }
+    children = std::move(sorted);
+  }
+  return children;
+}
+
+absl::Status AddNodesInPreorder(CompiledNode& node,
+                                const FlatteningOptions& options,
+                                std::vector<CompiledNode*>& order) {
+  order.push_back(&node);
+  ASSIGN_OR_RETURN(std::vector<CompiledNode*> children,
+                   GetChildNodes(node, options));
+  for (CompiledNode* child : children) {
+    RETURN_IF_ERROR(AddNodesInPreorder(*child, options, order));
+  }
+  return absl::OkStatus();
+}
+
+absl::Status AddNodesInBreadthFirstOrder(CompiledNode& root,
+                                         const FlatteningOptions& options,
+                                         std::vector<CompiledNode*>& order) {
+  std::deque<CompiledNode*> queue = {&root};
+  while (!queue.empty()) {
+    CompiledNode* node = queue.front();
+    queue.pop_front();
+    order.push_back(node);
+    ASSIGN_OR_RETURN(std::vector<CompiledNode*> children,
+                     GetChildNodes(*node, options));
+    queue.insert(queue.end(), children.begin(), children.end());
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace
+
+absl::StatusOr<std::vector<CompiledNode>> FlattenModel(
+    const CompiledNode& root, const FlatteningOptions& options) {
+  CompiledNode tree = root;
+  std::vector<CompiledNode*> order;
+  if (options.node_order == NodeOrder::kBreadthFirst) {
+    RETURN_IF_ERROR(AddNodesInBreadthFirstOrder(tree, options, order));
+  } else {
+    RETURN_IF_ERROR(AddNodesInPreorder(tree, options, order));
+  }
+
+  // The order is reversed, so that the child nodes are before their parents.
+  const int last = order.size() - 1;
+  absl::flat_hash_map<const CompiledNode*, int> indexes;
+  for (int i = 0; i <= last; ++i) {
+    indexes[order[i]] = last - i;
+  }
+
+  // Every node is visited after its parent, which releases the ownership of
+  // the node to @released.
+  std::vector<std::unique_ptr<CompiledNode>> released;
+  std::vector<CompiledNode> nodes(order.size());
+  for (CompiledNode* node : order) {
+    const int index = indexes[node];
+    if (node->has_branch_node()) {
+      for (BranchNode::Branch& branch :
+           *node->mutable_branch_node()->mutable_branches()) {
+        const int child_index = indexes[&branch.node()];
+        released.emplace_back(branch.release_node());
+        branch.set_node_index(child_index);
+      }
+    }
+    node->set_index(index);
+    nodes[index] = std::move(*node);
+  }
+  return nodes;
+}
+
+absl::StatusOr<NodeOrder> ParseNodeOrder(absl::string_view name) {
+  if (name == "dfs") {
+    return NodeOrder::kDepthFirst;
+  }
+  if (name == "bfs") {
+    return NodeOrder::kBreadthFirst;
+  }
+  if (name == "hot_path") {
+    return NodeOrder::kHotPathFirst;
+  }
+  return absl::InvalidArgumentError(
+      absl::StrCat("Unknown node order: ", name));
+}
+
+}  // namespace wfa_virtual_people
@@ -0,0 +1,69 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_COMPILER_MODEL_FLATTENING_H_
+#define SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_COMPILER_MODEL_FLATTENING_H_
+
+#include <vector>
+
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+#include "wfa/virtual_people/common/model.pb.h"
+#include "wfa/virtual_people/training/model_compiler/node_profile.h"
+
+namespace wfa_virtual_people {
+
+// The order in which the nodes of a tree are laid out by FlattenModel.
+enum class NodeOrder {
+  // Depth-first preorder, visiting the child nodes in the order of the
+  // branches. Each subtree is contiguous.
+  kDepthFirst,
+  // Breadth-first, visiting the child nodes in the order of the branches.
+  // The nodes of the same depth are contiguous.
+  kBreadthFirst,
+  // Depth-first preorder, visiting the child nodes in descending order of
+  // the probabilities of their branches, as returned by
+  // GetBranchProbabilities. The nodes on the most likely path from the root
+  // are contiguous.
+  kHotPathFirst,
+};
+
+struct FlatteningOptions {
+  NodeOrder node_order = NodeOrder::kDepthFirst;
+  // Used for the branch probabilities of kHotPathFirst. If not set, the
+  // probabilities are estimated from census populations and chances.
+  const NodeHitCounts* hit_counts = nullptr;
+};
+
+// Return the model with root @root as a list of nodes, where each nested child
+// node is moved to its own element and referenced by node_index. The index of
+// each node is its position in the list. The roots of UpdateTrees are kept
+// nested. The order of the branches is not changed.
+//
+// The child nodes are listed before their parents, and the root is the last
+// node, so the nodes can be built in the order of the list. The list is the
+// reverse of the order selected by @options.node_order, which keeps the nodes
+// adjacent in that order adjacent in the list.
+//
+// Return error status if any branch already refers to its child by
+// node_index.
+absl::StatusOr<std::vector<CompiledNode>> FlattenModel(
+    const CompiledNode& root, const FlatteningOptions& options = {});
+
+// Parse @name as a NodeOrder. The valid names are "dfs", "bfs" and "hot_path".
+absl::StatusOr<NodeOrder> ParseNodeOrder(absl::string_view name);
+
+}  // namespace wfa_virtual_people
+
+#endif  // SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_COMPILER_MODEL_FLATTENING_H_
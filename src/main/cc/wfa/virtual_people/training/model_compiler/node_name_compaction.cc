@@ -0,0 +1,115 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "wfa/virtual_people/training/model_compiler/node_name_compaction.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "common_cpp/macros/macros.h"
+#include "wfa/virtual_people/common/model.pb.h"
+#include "wfa/virtual_people/training/node_name_map.pb.h"
+
+namespace wfa_virtual_people {
+
+namespace {
+
+constexpr uint64_t kFnvOffsetBasis = 14695981039346656037ULL;
+constexpr uint64_t kFnvPrime = 1099511628211ULL;
+
+// Map from compact names to original names.
+using CompactNameMap = absl::flat_hash_map<std::string, std::string>;
+
+absl::Status CompactRecursively(CompiledNode& node,
+                                CompactNameMap& compact_names) {
+  if (!node.name().empty()) {
+    std::string compact_name = GetCompactNodeName(node.name());
+    auto [it, inserted] = compact_names.try_emplace(compact_name, node.name());
+    if (!inserted && it->second != node.name()) {
+      return absl::InternalError(absl::StrCat(
+          "Names ", it->second, " and ", node.name(),
+          " have the same compact name ", compact_name));
+    }
+    node.set_name(std::move(compact_name));
+  }
+  if (!node.has_branch_node()) {
+    return absl::OkStatus();
+  }
+  BranchNode& branch_node = *node.mutable_branch_node();
+  if (branch_node.has_updates()) {
+    for (BranchNode::AttributesUpdater& updater :
+         *branch_node.mutable_updates()->mutable_updates()) {
+      if (updater.has_update_tree()) {
+        RETURN_IF_ERROR(CompactRecursively(
+            *updater.mutable_update_tree()->mutable_root(), compact_names));
+      }
+    }
+  }
+  for (BranchNode::Branch& branch : *branch_node.mutable_branches()) {
+    if (branch.has_node()) {
+      RETURN_IF_ERROR(
+          CompactRecursively(*branch.mutable_node(), compact_names));
+    }
+  }
+  return absl::OkStatus();
+}
+
+NodeNameMap ToSortedNameMap(const CompactNameMap& compact_names) {
+  std::vector<std::pair<std::string, std::string>> sorted_names(
+      compact_names.begin(), compact_names.end());
+  std::sort(sorted_names.begin(), sorted_names.end());
+  NodeNameMap name_map;
+  for (auto& [compact_name, name] : sorted_names) {
+    NodeNameMap::Entry* entry = name_map.add_entries();
+    entry->set_compact_name(std::move(compact_name));
+    entry->set_name(std::move(name));
+  }
+  return name_map;
+}
+
+}  // namespace
+
+std::string GetCompactNodeName(absl::string_view name) {
+  uint64_t fingerprint = kFnvOffsetBasis;
+  for (char c : name) {
+    fingerprint ^= static_cast<unsigned char>(c);
+    fingerprint *= kFnvPrime;
+  }
+  return absl::StrCat(absl::Hex(fingerprint, absl::kZeroPad16));
+}
+
+absl::StatusOr<NodeNameMap> CompactNodeNames(CompiledNode& node) {
+  CompactNameMap compact_names;
+  RETURN_IF_ERROR(CompactRecursively(node, compact_names));
+  return ToSortedNameMap(compact_names);
+}
+
+absl::StatusOr<NodeNameMap> CompactNodeNames(
+    std::vector<CompiledNode>& nodes) {
+  CompactNameMap compact_names;
+  for (CompiledNode& node : nodes) {
+    RETURN_IF_ERROR(CompactRecursively(node, compact_names));
+  }
+  return ToSortedNameMap(compact_names);
+}
+
+}  // namespace wfa_virtual_people
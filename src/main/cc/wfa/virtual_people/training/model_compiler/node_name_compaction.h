@@ -0,0 +1,51 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_COMPILER_NODE_NAME_COMPACTION_H_
+#define SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_COMPILER_NODE_NAME_COMPACTION_H_
+
+#include <string>
+#include <vector>
+
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+#include "wfa/virtual_people/common/model.pb.h"
+#include "wfa/virtual_people/training/node_name_map.pb.h"
+
+namespace wfa_virtual_people {
+
+// Return the compact name of @name, which is the 64 bits FNV-1a fingerprint of
+// @name, as 16 hex digits. The compact name of a given name is stable across
+// compilations.
+std::string GetCompactNodeName(absl::string_view name);
+
+// Replace the names of @node and all its descendants, including the UpdateTree
+// roots, with the compact names as returned by GetCompactNodeName. Empty names
+// are kept empty.
+// Nodes with the same name get the same compact name, so the compact names are
+// unique if and only if the original names are unique.
+//
+// Return the mapping from the compact names to the original names, sorted by
+// the compact names.
+// Return error status if two different names have the same compact name.
+absl::StatusOr<NodeNameMap> CompactNodeNames(CompiledNode& node);
+
+// Same as above, for the list of nodes of a flattened model, as returned by
+// FlattenModel. The nodes get the same compact names as in the tree they are
+// flattened from, so the returned mapping is the same as for that tree.
+absl::StatusOr<NodeNameMap> CompactNodeNames(std::vector<CompiledNode>& nodes);
+
+}  // namespace wfa_virtual_people
+
+#endif  // SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_COMPILER_NODE_NAME_COMPACTION_H_
@@ -0,0 +1,87 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "wfa/virtual_people/training/model_compiler/node_profile.h"
+
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
+#include "absl/strings/string_view.h"
+#include "wfa/virtual_people/common/model.pb.h"
+
+namespace wfa_virtual_people {
+
+absl::StatusOr<NodeHitCounts> ParseNodeHitCounts(absl::string_view content) {
+  NodeHitCounts hit_counts;
+  bool is_header = true;
+  for (absl::string_view line : absl::StrSplit(content, '\n')) {
+    if (!line.empty() && line.back() == '\r') {
+      line.remove_suffix(1);
+    }
+    if (line.empty()) {
+      continue;
+    }
+    if (is_header) {
+      is_header = false;
+      continue;
+    }
+    // Node names may contain commas, so the count is after the last comma.
+    size_t comma = line.rfind(',');
+    int64_t count = 0;
+    if (comma == absl::string_view::npos ||
+        !absl::SimpleAtoi(line.substr(comma + 1), &count) || count < 0) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("Invalid hit count line: ", line));
+    }
+    hit_counts[line.substr(0, comma)] += count;
+  }
+  return hit_counts;
+}
+
+absl::StatusOr<NodeHitCounts> ReadNodeHitCounts(absl::string_view path) {
+  std::ifstream file{std::string(path)};
+  if (!file.is_open()) {
+    return absl::NotFoundError(absl::StrCat("Failed to open ", path));
+  }
+  std::stringstream content;
+  content << file.rdbuf();
+  return ParseNodeHitCounts(content.str());
+}
+
+int64_t GetHitCount(const CompiledNode& node,
+                    const NodeHitCounts& hit_counts) {
+  auto it = hit_counts.find(node.name());
+  if (it != hit_counts.end()) {
+    return it->second;
+  }
+  int64_t hit_count = 0;
+  if (node.has_branch_node()) {
+    for (const BranchNode::Branch& branch : node.branch_node().branches()) {
+      if (branch.has_node()) {
+        hit_count += GetHitCount(branch.node(), hit_counts);
+      }
+    }
+  }
+  return hit_count;
+}
+
+}  // namespace wfa_virtual_people
@@ -0,0 +1,51 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_COMPILER_NODE_PROFILE_H_
+#define SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_COMPILER_NODE_PROFILE_H_
+
+#include <cstdint>
+#include <string>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+#include "wfa/virtual_people/common/model.pb.h"
+
+namespace wfa_virtual_people {
+
+// The counts of the events visiting the nodes of a model, keyed by node name.
+using NodeHitCounts = absl::flat_hash_map<std::string, int64_t>;
+
+// Parse the hit counts from @content in CSV, with a header line and the
+// columns name and visit_count, as written by event_replay_main with
+// --visit_counts_path. The counts of rows with the same name are summed.
+// The counts include the nodes of the update trees, and each clone of an
+// event made by the multiplicity of a branch node counts as a visit of the
+// nodes below it.
+absl::StatusOr<NodeHitCounts> ParseNodeHitCounts(absl::string_view content);
+
+// Read the hit counts from the CSV file at @path. See ParseNodeHitCounts.
+absl::StatusOr<NodeHitCounts> ReadNodeHitCounts(absl::string_view path);
+
+// Return the hit count of @node in @hit_counts. If the name of @node is not
+// found, for example @node is added by the compiler after the profile is
+// recorded, return the sum of the hit counts of its nested child nodes, as
+// every event visiting a branch node visits one of its children. For a branch
+// node with multiplicity, the sum is the count of the clones.
+int64_t GetHitCount(const CompiledNode& node, const NodeHitCounts& hit_counts);
+
+}  // namespace wfa_virtual_people
+
+#endif  // SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_COMPILER_NODE_PROFILE_H_
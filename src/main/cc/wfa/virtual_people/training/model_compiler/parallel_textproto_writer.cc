@@ -0,0 +1,172 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "wfa/virtual_people/training/model_compiler/parallel_textproto_writer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "absl/random/random.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "common_cpp/macros/macros.h"
+#include "google/protobuf/text_format.h"
+#include "wfa/virtual_people/common/model.pb.h"
+
+namespace wfa_virtual_people {
+
+namespace {
+
+// Each nested node adds 3 indent levels, for node, branch_node and branches.
+constexpr int kIndentLevelsPerDepth = 3;
+
+// Return the nested nodes at the shallowest depth with at least
+// @min_chunk_count nodes, or at the deepest depth, in the order they are
+// printed. Set @depth to the depth of the returned nodes.
+std::vector<CompiledNode*> GetChunkRoots(CompiledNode& root,
+                                         int min_chunk_count, int& depth) {
+  std::vector<CompiledNode*> level = {&root};
+  depth = 0;
+  while (true) {
+    std::vector<CompiledNode*> next_level;
+    for (CompiledNode* node : level) {
+      if (!node->has_branch_node()) {
+        continue;
+      }
+      for (BranchNode::Branch& branch :
+           *node->mutable_branch_node()->mutable_branches()) {
+        if (branch.has_node()) {
+          next_level.push_back(branch.mutable_node());
+        }
+      }
+    }
+    if (next_level.empty()) {
+      return depth == 0 ? std::vector<CompiledNode*>() : level;
+    }
+    level = std::move(next_level);
+    ++depth;
+    if (level.size() >= min_chunk_count) {
+      return level;
+    }
+  }
+}
+
+// Print @root as described in PrintTextProtoInParallel, and pass the output
+// to @output in pieces.
+absl::Status PrintInParallel(
+    CompiledNode& root, const ParallelTextProtoOptions& options,
+    const std::function<void(absl::string_view)>& output) {
+  if (options.thread_count < 1) {
+    return absl::InvalidArgumentError("thread_count must be positive.");
+  }
+  const int min_chunk_count = options.min_chunk_count > 0
+                                  ? options.min_chunk_count
+                                  : 4 * options.thread_count;
+  int depth = 0;
+  std::vector<CompiledNode*> chunk_roots =
+      GetChunkRoots(root, min_chunk_count, depth);
+
+  // Move the subtrees out, leaving placeholders with unique names.
+  const uint64_t nonce = absl::Uniform<uint64_t>(absl::BitGen());
+  std::vector<CompiledNode> chunks(chunk_roots.size());
+  for (int i = 0; i < chunk_roots.size(); ++i) {
+    chunks[i].Swap(chunk_roots[i]);
+    chunk_roots[i]->set_name(
+        absl::StrCat("__parallel_textproto_", nonce, "_", i, "__"));
+  }
+
+  std::vector<std::string> chunk_texts(chunks.size());
+  std::atomic<int> next_chunk = 0;
+  auto print_chunks = [&]() {
+    google::protobuf::TextFormat::Printer printer;
+    printer.SetInitialIndentLevel(depth * kIndentLevelsPerDepth);
+    for (int i = next_chunk++; i < chunks.size(); i = next_chunk++) {
+      printer.PrintToString(chunks[i], &chunk_texts[i]);
+    }
+  };
+  std::vector<std::thread> threads;
+  const int thread_count = std::min<int>(options.thread_count, chunks.size());
+  for (int i = 1; i < thread_count; ++i) {
+    threads.emplace_back(print_chunks);
+  }
+  std::string skeleton;
+  google::protobuf::TextFormat::PrintToString(root, &skeleton);
+  print_chunks();
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+
+  // Restore the subtrees.
+  for (int i = 0; i < chunk_roots.size(); ++i) {
+    chunk_roots[i]->Swap(&chunks[i]);
+  }
+
+  // Replace each placeholder line with the printed subtree.
+  absl::string_view rest = skeleton;
+  const std::string indent(depth * kIndentLevelsPerDepth * 2, ' ');
+  for (int i = 0; i < chunk_texts.size(); ++i) {
+    const std::string placeholder = absl::StrCat(
+        indent, "name: \"__parallel_textproto_", nonce, "_", i, "__\"\n");
+    size_t position = rest.find(placeholder);
+    if (position == absl::string_view::npos) {
+      return absl::InternalError(
+          absl::StrCat("The placeholder of subtree ", i, " is not found."));
+    }
+    output(rest.substr(0, position));
+    output(chunk_texts[i]);
+    rest.remove_prefix(position + placeholder.size());
+  }
+  output(rest);
+  return absl::OkStatus();
+}
+
+}  // namespace
+
+absl::StatusOr<std::string> PrintTextProtoInParallel(
+    CompiledNode& root, const ParallelTextProtoOptions& options) {
+  std::string text;
+  RETURN_IF_ERROR(PrintInParallel(
+      root, options, [&text](absl::string_view piece) {
+        text.append(piece.data(), piece.size());
+      }));
+  return text;
+}
+
+absl::Status WriteTextProtoFileInParallel(
+    absl::string_view path, CompiledNode& root,
+    const ParallelTextProtoOptions& options) {
+  std::ofstream file{std::string(path)};
+  if (!file.is_open()) {
+    return absl::NotFoundError(absl::StrCat("Failed to open ", path));
+  }
+  RETURN_IF_ERROR(PrintInParallel(
+      root, options, [&file](absl::string_view piece) {
+        file.write(piece.data(), piece.size());
+      }));
+  file.close();
+  if (file.fail()) {
+    return absl::InternalError(absl::StrCat("Failed to write ", path));
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace wfa_virtual_people
@@ -0,0 +1,55 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_COMPILER_PARALLEL_TEXTPROTO_WRITER_H_
+#define SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_COMPILER_PARALLEL_TEXTPROTO_WRITER_H_
+
+#include <string>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+#include "wfa/virtual_people/common/model.pb.h"
+
+namespace wfa_virtual_people {
+
+struct ParallelTextProtoOptions {
+  // The count of the threads printing the subtrees.
+  int thread_count = 1;
+  // The subtrees are taken from the shallowest depth with at least this many
+  // nested nodes, or the deepest depth if there is no such depth. If not
+  // positive, 4 * thread_count is used.
+  int min_chunk_count = 0;
+};
+
+// Print @root in textproto, the same as TextFormat::PrintToString, byte by
+// byte. The nested subtrees of @root at one depth are printed concurrently
+// by TextFormat::Printer with the indentation of that depth, and the rest of
+// the tree is printed around them.
+//
+// @root is temporarily modified while printing, and restored before
+// returning.
+// Return error status if @options is invalid.
+absl::StatusOr<std::string> PrintTextProtoInParallel(
+    CompiledNode& root, const ParallelTextProtoOptions& options);
+
+// Write @root in textproto to the file at @path, as printed by
+// PrintTextProtoInParallel.
+absl::Status WriteTextProtoFileInParallel(
+    absl::string_view path, CompiledNode& root,
+    const ParallelTextProtoOptions& options);
+
+}  // namespace wfa_virtual_people
+
+#endif  // SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_COMPILER_PARALLEL_TEXTPROTO_WRITER_H_
@@ -0,0 +1,60 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "wfa/virtual_people/training/model_compiler/pool_fragmentation.h"
+
+#include <utility>
+
+#include "wfa/virtual_people/common/model.pb.h"
+#include "wfa/virtual_people/training/model_compiler/constants.h"
+
+namespace wfa_virtual_people {
+
+namespace {
+
+void CollectRecursively(const CompiledNode& node,
+                        PoolFragmentationReport& report) {
+  if (node.has_population_node()) {
+    PopulationNodeFragmentation fragmentation;
+    fragmentation.name = node.name();
+    for (const PopulationNode::VirtualPersonPool& pool :
+         node.population_node().pools()) {
+      if (pool.population_offset() < kCookieMonsterOffset) {
+        ++fragmentation.pool_count;
+        fragmentation.total_population += pool.total_population();
+      }
+    }
+    if (fragmentation.pool_count > 0) {
+      report.pool_count += fragmentation.pool_count;
+      report.total_population += fragmentation.total_population;
+      report.nodes.push_back(std::move(fragmentation));
+    }
+  } else if (node.has_branch_node()) {
+    for (const BranchNode::Branch& branch : node.branch_node().branches()) {
+      if (branch.has_node()) {
+        CollectRecursively(branch.node(), report);
+      }
+    }
+  }
+}
+
+}  // namespace
+
+PoolFragmentationReport GetPoolFragmentationReport(const CompiledNode& node) {
+  PoolFragmentationReport report;
+  CollectRecursively(node, report);
+  return report;
+}
+
+}  // namespace wfa_virtual_people
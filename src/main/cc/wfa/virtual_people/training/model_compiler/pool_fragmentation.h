@@ -0,0 +1,64 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_COMPILER_POOL_FRAGMENTATION_H_
+#define SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_COMPILER_POOL_FRAGMENTATION_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "wfa/virtual_people/common/model.pb.h"
+
+namespace wfa_virtual_people {
+
+// The VirtualPersonPools of a single PopulationNode.
+struct PopulationNodeFragmentation {
+  std::string name;
+  int pool_count = 0;
+  uint64_t total_population = 0;
+
+  double GetAveragePoolSize() const {
+    return pool_count == 0 ? 0.0
+                           : static_cast<double>(total_population) / pool_count;
+  }
+};
+
+struct PoolFragmentationReport {
+  // One entry for each PopulationNode, in depth-first order.
+  std::vector<PopulationNodeFragmentation> nodes;
+  int pool_count = 0;
+  uint64_t total_population = 0;
+
+  double GetAveragePoolsPerNode() const {
+    return nodes.empty() ? 0.0
+                         : static_cast<double>(pool_count) / nodes.size();
+  }
+  double GetAveragePoolSize() const {
+    return pool_count == 0 ? 0.0
+                           : static_cast<double>(total_population) / pool_count;
+  }
+};
+
+// Collect the count and sizes of the VirtualPersonPools of the PopulationNodes
+// in @node and all its descendants. A large number of small pools in a
+// PopulationNode indicates the census records are fragmented in id space.
+// The cookie monster pools are not counted, and the PopulationNodes with only
+// cookie monster pools are not included.
+// Child nodes referenced by index are not included.
+PoolFragmentationReport GetPoolFragmentationReport(const CompiledNode& node);
+
+}  // namespace wfa_virtual_people
+
+#endif  // SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_COMPILER_POOL_FRAGMENTATION_H_
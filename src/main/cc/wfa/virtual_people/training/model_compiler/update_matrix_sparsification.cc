@@ -0,0 +1,129 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "wfa/virtual_people/training/model_compiler/update_matrix_sparsification.h"
+
+#include <cstddef>
+#include <utility>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "common_cpp/macros/macros.h"
+#include "wfa/virtual_people/common/model.pb.h"
+
+namespace wfa_virtual_people {
+
+namespace {
+
+absl::Status SparsifyUpdateMatrix(BranchNode::AttributesUpdater& updater,
+                                  UpdateMatrixSparsificationReport& report) {
+  const UpdateMatrix& matrix = updater.update_matrix();
+  ASSIGN_OR_RETURN(SparseUpdateMatrix sparse_matrix,
+                   ToSparseUpdateMatrix(matrix));
+  size_t dense_size = matrix.ByteSizeLong();
+  size_t sparse_size = sparse_matrix.ByteSizeLong();
+  int sparse_probabilities_size = 0;
+  for (const SparseUpdateMatrix::Column& column : sparse_matrix.columns()) {
+    sparse_probabilities_size += column.probabilities_size();
+  }
+
+  ++report.update_matrix_count;
+  report.bytes_before += dense_size;
+  if (sparse_probabilities_size < matrix.probabilities_size() &&
+      sparse_size < dense_size) {
+    *updater.mutable_sparse_update_matrix() = std::move(sparse_matrix);
+    ++report.converted_count;
+    report.bytes_after += sparse_size;
+  } else {
+    report.bytes_after += dense_size;
+  }
+  return absl::OkStatus();
+}
+
+absl::Status SparsifyRecursively(CompiledNode& node,
+                                 UpdateMatrixSparsificationReport& report) {
+  if (!node.has_branch_node()) {
+    return absl::OkStatus();
+  }
+  BranchNode& branch_node = *node.mutable_branch_node();
+  if (branch_node.has_updates()) {
+    for (BranchNode::AttributesUpdater& updater :
+         *branch_node.mutable_updates()->mutable_updates()) {
+      if (updater.has_update_matrix()) {
+        RETURN_IF_ERROR(SparsifyUpdateMatrix(updater, report));
+      } else if (updater.has_update_tree()) {
+        RETURN_IF_ERROR(SparsifyRecursively(
+            *updater.mutable_update_tree()->mutable_root(), report));
+      }
+    }
+  }
+  for (BranchNode::Branch& branch : *branch_node.mutable_branches()) {
+    if (branch.has_node()) {
+      RETURN_IF_ERROR(SparsifyRecursively(*branch.mutable_node(), report));
+    }
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace
+
+absl::StatusOr<SparseUpdateMatrix> ToSparseUpdateMatrix(
+    const UpdateMatrix& matrix) {
+  const int columns_size = matrix.columns_size();
+  const int rows_size = matrix.rows_size();
+  if (matrix.probabilities_size() != columns_size * rows_size) {
+    return absl::InvalidArgumentError(absl::StrCat(
+        "The count of probabilities does not equal to the count of rows times "
+        "the count of columns in UpdateMatrix: ",
+        matrix.DebugString()));
+  }
+
+  SparseUpdateMatrix sparse_matrix;
+  for (int column_index = 0; column_index < columns_size; ++column_index) {
+    SparseUpdateMatrix::Column* column = sparse_matrix.add_columns();
+    *column->mutable_column_attrs() = matrix.columns(column_index);
+    for (int row_index = 0; row_index < rows_size; ++row_index) {
+      float probability =
+          matrix.probabilities(row_index * columns_size + column_index);
+      if (probability == 0.0f) {
+        continue;
+      }
+      *column->add_rows() = matrix.rows(row_index);
+      column->add_probabilities(probability);
+    }
+    if (column->probabilities_size() == 0) {
+      return absl::InvalidArgumentError(absl::StrCat(
+          "All probabilities are zero for column ", column_index,
+          " in UpdateMatrix: ", matrix.DebugString()));
+    }
+  }
+  if (matrix.has_pass_through_non_matches()) {
+    sparse_matrix.set_pass_through_non_matches(
+        matrix.pass_through_non_matches());
+  }
+  if (matrix.has_random_seed()) {
+    sparse_matrix.set_random_seed(matrix.random_seed());
+  }
+  return sparse_matrix;
+}
+
+absl::StatusOr<UpdateMatrixSparsificationReport> SparsifyUpdateMatrices(
+    CompiledNode& node) {
+  UpdateMatrixSparsificationReport report;
+  RETURN_IF_ERROR(SparsifyRecursively(node, report));
+  return report;
+}
+
+}  // namespace wfa_virtual_people
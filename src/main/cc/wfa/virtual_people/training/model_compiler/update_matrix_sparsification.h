@@ -0,0 +1,64 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_COMPILER_UPDATE_MATRIX_SPARSIFICATION_H_
+#define SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_COMPILER_UPDATE_MATRIX_SPARSIFICATION_H_
+
+#include <cstddef>
+
+#include "absl/status/statusor.h"
+#include "wfa/virtual_people/common/model.pb.h"
+
+namespace wfa_virtual_people {
+
+struct UpdateMatrixSparsificationReport {
+  // The count of UpdateMatrix found, and the count of them converted to
+  // SparseUpdateMatrix.
+  int update_matrix_count = 0;
+  int converted_count = 0;
+  // The serialized sizes of all the UpdateMatrix found, before and after the
+  // conversion.
+  size_t bytes_before = 0;
+  size_t bytes_after = 0;
+};
+
+// Convert @matrix to a SparseUpdateMatrix, with the zero probabilities
+// dropped.
+// The probabilities of @matrix are in row major order, i.e. the probability of
+// row i and column j is probabilities[i * columns_size + j].
+// Return error status if the count of probabilities does not match the count
+// of rows and columns, or any column has no non-zero probability.
+absl::StatusOr<SparseUpdateMatrix> ToSparseUpdateMatrix(
+    const UpdateMatrix& matrix);
+
+// Replace the UpdateMatrix in @node and all its descendants, including the
+// UpdateTree roots, with the equivalent SparseUpdateMatrix when the sparse
+// form has fewer probabilities and a smaller serialized size.
+//
+// Each column keeps its non-zero probabilities in the same relative order, so
+// each column samples from the same distribution of rows, and the aggregate
+// output is statistically the same. The output of individual events is not:
+// the row is chosen by hashing over the indexes of the choices, which are
+// renumbered when the zero probabilities are dropped, so the updated
+// attributes, and the VIDs assigned downstream of them, change for some events
+// compared with the dense model. SparseUpdateMatrix has no way to keep the
+// original indexes, so do not apply this to a model already in production,
+// whose per-event output must stay stable.
+// Return error status if any UpdateMatrix is invalid.
+absl::StatusOr<UpdateMatrixSparsificationReport> SparsifyUpdateMatrices(
+    CompiledNode& node);
+
+}  // namespace wfa_virtual_people
+
+#endif  // SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_COMPILER_UPDATE_MATRIX_SPARSIFICATION_H_
@@ -0,0 +1,138 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "wfa/virtual_people/training/model_compiler/vid_pool_index.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "common_cpp/macros/macros.h"
+#include "wfa/virtual_people/common/model.pb.h"
+#include "wfa/virtual_people/training/vid_pool_index.pb.h"
+
+namespace wfa_virtual_people {
+
+namespace {
+
+// Add the pools of @node and its descendants to @index. @path is the names of
+// the nodes from the root to the parent of @node.
+absl::Status AddPools(const CompiledNode& node, std::vector<std::string>& path,
+                      VidPoolIndex& index) {
+  path.push_back(node.name());
+  if (node.has_population_node()) {
+    const int node_path_index = index.node_paths_size();
+    bool has_pool = false;
+    const PopulationNode& population_node = node.population_node();
+    for (int i = 0; i < population_node.pools_size(); ++i) {
+      const PopulationNode::VirtualPersonPool& pool = population_node.pools(i);
+      if (pool.total_population() == 0) {
+        continue;
+      }
+      VidPoolIndex::Entry* entry = index.add_entries();
+      entry->set_population_offset(pool.population_offset());
+      entry->set_total_population(pool.total_population());
+      entry->set_node_path_index(node_path_index);
+      entry->set_pool_index(i);
+      has_pool = true;
+    }
+    if (has_pool) {
+      index.add_node_paths()->mutable_node_names()->Add(path.begin(),
+                                                        path.end());
+    }
+  } else if (node.has_branch_node()) {
+    for (const BranchNode::Branch& branch : node.branch_node().branches()) {
+      if (!branch.has_node()) {
+        return absl::InvalidArgumentError(absl::StrCat(
+            "Only nested child nodes are supported: ", node.name()));
+      }
+      RETURN_IF_ERROR(AddPools(branch.node(), path, index));
+    }
+  }
+  path.pop_back();
+  return absl::OkStatus();
+}
+
+}  // namespace
+
+absl::StatusOr<VidPoolIndex> BuildVidPoolIndex(const CompiledNode& root) {
+  VidPoolIndex index;
+  std::vector<std::string> path;
+  RETURN_IF_ERROR(AddPools(root, path, index));
+  // The pools are added in preorder, so the stable sort keeps the entries with
+  // the same offset in the order of the model.
+  std::stable_sort(index.mutable_entries()->begin(),
+                   index.mutable_entries()->end(),
+                   [](const VidPoolIndex::Entry& a,
+                      const VidPoolIndex::Entry& b) {
+                     return a.population_offset() < b.population_offset();
+                   });
+  return index;
+}
+
+absl::StatusOr<VidPoolLookup> VidPoolLookup::Create(VidPoolIndex index) {
+  VidPoolLookup lookup(std::move(index));
+  const VidPoolIndex& sorted_index = lookup.index_;
+  lookup.offsets_.reserve(sorted_index.entries_size());
+  lookup.max_ends_.reserve(sorted_index.entries_size());
+  uint64_t max_end = 0;
+  for (const VidPoolIndex::Entry& entry : sorted_index.entries()) {
+    if (!lookup.offsets_.empty() &&
+        entry.population_offset() < lookup.offsets_.back()) {
+      return absl::InvalidArgumentError(
+          "The entries are not sorted by population_offset.");
+    }
+    if (entry.total_population() >
+        std::numeric_limits<uint64_t>::max() - entry.population_offset()) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("The range overflows: ", entry.DebugString()));
+    }
+    if (entry.node_path_index() < 0 ||
+        entry.node_path_index() >= sorted_index.node_paths_size()) {
+      return absl::InvalidArgumentError(absl::StrCat(
+          "The node_path_index is out of range: ", entry.DebugString()));
+    }
+    max_end = std::max(max_end,
+                       entry.population_offset() + entry.total_population());
+    lookup.offsets_.push_back(entry.population_offset());
+    lookup.max_ends_.push_back(max_end);
+  }
+  return lookup;
+}
+
+std::vector<const VidPoolIndex::Entry*> VidPoolLookup::Lookup(
+    const uint64_t virtual_person_id) const {
+  std::vector<const VidPoolIndex::Entry*> entries;
+  // The entries after end start after the id.
+  int end = std::upper_bound(offsets_.begin(), offsets_.end(),
+                             virtual_person_id) -
+            offsets_.begin();
+  for (int i = end - 1; i >= 0 && max_ends_[i] > virtual_person_id; --i) {
+    const VidPoolIndex::Entry& entry = index_.entries(i);
+    if (entry.population_offset() + entry.total_population() >
+        virtual_person_id) {
+      entries.push_back(&entry);
+    }
+  }
+  std::reverse(entries.begin(), entries.end());
+  return entries;
+}
+
+}  // namespace wfa_virtual_people
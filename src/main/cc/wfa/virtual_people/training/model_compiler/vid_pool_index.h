@@ -0,0 +1,80 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_COMPILER_VID_POOL_INDEX_H_
+#define SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_COMPILER_VID_POOL_INDEX_H_
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "absl/status/statusor.h"
+#include "wfa/virtual_people/common/model.pb.h"
+#include "wfa/virtual_people/training/vid_pool_index.pb.h"
+
+namespace wfa_virtual_people {
+
+// Return the index of all the non-empty VirtualPersonPool ranges in the model
+// with root @root, with the paths to their population nodes. The entries are
+// sorted by population_offset.
+// The model must be a tree with nested child nodes. Return error status if
+// any branch refers to its child by node_index.
+absl::StatusOr<VidPoolIndex> BuildVidPoolIndex(const CompiledNode& root);
+
+// Finds the pools containing a virtual person id in a VidPoolIndex, by binary
+// search on the sorted population offsets.
+//
+// Example usage:
+//   ASSIGN_OR_RETURN(VidPoolLookup lookup,
+//                    VidPoolLookup::Create(std::move(index)));
+//   for (const VidPoolIndex::Entry* entry : lookup.Lookup(id)) {
+//     const VidPoolIndex::NodePath& path = lookup.GetNodePath(*entry);
+//     ...
+//   }
+class VidPoolLookup {
+ public:
+  // Return error status if @index is not sorted by population_offset, a range
+  // overflows, or a node_path_index is out of range.
+  static absl::StatusOr<VidPoolLookup> Create(VidPoolIndex index);
+
+  // Return the entries whose ranges contain @virtual_person_id, in the order
+  // of the index. Pools of a compiled model overlap: the delta pools of every
+  // identifier type cover the same ranges, and all the cookie monster pools
+  // share the range at kCookieMonsterOffset. So there is normally one entry per
+  // identifier type, and the id alone does not determine the identifier type
+  // or the delta of the event it was assigned to.
+  std::vector<const VidPoolIndex::Entry*> Lookup(
+      uint64_t virtual_person_id) const;
+
+  const VidPoolIndex::NodePath& GetNodePath(
+      const VidPoolIndex::Entry& entry) const {
+    return index_.node_paths(entry.node_path_index());
+  }
+
+  const VidPoolIndex& index() const { return index_; }
+
+ private:
+  explicit VidPoolLookup(VidPoolIndex index) : index_(std::move(index)) {}
+
+  VidPoolIndex index_;
+  // The population offsets of the entries, for binary search.
+  std::vector<uint64_t> offsets_;
+  // The maximum end of the ranges of the entries up to each position, to bound
+  // the backward scan for overlapping ranges.
+  std::vector<uint64_t> max_ends_;
+};
+
+}  // namespace wfa_virtual_people
+
+#endif  // SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_COMPILER_VID_POOL_INDEX_H_
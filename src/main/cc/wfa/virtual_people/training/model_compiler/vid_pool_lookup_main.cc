@@ -0,0 +1,101 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// This is a tool to find the population nodes and pools assigning virtual
+// person ids, using the VidPoolIndex written by compiler_main with
+// --vid_pool_index_path.
+// Each line of the output is a virtual person id, the path of the population
+// node from the root separated by "/", the index of the pool in the node, and
+// the range of the pool. Ids not in any pool are printed with "NOT_FOUND".
+// The pools of different identifier types share the same ranges, so an id is
+// normally printed once for each identifier type. The id alone does not
+// determine the identifier type or the delta it was assigned by.
+// Example usage:
+// bazel build -c opt \
+// //src/main/cc/wfa/virtual_people/training/model_compiler:vid_pool_lookup_main
+// bazel-bin/src/main/cc/wfa/virtual_people/training/model_compiler/\
+// vid_pool_lookup_main \
+// --index_path=/tmp/model_compiler/vid_pool_index.textproto \
+// --virtual_person_ids=1000,2500
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_join.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "common_cpp/protobuf_util/textproto_io.h"
+#include "glog/logging.h"
+#include "wfa/virtual_people/training/model_compiler/vid_pool_index.h"
+#include "wfa/virtual_people/training/vid_pool_index.pb.h"
+
+ABSL_FLAG(std::string, index_path, "",
+          "Path to the input VidPoolIndex textproto.");
+ABSL_FLAG(std::vector<std::string>, virtual_person_ids, {},
+          "Comma separated virtual person ids to look up.");
+
+int main(int argc, char** argv) {
+  absl::ParseCommandLine(argc, argv);
+  google::InitGoogleLogging(argv[0]);
+
+  std::string index_path = absl::GetFlag(FLAGS_index_path);
+  CHECK(!index_path.empty()) << "index_path is not set.";
+
+  absl::Time start = absl::Now();
+  wfa_virtual_people::VidPoolIndex index;
+  absl::Status read_status = wfa::ReadTextProtoFile(index_path, index);
+  CHECK(read_status.ok()) << read_status;
+  absl::StatusOr<wfa_virtual_people::VidPoolLookup> lookup =
+      wfa_virtual_people::VidPoolLookup::Create(std::move(index));
+  CHECK(lookup.ok()) << lookup.status();
+  LOG(INFO) << "Loaded " << lookup->index().entries_size() << " pools in "
+            << absl::Now() - start;
+
+  for (const std::string& id_string :
+       absl::GetFlag(FLAGS_virtual_person_ids)) {
+    uint64_t id;
+    CHECK(absl::SimpleAtoi(id_string, &id))
+        << "Invalid virtual person id: " << id_string;
+    start = absl::Now();
+    std::vector<const wfa_virtual_people::VidPoolIndex::Entry*> entries =
+        lookup->Lookup(id);
+    absl::Duration elapsed = absl::Now() - start;
+    if (entries.empty()) {
+      std::cout << id << "\tNOT_FOUND\n";
+    }
+    if (entries.size() > 1) {
+      LOG(INFO) << id << " is in " << entries.size()
+                << " pools. The id alone does not determine the identifier "
+                   "type or the delta.";
+    }
+    for (const wfa_virtual_people::VidPoolIndex::Entry* entry : entries) {
+      std::cout << id << "\t"
+                << absl::StrJoin(lookup->GetNodePath(*entry).node_names(), "/")
+                << "\tpool " << entry->pool_index() << "\t["
+                << entry->population_offset() << ", "
+                << entry->population_offset() + entry->total_population()
+                << ")\n";
+    }
+    LOG(INFO) << "Looked up " << id << " in " << elapsed;
+  }
+  return 0;
+}
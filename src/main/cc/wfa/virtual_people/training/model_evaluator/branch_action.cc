@@ -0,0 +1,651 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "wfa/virtual_people/training/model_evaluator/branch_action.h"
+
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/memory/memory.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
+#include "absl/strings/string_view.h"
+#include "common_cpp/macros/macros.h"
+#include "google/protobuf/descriptor.h"
+#include "google/protobuf/field_mask.pb.h"
+#include "google/protobuf/message.h"
+#include "google/protobuf/util/field_mask_util.h"
+#include "wfa/virtual_people/common/event.pb.h"
+#include "wfa/virtual_people/common/field_filter.pb.h"
+#include "wfa/virtual_people/common/field_filter/field_filter.h"
+#include "wfa/virtual_people/common/model.pb.h"
+#include "wfa/virtual_people/training/model_evaluator/field_filter_program.h"
+#include "wfa/virtual_people/training/model_evaluator/labeler_hash.h"
+
+namespace wfa_virtual_people {
+
+namespace {
+
+using ::google::protobuf::Descriptor;
+using ::google::protobuf::FieldDescriptor;
+using ::google::protobuf::FieldMask;
+using ::google::protobuf::Message;
+using ::google::protobuf::Reflection;
+using ::google::protobuf::util::FieldMaskUtil;
+
+using FieldPath = std::vector<const FieldDescriptor*>;
+
+// Return the path of the singular field @name of LabelerEvent.
+absl::StatusOr<FieldPath> ResolveField(absl::string_view name) {
+  if (name.empty()) {
+    return absl::InvalidArgumentError("The name of the field is not set.");
+  }
+  FieldPath path;
+  const Descriptor* descriptor = LabelerEvent::descriptor();
+  for (absl::string_view part : absl::StrSplit(name, '.')) {
+    if (!descriptor) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("The field ", name, " is not in a message."));
+    }
+    const FieldDescriptor* field =
+        descriptor->FindFieldByName(std::string(part));
+    if (!field) {
+      return absl::InvalidArgumentError(absl::StrCat(
+          "The field ", part, " is not found in ", descriptor->full_name()));
+    }
+    if (field->is_repeated()) {
+      return absl::InvalidArgumentError(absl::StrCat(
+          "Repeated field is not supported: ", field->full_name()));
+    }
+    path.push_back(field);
+    descriptor = field->message_type();
+  }
+  return path;
+}
+
+// Return the message directly containing the field, or nullptr if the field
+// is not set.
+const Message* GetParentIfSet(const LabelerEvent& event,
+                              const FieldPath& path) {
+  const Message* message = &event;
+  for (int i = 0; i < path.size(); ++i) {
+    const Reflection* reflection = message->GetReflection();
+    if (!reflection->HasField(*message, path[i])) {
+      return nullptr;
+    }
+    if (i + 1 < path.size()) {
+      message = &reflection->GetMessage(*message, path[i]);
+    }
+  }
+  return message;
+}
+
+// Return the message directly containing the field, creating the parent
+// messages.
+Message* GetMutableParent(LabelerEvent& event, const FieldPath& path) {
+  Message* message = &event;
+  for (int i = 0; i + 1 < path.size(); ++i) {
+    message = message->GetReflection()->MutableMessage(message, path[i]);
+  }
+  return message;
+}
+
+bool IsInteger(const FieldDescriptor::CppType cpp_type) {
+  switch (cpp_type) {
+    case FieldDescriptor::CPPTYPE_INT32:
+    case FieldDescriptor::CPPTYPE_INT64:
+    case FieldDescriptor::CPPTYPE_UINT32:
+    case FieldDescriptor::CPPTYPE_UINT64:
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool IsNumeric(const FieldDescriptor::CppType cpp_type) {
+  return IsInteger(cpp_type) || cpp_type == FieldDescriptor::CPPTYPE_FLOAT ||
+         cpp_type == FieldDescriptor::CPPTYPE_DOUBLE;
+}
+
+double GetNumber(const Message& parent, const FieldDescriptor* field) {
+  const Reflection* reflection = parent.GetReflection();
+  switch (field->cpp_type()) {
+    case FieldDescriptor::CPPTYPE_INT32:
+      return reflection->GetInt32(parent, field);
+    case FieldDescriptor::CPPTYPE_INT64:
+      return reflection->GetInt64(parent, field);
+    case FieldDescriptor::CPPTYPE_UINT32:
+      return reflection->GetUInt32(parent, field);
+    case FieldDescriptor::CPPTYPE_UINT64:
+      return reflection->GetUInt64(parent, field);
+    case FieldDescriptor::CPPTYPE_FLOAT:
+      return reflection->GetFloat(parent, field);
+    default:
+      return reflection->GetDouble(parent, field);
+  }
+}
+
+void SetInteger(Message& parent, const FieldDescriptor* field,
+                const int64_t value) {
+  const Reflection* reflection = parent.GetReflection();
+  switch (field->cpp_type()) {
+    case FieldDescriptor::CPPTYPE_INT32:
+      reflection->SetInt32(&parent, field, value);
+      break;
+    case FieldDescriptor::CPPTYPE_INT64:
+      reflection->SetInt64(&parent, field, value);
+      break;
+    case FieldDescriptor::CPPTYPE_UINT32:
+      reflection->SetUInt32(&parent, field, value);
+      break;
+    default:
+      reflection->SetUInt64(&parent, field, value);
+      break;
+  }
+}
+
+// Copy the value of @source_field in @source to @target_field in @target. The
+// fields are of the same type.
+void CopyField(const Message& source, const FieldDescriptor* source_field,
+               Message& target, const FieldDescriptor* target_field) {
+  const Reflection* source_reflection = source.GetReflection();
+  const Reflection* target_reflection = target.GetReflection();
+  switch (source_field->cpp_type()) {
+    case FieldDescriptor::CPPTYPE_INT32:
+      target_reflection->SetInt32(
+          &target, target_field,
+          source_reflection->GetInt32(source, source_field));
+      break;
+    case FieldDescriptor::CPPTYPE_INT64:
+      target_reflection->SetInt64(
+          &target, target_field,
+          source_reflection->GetInt64(source, source_field));
+      break;
+    case FieldDescriptor::CPPTYPE_UINT32:
+      target_reflection->SetUInt32(
+          &target, target_field,
+          source_reflection->GetUInt32(source, source_field));
+      break;
+    case FieldDescriptor::CPPTYPE_UINT64:
+      target_reflection->SetUInt64(
+          &target, target_field,
+          source_reflection->GetUInt64(source, source_field));
+      break;
+    case FieldDescriptor::CPPTYPE_FLOAT:
+      target_reflection->SetFloat(
+          &target, target_field,
+          source_reflection->GetFloat(source, source_field));
+      break;
+    case FieldDescriptor::CPPTYPE_DOUBLE:
+      target_reflection->SetDouble(
+          &target, target_field,
+          source_reflection->GetDouble(source, source_field));
+      break;
+    case FieldDescriptor::CPPTYPE_BOOL:
+      target_reflection->SetBool(
+          &target, target_field,
+          source_reflection->GetBool(source, source_field));
+      break;
+    case FieldDescriptor::CPPTYPE_ENUM:
+      target_reflection->SetEnumValue(
+          &target, target_field,
+          source_reflection->GetEnumValue(source, source_field));
+      break;
+    case FieldDescriptor::CPPTYPE_STRING:
+      target_reflection->SetString(
+          &target, target_field,
+          source_reflection->GetString(source, source_field));
+      break;
+    case FieldDescriptor::CPPTYPE_MESSAGE:
+      target_reflection->MutableMessage(&target, target_field)
+          ->CopyFrom(source_reflection->GetMessage(source, source_field));
+      break;
+  }
+}
+
+// Add the paths of the fields set in @message to @mask. The message fields are
+// added by the paths of their set fields, or by their own paths if none is
+// set.
+void AddSetFieldPaths(const Message& message, const std::string& prefix,
+                      FieldMask& mask) {
+  std::vector<const FieldDescriptor*> fields;
+  message.GetReflection()->ListFields(message, &fields);
+  for (const FieldDescriptor* field : fields) {
+    std::string path = absl::StrCat(prefix, field->name());
+    if (field->cpp_type() == FieldDescriptor::CPPTYPE_MESSAGE &&
+        !field->is_repeated()) {
+      const Message& sub_message =
+          message.GetReflection()->GetMessage(message, field);
+      std::vector<const FieldDescriptor*> sub_fields;
+      sub_message.GetReflection()->ListFields(sub_message, &sub_fields);
+      if (!sub_fields.empty()) {
+        AddSetFieldPaths(sub_message, absl::StrCat(path, "."), mask);
+        continue;
+      }
+    }
+    mask.add_paths(path);
+  }
+}
+
+// A column of an update matrix, with the rows that may be merged into the
+// events matching the column.
+struct MatrixColumn {
+  std::vector<LabelerEvent> rows;
+  std::vector<double> probabilities;
+};
+
+// UpdateMatrix and SparseUpdateMatrix. The events are matched to the columns
+// by the serialized values of the fields in the union of the fields set in the
+// columns.
+class MatrixUpdater : public AttributesUpdater {
+ public:
+  static absl::StatusOr<std::unique_ptr<AttributesUpdater>> New(
+      const UpdateMatrix& config);
+  static absl::StatusOr<std::unique_ptr<AttributesUpdater>> New(
+      const SparseUpdateMatrix& config);
+
+  absl::Status Update(SeedHashFunction hash,
+                      LabelerEvent& event) const override;
+
+ private:
+  MatrixUpdater(absl::string_view random_seed, bool pass_through_non_matches)
+      : random_seed_(random_seed),
+        pass_through_non_matches_(pass_through_non_matches) {}
+
+  // Set the columns, with the attributes in @column_attrs.
+  absl::Status SetColumns(const std::vector<const LabelerEvent*>& column_attrs,
+                          std::vector<MatrixColumn> columns);
+
+  std::string GetColumnKey(const LabelerEvent& event) const;
+
+  std::string random_seed_;
+  bool pass_through_non_matches_;
+  FieldMask column_mask_;
+  absl::flat_hash_map<std::string, int> column_indexes_;
+  std::vector<MatrixColumn> columns_;
+};
+
+absl::StatusOr<std::unique_ptr<AttributesUpdater>> MatrixUpdater::New(
+    const UpdateMatrix& config) {
+  const int column_count = config.columns_size();
+  const int row_count = config.rows_size();
+  if (column_count == 0 || row_count == 0) {
+    return absl::InvalidArgumentError(
+        "UpdateMatrix must have columns and rows.");
+  }
+  if (config.probabilities_size() != column_count * row_count) {
+    return absl::InvalidArgumentError(absl::StrCat(
+        "UpdateMatrix has ", config.probabilities_size(),
+        " probabilities, expected ", column_count * row_count));
+  }
+  std::vector<const LabelerEvent*> column_attrs;
+  std::vector<MatrixColumn> columns(column_count);
+  for (int column = 0; column < column_count; ++column) {
+    column_attrs.push_back(&config.columns(column));
+    columns[column].rows.assign(config.rows().begin(), config.rows().end());
+    for (int row = 0; row < row_count; ++row) {
+      columns[column].probabilities.push_back(
+          config.probabilities(row * column_count + column));
+    }
+  }
+  auto updater = absl::WrapUnique(new MatrixUpdater(
+      config.random_seed(), config.pass_through_non_matches()));
+  RETURN_IF_ERROR(updater->SetColumns(column_attrs, std::move(columns)));
+  return updater;
+}
+
+absl::StatusOr<std::unique_ptr<AttributesUpdater>> MatrixUpdater::New(
+    const SparseUpdateMatrix& config) {
+  if (config.columns_size() == 0) {
+    return absl::InvalidArgumentError(
+        "SparseUpdateMatrix must have columns.");
+  }
+  std::vector<const LabelerEvent*> column_attrs;
+  std::vector<MatrixColumn> columns;
+  for (const SparseUpdateMatrix::Column& config_column : config.columns()) {
+    if (config_column.rows_size() == 0 ||
+        config_column.rows_size() != config_column.probabilities_size()) {
+      return absl::InvalidArgumentError(absl::StrCat(
+          "A column of SparseUpdateMatrix must have rows, each with a "
+          "probability: ",
+          config_column.column_attrs().DebugString()));
+    }
+    column_attrs.push_back(&config_column.column_attrs());
+    MatrixColumn& column = columns.emplace_back();
+    column.rows.assign(config_column.rows().begin(),
+                       config_column.rows().end());
+    column.probabilities.assign(config_column.probabilities().begin(),
+                                config_column.probabilities().end());
+  }
+  auto updater = absl::WrapUnique(new MatrixUpdater(
+      config.random_seed(), config.pass_through_non_matches()));
+  RETURN_IF_ERROR(updater->SetColumns(column_attrs, std::move(columns)));
+  return updater;
+}
+
+absl::Status MatrixUpdater::SetColumns(
+    const std::vector<const LabelerEvent*>& column_attrs,
+    std::vector<MatrixColumn> columns) {
+  for (const LabelerEvent* attrs : column_attrs) {
+    AddSetFieldPaths(*attrs, "", column_mask_);
+  }
+  FieldMaskUtil::ToCanonicalForm(column_mask_, &column_mask_);
+  for (int i = 0; i < columns.size(); ++i) {
+    bool has_positive_probability = false;
+    for (double probability : columns[i].probabilities) {
+      if (probability < 0) {
+        return absl::InvalidArgumentError(
+            absl::StrCat("Negative probability in the update matrix column: ",
+                         column_attrs[i]->DebugString()));
+      }
+      has_positive_probability |= probability > 0;
+    }
+    if (!has_positive_probability) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("No positive probability in the update matrix column: ",
+                       column_attrs[i]->DebugString()));
+    }
+    if (!column_indexes_.emplace(GetColumnKey(*column_attrs[i]), i).second) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("Duplicated update matrix column: ",
+                       column_attrs[i]->DebugString()));
+    }
+  }
+  columns_ = std::move(columns);
+  return absl::OkStatus();
+}
+
+std::string MatrixUpdater::GetColumnKey(const LabelerEvent& event) const {
+  LabelerEvent masked;
+  FieldMaskUtil::MergeMessageTo(event, column_mask_,
+                                FieldMaskUtil::MergeOptions(), &masked);
+  return masked.SerializeAsString();
+}
+
+absl::Status MatrixUpdater::Update(SeedHashFunction hash,
+                                   LabelerEvent& event) const {
+  auto it = column_indexes_.find(GetColumnKey(event));
+  if (it == column_indexes_.end()) {
+    if (pass_through_non_matches_) {
+      return absl::OkStatus();
+    }
+    return absl::InvalidArgumentError(absl::StrCat(
+        "No column of the update matrix matches the event with seed ",
+        random_seed_));
+  }
+  const MatrixColumn& column = columns_[it->second];
+  const int row = SelectByConsistentHashing(
+      hash, GetEventSeed(random_seed_, event.acting_fingerprint()),
+      column.probabilities);
+  event.MergeFrom(column.rows[row]);
+  return absl::OkStatus();
+}
+
+class ConditionalMergeUpdater : public AttributesUpdater {
+ public:
+  static absl::StatusOr<std::unique_ptr<AttributesUpdater>> New(
+      const ConditionalMerge& config);
+
+  absl::Status Update(SeedHashFunction hash,
+                      LabelerEvent& event) const override;
+
+ private:
+  explicit ConditionalMergeUpdater(bool pass_through_non_matches)
+      : pass_through_non_matches_(pass_through_non_matches) {}
+
+  bool pass_through_non_matches_;
+  std::vector<EventCondition> conditions_;
+  std::vector<LabelerEvent> updates_;
+};
+
+absl::StatusOr<std::unique_ptr<AttributesUpdater>> ConditionalMergeUpdater::New(
+    const ConditionalMerge& config) {
+  if (config.nodes_size() == 0) {
+    return absl::InvalidArgumentError("ConditionalMerge must have nodes.");
+  }
+  auto updater = absl::WrapUnique(
+      new ConditionalMergeUpdater(config.pass_through_non_matches()));
+  for (const ConditionalMerge::ConditionalMergeNode& node : config.nodes()) {
+    if (!node.has_condition() || !node.has_update()) {
+      return absl::InvalidArgumentError(absl::StrCat(
+          "A node of ConditionalMerge must have condition and update: ",
+          node.DebugString()));
+    }
+    ASSIGN_OR_RETURN(EventCondition condition,
+                     EventCondition::Create(node.condition()));
+    updater->conditions_.push_back(std::move(condition));
+    updater->updates_.push_back(node.update());
+  }
+  return updater;
+}
+
+absl::Status ConditionalMergeUpdater::Update(SeedHashFunction hash,
+                                             LabelerEvent& event) const {
+  for (int i = 0; i < conditions_.size(); ++i) {
+    if (conditions_[i].IsMatch(event)) {
+      event.MergeFrom(updates_[i]);
+      return absl::OkStatus();
+    }
+  }
+  if (pass_through_non_matches_) {
+    return absl::OkStatus();
+  }
+  return absl::InvalidArgumentError(
+      "No node of ConditionalMerge matches the event.");
+}
+
+class ConditionalAssignmentUpdater : public AttributesUpdater {
+ public:
+  static absl::StatusOr<std::unique_ptr<AttributesUpdater>> New(
+      const ConditionalAssignment& config);
+
+  absl::Status Update(SeedHashFunction hash,
+                      LabelerEvent& event) const override;
+
+ private:
+  struct Assignment {
+    FieldPath source;
+    FieldPath target;
+  };
+
+  explicit ConditionalAssignmentUpdater(EventCondition condition)
+      : condition_(std::move(condition)) {}
+
+  EventCondition condition_;
+  std::vector<Assignment> assignments_;
+};
+
+absl::StatusOr<std::unique_ptr<AttributesUpdater>>
+ConditionalAssignmentUpdater::New(const ConditionalAssignment& config) {
+  if (!config.has_condition() || config.assignments_size() == 0) {
+    return absl::InvalidArgumentError(
+        "ConditionalAssignment must have condition and assignments.");
+  }
+  ASSIGN_OR_RETURN(EventCondition condition,
+                   EventCondition::Create(config.condition()));
+  auto updater =
+      absl::WrapUnique(new ConditionalAssignmentUpdater(std::move(condition)));
+  for (const ConditionalAssignment::Assignment& config_assignment :
+       config.assignments()) {
+    Assignment& assignment = updater->assignments_.emplace_back();
+    ASSIGN_OR_RETURN(assignment.source,
+                     ResolveField(config_assignment.source_field()));
+    ASSIGN_OR_RETURN(assignment.target,
+                     ResolveField(config_assignment.target_field()));
+    const FieldDescriptor* source = assignment.source.back();
+    const FieldDescriptor* target = assignment.target.back();
+    if (source->cpp_type() != target->cpp_type() ||
+        source->enum_type() != target->enum_type() ||
+        source->message_type() != target->message_type()) {
+      return absl::InvalidArgumentError(absl::StrCat(
+          "The source and target fields of an assignment have different "
+          "types: ",
+          source->full_name(), ", ", target->full_name()));
+    }
+  }
+  return updater;
+}
+
+absl::Status ConditionalAssignmentUpdater::Update(SeedHashFunction hash,
+                                                  LabelerEvent& event) const {
+  if (!condition_.IsMatch(event)) {
+    return absl::OkStatus();
+  }
+  for (const Assignment& assignment : assignments_) {
+    const Message* source_parent = GetParentIfSet(event, assignment.source);
+    if (!source_parent) {
+      continue;
+    }
+    CopyField(*source_parent, assignment.source.back(),
+              *GetMutableParent(event, assignment.target),
+              assignment.target.back());
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace
+
+absl::StatusOr<EventCondition> EventCondition::Create(
+    const FieldFilterProto& filter) {
+  EventCondition condition;
+  absl::StatusOr<FieldFilterProgram> program =
+      FieldFilterProgram::Compile(filter);
+  if (program.ok()) {
+    condition.program_ = *std::move(program);
+  } else if (absl::IsUnimplemented(program.status())) {
+    ASSIGN_OR_RETURN(condition.filter_,
+                     FieldFilter::New(LabelerEvent::descriptor(), filter));
+  } else {
+    return program.status();
+  }
+  return condition;
+}
+
+absl::StatusOr<std::unique_ptr<AttributesUpdater>> AttributesUpdater::New(
+    const BranchNode::AttributesUpdater& config) {
+  switch (config.update_case()) {
+    case BranchNode::AttributesUpdater::kUpdateMatrix:
+      return MatrixUpdater::New(config.update_matrix());
+    case BranchNode::AttributesUpdater::kSparseUpdateMatrix:
+      return MatrixUpdater::New(config.sparse_update_matrix());
+    case BranchNode::AttributesUpdater::kConditionalMerge:
+      return ConditionalMergeUpdater::New(config.conditional_merge());
+    case BranchNode::AttributesUpdater::kConditionalAssignment:
+      return ConditionalAssignmentUpdater::New(
+          config.conditional_assignment());
+    case BranchNode::AttributesUpdater::kUpdateTree:
+    case BranchNode::AttributesUpdater::kGeometricShredder:
+      return absl::UnimplementedError(absl::StrCat(
+          "AttributesUpdater is not supported: ", config.DebugString()));
+    default:
+      return absl::InvalidArgumentError(
+          "The update of the AttributesUpdater is not set.");
+  }
+}
+
+absl::StatusOr<EventMultiplicity> EventMultiplicity::Create(
+    const Multiplicity& config) {
+  EventMultiplicity multiplicity;
+  switch (config.multiplicity_ref_case()) {
+    case Multiplicity::kExpectedMultiplicity:
+      multiplicity.expected_multiplicity_ = config.expected_multiplicity();
+      break;
+    case Multiplicity::kExpectedMultiplicityField: {
+      ASSIGN_OR_RETURN(
+          multiplicity.expected_multiplicity_field_,
+          ResolveField(config.expected_multiplicity_field()));
+      if (!IsNumeric(
+              multiplicity.expected_multiplicity_field_.back()->cpp_type())) {
+        return absl::InvalidArgumentError(
+            absl::StrCat("expected_multiplicity_field must be numeric: ",
+                         config.expected_multiplicity_field()));
+      }
+      break;
+    }
+    default:
+      return absl::InvalidArgumentError(
+          "Multiplicity must have expected_multiplicity or "
+          "expected_multiplicity_field.");
+  }
+  if (config.has_max_value()) {
+    multiplicity.max_value_ = config.max_value();
+  }
+  multiplicity.cap_at_max_ = config.cap_at_max();
+  ASSIGN_OR_RETURN(multiplicity.person_index_field_,
+                   ResolveField(config.person_index_field()));
+  if (!IsInteger(multiplicity.person_index_field_.back()->cpp_type())) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("person_index_field must be an integer: ",
+                     config.person_index_field()));
+  }
+  multiplicity.random_seed_ = config.random_seed();
+  return multiplicity;
+}
+
+absl::StatusOr<int> EventMultiplicity::GetCloneCount(
+    SeedHashFunction hash, const LabelerEvent& event) const {
+  double expected;
+  if (expected_multiplicity_) {
+    expected = *expected_multiplicity_;
+  } else {
+    const Message* parent =
+        GetParentIfSet(event, expected_multiplicity_field_);
+    if (!parent) {
+      return absl::InvalidArgumentError(absl::StrCat(
+          "The expected multiplicity field is not set: ",
+          expected_multiplicity_field_.back()->full_name()));
+    }
+    expected = GetNumber(*parent, expected_multiplicity_field_.back());
+  }
+  if (!(expected >= 0) || expected > std::numeric_limits<int>::max()) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Invalid expected multiplicity: ", expected));
+  }
+  if (max_value_ && expected > *max_value_) {
+    if (!cap_at_max_) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("The expected multiplicity ", expected,
+                       " is greater than max_value ", *max_value_));
+    }
+    expected = *max_value_;
+  }
+  const double integer_part = std::floor(expected);
+  int count = integer_part;
+  if (GetUniformHash(hash, GetEventSeed(random_seed_,
+                                        event.acting_fingerprint())) <
+      expected - integer_part) {
+    ++count;
+  }
+  return count;
+}
+
+void EventMultiplicity::SetClone(SeedHashFunction hash, const int index,
+                                 LabelerEvent& clone) const {
+  SetInteger(*GetMutableParent(clone, person_index_field_),
+             person_index_field_.back(), index);
+  if (index > 0) {
+    clone.set_acting_fingerprint(
+        hash(absl::StrCat(clone.acting_fingerprint(), "-", index)));
+  }
+}
+
+}  // namespace wfa_virtual_people
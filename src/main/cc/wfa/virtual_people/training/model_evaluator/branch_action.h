@@ -0,0 +1,116 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_EVALUATOR_BRANCH_ACTION_H_
+#define SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_EVALUATOR_BRANCH_ACTION_H_
+
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "google/protobuf/descriptor.h"
+#include "wfa/virtual_people/common/event.pb.h"
+#include "wfa/virtual_people/common/field_filter.pb.h"
+#include "wfa/virtual_people/common/field_filter/field_filter.h"
+#include "wfa/virtual_people/common/model.pb.h"
+#include "wfa/virtual_people/training/model_evaluator/field_filter_program.h"
+#include "wfa/virtual_people/training/model_evaluator/labeler_hash.h"
+
+namespace wfa_virtual_people {
+
+// A condition on LabelerEvent. FieldFilterProgram is used when it supports the
+// filter, and FieldFilter otherwise.
+class EventCondition {
+ public:
+  static absl::StatusOr<EventCondition> Create(const FieldFilterProto& filter);
+
+  bool IsMatch(const LabelerEvent& event) const {
+    return program_ ? program_->IsMatch(event) : filter_->IsMatch(event);
+  }
+
+ private:
+  EventCondition() = default;
+
+  std::optional<FieldFilterProgram> program_;
+  std::unique_ptr<FieldFilter> filter_;
+};
+
+// Updates the attributes of events, as an AttributesUpdater of a branch node
+// in the labeler:
+// * UpdateMatrix and SparseUpdateMatrix find the column matching the event, on
+//   the union of the fields set in the columns. A row of the column is selected
+//   by SelectByConsistentHashing with the seed GetEventSeed of random_seed, and
+//   merged into the event.
+// * ConditionalMerge merges the update of the first node whose condition
+//   matches the event.
+// * ConditionalAssignment copies each source field set in the event to the
+//   target field, if the condition matches the event.
+// The events matching no column or no node are errors, unless
+// pass_through_non_matches is set.
+//
+// UpdateTree is not an AttributesUpdater, as the tree is walked as a part of
+// the model by its owner.
+class AttributesUpdater {
+ public:
+  // Return Unimplemented error status for UpdateTree and GeometricShredder.
+  static absl::StatusOr<std::unique_ptr<AttributesUpdater>> New(
+      const BranchNode::AttributesUpdater& config);
+
+  virtual ~AttributesUpdater() = default;
+
+  virtual absl::Status Update(SeedHashFunction hash,
+                              LabelerEvent& event) const = 0;
+};
+
+// Clones events, as the multiplicity of a branch node in the labeler.
+//
+// The expected count of the clones is expected_multiplicity, or the value of
+// expected_multiplicity_field in the event, capped at max_value if
+// cap_at_max is set. The count is its integer part, plus 1 if
+// GetUniformHash of the seed GetEventSeed of random_seed is less than its
+// fractional part.
+// Clone i has person_index_field set to i. The clones after the first are
+// given the acting_fingerprint hash("<acting_fingerprint>-<i>"), so that they
+// make their own random choices.
+class EventMultiplicity {
+ public:
+  static absl::StatusOr<EventMultiplicity> Create(const Multiplicity& config);
+
+  // Return error status if the expected count is negative, not set in the
+  // event, or greater than max_value without cap_at_max.
+  absl::StatusOr<int> GetCloneCount(SeedHashFunction hash,
+                                    const LabelerEvent& event) const;
+
+  // Make @clone the clone @index of an event, from a copy of the event.
+  void SetClone(SeedHashFunction hash, int index, LabelerEvent& clone) const;
+
+ private:
+  using FieldPath = std::vector<const google::protobuf::FieldDescriptor*>;
+
+  EventMultiplicity() = default;
+
+  std::optional<double> expected_multiplicity_;
+  FieldPath expected_multiplicity_field_;
+  std::optional<double> max_value_;
+  bool cap_at_max_ = false;
+  FieldPath person_index_field_;
+  std::string random_seed_;
+};
+
+}  // namespace wfa_virtual_people
+
+#endif  // SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_EVALUATOR_BRANCH_ACTION_H_
@@ -0,0 +1,141 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "wfa/virtual_people/training/model_evaluator/event_replay.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "absl/types/span.h"
+#include "wfa/virtual_people/common/event.pb.h"
+#include "wfa/virtual_people/training/model_evaluator/model_walker.h"
+
+namespace wfa_virtual_people {
+
+namespace {
+
+// The result of walking a shard of the events in one thread.
+struct ShardResult {
+  int64_t error_count = 0;
+  int64_t total_depth = 0;
+  std::vector<int64_t> visit_counts;
+  // The time of walking each sampled event.
+  std::vector<int64_t> latency_nanos;
+};
+
+void ReplayShard(const ModelWalker& walker,
+                 absl::Span<const LabelerEvent> events,
+                 const int latency_sample_interval, ShardResult& result) {
+  result.visit_counts.assign(walker.node_count(), 0);
+  result.latency_nanos.reserve(events.size() / latency_sample_interval + 1);
+  auto walk = [&walker, &result](const LabelerEvent& event) {
+    absl::StatusOr<WalkResult> walk_result =
+        walker.Walk(event, result.visit_counts);
+    if (walk_result.ok()) {
+      result.total_depth += walk_result->depth;
+    } else {
+      ++result.error_count;
+    }
+  };
+  for (size_t i = 0; i < events.size(); ++i) {
+    if (i % latency_sample_interval != 0) {
+      walk(events[i]);
+      continue;
+    }
+    auto start = std::chrono::steady_clock::now();
+    walk(events[i]);
+    auto end = std::chrono::steady_clock::now();
+    result.latency_nanos.push_back(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(end - start)
+            .count());
+  }
+}
+
+// Return the @percentile of @values, which is reordered.
+absl::Duration GetPercentile(std::vector<int64_t>& values, double percentile) {
+  if (values.empty()) {
+    return absl::ZeroDuration();
+  }
+  auto nth = values.begin() + static_cast<int64_t>(
+                                  percentile / 100 * (values.size() - 1));
+  std::nth_element(values.begin(), nth, values.end());
+  return absl::Nanoseconds(*nth);
+}
+
+}  // namespace
+
+absl::StatusOr<ReplayReport> ReplayEvents(const ModelWalker& walker,
+                                          absl::Span<const LabelerEvent> events,
+                                          const ReplayOptions& options) {
+  if (options.thread_count < 1) {
+    return absl::InvalidArgumentError("thread_count must be positive.");
+  }
+  if (options.latency_sample_interval < 1) {
+    return absl::InvalidArgumentError(
+        "latency_sample_interval must be positive.");
+  }
+  const int shard_count = std::max<int>(
+      1, std::min<int64_t>(options.thread_count, events.size()));
+  const int64_t shard_size = (events.size() + shard_count - 1) / shard_count;
+  std::vector<ShardResult> shard_results(shard_count);
+
+  absl::Time start = absl::Now();
+  std::vector<std::thread> threads;
+  threads.reserve(shard_count);
+  for (int i = 0; i < shard_count; ++i) {
+    absl::Span<const LabelerEvent> shard =
+        events.subspan(std::min<int64_t>(i * shard_size, events.size()),
+                       shard_size);
+    threads.emplace_back(ReplayShard, std::cref(walker), shard,
+                         options.latency_sample_interval,
+                         std::ref(shard_results[i]));
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+
+  ReplayReport report;
+  report.elapsed = absl::Now() - start;
+  report.event_count = events.size();
+  report.visit_counts.assign(walker.node_count(), 0);
+  std::vector<int64_t> latency_nanos;
+  latency_nanos.reserve(events.size() / options.latency_sample_interval +
+                        shard_count);
+  for (const ShardResult& shard_result : shard_results) {
+    report.error_count += shard_result.error_count;
+    report.total_depth += shard_result.total_depth;
+    for (int i = 0; i < walker.node_count(); ++i) {
+      report.visit_counts[i] += shard_result.visit_counts[i];
+    }
+    latency_nanos.insert(latency_nanos.end(),
+                         shard_result.latency_nanos.begin(),
+                         shard_result.latency_nanos.end());
+  }
+  report.latency_p50 = GetPercentile(latency_nanos, 50);
+  report.latency_p90 = GetPercentile(latency_nanos, 90);
+  report.latency_p99 = GetPercentile(latency_nanos, 99);
+  report.latency_max = GetPercentile(latency_nanos, 100);
+  return report;
+}
+
+}  // namespace wfa_virtual_people
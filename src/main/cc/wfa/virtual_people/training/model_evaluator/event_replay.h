@@ -0,0 +1,80 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_EVALUATOR_EVENT_REPLAY_H_
+#define SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_EVALUATOR_EVENT_REPLAY_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "absl/status/statusor.h"
+#include "absl/time/time.h"
+#include "absl/types/span.h"
+#include "wfa/virtual_people/common/event.pb.h"
+#include "wfa/virtual_people/training/model_evaluator/model_walker.h"
+
+namespace wfa_virtual_people {
+
+struct ReplayOptions {
+  // The count of the threads walking the events. The events are split into
+  // contiguous shards, one per thread.
+  int thread_count = 1;
+  // Every latency_sample_interval-th event of each shard is timed, starting
+  // from the first. Reading the clock costs about as much as walking a small
+  // model, so timing every event would lower the throughput.
+  int latency_sample_interval = 64;
+};
+
+struct ReplayReport {
+  int64_t event_count = 0;
+  // The count of the events for which the walk returns error status, for
+  // example no condition matches the event.
+  int64_t error_count = 0;
+  // The wall time of walking all the events.
+  absl::Duration elapsed;
+  // The percentiles of the time of walking an event, over the sampled
+  // events. Each sampled event is timed by itself, so the time includes
+  // reading the clock once.
+  absl::Duration latency_p50;
+  absl::Duration latency_p90;
+  absl::Duration latency_p99;
+  absl::Duration latency_max;
+  // The visit counts of the nodes, by the positions in ModelWalker.
+  std::vector<int64_t> visit_counts;
+  // The sum of the depths of the successful walks.
+  int64_t total_depth = 0;
+
+  double GetEventsPerSecond() const {
+    return elapsed > absl::ZeroDuration()
+               ? event_count / absl::ToDoubleSeconds(elapsed)
+               : 0;
+  }
+  double GetAverageDepth() const {
+    return event_count > error_count
+               ? static_cast<double>(total_depth) / (event_count - error_count)
+               : 0;
+  }
+};
+
+// Walk all the @events through @walker, and report the throughput, the
+// latency, and the nodes visited, including the nodes of the update trees and
+// the nodes visited by the clones of the events.
+// Return error status if @options is invalid.
+absl::StatusOr<ReplayReport> ReplayEvents(const ModelWalker& walker,
+                                          absl::Span<const LabelerEvent> events,
+                                          const ReplayOptions& options);
+
+}  // namespace wfa_virtual_people
+
+#endif  // SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_EVALUATOR_EVENT_REPLAY_H_
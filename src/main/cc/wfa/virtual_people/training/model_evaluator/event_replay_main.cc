@@ -0,0 +1,141 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// This is a tool to measure how fast a compiled model labels events locally.
+// It walks the LabelerEvents in a Riegeli file through the model with
+// ModelWalker in multiple threads, and logs the events per second, the latency
+// percentiles of a sample of the events and the average path depth.
+// The model is either a Riegeli file of CompiledNodes referencing the child
+// nodes by index, or a textproto of the root CompiledNode with nested child
+// nodes, as written by compiler_main.
+// Example usage:
+// bazel build -c opt \
+// //src/main/cc/wfa/virtual_people/training/model_evaluator:event_replay_main
+// bazel-bin/src/main/cc/wfa/virtual_people/training/model_evaluator/\
+// event_replay_main \
+// --model_path=/tmp/model_compiler/model.riegeli \
+// --events_path=/tmp/model_evaluator/events.riegeli \
+// --thread_count=8 \
+// --visit_counts_path=/tmp/model_evaluator/visit_counts.csv
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "common_cpp/protobuf_util/riegeli_io.h"
+#include "common_cpp/protobuf_util/textproto_io.h"
+#include "glog/logging.h"
+#include "wfa/virtual_people/common/event.pb.h"
+#include "wfa/virtual_people/common/model.pb.h"
+#include "wfa/virtual_people/training/model_evaluator/event_replay.h"
+#include "wfa/virtual_people/training/model_evaluator/model_walker.h"
+
+ABSL_FLAG(std::string, model_path, "", "Path to the input model.");
+ABSL_FLAG(std::string, model_format, "riegeli",
+          "The format of the model. One of riegeli, for a Riegeli file of "
+          "CompiledNodes, or textproto, for the root CompiledNode in "
+          "textproto.");
+ABSL_FLAG(std::string, events_path, "",
+          "Path to the input LabelerEvent Riegeli file.");
+ABSL_FLAG(int, thread_count, 1, "The count of the threads walking events.");
+ABSL_FLAG(int, latency_sample_interval, 64,
+          "Time every latency_sample_interval-th event of each thread, for "
+          "the latency percentiles. 1 times every event, at the cost of "
+          "throughput.");
+ABSL_FLAG(std::string, visit_counts_path, "",
+          "If set, write the visit count of each node to this path, as CSV, "
+          "which is the profile read by compiler_main --profile_path.");
+
+namespace {
+
+absl::StatusOr<wfa_virtual_people::ModelWalker> ReadModel(
+    const std::string& model_path, const std::string& model_format) {
+  if (model_format == "riegeli") {
+    std::vector<wfa_virtual_people::CompiledNode> nodes;
+    absl::Status read_status =
+        wfa::ReadRiegeliFile<wfa_virtual_people::CompiledNode>(model_path,
+                                                                nodes);
+    if (!read_status.ok()) {
+      return read_status;
+    }
+    return wfa_virtual_people::ModelWalker::Create(nodes);
+  }
+  if (model_format == "textproto") {
+    wfa_virtual_people::CompiledNode root;
+    absl::Status read_status = wfa::ReadTextProtoFile(model_path, root);
+    if (!read_status.ok()) {
+      return read_status;
+    }
+    return wfa_virtual_people::ModelWalker::Create(root);
+  }
+  return absl::InvalidArgumentError("Invalid model_format: " + model_format);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  absl::ParseCommandLine(argc, argv);
+  google::InitGoogleLogging(argv[0]);
+
+  std::string model_path = absl::GetFlag(FLAGS_model_path);
+  CHECK(!model_path.empty()) << "model_path is not set.";
+  std::string events_path = absl::GetFlag(FLAGS_events_path);
+  CHECK(!events_path.empty()) << "events_path is not set.";
+
+  absl::StatusOr<wfa_virtual_people::ModelWalker> walker =
+      ReadModel(model_path, absl::GetFlag(FLAGS_model_format));
+  CHECK(walker.ok()) << walker.status();
+
+  std::vector<wfa_virtual_people::LabelerEvent> events;
+  absl::Status read_status =
+      wfa::ReadRiegeliFile<wfa_virtual_people::LabelerEvent>(events_path,
+                                                              events);
+  CHECK(read_status.ok()) << read_status;
+
+  wfa_virtual_people::ReplayOptions options;
+  options.thread_count = absl::GetFlag(FLAGS_thread_count);
+  options.latency_sample_interval =
+      absl::GetFlag(FLAGS_latency_sample_interval);
+  absl::StatusOr<wfa_virtual_people::ReplayReport> report =
+      wfa_virtual_people::ReplayEvents(*walker, events, options);
+  CHECK(report.ok()) << report.status();
+
+  LOG(INFO) << "Walked " << report->event_count << " events through "
+            << walker->node_count() << " nodes in " << report->elapsed
+            << " with " << options.thread_count << " threads: "
+            << report->GetEventsPerSecond() << " events/sec, "
+            << report->error_count << " errors.";
+  LOG(INFO) << "Latency p50: " << report->latency_p50
+            << ", p90: " << report->latency_p90
+            << ", p99: " << report->latency_p99
+            << ", max: " << report->latency_max;
+  LOG(INFO) << "Average depth: " << report->GetAverageDepth();
+
+  std::string visit_counts_path = absl::GetFlag(FLAGS_visit_counts_path);
+  if (!visit_counts_path.empty()) {
+    std::ofstream visit_counts_file(visit_counts_path);
+    CHECK(visit_counts_file.is_open())
+        << "Failed to open " << visit_counts_path;
+    visit_counts_file << "name,visit_count\n";
+    for (int i = 0; i < walker->node_count(); ++i) {
+      visit_counts_file << walker->node_name(i) << ","
+                        << report->visit_counts[i] << "\n";
+    }
+  }
+  return 0;
+}
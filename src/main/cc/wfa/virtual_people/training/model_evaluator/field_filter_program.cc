@@ -0,0 +1,771 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "wfa/virtual_people/training/model_evaluator/field_filter_program.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_join.h"
+#include "absl/strings/str_split.h"
+#include "absl/strings/string_view.h"
+#include "common_cpp/macros/macros.h"
+#include "google/protobuf/descriptor.h"
+#include "google/protobuf/message.h"
+#include "wfa/virtual_people/common/event.pb.h"
+#include "wfa/virtual_people/common/field_filter.pb.h"
+
+namespace wfa_virtual_people {
+
+using ::google::protobuf::Descriptor;
+using ::google::protobuf::FieldDescriptor;
+using ::google::protobuf::Message;
+using ::google::protobuf::Reflection;
+
+using FieldPath = std::vector<const FieldDescriptor*>;
+
+// Emits the instructions, fields and constants of a FieldFilterProgram.
+class FieldFilterProgram::Compiler {
+ public:
+  explicit Compiler(FieldFilterProgram& program) : program_(program) {}
+
+  // Append the instructions of @filter, whose field names are relative to
+  // @descriptor, which is reached from LabelerEvent by @prefix.
+  absl::Status CompileFilter(const FieldFilterProto& filter,
+                             const Descriptor* descriptor,
+                             const FieldPath& prefix);
+
+ private:
+  // Compile AND or OR. The @jump opcode skips the rest of the sub-filters when
+  // the result is decided.
+  absl::Status CompileConnective(const FieldFilterProto& filter,
+                                 const Descriptor* descriptor,
+                                 const FieldPath& prefix, Opcode jump);
+
+  // Point the jump instructions at indexes @jumps to the next instruction.
+  void PatchJumps(const std::vector<uint32_t>& jumps);
+
+  // Return the path of @name, resolved from @descriptor and appended to
+  // @prefix.
+  absl::StatusOr<FieldPath> ResolvePath(const Descriptor* descriptor,
+                                        const FieldPath& prefix,
+                                        absl::string_view name);
+
+  // Return the index of @path in the fields of the program, adding it if not
+  // found.
+  uint32_t InternField(const FieldPath& path);
+
+  // Parse @value to the type of @field, and return its index in the constants
+  // of that type.
+  absl::StatusOr<uint32_t> AddConstant(const Field& field,
+                                       absl::string_view value);
+
+  void Emit(Opcode opcode, uint32_t field = 0, uint32_t operand = 0,
+            uint32_t count = 0) {
+    program_.instructions_.push_back({opcode, field, operand, count});
+  }
+
+  FieldFilterProgram& program_;
+  absl::flat_hash_map<std::string, uint32_t> field_indexes_;
+};
+
+namespace {
+
+bool IsNumeric(const FieldDescriptor::CppType cpp_type) {
+  switch (cpp_type) {
+    case FieldDescriptor::CPPTYPE_INT32:
+    case FieldDescriptor::CPPTYPE_INT64:
+    case FieldDescriptor::CPPTYPE_UINT32:
+    case FieldDescriptor::CPPTYPE_UINT64:
+    case FieldDescriptor::CPPTYPE_FLOAT:
+    case FieldDescriptor::CPPTYPE_DOUBLE:
+      return true;
+    default:
+      return false;
+  }
+}
+
+std::string GetPathName(const FieldPath& path) {
+  return absl::StrJoin(path, ".",
+                       [](std::string* out, const FieldDescriptor* field) {
+                         absl::StrAppend(out, field->name());
+                       });
+}
+
+template <typename T>
+uint32_t AppendConstant(const T& value, std::vector<T>& constants) {
+  constants.push_back(value);
+  return constants.size() - 1;
+}
+
+}  // namespace
+
+absl::StatusOr<FieldPath> FieldFilterProgram::Compiler::ResolvePath(
+    const Descriptor* descriptor, const FieldPath& prefix,
+    absl::string_view name) {
+  if (name.empty()) {
+    return absl::InvalidArgumentError("The name of the field is not set.");
+  }
+  FieldPath path = prefix;
+  for (absl::string_view part : absl::StrSplit(name, '.')) {
+    if (!descriptor) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("The field ", name, " is not in a message."));
+    }
+    const FieldDescriptor* field =
+        descriptor->FindFieldByName(std::string(part));
+    if (!field) {
+      return absl::InvalidArgumentError(absl::StrCat(
+          "The field ", part, " is not found in ", descriptor->full_name()));
+    }
+    if (field->is_repeated()) {
+      return absl::UnimplementedError(absl::StrCat(
+          "Repeated field is not supported: ", field->full_name()));
+    }
+    path.push_back(field);
+    descriptor = field->message_type();
+  }
+  return path;
+}
+
+uint32_t FieldFilterProgram::Compiler::InternField(const FieldPath& path) {
+  auto [it, inserted] =
+      field_indexes_.try_emplace(GetPathName(path), program_.fields_.size());
+  if (inserted) {
+    program_.fields_.push_back({path, path.back()->cpp_type()});
+  }
+  return it->second;
+}
+
+absl::StatusOr<uint32_t> FieldFilterProgram::Compiler::AddConstant(
+    const Field& field, absl::string_view value) {
+  const FieldDescriptor* descriptor = field.path.back();
+  absl::Status parse_error = absl::InvalidArgumentError(
+      absl::StrCat("Invalid value ", value, " for ", descriptor->full_name()));
+  switch (field.cpp_type) {
+    case FieldDescriptor::CPPTYPE_INT32: {
+      int32_t parsed;
+      if (!absl::SimpleAtoi(value, &parsed)) return parse_error;
+      return AppendConstant<int64_t>(parsed, program_.int_constants_);
+    }
+    case FieldDescriptor::CPPTYPE_INT64: {
+      int64_t parsed;
+      if (!absl::SimpleAtoi(value, &parsed)) return parse_error;
+      return AppendConstant<int64_t>(parsed, program_.int_constants_);
+    }
+    case FieldDescriptor::CPPTYPE_UINT32: {
+      uint32_t parsed;
+      if (!absl::SimpleAtoi(value, &parsed)) return parse_error;
+      return AppendConstant<uint64_t>(parsed, program_.uint_constants_);
+    }
+    case FieldDescriptor::CPPTYPE_UINT64: {
+      uint64_t parsed;
+      if (!absl::SimpleAtoi(value, &parsed)) return parse_error;
+      return AppendConstant<uint64_t>(parsed, program_.uint_constants_);
+    }
+    case FieldDescriptor::CPPTYPE_FLOAT: {
+      float parsed;
+      if (!absl::SimpleAtof(value, &parsed)) return parse_error;
+      return AppendConstant<float>(parsed, program_.float_constants_);
+    }
+    case FieldDescriptor::CPPTYPE_DOUBLE: {
+      double parsed;
+      if (!absl::SimpleAtod(value, &parsed)) return parse_error;
+      return AppendConstant<double>(parsed, program_.double_constants_);
+    }
+    case FieldDescriptor::CPPTYPE_BOOL: {
+      bool parsed;
+      if (!absl::SimpleAtob(value, &parsed)) return parse_error;
+      program_.bool_constants_.push_back(parsed);
+      return program_.bool_constants_.size() - 1;
+    }
+    case FieldDescriptor::CPPTYPE_ENUM: {
+      const google::protobuf::EnumValueDescriptor* enum_value =
+          descriptor->enum_type()->FindValueByName(std::string(value));
+      if (!enum_value) return parse_error;
+      return AppendConstant<int64_t>(enum_value->number(),
+                                     program_.int_constants_);
+    }
+    case FieldDescriptor::CPPTYPE_STRING:
+      return AppendConstant<std::string>(std::string(value),
+                                         program_.string_constants_);
+    default:
+      return absl::InvalidArgumentError(absl::StrCat(
+          "Cannot compare the value of ", descriptor->full_name()));
+  }
+}
+
+void FieldFilterProgram::Compiler::PatchJumps(
+    const std::vector<uint32_t>& jumps) {
+  for (uint32_t jump : jumps) {
+    program_.instructions_[jump].operand = program_.instructions_.size();
+  }
+}
+
+absl::Status FieldFilterProgram::Compiler::CompileConnective(
+    const FieldFilterProto& filter, const Descriptor* descriptor,
+    const FieldPath& prefix, Opcode jump) {
+  if (filter.sub_filters_size() == 0) {
+    return absl::InvalidArgumentError(absl::StrCat(
+        "sub_filters must be set when op is ",
+        FieldFilterProto::Op_Name(filter.op()), ": ", filter.DebugString()));
+  }
+  std::vector<uint32_t> jumps;
+  for (int i = 0; i < filter.sub_filters_size(); ++i) {
+    RETURN_IF_ERROR(CompileFilter(filter.sub_filters(i), descriptor, prefix));
+    if (i + 1 < filter.sub_filters_size()) {
+      jumps.push_back(program_.instructions_.size());
+      Emit(jump);
+    }
+  }
+  PatchJumps(jumps);
+  return absl::OkStatus();
+}
+
+absl::Status FieldFilterProgram::Compiler::CompileFilter(
+    const FieldFilterProto& filter, const Descriptor* descriptor,
+    const FieldPath& prefix) {
+  switch (filter.op()) {
+    case FieldFilterProto::TRUE:
+      Emit(Opcode::kTrue);
+      return absl::OkStatus();
+    case FieldFilterProto::AND:
+      return CompileConnective(filter, descriptor, prefix,
+                               Opcode::kJumpIfFalse);
+    case FieldFilterProto::OR:
+      return CompileConnective(filter, descriptor, prefix,
+                               Opcode::kJumpIfTrue);
+    case FieldFilterProto::NOT:
+      if (filter.sub_filters_size() != 1) {
+        return absl::InvalidArgumentError(absl::StrCat(
+            "NOT requires exactly one sub_filter: ", filter.DebugString()));
+      }
+      RETURN_IF_ERROR(
+          CompileFilter(filter.sub_filters(0), descriptor, prefix));
+      Emit(Opcode::kNot);
+      return absl::OkStatus();
+    case FieldFilterProto::PARTIAL: {
+      ASSIGN_OR_RETURN(FieldPath path,
+                       ResolvePath(descriptor, prefix, filter.name()));
+      const Descriptor* sub_descriptor = path.back()->message_type();
+      if (!sub_descriptor) {
+        return absl::InvalidArgumentError(absl::StrCat(
+            "PARTIAL requires a message field: ", filter.DebugString()));
+      }
+      // PARTIAL is compiled as HAS on the message field, AND all the
+      // sub-filters on the paths under it.
+      Emit(Opcode::kHas, InternField(path));
+      std::vector<uint32_t> jumps;
+      for (const FieldFilterProto& sub_filter : filter.sub_filters()) {
+        jumps.push_back(program_.instructions_.size());
+        Emit(Opcode::kJumpIfFalse);
+        RETURN_IF_ERROR(CompileFilter(sub_filter, sub_descriptor, path));
+      }
+      PatchJumps(jumps);
+      return absl::OkStatus();
+    }
+    case FieldFilterProto::HAS: {
+      ASSIGN_OR_RETURN(FieldPath path,
+                       ResolvePath(descriptor, prefix, filter.name()));
+      Emit(Opcode::kHas, InternField(path));
+      return absl::OkStatus();
+    }
+    case FieldFilterProto::EQUAL:
+    case FieldFilterProto::GT:
+    case FieldFilterProto::LT: {
+      ASSIGN_OR_RETURN(FieldPath path,
+                       ResolvePath(descriptor, prefix, filter.name()));
+      uint32_t field_index = InternField(path);
+      const Field& field = program_.fields_[field_index];
+      Opcode opcode = Opcode::kEqual;
+      if (filter.op() != FieldFilterProto::EQUAL) {
+        if (!IsNumeric(field.cpp_type)) {
+          return absl::InvalidArgumentError(absl::StrCat(
+              "GT and LT require a numeric field: ", filter.DebugString()));
+        }
+        opcode = filter.op() == FieldFilterProto::GT ? Opcode::kGreaterThan
+                                                     : Opcode::kLessThan;
+      }
+      ASSIGN_OR_RETURN(uint32_t constant, AddConstant(field, filter.value()));
+      Emit(opcode, field_index, constant);
+      return absl::OkStatus();
+    }
+    case FieldFilterProto::IN: {
+      ASSIGN_OR_RETURN(FieldPath path,
+                       ResolvePath(descriptor, prefix, filter.name()));
+      uint32_t field_index = InternField(path);
+      const Field& field = program_.fields_[field_index];
+      uint32_t first = 0;
+      uint32_t count = 0;
+      for (absl::string_view value : absl::StrSplit(filter.value(), ',')) {
+        ASSIGN_OR_RETURN(uint32_t constant, AddConstant(field, value));
+        if (count == 0) {
+          first = constant;
+        }
+        ++count;
+      }
+      Emit(Opcode::kIn, field_index, first, count);
+      return absl::OkStatus();
+    }
+    case FieldFilterProto::REGEXP:
+    case FieldFilterProto::ANY_IN:
+      return absl::UnimplementedError(
+          absl::StrCat("Op is not supported by FieldFilterProgram: ",
+                       FieldFilterProto::Op_Name(filter.op())));
+    default:
+      return absl::InvalidArgumentError(
+          absl::StrCat("Invalid op: ", filter.DebugString()));
+  }
+}
+
+absl::StatusOr<FieldFilterProgram> FieldFilterProgram::Compile(
+    const FieldFilterProto& filter) {
+  FieldFilterProgram program;
+  Compiler compiler(program);
+  RETURN_IF_ERROR(
+      compiler.CompileFilter(filter, LabelerEvent::descriptor(), {}));
+  return program;
+}
+
+namespace {
+
+// Appends the numbers and strings of a serialized FieldFilterProgram.
+class ProgramWriter {
+ public:
+  template <typename T>
+  void Write(const T value) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    data_.append(reinterpret_cast<const char*>(&value), sizeof(T));
+  }
+
+  template <typename T>
+  void WriteVector(const std::vector<T>& values) {
+    Write<uint32_t>(values.size());
+    for (const T& value : values) {
+      Write<T>(value);
+    }
+  }
+
+  void WriteString(absl::string_view value) {
+    Write<uint32_t>(value.size());
+    data_.append(value.data(), value.size());
+  }
+
+  std::string data() && { return std::move(data_); }
+
+ private:
+  std::string data_;
+};
+
+// Reads the numbers and strings of a serialized FieldFilterProgram. Each read
+// returns false if the data is truncated.
+class ProgramReader {
+ public:
+  explicit ProgramReader(absl::string_view data) : data_(data) {}
+
+  template <typename T>
+  bool Read(T& value) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    if (data_.size() < sizeof(T)) {
+      return false;
+    }
+    std::memcpy(&value, data_.data(), sizeof(T));
+    data_.remove_prefix(sizeof(T));
+    return true;
+  }
+
+  template <typename T>
+  bool ReadVector(std::vector<T>& values) {
+    uint32_t size;
+    if (!Read(size) || size > data_.size() / sizeof(T)) {
+      return false;
+    }
+    values.resize(size);
+    for (T& value : values) {
+      Read(value);
+    }
+    return true;
+  }
+
+  bool ReadString(std::string& value) {
+    uint32_t size;
+    if (!Read(size) || size > data_.size()) {
+      return false;
+    }
+    value.assign(data_.data(), size);
+    data_.remove_prefix(size);
+    return true;
+  }
+
+  bool empty() const { return data_.empty(); }
+
+ private:
+  absl::string_view data_;
+};
+
+absl::Status InvalidProgram(absl::string_view message) {
+  return absl::InvalidArgumentError(
+      absl::StrCat("Invalid FieldFilterProgram data: ", message));
+}
+
+}  // namespace
+
+std::string FieldFilterProgram::Serialize() const {
+  ProgramWriter writer;
+  writer.Write<uint32_t>(fields_.size());
+  for (const Field& field : fields_) {
+    writer.Write<uint32_t>(field.path.size());
+    for (const FieldDescriptor* descriptor : field.path) {
+      writer.Write<int32_t>(descriptor->number());
+    }
+  }
+  writer.Write<uint32_t>(instructions_.size());
+  for (const Instruction& instruction : instructions_) {
+    writer.Write<uint8_t>(static_cast<uint8_t>(instruction.opcode));
+    writer.Write<uint32_t>(instruction.field);
+    writer.Write<uint32_t>(instruction.operand);
+    writer.Write<uint32_t>(instruction.count);
+  }
+  writer.WriteVector(int_constants_);
+  writer.WriteVector(uint_constants_);
+  writer.WriteVector(double_constants_);
+  writer.WriteVector(float_constants_);
+  writer.Write<uint32_t>(bool_constants_.size());
+  for (const bool value : bool_constants_) {
+    writer.Write<uint8_t>(value);
+  }
+  writer.Write<uint32_t>(string_constants_.size());
+  for (const std::string& value : string_constants_) {
+    writer.WriteString(value);
+  }
+  return std::move(writer).data();
+}
+
+absl::StatusOr<FieldFilterProgram> FieldFilterProgram::Deserialize(
+    absl::string_view data) {
+  const absl::Status truncated = InvalidProgram("Truncated.");
+  ProgramReader reader(data);
+  FieldFilterProgram program;
+
+  uint32_t field_count;
+  if (!reader.Read(field_count)) return truncated;
+  for (uint32_t i = 0; i < field_count; ++i) {
+    uint32_t depth;
+    if (!reader.Read(depth)) return truncated;
+    if (depth == 0) {
+      return InvalidProgram(absl::StrCat("Empty path of field ", i));
+    }
+    Field field;
+    const Descriptor* descriptor = LabelerEvent::descriptor();
+    for (uint32_t j = 0; j < depth; ++j) {
+      int32_t number;
+      if (!reader.Read(number)) return truncated;
+      const FieldDescriptor* field_descriptor =
+          descriptor ? descriptor->FindFieldByNumber(number) : nullptr;
+      if (!field_descriptor || field_descriptor->is_repeated()) {
+        return InvalidProgram(absl::StrCat("Invalid path of field ", i));
+      }
+      field.path.push_back(field_descriptor);
+      descriptor = field_descriptor->message_type();
+    }
+    field.cpp_type = field.path.back()->cpp_type();
+    program.fields_.push_back(std::move(field));
+  }
+
+  uint32_t instruction_count;
+  if (!reader.Read(instruction_count)) return truncated;
+  for (uint32_t i = 0; i < instruction_count; ++i) {
+    uint8_t opcode;
+    Instruction instruction;
+    if (!reader.Read(opcode) || !reader.Read(instruction.field) ||
+        !reader.Read(instruction.operand) || !reader.Read(instruction.count)) {
+      return truncated;
+    }
+    if (opcode > static_cast<uint8_t>(Opcode::kJumpIfTrue)) {
+      return InvalidProgram(absl::StrCat("Invalid opcode in instruction ", i));
+    }
+    instruction.opcode = static_cast<Opcode>(opcode);
+    program.instructions_.push_back(instruction);
+  }
+
+  if (!reader.ReadVector(program.int_constants_) ||
+      !reader.ReadVector(program.uint_constants_) ||
+      !reader.ReadVector(program.double_constants_) ||
+      !reader.ReadVector(program.float_constants_)) {
+    return truncated;
+  }
+  uint32_t bool_count;
+  if (!reader.Read(bool_count)) return truncated;
+  for (uint32_t i = 0; i < bool_count; ++i) {
+    uint8_t value;
+    if (!reader.Read(value)) return truncated;
+    program.bool_constants_.push_back(value != 0);
+  }
+  uint32_t string_count;
+  if (!reader.Read(string_count)) return truncated;
+  for (uint32_t i = 0; i < string_count; ++i) {
+    std::string value;
+    if (!reader.ReadString(value)) return truncated;
+    program.string_constants_.push_back(std::move(value));
+  }
+  if (!reader.empty()) {
+    return InvalidProgram("Trailing bytes.");
+  }
+
+  for (uint32_t pc = 0; pc < program.instructions_.size(); ++pc) {
+    RETURN_IF_ERROR(program.CheckInstruction(pc));
+  }
+  return program;
+}
+
+size_t FieldFilterProgram::GetConstantCount(
+    const FieldDescriptor::CppType cpp_type) const {
+  switch (cpp_type) {
+    case FieldDescriptor::CPPTYPE_INT32:
+    case FieldDescriptor::CPPTYPE_INT64:
+    case FieldDescriptor::CPPTYPE_ENUM:
+      return int_constants_.size();
+    case FieldDescriptor::CPPTYPE_UINT32:
+    case FieldDescriptor::CPPTYPE_UINT64:
+      return uint_constants_.size();
+    case FieldDescriptor::CPPTYPE_FLOAT:
+      return float_constants_.size();
+    case FieldDescriptor::CPPTYPE_DOUBLE:
+      return double_constants_.size();
+    case FieldDescriptor::CPPTYPE_BOOL:
+      return bool_constants_.size();
+    case FieldDescriptor::CPPTYPE_STRING:
+      return string_constants_.size();
+    default:
+      return 0;
+  }
+}
+
+absl::Status FieldFilterProgram::CheckInstruction(const uint32_t pc) const {
+  const Instruction& instruction = instructions_[pc];
+  const absl::Status invalid =
+      InvalidProgram(absl::StrCat("Invalid instruction ", pc));
+  switch (instruction.opcode) {
+    case Opcode::kTrue:
+    case Opcode::kNot:
+      return absl::OkStatus();
+    case Opcode::kHas:
+      return instruction.field < fields_.size() ? absl::OkStatus() : invalid;
+    case Opcode::kEqual:
+    case Opcode::kIn:
+    case Opcode::kGreaterThan:
+    case Opcode::kLessThan: {
+      if (instruction.field >= fields_.size()) {
+        return invalid;
+      }
+      const FieldDescriptor::CppType cpp_type =
+          fields_[instruction.field].cpp_type;
+      if (instruction.opcode != Opcode::kEqual &&
+          instruction.opcode != Opcode::kIn && !IsNumeric(cpp_type)) {
+        return invalid;
+      }
+      const size_t constant_count = GetConstantCount(cpp_type);
+      const size_t count =
+          instruction.opcode == Opcode::kIn ? instruction.count : 1;
+      if (instruction.operand > constant_count ||
+          count > constant_count - instruction.operand) {
+        return invalid;
+      }
+      return absl::OkStatus();
+    }
+    case Opcode::kJumpIfFalse:
+    case Opcode::kJumpIfTrue:
+      // Jumping forward only, so IsMatch always ends.
+      return instruction.operand > pc &&
+                     instruction.operand <= instructions_.size()
+                 ? absl::OkStatus()
+                 : invalid;
+  }
+  return invalid;
+}
+
+const Message* FieldFilterProgram::GetParentIfSet(const LabelerEvent& event,
+                                                  const Field& field) const {
+  const Message* message = &event;
+  const int last = field.path.size() - 1;
+  for (int i = 0; i < last; ++i) {
+    const Reflection* reflection = message->GetReflection();
+    if (!reflection->HasField(*message, field.path[i])) {
+      return nullptr;
+    }
+    message = &reflection->GetMessage(*message, field.path[i]);
+  }
+  if (!message->GetReflection()->HasField(*message, field.path[last])) {
+    return nullptr;
+  }
+  return message;
+}
+
+namespace {
+
+enum class Comparison { kEqual, kGreaterThan, kLessThan, kIn };
+
+template <typename T>
+bool Compare(const T value, const std::vector<T>& constants,
+             const uint32_t operand, const uint32_t count,
+             const Comparison comparison) {
+  switch (comparison) {
+    case Comparison::kEqual:
+      return value == constants[operand];
+    case Comparison::kGreaterThan:
+      return value > constants[operand];
+    case Comparison::kLessThan:
+      return value < constants[operand];
+    case Comparison::kIn:
+      for (uint32_t i = operand; i < operand + count; ++i) {
+        if (value == constants[i]) {
+          return true;
+        }
+      }
+      return false;
+  }
+  return false;
+}
+
+}  // namespace
+
+bool FieldFilterProgram::EvaluateComparison(const Instruction& instruction,
+                                            const LabelerEvent& event) const {
+  const Field& field = fields_[instruction.field];
+  const Message* parent = GetParentIfSet(event, field);
+  if (!parent) {
+    return false;
+  }
+  const Reflection* reflection = parent->GetReflection();
+  const FieldDescriptor* descriptor = field.path.back();
+  Comparison comparison = Comparison::kIn;
+  switch (instruction.opcode) {
+    case Opcode::kEqual:
+      comparison = Comparison::kEqual;
+      break;
+    case Opcode::kGreaterThan:
+      comparison = Comparison::kGreaterThan;
+      break;
+    case Opcode::kLessThan:
+      comparison = Comparison::kLessThan;
+      break;
+    default:
+      break;
+  }
+  const uint32_t operand = instruction.operand;
+  // EQUAL is IN with a single value for bool and string fields.
+  const uint32_t count =
+      comparison == Comparison::kIn ? instruction.count : 1;
+  switch (field.cpp_type) {
+    case FieldDescriptor::CPPTYPE_INT32:
+      return Compare<int64_t>(reflection->GetInt32(*parent, descriptor),
+                              int_constants_, operand, count, comparison);
+    case FieldDescriptor::CPPTYPE_INT64:
+      return Compare<int64_t>(reflection->GetInt64(*parent, descriptor),
+                              int_constants_, operand, count, comparison);
+    case FieldDescriptor::CPPTYPE_UINT32:
+      return Compare<uint64_t>(reflection->GetUInt32(*parent, descriptor),
+                               uint_constants_, operand, count,
+                               comparison);
+    case FieldDescriptor::CPPTYPE_UINT64:
+      return Compare<uint64_t>(reflection->GetUInt64(*parent, descriptor),
+                               uint_constants_, operand, count,
+                               comparison);
+    case FieldDescriptor::CPPTYPE_FLOAT:
+      return Compare<float>(reflection->GetFloat(*parent, descriptor),
+                            float_constants_, operand, count, comparison);
+    case FieldDescriptor::CPPTYPE_DOUBLE:
+      return Compare<double>(reflection->GetDouble(*parent, descriptor),
+                             double_constants_, operand, count, comparison);
+    case FieldDescriptor::CPPTYPE_ENUM:
+      return Compare<int64_t>(reflection->GetEnumValue(*parent, descriptor),
+                              int_constants_, operand, count,
+                              comparison);
+    case FieldDescriptor::CPPTYPE_BOOL: {
+      bool value = reflection->GetBool(*parent, descriptor);
+      for (uint32_t i = operand; i < operand + count; ++i) {
+        if (value == bool_constants_[i]) {
+          return true;
+        }
+      }
+      return false;
+    }
+    case FieldDescriptor::CPPTYPE_STRING: {
+      std::string scratch;
+      const std::string& value =
+          reflection->GetStringReference(*parent, descriptor, &scratch);
+      for (uint32_t i = operand; i < operand + count; ++i) {
+        if (value == string_constants_[i]) {
+          return true;
+        }
+      }
+      return false;
+    }
+    default:
+      return false;
+  }
+}
+
+bool FieldFilterProgram::IsMatch(const LabelerEvent& event) const {
+  bool result = false;
+  const uint32_t size = instructions_.size();
+  uint32_t pc = 0;
+  while (pc < size) {
+    const Instruction& instruction = instructions_[pc];
+    switch (instruction.opcode) {
+      case Opcode::kTrue:
+        result = true;
+        break;
+      case Opcode::kHas:
+        result = GetParentIfSet(event, fields_[instruction.field]) != nullptr;
+        break;
+      case Opcode::kEqual:
+      case Opcode::kIn:
+      case Opcode::kGreaterThan:
+      case Opcode::kLessThan:
+        result = EvaluateComparison(instruction, event);
+        break;
+      case Opcode::kNot:
+        result = !result;
+        break;
+      case Opcode::kJumpIfFalse:
+        if (!result) {
+          pc = instruction.operand;
+          continue;
+        }
+        break;
+      case Opcode::kJumpIfTrue:
+        if (result) {
+          pc = instruction.operand;
+          continue;
+        }
+        break;
+    }
+    ++pc;
+  }
+  return result;
+}
+
+}  // namespace wfa_virtual_people
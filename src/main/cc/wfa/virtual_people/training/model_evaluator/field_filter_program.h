@@ -0,0 +1,146 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_EVALUATOR_FIELD_FILTER_PROGRAM_H_
+#define SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_EVALUATOR_FIELD_FILTER_PROGRAM_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+#include "google/protobuf/descriptor.h"
+#include "google/protobuf/message.h"
+#include "wfa/virtual_people/common/event.pb.h"
+#include "wfa/virtual_people/common/field_filter.pb.h"
+
+namespace wfa_virtual_people {
+
+// A FieldFilterProto compiled to a flat bytecode, which is evaluated against
+// LabelerEvent without walking the proto tree.
+//
+// The bytecode runs on a single boolean accumulator. Sub-filters are emitted
+// before the operators that consume them (postfix order), and AND / OR
+// short-circuit by jumping to the end of the operator when the accumulator
+// decides the result. Field paths are resolved and interned once, and the
+// values are parsed to the types of the fields at compile time.
+//
+// The matching semantics are the same as FieldFilter:
+// * HAS matches if the field is set.
+// * EQUAL, IN, GT and LT match only if the field is set. The values of IN are
+//   separated by ",". GT and LT only apply to numeric fields.
+// * PARTIAL matches if the message field is set, and all the sub-filters
+//   match the message field.
+// * AND, OR, NOT and TRUE are as expected.
+// REGEXP and ANY_IN, and filters on repeated fields, are not supported, and
+// Compile returns error status for them.
+//
+// Example usage:
+//   ASSIGN_OR_RETURN(FieldFilterProgram program,
+//                    FieldFilterProgram::Compile(filter));
+//   bool matched = program.IsMatch(event);
+//
+// A program can be stored with Serialize and loaded with Deserialize, which
+// skips parsing the FieldFilterProto, resolving the field names and parsing
+// the values.
+class FieldFilterProgram {
+ public:
+  static absl::StatusOr<FieldFilterProgram> Compile(
+      const FieldFilterProto& filter);
+
+  // Load a program written by Serialize. The bytecode is checked, so that
+  // IsMatch never reads out of bounds.
+  // Return error status if @data is not a valid program.
+  static absl::StatusOr<FieldFilterProgram> Deserialize(
+      absl::string_view data);
+
+  // Return the program as bytes. The fields are stored as the field numbers
+  // of their paths from LabelerEvent, and the numbers in the byte order of
+  // this machine.
+  std::string Serialize() const;
+
+  bool IsMatch(const LabelerEvent& event) const;
+
+  int instruction_count() const { return instructions_.size(); }
+  int field_count() const { return fields_.size(); }
+
+ private:
+  enum class Opcode : uint8_t {
+    kTrue,
+    kHas,
+    kEqual,
+    kIn,
+    kGreaterThan,
+    kLessThan,
+    kNot,
+    // Jump to the target if the accumulator is false, or true.
+    kJumpIfFalse,
+    kJumpIfTrue,
+  };
+
+  struct Instruction {
+    Opcode opcode;
+    // The index in fields_, for the opcodes reading a field.
+    uint32_t field;
+    // For kEqual, kGreaterThan and kLessThan, the index of the value in the
+    // constants of the type of the field. For kIn, the first index of the
+    // values. For jumps, the target instruction.
+    uint32_t operand;
+    // For kIn, the count of the values.
+    uint32_t count;
+  };
+
+  // A field path resolved from LabelerEvent.
+  struct Field {
+    std::vector<const google::protobuf::FieldDescriptor*> path;
+    google::protobuf::FieldDescriptor::CppType cpp_type;
+  };
+
+  class Compiler;
+
+  FieldFilterProgram() = default;
+
+  // Return the message directly containing the field, or nullptr if the field
+  // is not set.
+  const google::protobuf::Message* GetParentIfSet(const LabelerEvent& event,
+                                                  const Field& field) const;
+  bool EvaluateComparison(const Instruction& instruction,
+                          const LabelerEvent& event) const;
+
+  // Return the count of the constants compared with fields of @cpp_type.
+  size_t GetConstantCount(
+      google::protobuf::FieldDescriptor::CppType cpp_type) const;
+
+  // Return error status if the instruction at @pc reads a field or constant
+  // out of bounds, or does not jump forward within the program.
+  absl::Status CheckInstruction(uint32_t pc) const;
+
+  std::vector<Instruction> instructions_;
+  std::vector<Field> fields_;
+  // The constants, by the types of the fields they are compared with. Enum
+  // values are stored as numbers in int_constants_.
+  std::vector<int64_t> int_constants_;
+  std::vector<uint64_t> uint_constants_;
+  std::vector<double> double_constants_;
+  std::vector<float> float_constants_;
+  std::vector<bool> bool_constants_;
+  std::vector<std::string> string_constants_;
+};
+
+}  // namespace wfa_virtual_people
+
+#endif  // SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_EVALUATOR_FIELD_FILTER_PROGRAM_H_
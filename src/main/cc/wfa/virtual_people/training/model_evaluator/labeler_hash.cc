@@ -0,0 +1,63 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "wfa/virtual_people/training/model_evaluator/labeler_hash.h"
+
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <string>
+
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
+#include "common_cpp/fingerprinters/fingerprinters.h"
+
+namespace wfa_virtual_people {
+
+uint64_t LabelerFingerprint64(absl::string_view seed) {
+  return wfa::GetFarmFingerprinter().Fingerprint(seed);
+}
+
+std::string GetEventSeed(absl::string_view random_seed,
+                         uint64_t acting_fingerprint) {
+  return absl::StrCat(random_seed, acting_fingerprint);
+}
+
+double GetUniformHash(SeedHashFunction hash, absl::string_view seed) {
+  return static_cast<double>(hash(seed)) /
+         static_cast<double>(std::numeric_limits<uint64_t>::max());
+}
+
+int SelectByConsistentHashing(SeedHashFunction hash, absl::string_view seed,
+                              absl::Span<const double> probabilities) {
+  int selected = -1;
+  double min_score = std::numeric_limits<double>::infinity();
+  for (int i = 0; i < probabilities.size(); ++i) {
+    if (probabilities[i] <= 0) {
+      continue;
+    }
+    const double score =
+        -std::log(GetUniformHash(
+            hash, absl::StrCat("consistent-hashing-", seed, "-", i))) /
+        probabilities[i];
+    if (selected < 0 || score < min_score) {
+      selected = i;
+      min_score = score;
+    }
+  }
+  return selected;
+}
+
+}  // namespace wfa_virtual_people
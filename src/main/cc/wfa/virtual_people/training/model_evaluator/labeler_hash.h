@@ -0,0 +1,56 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_EVALUATOR_LABELER_HASH_H_
+#define SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_EVALUATOR_LABELER_HASH_H_
+
+#include <cstdint>
+#include <string>
+
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
+
+namespace wfa_virtual_people {
+
+// The hash function of the seeds, from which the random choices of a model
+// are made. All the choices of ModelWalker and of the generated labeling
+// functions go through it, so the labeler's algorithm is replaced at a single
+// place.
+using SeedHashFunction = uint64_t (*)(absl::string_view seed);
+
+// Return the farmhash Fingerprint64 of @seed, which is the hash used by the
+// labeler.
+uint64_t LabelerFingerprint64(absl::string_view seed);
+
+// Return the seed of the choices made for an event with @acting_fingerprint,
+// by a node or an updater with @random_seed. This is the concatenation of
+// @random_seed and the decimal @acting_fingerprint, same as the labeler.
+std::string GetEventSeed(absl::string_view random_seed,
+                         uint64_t acting_fingerprint);
+
+// Return the hash of @seed as a double in [0, 1].
+double GetUniformHash(SeedHashFunction hash, absl::string_view seed);
+
+// Return the index of the choice selected for @seed with @probabilities, by
+// the distributed consistent hashing of the labeler: each choice i has the
+// score -log(GetUniformHash("consistent-hashing-<seed>-<i>")) / probability,
+// and the choice with the lowest score is selected. The probabilities need not
+// sum to 1, and the choices with probability 0 are never selected. Return -1
+// if all the probabilities are 0.
+int SelectByConsistentHashing(SeedHashFunction hash, absl::string_view seed,
+                              absl::Span<const double> probabilities);
+
+}  // namespace wfa_virtual_people
+
+#endif  // SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_EVALUATOR_LABELER_HASH_H_
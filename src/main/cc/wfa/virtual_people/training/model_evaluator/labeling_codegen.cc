@@ -0,0 +1,835 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "wfa/virtual_people/training/model_evaluator/labeling_codegen.h"
+
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/container/flat_hash_set.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/ascii.h"
+#include "absl/strings/escaping.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/str_join.h"
+#include "absl/strings/str_split.h"
+#include "absl/strings/string_view.h"
+#include "common_cpp/macros/macros.h"
+#include "google/protobuf/descriptor.h"
+#include "google/protobuf/message.h"
+#include "wfa/virtual_people/common/event.pb.h"
+#include "wfa/virtual_people/common/field_filter.pb.h"
+#include "wfa/virtual_people/common/model.pb.h"
+#include "wfa/virtual_people/training/model_evaluator/branch_action.h"
+#include "wfa/virtual_people/training/model_evaluator/model_walker.h"
+
+namespace wfa_virtual_people {
+
+namespace {
+
+using ::google::protobuf::Descriptor;
+using ::google::protobuf::FieldDescriptor;
+
+using FieldPath = std::vector<const FieldDescriptor*>;
+
+// The tolerance of the sum of the chances of a branch node, same as
+// ModelWalker.
+constexpr double kChanceSumTolerance = 1e-6;
+
+// The C++ expressions reading a field of LabelerEvent.
+struct FieldAccess {
+  const FieldDescriptor* field;
+  // True if the field and all its parent messages are set.
+  std::string has_expression;
+  // The value of the field. Enum values are converted to int.
+  std::string value_expression;
+};
+
+std::string GetStringLiteral(absl::string_view value) {
+  return absl::StrCat("\"", absl::CEscape(value), "\"");
+}
+
+absl::StatusOr<FieldPath> ResolvePath(const Descriptor* descriptor,
+                                      const FieldPath& prefix,
+                                      absl::string_view name) {
+  if (name.empty()) {
+    return absl::InvalidArgumentError("The name of the field is not set.");
+  }
+  FieldPath path = prefix;
+  for (absl::string_view part : absl::StrSplit(name, '.')) {
+    if (!descriptor) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("The field ", name, " is not in a message."));
+    }
+    const FieldDescriptor* field =
+        descriptor->FindFieldByName(std::string(part));
+    if (!field) {
+      return absl::InvalidArgumentError(absl::StrCat(
+          "The field ", part, " is not found in ", descriptor->full_name()));
+    }
+    if (field->is_repeated()) {
+      return absl::UnimplementedError(absl::StrCat(
+          "Repeated field is not supported: ", field->full_name()));
+    }
+    path.push_back(field);
+    descriptor = field->message_type();
+  }
+  return path;
+}
+
+FieldAccess GetFieldAccess(const FieldPath& path) {
+  std::string object = "event";
+  std::vector<std::string> has_expressions;
+  for (const FieldDescriptor* field : path) {
+    std::string accessor = absl::AsciiStrToLower(field->name());
+    has_expressions.push_back(absl::StrCat(object, ".has_", accessor, "()"));
+    absl::StrAppend(&object, ".", accessor, "()");
+  }
+  if (path.back()->cpp_type() == FieldDescriptor::CPPTYPE_ENUM) {
+    object = absl::StrCat("static_cast<int>(", object, ")");
+  }
+  return {path.back(), absl::StrJoin(has_expressions, " && "), object};
+}
+
+bool IsNumeric(const FieldDescriptor::CppType cpp_type) {
+  switch (cpp_type) {
+    case FieldDescriptor::CPPTYPE_INT32:
+    case FieldDescriptor::CPPTYPE_INT64:
+    case FieldDescriptor::CPPTYPE_UINT32:
+    case FieldDescriptor::CPPTYPE_UINT64:
+    case FieldDescriptor::CPPTYPE_FLOAT:
+    case FieldDescriptor::CPPTYPE_DOUBLE:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Whether the values of the fields of @cpp_type can be the case labels of a
+// switch on int64_t.
+bool IsSwitchable(const FieldDescriptor::CppType cpp_type) {
+  switch (cpp_type) {
+    case FieldDescriptor::CPPTYPE_INT32:
+    case FieldDescriptor::CPPTYPE_INT64:
+    case FieldDescriptor::CPPTYPE_UINT32:
+    case FieldDescriptor::CPPTYPE_ENUM:
+      return true;
+    default:
+      return false;
+  }
+}
+
+std::string GetInt64Literal(const int64_t value) {
+  if (value == std::numeric_limits<int64_t>::min()) {
+    return "(-9223372036854775807LL - 1)";
+  }
+  return absl::StrCat(value, "LL");
+}
+
+// Return the C++ literal of @value, parsed to the type of @field.
+absl::StatusOr<std::string> GetLiteral(const FieldDescriptor* field,
+                                       absl::string_view value) {
+  absl::Status parse_error = absl::InvalidArgumentError(
+      absl::StrCat("Invalid value ", value, " for ", field->full_name()));
+  switch (field->cpp_type()) {
+    case FieldDescriptor::CPPTYPE_INT32: {
+      int32_t parsed;
+      if (!absl::SimpleAtoi(value, &parsed)) return parse_error;
+      return GetInt64Literal(parsed);
+    }
+    case FieldDescriptor::CPPTYPE_INT64: {
+      int64_t parsed;
+      if (!absl::SimpleAtoi(value, &parsed)) return parse_error;
+      return GetInt64Literal(parsed);
+    }
+    case FieldDescriptor::CPPTYPE_UINT32: {
+      uint32_t parsed;
+      if (!absl::SimpleAtoi(value, &parsed)) return parse_error;
+      return absl::StrCat(parsed, "ULL");
+    }
+    case FieldDescriptor::CPPTYPE_UINT64: {
+      uint64_t parsed;
+      if (!absl::SimpleAtoi(value, &parsed)) return parse_error;
+      return absl::StrCat(parsed, "ULL");
+    }
+    case FieldDescriptor::CPPTYPE_FLOAT: {
+      float parsed;
+      if (!absl::SimpleAtof(value, &parsed)) return parse_error;
+      if (!std::isfinite(parsed)) {
+        return absl::UnimplementedError(absl::StrCat(
+            "Non-finite value is not supported: ", field->full_name()));
+      }
+      return absl::StrFormat("%af", parsed);
+    }
+    case FieldDescriptor::CPPTYPE_DOUBLE: {
+      double parsed;
+      if (!absl::SimpleAtod(value, &parsed)) return parse_error;
+      if (!std::isfinite(parsed)) {
+        return absl::UnimplementedError(absl::StrCat(
+            "Non-finite value is not supported: ", field->full_name()));
+      }
+      return absl::StrFormat("%a", parsed);
+    }
+    case FieldDescriptor::CPPTYPE_BOOL: {
+      bool parsed;
+      if (!absl::SimpleAtob(value, &parsed)) return parse_error;
+      return parsed ? "true" : "false";
+    }
+    case FieldDescriptor::CPPTYPE_ENUM: {
+      const google::protobuf::EnumValueDescriptor* enum_value =
+          field->enum_type()->FindValueByName(std::string(value));
+      if (!enum_value) return parse_error;
+      return GetInt64Literal(enum_value->number());
+    }
+    case FieldDescriptor::CPPTYPE_STRING:
+      return GetStringLiteral(value);
+    default:
+      return absl::InvalidArgumentError(
+          absl::StrCat("Cannot compare the value of ", field->full_name()));
+  }
+}
+
+// Return the literals of the values of an IN filter on @field.
+absl::StatusOr<std::vector<std::string>> GetInLiterals(
+    const FieldDescriptor* field, absl::string_view values) {
+  std::vector<std::string> literals;
+  for (absl::string_view value : absl::StrSplit(values, ',')) {
+    ASSIGN_OR_RETURN(literals.emplace_back(), GetLiteral(field, value));
+  }
+  return literals;
+}
+
+// Return the C++ expression of @filter, whose field names are relative to
+// @descriptor, which is reached from LabelerEvent by @prefix.
+absl::StatusOr<std::string> GetConditionExpression(
+    const FieldFilterProto& filter, const Descriptor* descriptor,
+    const FieldPath& prefix) {
+  switch (filter.op()) {
+    case FieldFilterProto::TRUE:
+      return std::string("true");
+    case FieldFilterProto::AND:
+    case FieldFilterProto::OR: {
+      if (filter.sub_filters_size() == 0) {
+        return absl::InvalidArgumentError(absl::StrCat(
+            "sub_filters must be set when op is ",
+            FieldFilterProto::Op_Name(filter.op()), ": ",
+            filter.DebugString()));
+      }
+      std::vector<std::string> expressions;
+      for (const FieldFilterProto& sub_filter : filter.sub_filters()) {
+        ASSIGN_OR_RETURN(
+            expressions.emplace_back(),
+            GetConditionExpression(sub_filter, descriptor, prefix));
+      }
+      const char* separator =
+          filter.op() == FieldFilterProto::AND ? " && " : " || ";
+      return absl::StrCat("(", absl::StrJoin(expressions, separator), ")");
+    }
+    case FieldFilterProto::NOT: {
+      if (filter.sub_filters_size() != 1) {
+        return absl::InvalidArgumentError(absl::StrCat(
+            "NOT requires exactly one sub_filter: ", filter.DebugString()));
+      }
+      ASSIGN_OR_RETURN(
+          std::string expression,
+          GetConditionExpression(filter.sub_filters(0), descriptor, prefix));
+      return absl::StrCat("!", expression);
+    }
+    case FieldFilterProto::PARTIAL: {
+      ASSIGN_OR_RETURN(FieldPath path,
+                       ResolvePath(descriptor, prefix, filter.name()));
+      const Descriptor* sub_descriptor = path.back()->message_type();
+      if (!sub_descriptor) {
+        return absl::InvalidArgumentError(absl::StrCat(
+            "PARTIAL requires a message field: ", filter.DebugString()));
+      }
+      std::vector<std::string> expressions = {
+          GetFieldAccess(path).has_expression};
+      for (const FieldFilterProto& sub_filter : filter.sub_filters()) {
+        ASSIGN_OR_RETURN(
+            expressions.emplace_back(),
+            GetConditionExpression(sub_filter, sub_descriptor, path));
+      }
+      return absl::StrCat("(", absl::StrJoin(expressions, " && "), ")");
+    }
+    case FieldFilterProto::HAS: {
+      ASSIGN_OR_RETURN(FieldPath path,
+                       ResolvePath(descriptor, prefix, filter.name()));
+      return absl::StrCat("(", GetFieldAccess(path).has_expression, ")");
+    }
+    case FieldFilterProto::EQUAL:
+    case FieldFilterProto::GT:
+    case FieldFilterProto::LT: {
+      ASSIGN_OR_RETURN(FieldPath path,
+                       ResolvePath(descriptor, prefix, filter.name()));
+      FieldAccess access = GetFieldAccess(path);
+      const char* comparison = " == ";
+      if (filter.op() != FieldFilterProto::EQUAL) {
+        if (!IsNumeric(access.field->cpp_type())) {
+          return absl::InvalidArgumentError(absl::StrCat(
+              "GT and LT require a numeric field: ", filter.DebugString()));
+        }
+        comparison = filter.op() == FieldFilterProto::GT ? " > " : " < ";
+      }
+      ASSIGN_OR_RETURN(std::string literal,
+                       GetLiteral(access.field, filter.value()));
+      return absl::StrCat("(", access.has_expression, " && ",
+                          access.value_expression, comparison, literal, ")");
+    }
+    case FieldFilterProto::IN: {
+      ASSIGN_OR_RETURN(FieldPath path,
+                       ResolvePath(descriptor, prefix, filter.name()));
+      FieldAccess access = GetFieldAccess(path);
+      ASSIGN_OR_RETURN(std::vector<std::string> literals,
+                       GetInLiterals(access.field, filter.value()));
+      std::vector<std::string> comparisons;
+      for (const std::string& literal : literals) {
+        comparisons.push_back(
+            absl::StrCat(access.value_expression, " == ", literal));
+      }
+      return absl::StrCat("(", access.has_expression, " && (",
+                          absl::StrJoin(comparisons, " || "), "))");
+    }
+    case FieldFilterProto::REGEXP:
+    case FieldFilterProto::ANY_IN:
+      return absl::UnimplementedError(
+          absl::StrCat("Op is not supported by code generation: ",
+                       FieldFilterProto::Op_Name(filter.op())));
+    default:
+      return absl::InvalidArgumentError(
+          absl::StrCat("Invalid op: ", filter.DebugString()));
+  }
+}
+
+// If @condition is EQUAL or IN on an integer or enum field of LabelerEvent,
+// return the field.
+const FieldDescriptor* GetSwitchField(const FieldFilterProto& condition) {
+  if (condition.op() != FieldFilterProto::EQUAL &&
+      condition.op() != FieldFilterProto::IN) {
+    return nullptr;
+  }
+  absl::StatusOr<FieldPath> path =
+      ResolvePath(LabelerEvent::descriptor(), {}, condition.name());
+  if (!path.ok() || !IsSwitchable(path->back()->cpp_type())) {
+    return nullptr;
+  }
+  return path->back();
+}
+
+bool IsValidIdentifier(absl::string_view name) {
+  if (name.empty() || absl::ascii_isdigit(name[0])) {
+    return false;
+  }
+  for (char c : name) {
+    if (!absl::ascii_isalnum(c) && c != '_') {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Whether @node or any of its nested descendants has attribute updates or
+// multiplicity.
+bool UpdatesEvents(const CompiledNode& node) {
+  if (!node.has_branch_node()) {
+    return false;
+  }
+  const BranchNode& branch_node = node.branch_node();
+  if (branch_node.has_updates() || branch_node.has_multiplicity()) {
+    return true;
+  }
+  for (const BranchNode::Branch& branch : branch_node.branches()) {
+    if (branch.has_node() && UpdatesEvents(branch.node())) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Return the C++ definition of a constant string_view named @name, with the
+// serialized @config.
+std::string GetSerializedConfigDefinition(
+    absl::string_view name, const google::protobuf::Message& config) {
+  const std::string serialized = config.SerializeAsString();
+  return absl::StrCat("constexpr absl::string_view ", name, "(\n    ",
+                      GetStringLiteral(serialized), ", ", serialized.size(),
+                      ");\n\n");
+}
+
+// Generates the code of the nodes of a model. Each node is numbered by its
+// position in preorder, same as ModelWalker, and its code is a block labeled
+// node_<position>.
+//
+// The code is split into walk functions. Function 0 walks events from the
+// root. Each branch node with multiplicity has a function walking each clone
+// from the selection of a child, which contains the code of the descendants of
+// the node.
+// The nodes of an update tree are in the function of their branch node, and
+// the stop nodes of the tree go back to the label after the goto to its root.
+class LabelingCodeGenerator {
+ public:
+  explicit LabelingCodeGenerator(bool updates_events);
+
+  // Generate the code of @node and its descendants in the walk function
+  // @function, and return the position of @node. @update_tree_end is the label
+  // the stop nodes go to, if @node is in an update tree, and empty otherwise.
+  absl::StatusOr<int> AddNode(const CompiledNode& node, int function,
+                              absl::string_view update_tree_end);
+
+  std::string GetSource(const CompiledNode& root,
+                        absl::string_view function_name) const;
+
+ private:
+  struct WalkFunction {
+    std::string name;
+    // The code of the nodes, in order.
+    std::vector<std::string> code;
+  };
+
+  void AddPopulationNodeCode(int position, const PopulationNode& node,
+                             std::string& code);
+
+  absl::Status AddUpdatesCode(int position, const CompiledNode& node,
+                              int function, absl::string_view update_tree_end,
+                              std::string& code);
+
+  absl::Status AddConditionBranchesCode(const CompiledNode& node,
+                                        const std::vector<int>& children,
+                                        std::string& code) const;
+
+  // Whether the model has attribute updates or multiplicity. If so, the walk
+  // functions take a mutable event, and read the fingerprint from the event
+  // after the updates.
+  const bool updates_events_;
+  // The C++ expression of the acting fingerprint of the event.
+  const std::string fingerprint_;
+  int node_count_ = 0;
+  std::vector<WalkFunction> functions_;
+  // The constant tables of the chances and the pools, and the serialized
+  // configs of the attribute updates and the multiplicity.
+  std::string tables_;
+};
+
+LabelingCodeGenerator::LabelingCodeGenerator(const bool updates_events)
+    : updates_events_(updates_events),
+      fingerprint_(updates_events ? "event.acting_fingerprint()"
+                                  : "fingerprint") {
+  functions_.push_back({"WalkFromRoot", {}});
+}
+
+void LabelingCodeGenerator::AddPopulationNodeCode(int position,
+                                                  const PopulationNode& node,
+                                                  std::string& code) {
+  std::vector<std::pair<uint64_t, uint64_t>> pools;
+  uint64_t total_population = 0;
+  for (const PopulationNode::VirtualPersonPool& pool : node.pools()) {
+    if (pool.total_population() > 0) {
+      pools.emplace_back(pool.population_offset(), pool.total_population());
+      total_population += pool.total_population();
+    }
+  }
+  if (pools.empty()) {
+    return;
+  }
+  std::string hash =
+      absl::StrCat("hash(GetEventSeed(", GetStringLiteral(node.random_seed()),
+                   ", ", fingerprint_, "))");
+  if (pools.size() == 1) {
+    absl::StrAppend(&code, "  leaf.virtual_person_id =\n      ",
+                    pools[0].first, "ULL + ", hash, " % ", total_population,
+                    "ULL;\n");
+    return;
+  }
+  std::string table = absl::StrCat("kPools", position);
+  absl::StrAppend(&tables_, "constexpr PoolRange ", table, "[] = {\n");
+  for (const auto& [offset, size] : pools) {
+    absl::StrAppend(&tables_, "    {", offset, "ULL, ", size, "ULL},\n");
+  }
+  absl::StrAppend(&tables_, "};\n\n");
+  absl::StrAppend(&code, "  {\n    uint64_t id = ", hash, " % ",
+                  total_population, "ULL;\n",
+                  "    for (const PoolRange& pool : ", table, ") {\n",
+                  "      if (id < pool.size) {\n",
+                  "        leaf.virtual_person_id = pool.offset + id;\n",
+                  "        break;\n",
+                  "      }\n",
+                  "      id -= pool.size;\n",
+                  "    }\n",
+                  "  }\n");
+}
+
+absl::Status LabelingCodeGenerator::AddUpdatesCode(
+    const int position, const CompiledNode& node, const int function,
+    absl::string_view update_tree_end, std::string& code) {
+  const BranchNode::AttributesUpdaters& updates =
+      node.branch_node().updates();
+  for (int i = 0; i < updates.updates_size(); ++i) {
+    const BranchNode::AttributesUpdater& config = updates.updates(i);
+    if (config.has_update_tree()) {
+      if (!config.update_tree().has_root()) {
+        return absl::InvalidArgumentError(absl::StrCat(
+            "The root of the update tree is not set: ", node.name()));
+      }
+      // The stop nodes of the tree go back to the label after the goto.
+      std::string end_label = absl::StrCat("node_", position, "_update_", i);
+      absl::StrAppend(&code, "  goto node_", node_count_, ";\n", end_label,
+                      ":\n");
+      RETURN_IF_ERROR(
+          AddNode(config.update_tree().root(), function, end_label).status());
+      continue;
+    }
+    // The updater is created at generation time only to validate the config.
+    absl::StatusOr<std::unique_ptr<AttributesUpdater>> updater =
+        AttributesUpdater::New(config);
+    if (!updater.ok()) {
+      return absl::Status(
+          updater.status().code(),
+          absl::StrCat(updater.status().message(), " at ", node.name()));
+    }
+    std::string config_name = absl::StrCat("kUpdater", position, "_", i);
+    absl::StrAppend(&tables_,
+                    GetSerializedConfigDefinition(config_name, config));
+    absl::StrAppend(&code, "  {\n",
+                    "    static const AttributesUpdater* const updater =\n",
+                    "        NewUpdater(", config_name, ");\n",
+                    "    const absl::Status status = "
+                    "updater->Update(hash, event);\n",
+                    "    if (!status.ok()) return AtNode(status, ",
+                    GetStringLiteral(node.name()), ");\n",
+                    "  }\n");
+  }
+  return absl::OkStatus();
+}
+
+absl::Status LabelingCodeGenerator::AddConditionBranchesCode(
+    const CompiledNode& node, const std::vector<int>& children,
+    std::string& code) const {
+  const BranchNode& branch_node = node.branch_node();
+  // The leading branches with EQUAL or IN conditions on the same field are
+  // compiled to a switch.
+  int switch_end = 0;
+  const FieldDescriptor* switch_field =
+      GetSwitchField(branch_node.branches(0).condition());
+  if (switch_field) {
+    switch_end = 1;
+    while (switch_end < branch_node.branches_size() &&
+           branch_node.branches(switch_end).condition().name() ==
+               branch_node.branches(0).condition().name() &&
+           GetSwitchField(branch_node.branches(switch_end).condition())) {
+      ++switch_end;
+    }
+  }
+  if (switch_end < 2) {
+    switch_end = 0;
+  }
+  if (switch_end > 0) {
+    ASSIGN_OR_RETURN(FieldPath path,
+                     ResolvePath(LabelerEvent::descriptor(), {},
+                                 branch_node.branches(0).condition().name()));
+    FieldAccess access = GetFieldAccess(path);
+    absl::StrAppend(&code, "  if (", access.has_expression, ") {\n",
+                    "    switch (static_cast<int64_t>(",
+                    access.value_expression, ")) {\n");
+    // A value is selected by the first branch with it.
+    absl::flat_hash_set<std::string> seen_literals;
+    for (int i = 0; i < switch_end; ++i) {
+      const FieldFilterProto& condition = branch_node.branches(i).condition();
+      std::vector<std::string> literals;
+      if (condition.op() == FieldFilterProto::EQUAL) {
+        ASSIGN_OR_RETURN(literals.emplace_back(),
+                         GetLiteral(switch_field, condition.value()));
+      } else {
+        ASSIGN_OR_RETURN(literals,
+                         GetInLiterals(switch_field, condition.value()));
+      }
+      bool has_case = false;
+      for (const std::string& literal : literals) {
+        if (seen_literals.insert(literal).second) {
+          absl::StrAppend(&code, "      case ", literal, ":\n");
+          has_case = true;
+        }
+      }
+      if (has_case) {
+        absl::StrAppend(&code, "        goto node_", children[i], ";\n");
+      }
+    }
+    absl::StrAppend(&code, "    }\n  }\n");
+  }
+  for (int i = switch_end; i < branch_node.branches_size(); ++i) {
+    ASSIGN_OR_RETURN(std::string expression,
+                     GetConditionExpression(branch_node.branches(i).condition(),
+                                            LabelerEvent::descriptor(), {}));
+    absl::StrAppend(&code, "  if (", expression, ") goto node_", children[i],
+                    ";\n");
+  }
+  absl::StrAppend(&code, "  return absl::InvalidArgumentError(",
+                  GetStringLiteral(absl::StrCat(
+                      "No condition matches the event at ", node.name())),
+                  ");\n");
+  return absl::OkStatus();
+}
+
+absl::StatusOr<int> LabelingCodeGenerator::AddNode(
+    const CompiledNode& node, const int function,
+    absl::string_view update_tree_end) {
+  const int position = node_count_++;
+  // The code is accessed by index, as adding the child nodes may reallocate
+  // functions_.
+  const int code_index = functions_[function].code.size();
+  functions_[function].code.emplace_back();
+  std::string code;
+  // The root is not the target of any goto.
+  if (position > 0) {
+    absl::StrAppend(&code, "node_", position, ":\n");
+  }
+  absl::StrAppend(&code, "  ++result.depth;\n");
+  if (node.has_population_node() && !update_tree_end.empty()) {
+    return absl::UnimplementedError(absl::StrCat(
+        "Population node in an update tree is not supported: ", node.name()));
+  }
+  if (node.has_stop_node() && !update_tree_end.empty()) {
+    absl::StrAppend(&code, "  goto ", update_tree_end, ";\n");
+    functions_[function].code[code_index] = std::move(code);
+    return position;
+  }
+  if (node.has_population_node() || node.has_stop_node()) {
+    // The leaf is in a block, as the gotos cannot cross its initialization.
+    absl::StrAppend(&code, "  {\n", "  WalkResult::Leaf& leaf = ",
+                    "result.leaves.emplace_back();\n", "  leaf.name = ",
+                    GetStringLiteral(node.name()), ";\n");
+    if (node.has_population_node()) {
+      AddPopulationNodeCode(position, node.population_node(), code);
+    }
+    absl::StrAppend(&code, "  }\n  return absl::OkStatus();\n");
+    functions_[function].code[code_index] = std::move(code);
+    return position;
+  }
+  if (!node.has_branch_node()) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("The type of the node is not set: ", node.name()));
+  }
+  const BranchNode& branch_node = node.branch_node();
+  if (branch_node.branches_size() == 0) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("The branch node has no branches: ", node.name()));
+  }
+  // The update trees are numbered before the children, same as ModelWalker.
+  RETURN_IF_ERROR(
+      AddUpdatesCode(position, node, function, update_tree_end, code));
+  // The children of a node with multiplicity are in the walk function of its
+  // clones, which starts with the selection of a child.
+  int child_function = function;
+  if (branch_node.has_multiplicity()) {
+    if (!update_tree_end.empty()) {
+      return absl::UnimplementedError(absl::StrCat(
+          "Multiplicity in an update tree is not supported: ", node.name()));
+    }
+    // The multiplicity is created at generation time only to validate the
+    // config.
+    absl::StatusOr<EventMultiplicity> multiplicity =
+        EventMultiplicity::Create(branch_node.multiplicity());
+    if (!multiplicity.ok()) {
+      return absl::Status(multiplicity.status().code(),
+                          absl::StrCat(multiplicity.status().message(), " at ",
+                                       node.name()));
+    }
+    std::string config_name = absl::StrCat("kMultiplicity", position);
+    absl::StrAppend(&tables_, GetSerializedConfigDefinition(
+                                  config_name, branch_node.multiplicity()));
+    child_function = functions_.size();
+    functions_.push_back(
+        {absl::StrCat("WalkCloneFromNode", position), {std::string()}});
+    absl::StrAppend(
+        &code, "  {\n",
+        "    static const EventMultiplicity* const multiplicity =\n",
+        "        NewMultiplicity(", config_name, ");\n",
+        "    const absl::StatusOr<int> clone_count =\n",
+        "        multiplicity->GetCloneCount(hash, event);\n",
+        "    if (!clone_count.ok()) return clone_count.status();\n",
+        "    for (int i = 0; i < *clone_count; ++i) {\n",
+        "      LabelerEvent clone = event;\n",
+        "      multiplicity->SetClone(hash, i, clone);\n",
+        "      const absl::Status status = ", functions_[child_function].name,
+        "(clone, hash, result);\n",
+        "      if (!status.ok()) return status;\n",
+        "    }\n",
+        "  }\n",
+        "  return absl::OkStatus();\n");
+    functions_[function].code[code_index] = std::move(code);
+    code.clear();
+  }
+  const bool select_by_chance = branch_node.branches(0).has_chance();
+  std::vector<int> children;
+  std::vector<std::string> chances;
+  double chance_sum = 0;
+  for (const BranchNode::Branch& branch : branch_node.branches()) {
+    if (select_by_chance != branch.has_chance() ||
+        (!branch.has_chance() && !branch.has_condition())) {
+      return absl::InvalidArgumentError(absl::StrCat(
+          "All branches must be selected by chance, or all by condition: ",
+          node.name()));
+    }
+    if (!branch.has_node()) {
+      return absl::UnimplementedError(absl::StrCat(
+          "Only nested child nodes are supported: ", node.name()));
+    }
+    if (select_by_chance) {
+      chance_sum += branch.chance();
+      chances.push_back(absl::StrFormat("%a", branch.chance()));
+    }
+    ASSIGN_OR_RETURN(children.emplace_back(),
+                     AddNode(branch.node(), child_function, update_tree_end));
+  }
+  if (select_by_chance) {
+    if (std::abs(chance_sum - 1) > kChanceSumTolerance) {
+      return absl::InvalidArgumentError(absl::StrCat(
+          "The chances of the branches do not sum to 1: ", node.name()));
+    }
+    std::string table = absl::StrCat("kChances", position);
+    absl::StrAppend(&tables_, "constexpr double ", table, "[] = {",
+                    absl::StrJoin(chances, ", "), "};\n\n");
+    absl::StrAppend(&code, "  switch (SelectByConsistentHashing(\n",
+                    "      hash, GetEventSeed(",
+                    GetStringLiteral(branch_node.random_seed()), ", ",
+                    fingerprint_, "), ", table, ")) {\n");
+    for (int i = 0; i + 1 < children.size(); ++i) {
+      absl::StrAppend(&code, "    case ", i, ":\n      goto node_", children[i],
+                      ";\n");
+    }
+    absl::StrAppend(&code, "    default:\n      goto node_", children.back(),
+                    ";\n  }\n");
+  } else {
+    RETURN_IF_ERROR(AddConditionBranchesCode(node, children, code));
+  }
+  if (child_function != function) {
+    functions_[child_function].code[0] = std::move(code);
+  } else {
+    functions_[function].code[code_index] = std::move(code);
+  }
+  return position;
+}
+
+std::string LabelingCodeGenerator::GetSource(
+    const CompiledNode& root, absl::string_view function_name) const {
+  std::string source = absl::StrCat(
+      "// Generated by labeling_codegen from the model ",
+      absl::CEscape(root.name()), ".\n// DO NOT EDIT.\n\n",
+      "#include <cstdint>\n\n",
+      "#include \"absl/status/status.h\"\n",
+      "#include \"absl/status/statusor.h\"\n");
+  if (updates_events_) {
+    absl::StrAppend(&source, "#include \"absl/strings/str_cat.h\"\n",
+                    "#include \"absl/strings/string_view.h\"\n");
+  }
+  absl::StrAppend(&source, "#include \"wfa/virtual_people/common/event.pb.h\"\n");
+  if (updates_events_) {
+    absl::StrAppend(&source,
+                    "#include \"wfa/virtual_people/common/model.pb.h\"\n",
+                    "#include \"wfa/virtual_people/training/model_evaluator/"
+                    "branch_action.h\"\n");
+  }
+  absl::StrAppend(&source,
+                  "#include \"wfa/virtual_people/training/model_evaluator/"
+                  "labeler_hash.h\"\n",
+                  "#include \"wfa/virtual_people/training/model_evaluator/"
+                  "model_walker.h\"\n\n",
+                  "namespace wfa_virtual_people {\n\n", "namespace {\n\n");
+  if (!tables_.empty()) {
+    absl::StrAppend(&source, "struct PoolRange {\n", "  uint64_t offset;\n",
+                    "  uint64_t size;\n", "};\n\n", tables_);
+  }
+  const char* event_type = "const LabelerEvent&";
+  if (updates_events_) {
+    event_type = "LabelerEvent&";
+    absl::StrAppend(
+        &source,
+        "absl::Status AtNode(const absl::Status& status,\n",
+        "                    absl::string_view node_name) {\n",
+        "  return absl::Status(status.code(),\n",
+        "                      absl::StrCat(status.message(), \" at \", "
+        "node_name));\n",
+        "}\n\n",
+        "// The configs are validated by the code generator.\n",
+        "const AttributesUpdater* NewUpdater(absl::string_view config) {\n",
+        "  BranchNode::AttributesUpdater updater;\n",
+        "  updater.ParseFromArray(config.data(), config.size());\n",
+        "  return AttributesUpdater::New(updater).value().release();\n",
+        "}\n\n",
+        "const EventMultiplicity* NewMultiplicity(absl::string_view config) "
+        "{\n",
+        "  Multiplicity multiplicity;\n",
+        "  multiplicity.ParseFromArray(config.data(), config.size());\n",
+        "  return new EventMultiplicity(\n",
+        "      EventMultiplicity::Create(multiplicity).value());\n",
+        "}\n\n");
+  }
+  // The walk functions of the clones are defined before their callers.
+  for (auto function = functions_.rbegin(); function != functions_.rend();
+       ++function) {
+    absl::StrAppend(&source, "absl::Status ", function->name, "(", event_type,
+                    " event, SeedHashFunction hash,\n",
+                    "    WalkResult& result) {\n");
+    if (!updates_events_) {
+      absl::StrAppend(&source,
+                      "  [[maybe_unused]] const uint64_t fingerprint = "
+                      "event.acting_fingerprint();\n");
+    }
+    for (const std::string& code : function->code) {
+      absl::StrAppend(&source, code);
+    }
+    absl::StrAppend(&source, "}\n\n");
+  }
+  absl::StrAppend(&source, "}  // namespace\n\n", "absl::StatusOr<WalkResult> ",
+                  function_name,
+                  "(const LabelerEvent& event, SeedHashFunction hash) {\n",
+                  "  WalkResult result;\n");
+  if (updates_events_) {
+    absl::StrAppend(&source, "  LabelerEvent updated_event = event;\n",
+                    "  const absl::Status status =\n",
+                    "      WalkFromRoot(updated_event, hash, result);\n");
+  } else {
+    absl::StrAppend(&source,
+                    "  const absl::Status status = "
+                    "WalkFromRoot(event, hash, result);\n");
+  }
+  absl::StrAppend(&source, "  if (!status.ok()) return status;\n",
+                  "  return result;\n",
+                  "}\n\n}  // namespace wfa_virtual_people\n");
+  return source;
+}
+
+}  // namespace
+
+absl::StatusOr<std::string> GenerateLabelingFunction(
+    const CompiledNode& root, absl::string_view function_name) {
+  if (!IsValidIdentifier(function_name)) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Invalid function name: ", function_name));
+  }
+  LabelingCodeGenerator generator(UpdatesEvents(root));
+  RETURN_IF_ERROR(
+      generator.AddNode(root, /*function=*/0, /*update_tree_end=*/"")
+          .status());
+  return generator.GetSource(root, function_name);
+}
+
+}  // namespace wfa_virtual_people
@@ -0,0 +1,56 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_EVALUATOR_LABELING_CODEGEN_H_
+#define SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_EVALUATOR_LABELING_CODEGEN_H_
+
+#include <string>
+
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+#include "wfa/virtual_people/common/model.pb.h"
+
+namespace wfa_virtual_people {
+
+// Return the C++ source of a function specialized for the model @root, with
+// the signature
+//   absl::StatusOr<WalkResult> <function_name>(const LabelerEvent& event,
+//                                              SeedHashFunction hash)
+// in namespace wfa_virtual_people. The function returns the same results as
+// ModelWalker created with @hash for the model, without interpreting the model
+// at run time:
+// * Each node is a block of code, and the selected child is reached by goto.
+// * Conditions are inlined as expressions on the generated accessors of
+//   LabelerEvent. Consecutive EQUAL or IN conditions on the same integer or
+//   enum field are compiled to a switch statement.
+// * The chances of each branch node and the pools of each population node are
+//   constant tables.
+// * The attribute updaters and the multiplicity are created from their
+//   serialized configs on first use. The nodes of an update tree are blocks of
+//   code, and its stop nodes go back to the branch node with the updates.
+// * The clones of an event by a branch node with multiplicity are walked by a
+//   function, with the code of the descendants of the node.
+//
+// The generated source depends on model_walker.h, labeler_hash.h and the
+// LabelerEvent proto, and on branch_action.h and the model proto if the model
+// has attribute updates or multiplicity.
+// Returns error status if the model is not supported by ModelWalker, or has
+// multiplicity in an update tree, or the conditions use REGEXP, ANY_IN,
+// repeated fields, or non-finite values.
+absl::StatusOr<std::string> GenerateLabelingFunction(
+    const CompiledNode& root, absl::string_view function_name);
+
+}  // namespace wfa_virtual_people
+
+#endif  // SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_EVALUATOR_LABELING_CODEGEN_H_
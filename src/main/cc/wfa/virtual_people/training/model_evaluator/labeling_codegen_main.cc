@@ -0,0 +1,76 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// This is a tool to generate a C++ labeling function specialized for a model.
+// The input model is a CompiledNode in textproto, with nested child nodes.
+// The output is a C++ source file defining
+//   absl::StatusOr<WalkResult> <function_name>(const LabelerEvent& event,
+//                                              SeedHashFunction hash)
+// in namespace wfa_virtual_people, which returns the same results as
+// ModelWalker.
+// Example usage:
+// bazel build -c opt \
+// //src/main/cc/wfa/virtual_people/training/model_evaluator:\
+// labeling_codegen_main
+// bazel-bin/src/main/cc/wfa/virtual_people/training/model_evaluator/\
+// labeling_codegen_main \
+// --model_path=/tmp/model_compiler/model.textproto \
+// --function_name=LabelModel \
+// --output_path=/tmp/model_compiler/label_model.cc
+
+#include <fstream>
+#include <string>
+
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "common_cpp/protobuf_util/textproto_io.h"
+#include "glog/logging.h"
+#include "wfa/virtual_people/common/model.pb.h"
+#include "wfa/virtual_people/training/model_evaluator/labeling_codegen.h"
+
+ABSL_FLAG(std::string, model_path, "",
+          "Path to the input CompiledNode textproto.");
+ABSL_FLAG(std::string, function_name, "",
+          "Name of the generated function.");
+ABSL_FLAG(std::string, output_path, "",
+          "Path to the output C++ source file.");
+
+int main(int argc, char** argv) {
+  absl::ParseCommandLine(argc, argv);
+  google::InitGoogleLogging(argv[0]);
+
+  std::string model_path = absl::GetFlag(FLAGS_model_path);
+  CHECK(!model_path.empty()) << "model_path is not set.";
+  std::string function_name = absl::GetFlag(FLAGS_function_name);
+  CHECK(!function_name.empty()) << "function_name is not set.";
+  std::string output_path = absl::GetFlag(FLAGS_output_path);
+  CHECK(!output_path.empty()) << "output_path is not set.";
+
+  wfa_virtual_people::CompiledNode root;
+  absl::Status read_status = wfa::ReadTextProtoFile(model_path, root);
+  CHECK(read_status.ok()) << read_status;
+
+  absl::StatusOr<std::string> source =
+      wfa_virtual_people::GenerateLabelingFunction(root, function_name);
+  CHECK(source.ok()) << source.status();
+
+  std::ofstream output_file(output_path);
+  CHECK(output_file.is_open()) << "Failed to open " << output_path;
+  output_file << *source;
+  output_file.close();
+  CHECK(output_file.good()) << "Failed to write " << output_path;
+  return 0;
+}
@@ -0,0 +1,348 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "wfa/virtual_people/training/model_evaluator/model_walker.h"
+
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "absl/container/flat_hash_set.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "common_cpp/macros/macros.h"
+#include "wfa/virtual_people/common/event.pb.h"
+#include "wfa/virtual_people/common/model.pb.h"
+#include "wfa/virtual_people/training/model_evaluator/branch_action.h"
+#include "wfa/virtual_people/training/model_evaluator/labeler_hash.h"
+
+namespace wfa_virtual_people {
+
+namespace {
+
+// The tolerance of the sum of the chances of a branch node.
+constexpr double kChanceSumTolerance = 1e-6;
+
+}  // namespace
+
+absl::StatusOr<ModelWalker> ModelWalker::Create(const CompiledNode& root,
+                                                SeedHashFunction hash) {
+  ModelWalker walker(hash);
+  IndexedNodes indexed_nodes;
+  RETURN_IF_ERROR(walker.AddNode(root, indexed_nodes).status());
+  return walker;
+}
+
+namespace {
+
+// Add the node indexes referenced by @node and its nested descendants to
+// @referenced_indexes.
+void AddReferencedIndexes(const CompiledNode& node,
+                          absl::flat_hash_set<uint32_t>& referenced_indexes) {
+  if (!node.has_branch_node()) {
+    return;
+  }
+  for (const BranchNode::Branch& branch : node.branch_node().branches()) {
+    if (branch.has_node_index()) {
+      referenced_indexes.insert(branch.node_index());
+    } else if (branch.has_node()) {
+      AddReferencedIndexes(branch.node(), referenced_indexes);
+    }
+  }
+}
+
+}  // namespace
+
+absl::StatusOr<ModelWalker> ModelWalker::Create(
+    const std::vector<CompiledNode>& nodes, SeedHashFunction hash) {
+  IndexedNodes indexed_nodes;
+  absl::flat_hash_set<uint32_t> referenced_indexes;
+  for (const CompiledNode& node : nodes) {
+    if (node.has_index() &&
+        !indexed_nodes.nodes.emplace(node.index(), &node).second) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("Duplicated node index: ", node.index()));
+    }
+    AddReferencedIndexes(node, referenced_indexes);
+  }
+  const CompiledNode* root = nullptr;
+  for (const CompiledNode& node : nodes) {
+    if (node.has_index() && referenced_indexes.contains(node.index())) {
+      continue;
+    }
+    if (root) {
+      return absl::InvalidArgumentError(absl::StrCat(
+          "Only 1 root node is expected, got ", root->name(), " and ",
+          node.name()));
+    }
+    root = &node;
+  }
+  if (!root) {
+    return absl::InvalidArgumentError("No root node is found.");
+  }
+  ModelWalker walker(hash);
+  if (root->has_index()) {
+    RETURN_IF_ERROR(
+        walker.AddIndexedNode(root->index(), indexed_nodes).status());
+  } else {
+    RETURN_IF_ERROR(walker.AddNode(*root, indexed_nodes).status());
+  }
+  return walker;
+}
+
+absl::StatusOr<int> ModelWalker::AddIndexedNode(uint32_t index,
+                                                IndexedNodes& indexed_nodes) {
+  if (indexed_nodes.in_progress.contains(index)) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("The node references have a cycle at index ", index));
+  }
+  auto position_it = indexed_nodes.positions.find(index);
+  if (position_it != indexed_nodes.positions.end()) {
+    return position_it->second;
+  }
+  auto node_it = indexed_nodes.nodes.find(index);
+  if (node_it == indexed_nodes.nodes.end()) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("The node_index is not found: ", index));
+  }
+  indexed_nodes.in_progress.insert(index);
+  ASSIGN_OR_RETURN(int position, AddNode(*node_it->second, indexed_nodes));
+  indexed_nodes.in_progress.erase(index);
+  indexed_nodes.positions[index] = position;
+  return position;
+}
+
+absl::StatusOr<int> ModelWalker::AddNode(const CompiledNode& node,
+                                         IndexedNodes& indexed_nodes,
+                                         const bool in_update_tree) {
+  // The node is accessed by position, as adding the child nodes may reallocate
+  // nodes_.
+  const int position = nodes_.size();
+  nodes_.emplace_back();
+  nodes_[position].name = node.name();
+  nodes_[position].in_update_tree = in_update_tree;
+  if (node.has_population_node()) {
+    if (in_update_tree) {
+      return absl::UnimplementedError(absl::StrCat(
+          "Population node in an update tree is not supported: ",
+          node.name()));
+    }
+    const PopulationNode& population_node = node.population_node();
+    nodes_[position].random_seed = population_node.random_seed();
+    for (const PopulationNode::VirtualPersonPool& pool :
+         population_node.pools()) {
+      nodes_[position].pools.push_back(
+          {pool.population_offset(), pool.total_population()});
+      nodes_[position].total_population += pool.total_population();
+    }
+    return position;
+  }
+  if (node.has_stop_node()) {
+    return position;
+  }
+  if (!node.has_branch_node()) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("The type of the node is not set: ", node.name()));
+  }
+  const BranchNode& branch_node = node.branch_node();
+  if (branch_node.branches_size() == 0) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("The branch node has no branches: ", node.name()));
+  }
+  if (branch_node.has_updates()) {
+    updates_events_ = true;
+    for (const BranchNode::AttributesUpdater& config :
+         branch_node.updates().updates()) {
+      Update update;
+      if (config.has_update_tree()) {
+        if (!config.update_tree().has_root()) {
+          return absl::InvalidArgumentError(absl::StrCat(
+              "The root of the update tree is not set: ", node.name()));
+        }
+        ASSIGN_OR_RETURN(update.tree_root,
+                         AddNode(config.update_tree().root(), indexed_nodes,
+                                 /*in_update_tree=*/true));
+      } else {
+        absl::StatusOr<std::unique_ptr<AttributesUpdater>> updater =
+            AttributesUpdater::New(config);
+        if (!updater.ok()) {
+          return absl::Status(updater.status().code(),
+                              absl::StrCat(updater.status().message(),
+                                           " at ", node.name()));
+        }
+        update.updater = *std::move(updater);
+      }
+      nodes_[position].updates.push_back(std::move(update));
+    }
+  } else if (branch_node.has_multiplicity()) {
+    updates_events_ = true;
+    absl::StatusOr<EventMultiplicity> multiplicity =
+        EventMultiplicity::Create(branch_node.multiplicity());
+    if (!multiplicity.ok()) {
+      return absl::Status(multiplicity.status().code(),
+                          absl::StrCat(multiplicity.status().message(), " at ",
+                                       node.name()));
+    }
+    nodes_[position].multiplicity = *std::move(multiplicity);
+  }
+  nodes_[position].random_seed = branch_node.random_seed();
+  const bool select_by_chance = branch_node.branches(0).has_chance();
+  double chance_sum = 0;
+  for (const BranchNode::Branch& branch : branch_node.branches()) {
+    if (select_by_chance != branch.has_chance() ||
+        (!branch.has_chance() && !branch.has_condition())) {
+      return absl::InvalidArgumentError(absl::StrCat(
+          "All branches must be selected by chance, or all by condition: ",
+          node.name()));
+    }
+    if (!branch.has_node() && !branch.has_node_index()) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("The child node is not set: ", node.name()));
+    }
+    if (select_by_chance) {
+      chance_sum += branch.chance();
+      nodes_[position].chances.push_back(branch.chance());
+    } else {
+      ASSIGN_OR_RETURN(EventCondition condition,
+                       EventCondition::Create(branch.condition()));
+      nodes_[position].conditions.push_back(std::move(condition));
+    }
+    int child;
+    if (branch.has_node()) {
+      ASSIGN_OR_RETURN(child,
+                       AddNode(branch.node(), indexed_nodes, in_update_tree));
+    } else if (in_update_tree) {
+      return absl::UnimplementedError(absl::StrCat(
+          "node_index in an update tree is not supported: ", node.name()));
+    } else {
+      ASSIGN_OR_RETURN(child,
+                       AddIndexedNode(branch.node_index(), indexed_nodes));
+    }
+    nodes_[position].children.push_back(child);
+  }
+  if (select_by_chance && std::abs(chance_sum - 1) > kChanceSumTolerance) {
+    return absl::InvalidArgumentError(absl::StrCat(
+        "The chances of the branches do not sum to 1: ", node.name()));
+  }
+  return position;
+}
+
+absl::StatusOr<WalkResult> ModelWalker::Walk(const LabelerEvent& event) const {
+  return WalkInternal(event, nullptr);
+}
+
+absl::StatusOr<WalkResult> ModelWalker::Walk(
+    const LabelerEvent& event, std::vector<int64_t>& visit_counts) const {
+  if (visit_counts.size() != nodes_.size()) {
+    return absl::InvalidArgumentError(
+        "The size of visit_counts does not match the node count.");
+  }
+  return WalkInternal(event, &visit_counts);
+}
+
+absl::StatusOr<WalkResult> ModelWalker::WalkInternal(
+    const LabelerEvent& event, std::vector<int64_t>* visit_counts) const {
+  WalkResult result;
+  if (updates_events_) {
+    LabelerEvent updated_event = event;
+    RETURN_IF_ERROR(WalkFrom(0, updated_event, result, visit_counts));
+  } else {
+    RETURN_IF_ERROR(WalkFrom(0, event, result, visit_counts));
+  }
+  return result;
+}
+
+template <typename Event>
+absl::Status ModelWalker::WalkFrom(const int start_position, Event& event,
+                                   WalkResult& result,
+                                   std::vector<int64_t>* visit_counts) const {
+  int position = start_position;
+  while (true) {
+    const Node& node = nodes_[position];
+    ++result.depth;
+    if (visit_counts) {
+      ++(*visit_counts)[position];
+    }
+    if (node.children.empty()) {
+      if (node.in_update_tree) {
+        return absl::OkStatus();
+      }
+      WalkResult::Leaf& leaf = result.leaves.emplace_back();
+      leaf.name = node.name;
+      if (node.total_population > 0) {
+        uint64_t id = hash_(GetEventSeed(node.random_seed,
+                                         event.acting_fingerprint())) %
+                      node.total_population;
+        for (const Pool& pool : node.pools) {
+          if (id < pool.size) {
+            leaf.virtual_person_id = pool.offset + id;
+            break;
+          }
+          id -= pool.size;
+        }
+      }
+      return absl::OkStatus();
+    }
+    if constexpr (!std::is_const_v<Event>) {
+      for (const Update& update : node.updates) {
+        if (update.updater) {
+          absl::Status status = update.updater->Update(hash_, event);
+          if (!status.ok()) {
+            return absl::Status(
+                status.code(),
+                absl::StrCat(status.message(), " at ", node.name));
+          }
+        } else {
+          RETURN_IF_ERROR(
+              WalkFrom(update.tree_root, event, result, visit_counts));
+        }
+      }
+      if (node.multiplicity) {
+        ASSIGN_OR_RETURN(int clone_count,
+                         node.multiplicity->GetCloneCount(hash_, event));
+        for (int i = 0; i < clone_count; ++i) {
+          LabelerEvent clone = event;
+          node.multiplicity->SetClone(hash_, i, clone);
+          ASSIGN_OR_RETURN(int child, SelectChild(position, clone));
+          RETURN_IF_ERROR(WalkFrom(child, clone, result, visit_counts));
+        }
+        return absl::OkStatus();
+      }
+    }
+    ASSIGN_OR_RETURN(position, SelectChild(position, event));
+  }
+}
+
+absl::StatusOr<int> ModelWalker::SelectChild(const int position,
+                                             const LabelerEvent& event) const {
+  const Node& node = nodes_[position];
+  if (!node.chances.empty()) {
+    return node.children[SelectByConsistentHashing(
+        hash_, GetEventSeed(node.random_seed, event.acting_fingerprint()),
+        node.chances)];
+  }
+  for (int i = 0; i < node.conditions.size(); ++i) {
+    if (node.conditions[i].IsMatch(event)) {
+      return node.children[i];
+    }
+  }
+  return absl::InvalidArgumentError(
+      absl::StrCat("No condition matches the event at ", node.name));
+}
+
+}  // namespace wfa_virtual_people
@@ -0,0 +1,191 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_EVALUATOR_MODEL_WALKER_H_
+#define SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_EVALUATOR_MODEL_WALKER_H_
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/container/flat_hash_set.h"
+#include "absl/container/inlined_vector.h"
+#include "absl/status/statusor.h"
+#include "absl/status/status.h"
+#include "absl/strings/string_view.h"
+#include "wfa/virtual_people/common/event.pb.h"
+#include "wfa/virtual_people/common/model.pb.h"
+#include "wfa/virtual_people/training/model_evaluator/branch_action.h"
+#include "wfa/virtual_people/training/model_evaluator/labeler_hash.h"
+
+namespace wfa_virtual_people {
+
+// The result of walking an event through a model.
+struct WalkResult {
+  struct Leaf {
+    // The name of the leaf node.
+    absl::string_view name;
+    // Set if the leaf node is a population node with non-empty pools.
+    std::optional<uint64_t> virtual_person_id;
+  };
+
+  // The leaf node reached by the event. If the event is cloned by the
+  // multiplicity of a branch node, the leaf node reached by each clone, in
+  // order, which may be none.
+  absl::InlinedVector<Leaf, 1> leaves;
+  // The count of the nodes visited, including the root, the leaves, and the
+  // nodes of the update trees, by the event and all its clones.
+  int depth = 0;
+};
+
+// Walks events through a compiled model tree, to find the leaf node and the
+// virtual person id of each event.
+//
+// This is a local approximation of the labeler, for evaluating and profiling
+// models offline. The random choices are made from the seeds and the hashing
+// of the labeler, by the hash function passed to Create, which is
+// LabelerFingerprint64 by default.
+//
+// * A branch node with attribute updates applies them to the event in order,
+//   before selecting a branch, see AttributesUpdater. An UpdateTree is walked
+//   from its root as a part of the model, until a stop node.
+// * A branch node with multiplicity clones the event, see EventMultiplicity,
+//   and each clone selects a branch and walks on.
+// * A branch node with chances selects a branch by SelectByConsistentHashing,
+//   with the seed GetEventSeed of the random_seed of the node.
+// * A branch node with conditions selects the first branch whose condition
+//   matches the event. It is an error if no condition matches.
+// * A population node selects the id at position
+//   hash(GetEventSeed(random_seed)) % total_population in its pools,
+//   concatenated in order.
+// The event is copied only if the model has attribute updates or
+// multiplicity.
+// GeometricShredder and the population nodes in the update trees are not
+// supported.
+//
+// The model is either a root node with nested child nodes, or a list of nodes
+// referencing their child nodes by node_index.
+class ModelWalker {
+ public:
+  // Return error status if an attribute updater or a multiplicity is invalid,
+  // or Unimplemented error status if it is not supported.
+  static absl::StatusOr<ModelWalker> Create(
+      const CompiledNode& root, SeedHashFunction hash = &LabelerFingerprint64);
+
+  // The root is the only node not referenced by any node_index. A node
+  // referenced by several branches is walked as the same node.
+  // Return error status if the indexes are not unique, a node_index is not
+  // found, the references have a cycle, or as above.
+  static absl::StatusOr<ModelWalker> Create(
+      const std::vector<CompiledNode>& nodes,
+      SeedHashFunction hash = &LabelerFingerprint64);
+
+  absl::StatusOr<WalkResult> Walk(const LabelerEvent& event) const;
+
+  // Same as above, and increments @visit_counts at the position of each node
+  // visited. @visit_counts must have node_count() elements.
+  absl::StatusOr<WalkResult> Walk(const LabelerEvent& event,
+                                  std::vector<int64_t>& visit_counts) const;
+
+  // The nodes are numbered by their positions in preorder, with the root at
+  // 0. A node referenced by index is numbered when it is first reached.
+  int node_count() const { return nodes_.size(); }
+  absl::string_view node_name(int position) const {
+    return nodes_[position].name;
+  }
+
+ private:
+  struct Pool {
+    uint64_t offset;
+    uint64_t size;
+  };
+
+  // An attribute update of a branch node, which is either an updater, or an
+  // update tree whose root is at the position tree_root.
+  struct Update {
+    std::unique_ptr<AttributesUpdater> updater;
+    int tree_root = -1;
+  };
+
+  struct Node {
+    std::string name;
+    // Set for branch nodes.
+    std::vector<int> children;
+    // Set for branch nodes selecting by chances.
+    std::vector<double> chances;
+    // Set for branch nodes selecting by conditions.
+    std::vector<EventCondition> conditions;
+    // Set for branch nodes with attribute updates.
+    std::vector<Update> updates;
+    // Set for branch nodes with multiplicity.
+    std::optional<EventMultiplicity> multiplicity;
+    // Set for population nodes.
+    std::vector<Pool> pools;
+    uint64_t total_population = 0;
+    std::string random_seed;
+    // Whether the node is in an update tree, where the walk ends at the stop
+    // nodes without reaching a leaf.
+    bool in_update_tree = false;
+  };
+
+  // The nodes referenced by index, used while adding the nodes.
+  struct IndexedNodes {
+    absl::flat_hash_map<uint32_t, const CompiledNode*> nodes;
+    absl::flat_hash_map<uint32_t, int> positions;
+    // The indexes of the nodes whose descendants are being added.
+    absl::flat_hash_set<uint32_t> in_progress;
+  };
+
+  explicit ModelWalker(SeedHashFunction hash) : hash_(hash) {}
+
+  // Append @node and its descendants in preorder, and return the position of
+  // @node. The nodes of update trees are appended after the branch node with
+  // the updates, and before its children. @in_update_tree is true for the
+  // nodes in update trees.
+  absl::StatusOr<int> AddNode(const CompiledNode& node,
+                              IndexedNodes& indexed_nodes,
+                              bool in_update_tree = false);
+
+  // Return the position of the node with @index, appending it if it is not
+  // added yet.
+  absl::StatusOr<int> AddIndexedNode(uint32_t index,
+                                     IndexedNodes& indexed_nodes);
+
+  absl::StatusOr<WalkResult> WalkInternal(
+      const LabelerEvent& event, std::vector<int64_t>* visit_counts) const;
+
+  // Walk @event from the node at @position, and add the leaves reached to
+  // @result. @Event is LabelerEvent if the model has attribute updates or
+  // multiplicity, and const LabelerEvent otherwise.
+  template <typename Event>
+  absl::Status WalkFrom(int position, Event& event, WalkResult& result,
+                        std::vector<int64_t>* visit_counts) const;
+
+  // Return the position of the child selected by the branch node at
+  // @position.
+  absl::StatusOr<int> SelectChild(int position,
+                                  const LabelerEvent& event) const;
+
+  SeedHashFunction hash_;
+  // Whether any branch node has attribute updates or multiplicity.
+  bool updates_events_ = false;
+  std::vector<Node> nodes_;
+};
+
+}  // namespace wfa_virtual_people
+
+#endif  // SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_EVALUATOR_MODEL_WALKER_H_
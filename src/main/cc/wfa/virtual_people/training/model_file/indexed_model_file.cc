@@ -0,0 +1,181 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "wfa/virtual_people/training/model_file/indexed_model_file.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/memory/memory.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "common_cpp/macros/macros.h"
+#include "common_cpp/protobuf_util/riegeli_io.h"
+#include "riegeli/bytes/fd_reader.h"
+#include "riegeli/bytes/fd_writer.h"
+#include "riegeli/records/record_reader.h"
+#include "riegeli/records/record_writer.h"
+#include "wfa/virtual_people/common/model.pb.h"
+#include "wfa/virtual_people/training/model_record_index.pb.h"
+
+namespace wfa_virtual_people {
+
+namespace {
+
+// Return the index of the only node in @nodes not referenced by any node.
+absl::StatusOr<uint32_t> GetRootIndex(const std::vector<CompiledNode>& nodes) {
+  std::vector<bool> referenced(nodes.size(), false);
+  for (int i = 0; i < nodes.size(); ++i) {
+    const CompiledNode& node = nodes[i];
+    if (node.index() != i) {
+      return absl::InvalidArgumentError(absl::StrCat(
+          "The index of node ", node.name(), " is not its position ", i));
+    }
+    for (const BranchNode::Branch& branch : node.branch_node().branches()) {
+      if (!branch.has_node_index()) {
+        continue;
+      }
+      if (branch.node_index() >= nodes.size()) {
+        return absl::InvalidArgumentError(
+            absl::StrCat("Node ", node.name(), " references node index ",
+                         branch.node_index(), ", which does not exist."));
+      }
+      referenced[branch.node_index()] = true;
+    }
+  }
+  int root_index = -1;
+  for (int i = 0; i < nodes.size(); ++i) {
+    if (referenced[i]) {
+      continue;
+    }
+    if (root_index >= 0) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("Multiple root nodes: ", nodes[root_index].name(),
+                       " and ", nodes[i].name()));
+    }
+    root_index = i;
+  }
+  if (root_index < 0) {
+    return absl::InvalidArgumentError("No root node.");
+  }
+  return root_index;
+}
+
+}  // namespace
+
+std::string GetModelRecordIndexPath(absl::string_view model_path) {
+  return absl::StrCat(model_path, ".index");
+}
+
+absl::Status WriteIndexedModelFile(absl::string_view path,
+                                   const std::vector<CompiledNode>& nodes) {
+  ModelRecordIndex index;
+  ASSIGN_OR_RETURN(uint32_t root_index, GetRootIndex(nodes));
+  index.set_root_index(root_index);
+
+  riegeli::RecordWriter<riegeli::FdWriter<>> writer{riegeli::FdWriter<>(path)};
+  for (const CompiledNode& node : nodes) {
+    if (!writer.WriteRecord(node)) {
+      return writer.status();
+    }
+    index.add_record_positions(writer.LastPos().get().numeric());
+  }
+  if (!writer.Close()) {
+    return writer.status();
+  }
+  return wfa::WriteRiegeliFile(GetModelRecordIndexPath(path),
+                               std::vector<ModelRecordIndex>({index}));
+}
+
+absl::StatusOr<std::unique_ptr<IndexedModelReader>> IndexedModelReader::Open(
+    absl::string_view path) {
+  std::vector<ModelRecordIndex> indexes;
+  RETURN_IF_ERROR(
+      wfa::ReadRiegeliFile(GetModelRecordIndexPath(path), indexes));
+  if (indexes.size() != 1) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Expected 1 ModelRecordIndex for ", path, ", got ",
+                     indexes.size()));
+  }
+  auto reader =
+      absl::WrapUnique(new IndexedModelReader(path, std::move(indexes[0])));
+  if (!reader->reader_.ok()) {
+    return reader->reader_.status();
+  }
+  return reader;
+}
+
+IndexedModelReader::IndexedModelReader(absl::string_view path,
+                                       ModelRecordIndex index)
+    : index_(std::move(index)),
+      reader_(riegeli::FdReader<>(path)) {}
+
+absl::StatusOr<CompiledNode> IndexedModelReader::ReadNode(uint32_t index) {
+  if (index >= node_count()) {
+    return absl::OutOfRangeError(absl::StrCat(
+        "Node index ", index, " is out of range [0, ", node_count(), ")"));
+  }
+  CompiledNode node;
+  if (!reader_.Seek(index_.record_positions(index)) ||
+      !reader_.ReadRecord(node)) {
+    if (!reader_.ok()) {
+      return reader_.status();
+    }
+    return absl::DataLossError(
+        absl::StrCat("Failed to read the record of node index ", index));
+  }
+  if (node.index() != index) {
+    return absl::DataLossError(
+        absl::StrCat("The record of node index ", index, " has index ",
+                     node.index(), ". The ModelRecordIndex is outdated."));
+  }
+  return node;
+}
+
+absl::StatusOr<CompiledNode> IndexedModelReader::ReadSubtree(uint32_t index,
+                                                             int max_depth) {
+  std::vector<bool> in_progress(node_count(), false);
+  return ReadSubtree(index, max_depth, in_progress);
+}
+
+absl::StatusOr<CompiledNode> IndexedModelReader::ReadSubtree(
+    uint32_t index, int max_depth, std::vector<bool>& in_progress) {
+  ASSIGN_OR_RETURN(CompiledNode node, ReadNode(index));
+  if (max_depth == 0 || !node.has_branch_node()) {
+    return node;
+  }
+  in_progress[index] = true;
+  for (BranchNode::Branch& branch :
+       *node.mutable_branch_node()->mutable_branches()) {
+    if (!branch.has_node_index()) {
+      continue;
+    }
+    const uint32_t child_index = branch.node_index();
+    if (child_index < in_progress.size() && in_progress[child_index]) {
+      return absl::InvalidArgumentError(absl::StrCat(
+          "The model has a reference cycle at node ", node.name()));
+    }
+    ASSIGN_OR_RETURN(*branch.mutable_node(),
+                     ReadSubtree(child_index, max_depth - 1, in_progress));
+  }
+  in_progress[index] = false;
+  return node;
+}
+
+}  // namespace wfa_virtual_people
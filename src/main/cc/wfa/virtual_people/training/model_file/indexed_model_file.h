@@ -0,0 +1,83 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_FILE_INDEXED_MODEL_FILE_H_
+#define SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_FILE_INDEXED_MODEL_FILE_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+#include "riegeli/bytes/fd_reader.h"
+#include "riegeli/records/record_reader.h"
+#include "wfa/virtual_people/common/model.pb.h"
+#include "wfa/virtual_people/training/model_record_index.pb.h"
+
+namespace wfa_virtual_people {
+
+// Return the path of the ModelRecordIndex of the model file at @model_path.
+std::string GetModelRecordIndexPath(absl::string_view model_path);
+
+// Write @nodes to a Riegeli file at @path, and the record position of each
+// node to a ModelRecordIndex at GetModelRecordIndexPath(@path). The file can
+// be read by ReadRiegeliFile as usual.
+//
+// The index of each node must be its position in @nodes, and exactly one node
+// must not be referenced by any other node, which is the root. Return error
+// status otherwise.
+absl::Status WriteIndexedModelFile(absl::string_view path,
+                                   const std::vector<CompiledNode>& nodes);
+
+// Reads the nodes of a model file written by WriteIndexedModelFile on demand,
+// by seeking to their record positions. Only the ModelRecordIndex is kept in
+// memory.
+// Not thread-safe.
+class IndexedModelReader {
+ public:
+  // Open the model file at @path, and read its ModelRecordIndex.
+  static absl::StatusOr<std::unique_ptr<IndexedModelReader>> Open(
+      absl::string_view path);
+
+  IndexedModelReader(const IndexedModelReader&) = delete;
+  IndexedModelReader& operator=(const IndexedModelReader&) = delete;
+
+  int node_count() const { return index_.record_positions_size(); }
+  uint32_t root_index() const { return index_.root_index(); }
+
+  // Read the node with @index. Its child nodes are referenced by index.
+  absl::StatusOr<CompiledNode> ReadNode(uint32_t index);
+
+  // Read the subtree with root @index, where the child nodes are nested
+  // instead of referenced by index, down to @max_depth levels below the root.
+  // The child nodes below @max_depth are still referenced by index. If
+  // @max_depth is negative, the whole subtree is read.
+  absl::StatusOr<CompiledNode> ReadSubtree(uint32_t index, int max_depth = -1);
+
+ private:
+  IndexedModelReader(absl::string_view path, ModelRecordIndex index);
+
+  absl::StatusOr<CompiledNode> ReadSubtree(uint32_t index, int max_depth,
+                                           std::vector<bool>& in_progress);
+
+  ModelRecordIndex index_;
+  riegeli::RecordReader<riegeli::FdReader<>> reader_;
+};
+
+}  // namespace wfa_virtual_people
+
+#endif  // SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_FILE_INDEXED_MODEL_FILE_H_
@@ -0,0 +1,79 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// This is a tool to extract a subtree of a model, which is composed of a list
+// of CompiledNodes written with a ModelRecordIndex, for example by
+// compiler_main with --flattened_output_path. Only the nodes in the subtree
+// are read from the model file.
+// The output CompiledNode is formatted in textproto, with the child nodes
+// nested.
+// Example usage:
+// bazel build -c opt \
+// //src/main/cc/wfa/virtual_people/training/model_file:model_subtree_main
+// bazel-bin/src/main/cc/wfa/virtual_people/training/model_file/\
+// model_subtree_main \
+// --model_path=/tmp/model_compiler/model.riegeli \
+// --node_index=12 \
+// --output_path=/tmp/model_file/subtree.textproto
+
+#include <memory>
+#include <string>
+
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "common_cpp/protobuf_util/textproto_io.h"
+#include "glog/logging.h"
+#include "wfa/virtual_people/common/model.pb.h"
+#include "wfa/virtual_people/training/model_file/indexed_model_file.h"
+
+ABSL_FLAG(std::string, model_path, "",
+          "Path to the input CompiledNode Riegeli file, with the "
+          "ModelRecordIndex next to it.");
+ABSL_FLAG(int, node_index, -1,
+          "The index of the root of the subtree. Defaults to the model root.");
+ABSL_FLAG(int, max_depth, -1,
+          "If not negative, only read this many levels below the root of the "
+          "subtree. The deeper child nodes are referenced by index.");
+ABSL_FLAG(std::string, output_path, "",
+          "Path to the output CompiledNode textproto.");
+
+int main(int argc, char** argv) {
+  absl::ParseCommandLine(argc, argv);
+  google::InitGoogleLogging(argv[0]);
+
+  std::string model_path = absl::GetFlag(FLAGS_model_path);
+  CHECK(!model_path.empty()) << "model_path is not set.";
+
+  std::string output_path = absl::GetFlag(FLAGS_output_path);
+  CHECK(!output_path.empty()) << "output_path is not set.";
+
+  absl::StatusOr<std::unique_ptr<wfa_virtual_people::IndexedModelReader>>
+      reader = wfa_virtual_people::IndexedModelReader::Open(model_path);
+  CHECK(reader.ok()) << reader.status();
+
+  int node_index = absl::GetFlag(FLAGS_node_index);
+  if (node_index < 0) {
+    node_index = (*reader)->root_index();
+  }
+  absl::StatusOr<wfa_virtual_people::CompiledNode> subtree =
+      (*reader)->ReadSubtree(node_index, absl::GetFlag(FLAGS_max_depth));
+  CHECK(subtree.ok()) << subtree.status();
+
+  absl::Status write_status = wfa::WriteTextProtoFile(output_path, *subtree);
+  CHECK(write_status.ok()) << write_status;
+
+  return 0;
+}
@@ -0,0 +1,150 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_IMAGE_MODEL_IMAGE_FORMAT_H_
+#define SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_IMAGE_MODEL_IMAGE_FORMAT_H_
+
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+
+// The layout of a model image, which is a pointer-free binary form of a
+// CompiledNode tree that can be memory-mapped and read in place.
+//
+// An image consists of a header followed by 5 sections, each 8 bytes aligned:
+// * Node table: one ImageNode for each CompiledNode, in depth-first preorder.
+//   The root is the first node.
+// * Branch table: one ImageBranch for each BranchNode.Branch. The branches of
+//   a BranchNode are contiguous.
+// * Pool table: one ImagePool for each PopulationNode.VirtualPersonPool. The
+//   pools of a PopulationNode are contiguous.
+// * Blob table: one ImageBlob for each distinct byte string. Names, random
+//   seeds, serialized conditions, compiled conditions and serialized updaters
+//   are interned, so identical values are stored once.
+// * Blob data: the bytes of all blobs.
+//
+// All integers are stored in the byte order of the machine writing the image,
+// which is checked against the byte order mark when reading.
+
+namespace wfa_virtual_people {
+
+inline constexpr char kModelImageMagic[8] = {'V', 'P', 'M', 'I',
+                                             'M', 'A', 'G', 'E'};
+inline constexpr uint32_t kModelImageVersion = 2;
+inline constexpr uint32_t kModelImageByteOrderMark = 0x01020304;
+inline constexpr uint32_t kModelImageAlignment = 8;
+
+// Indicates an optional string field is not set.
+inline constexpr uint32_t kNoBlob = std::numeric_limits<uint32_t>::max();
+
+enum class ImageNodeType : uint32_t {
+  kNone = 0,
+  kBranch = 1,
+  kStop = 2,
+  kPopulation = 3,
+};
+
+enum class ImageActionType : uint32_t {
+  kNone = 0,
+  // The action blob is a serialized BranchNode.AttributesUpdaters.
+  kUpdates = 1,
+  // The action blob is a serialized Multiplicity.
+  kMultiplicity = 2,
+};
+
+enum class ImageChildType : uint32_t {
+  kNone = 0,
+  // The child is the node at the given position of the node table.
+  kNode = 1,
+  // The child is referenced by BranchNode.Branch.node_index.
+  kNodeIndex = 2,
+};
+
+enum class ImageSelectType : uint32_t {
+  kNone = 0,
+  kChance = 1,
+  // The program blob is the condition compiled to a serialized
+  // FieldFilterProgram, which is what the labeler evaluates. The condition
+  // blob is the serialized FieldFilterProto, only read to convert the image
+  // back to a CompiledNode, and to report why the condition is not compiled
+  // when the program blob is kNoBlob.
+  kCondition = 2,
+};
+
+struct ImageSection {
+  uint64_t offset;
+  uint64_t count;
+};
+
+struct ModelImageHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order_mark;
+  ImageSection nodes;
+  ImageSection branches;
+  ImageSection pools;
+  ImageSection blobs;
+  uint64_t blob_data_offset;
+  uint64_t blob_data_size;
+};
+
+struct ImageNode {
+  ImageNodeType type;
+  uint32_t name;
+  uint32_t has_index;
+  uint32_t index;
+  // For kBranch, the range in the branch table. For kPopulation, the range in
+  // the pool table.
+  uint32_t first;
+  uint32_t count;
+  uint32_t random_seed;
+  ImageActionType action_type;
+  uint32_t action;
+  uint32_t reserved;
+};
+
+struct ImageBranch {
+  double chance;
+  ImageChildType child_type;
+  uint32_t child;
+  ImageSelectType select_type;
+  uint32_t condition;
+  uint32_t program;
+  uint32_t reserved;
+};
+
+struct ImagePool {
+  uint64_t population_offset;
+  uint64_t total_population;
+};
+
+struct ImageBlob {
+  uint64_t offset;
+  uint64_t size;
+};
+
+static_assert(std::is_trivially_copyable_v<ModelImageHeader> &&
+              std::is_trivially_copyable_v<ImageNode> &&
+              std::is_trivially_copyable_v<ImageBranch> &&
+              std::is_trivially_copyable_v<ImagePool> &&
+              std::is_trivially_copyable_v<ImageBlob>);
+static_assert(sizeof(ModelImageHeader) == 96);
+static_assert(sizeof(ImageNode) == 40);
+static_assert(sizeof(ImageBranch) == 32);
+static_assert(sizeof(ImagePool) == 16);
+static_assert(sizeof(ImageBlob) == 16);
+
+}  // namespace wfa_virtual_people
+
+#endif  // SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_IMAGE_MODEL_IMAGE_FORMAT_H_
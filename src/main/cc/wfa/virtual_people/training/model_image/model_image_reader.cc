@@ -0,0 +1,307 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "wfa/virtual_people/training/model_image/model_image_reader.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+
+#include "absl/memory/memory.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
+#include "common_cpp/macros/macros.h"
+#include "wfa/virtual_people/common/field_filter.pb.h"
+#include "wfa/virtual_people/common/model.pb.h"
+#include "wfa/virtual_people/training/model_evaluator/field_filter_program.h"
+#include "wfa/virtual_people/training/model_image/model_image_format.h"
+
+namespace wfa_virtual_people {
+
+namespace {
+
+absl::Status InvalidImage(absl::string_view message) {
+  return absl::InvalidArgumentError(
+      absl::StrCat("Invalid model image: ", message));
+}
+
+// Return the table of @section in @data. Return error status if the table is
+// not within @data, or not aligned.
+template <typename T>
+absl::StatusOr<absl::Span<const T>> GetTable(absl::string_view data,
+                                             const ImageSection& section,
+                                             absl::string_view name) {
+  if (section.offset % kModelImageAlignment != 0 ||
+      section.offset > data.size() ||
+      section.count > (data.size() - section.offset) / sizeof(T)) {
+    return InvalidImage(absl::StrCat("The ", name, " table is out of bounds."));
+  }
+  return absl::MakeConstSpan(
+      reinterpret_cast<const T*>(data.data() + section.offset), section.count);
+}
+
+template <typename T>
+absl::Status ParseBlob(absl::string_view blob, T& message) {
+  if (!message.ParseFromArray(blob.data(), blob.size())) {
+    return InvalidImage(
+        absl::StrCat("Failed to parse ", message.GetTypeName(), "."));
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace
+
+absl::StatusOr<ModelImage> ModelImage::Create(absl::string_view data) {
+  if (reinterpret_cast<uintptr_t>(data.data()) % kModelImageAlignment != 0) {
+    return absl::InvalidArgumentError(
+        "The model image data must be 8 bytes aligned.");
+  }
+  if (data.size() < sizeof(ModelImageHeader)) {
+    return InvalidImage("The data is smaller than the header.");
+  }
+  const ModelImageHeader& header =
+      *reinterpret_cast<const ModelImageHeader*>(data.data());
+  if (std::memcmp(header.magic, kModelImageMagic, sizeof(header.magic)) != 0) {
+    return InvalidImage("Wrong magic.");
+  }
+  if (header.byte_order_mark != kModelImageByteOrderMark) {
+    return InvalidImage("The byte order does not match this machine.");
+  }
+  if (header.version != kModelImageVersion) {
+    return InvalidImage(absl::StrCat("Unsupported version ", header.version));
+  }
+
+  ModelImage image;
+  ASSIGN_OR_RETURN(image.nodes_,
+                   GetTable<ImageNode>(data, header.nodes, "node"));
+  ASSIGN_OR_RETURN(image.branches_,
+                   GetTable<ImageBranch>(data, header.branches, "branch"));
+  ASSIGN_OR_RETURN(image.pools_,
+                   GetTable<ImagePool>(data, header.pools, "pool"));
+  ASSIGN_OR_RETURN(image.blobs_,
+                   GetTable<ImageBlob>(data, header.blobs, "blob"));
+  if (header.blob_data_offset > data.size() ||
+      header.blob_data_size > data.size() - header.blob_data_offset) {
+    return InvalidImage("The blob data is out of bounds.");
+  }
+  image.blob_data_ =
+      data.substr(header.blob_data_offset, header.blob_data_size);
+
+  if (image.nodes_.empty()) {
+    return InvalidImage("No node.");
+  }
+  return image;
+}
+
+absl::Status ModelImage::Validate() const {
+  for (uint32_t position = 0; position < nodes_.size(); ++position) {
+    RETURN_IF_ERROR(ValidateNode(position));
+  }
+  return absl::OkStatus();
+}
+
+bool ModelImage::IsValidBlob(const uint32_t index) const {
+  if (index == kNoBlob) {
+    return true;
+  }
+  if (index >= blobs_.size()) {
+    return false;
+  }
+  const ImageBlob& blob = blobs_[index];
+  return blob.offset <= blob_data_.size() &&
+         blob.size <= blob_data_.size() - blob.offset;
+}
+
+absl::Status ModelImage::ValidateNode(const uint32_t position) const {
+  const ImageNode& node = nodes_[position];
+  if (!IsValidBlob(node.name) || !IsValidBlob(node.random_seed) ||
+      !IsValidBlob(node.action)) {
+    return InvalidImage(absl::StrCat("Invalid blob in node ", position));
+  }
+  if (node.action_type > ImageActionType::kMultiplicity ||
+      (node.action_type != ImageActionType::kNone && node.action == kNoBlob)) {
+    return InvalidImage(absl::StrCat("Invalid action in node ", position));
+  }
+  switch (node.type) {
+    case ImageNodeType::kNone:
+    case ImageNodeType::kStop:
+      return absl::OkStatus();
+    case ImageNodeType::kPopulation:
+      if (node.first > pools_.size() ||
+          node.count > pools_.size() - node.first) {
+        return InvalidImage(
+            absl::StrCat("Pools out of bounds in node ", position));
+      }
+      return absl::OkStatus();
+    case ImageNodeType::kBranch:
+      if (node.first > branches_.size() ||
+          node.count > branches_.size() - node.first) {
+        return InvalidImage(
+            absl::StrCat("Branches out of bounds in node ", position));
+      }
+      for (const ImageBranch& branch : branches(node)) {
+        // Child nodes always follow their parent in preorder, which also
+        // guarantees the tree has no cycle.
+        if (branch.child_type > ImageChildType::kNodeIndex ||
+            (branch.child_type == ImageChildType::kNode &&
+             (branch.child <= position || branch.child >= nodes_.size()))) {
+          return InvalidImage(absl::StrCat("Invalid child in node ", position));
+        }
+        if (branch.select_type > ImageSelectType::kCondition ||
+            !IsValidBlob(branch.condition) || !IsValidBlob(branch.program) ||
+            (branch.select_type == ImageSelectType::kCondition &&
+             branch.condition == kNoBlob)) {
+          return InvalidImage(
+              absl::StrCat("Invalid condition in node ", position));
+        }
+      }
+      return absl::OkStatus();
+    default:
+      return InvalidImage(absl::StrCat("Invalid type of node ", position));
+  }
+}
+
+absl::string_view ModelImage::blob(const uint32_t index) const {
+  if (index == kNoBlob) {
+    return absl::string_view();
+  }
+  const ImageBlob& blob = blobs_[index];
+  return blob_data_.substr(blob.offset, blob.size);
+}
+
+absl::StatusOr<FieldFilterProgram> ModelImage::GetCondition(
+    const ImageBranch& branch) const {
+  if (branch.program != kNoBlob) {
+    return FieldFilterProgram::Deserialize(blob(branch.program));
+  }
+  // The condition is not compiled by the writer. Compiling it again returns
+  // the reason.
+  FieldFilterProto condition;
+  RETURN_IF_ERROR(ParseBlob(blob(branch.condition), condition));
+  return FieldFilterProgram::Compile(condition);
+}
+
+absl::StatusOr<CompiledNode> ModelImage::ToCompiledNode(
+    const uint32_t position) const {
+  if (position >= nodes_.size()) {
+    return absl::OutOfRangeError(
+        absl::StrCat("Node position out of range: ", position));
+  }
+  RETURN_IF_ERROR(ValidateNode(position));
+  const ImageNode& image_node = nodes_[position];
+  CompiledNode node;
+  if (image_node.name != kNoBlob) {
+    node.set_name(std::string(blob(image_node.name)));
+  }
+  if (image_node.has_index) {
+    node.set_index(image_node.index);
+  }
+
+  switch (image_node.type) {
+    case ImageNodeType::kBranch: {
+      BranchNode& branch_node = *node.mutable_branch_node();
+      for (const ImageBranch& image_branch : branches(image_node)) {
+        BranchNode::Branch& branch = *branch_node.add_branches();
+        if (image_branch.child_type == ImageChildType::kNodeIndex) {
+          branch.set_node_index(image_branch.child);
+        } else if (image_branch.child_type == ImageChildType::kNode) {
+          ASSIGN_OR_RETURN(*branch.mutable_node(),
+                           ToCompiledNode(image_branch.child));
+        }
+        if (image_branch.select_type == ImageSelectType::kChance) {
+          branch.set_chance(image_branch.chance);
+        } else if (image_branch.select_type == ImageSelectType::kCondition) {
+          RETURN_IF_ERROR(ParseBlob(blob(image_branch.condition),
+                                    *branch.mutable_condition()));
+        }
+      }
+      if (image_node.random_seed != kNoBlob) {
+        branch_node.set_random_seed(std::string(blob(image_node.random_seed)));
+      }
+      if (image_node.action_type == ImageActionType::kUpdates) {
+        RETURN_IF_ERROR(ParseBlob(blob(image_node.action),
+                                  *branch_node.mutable_updates()));
+      } else if (image_node.action_type == ImageActionType::kMultiplicity) {
+        RETURN_IF_ERROR(ParseBlob(blob(image_node.action),
+                                  *branch_node.mutable_multiplicity()));
+      }
+      break;
+    }
+    case ImageNodeType::kStop:
+      node.mutable_stop_node();
+      break;
+    case ImageNodeType::kPopulation: {
+      PopulationNode& population_node = *node.mutable_population_node();
+      for (const ImagePool& image_pool : pools(image_node)) {
+        PopulationNode::VirtualPersonPool& pool = *population_node.add_pools();
+        pool.set_population_offset(image_pool.population_offset);
+        pool.set_total_population(image_pool.total_population);
+      }
+      if (image_node.random_seed != kNoBlob) {
+        population_node.set_random_seed(
+            std::string(blob(image_node.random_seed)));
+      }
+      break;
+    }
+    default:
+      break;
+  }
+  return node;
+}
+
+absl::StatusOr<std::unique_ptr<MappedModelImage>> MappedModelImage::Open(
+    absl::string_view path) {
+  std::string path_string(path);
+  int fd = open(path_string.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return absl::NotFoundError(absl::StrCat("Failed to open ", path));
+  }
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0) {
+    close(fd);
+    return absl::InternalError(absl::StrCat("Failed to stat ", path));
+  }
+  size_t size = static_cast<size_t>(file_stat.st_size);
+  if (size == 0) {
+    close(fd);
+    return InvalidImage("The data is smaller than the header.");
+  }
+  void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    return absl::InternalError(absl::StrCat("Failed to mmap ", path));
+  }
+
+  absl::StatusOr<ModelImage> image =
+      ModelImage::Create(absl::string_view(static_cast<char*>(data), size));
+  if (!image.ok()) {
+    munmap(data, size);
+    return image.status();
+  }
+  return absl::WrapUnique(new MappedModelImage(data, size, *image));
+}
+
+MappedModelImage::~MappedModelImage() { munmap(data_, size_); }
+
+}  // namespace wfa_virtual_people
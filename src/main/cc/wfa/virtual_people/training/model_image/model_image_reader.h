@@ -0,0 +1,141 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_IMAGE_MODEL_IMAGE_READER_H_
+#define SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_IMAGE_MODEL_IMAGE_READER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
+#include "wfa/virtual_people/common/model.pb.h"
+#include "wfa/virtual_people/training/model_evaluator/field_filter_program.h"
+#include "wfa/virtual_people/training/model_image/model_image_format.h"
+
+namespace wfa_virtual_people {
+
+// A read-only view of a model image, which reads the tables in place without
+// copying. See model_image_format.h for the layout.
+//
+// Create only checks the header and the bounds of the tables, so opening an
+// image costs the same regardless of the size of the model. The entries of
+// the tables are checked by Validate, or node by node by ToCompiledNode. The
+// accessors below do not check them, so an image from an untrusted source
+// must be validated before they are used.
+//
+// The image data must outlive the view.
+//
+// Example usage:
+//   ASSIGN_OR_RETURN(ModelImage image, ModelImage::Create(data));
+//   RETURN_IF_ERROR(image.Validate());
+//   for (const ImageBranch& branch : image.branches(image.root())) {
+//     ...
+//   }
+class ModelImage {
+ public:
+  // Check the header of @data, and that the tables are within @data.
+  // Return error status if @data is not a valid model image, or @data is not 8
+  // bytes aligned.
+  static absl::StatusOr<ModelImage> Create(absl::string_view data);
+
+  // Check all the nodes, branches and blobs, so that the accessors below never
+  // read out of bounds.
+  // Return error status if any entry is invalid.
+  absl::Status Validate() const;
+
+  uint32_t node_count() const { return nodes_.size(); }
+
+  const ImageNode& root() const { return nodes_[0]; }
+
+  // Return the node at @position of the node table.
+  const ImageNode& node(const uint32_t position) const {
+    return nodes_[position];
+  }
+
+  // Return the branches of @node, which must be a kBranch node.
+  absl::Span<const ImageBranch> branches(const ImageNode& node) const {
+    return branches_.subspan(node.first, node.count);
+  }
+
+  // Return the pools of @node, which must be a kPopulation node.
+  absl::Span<const ImagePool> pools(const ImageNode& node) const {
+    return pools_.subspan(node.first, node.count);
+  }
+
+  // Return the blob at @index of the blob table. Return empty if @index is
+  // kNoBlob.
+  absl::string_view blob(const uint32_t index) const;
+
+  // Load the condition of @branch, which must be a kCondition branch, from its
+  // program blob.
+  // Return error status if the program blob is invalid, or the condition is
+  // not supported by FieldFilterProgram.
+  absl::StatusOr<FieldFilterProgram> GetCondition(
+      const ImageBranch& branch) const;
+
+  // Convert the node at @position and all its descendants to a CompiledNode.
+  // Each converted node is checked as by Validate.
+  absl::StatusOr<CompiledNode> ToCompiledNode(const uint32_t position) const;
+
+  // Convert the whole image to a CompiledNode.
+  absl::StatusOr<CompiledNode> ToCompiledNode() const {
+    return ToCompiledNode(0);
+  }
+
+ private:
+  ModelImage() = default;
+
+  bool IsValidBlob(uint32_t index) const;
+
+  // Check the node at @position, its branches or pools, and its blobs.
+  absl::Status ValidateNode(uint32_t position) const;
+
+  absl::Span<const ImageNode> nodes_;
+  absl::Span<const ImageBranch> branches_;
+  absl::Span<const ImagePool> pools_;
+  absl::Span<const ImageBlob> blobs_;
+  absl::string_view blob_data_;
+};
+
+// A model image file mapped into memory.
+class MappedModelImage {
+ public:
+  // Map the file at @path into memory and create a ModelImage of it. The
+  // image is not validated, see ModelImage::Validate.
+  static absl::StatusOr<std::unique_ptr<MappedModelImage>> Open(
+      absl::string_view path);
+
+  ~MappedModelImage();
+
+  MappedModelImage(const MappedModelImage&) = delete;
+  MappedModelImage& operator=(const MappedModelImage&) = delete;
+
+  const ModelImage& image() const { return image_; }
+
+ private:
+  MappedModelImage(void* data, size_t size, ModelImage image)
+      : data_(data), size_(size), image_(image) {}
+
+  void* data_;
+  size_t size_;
+  ModelImage image_;
+};
+
+}  // namespace wfa_virtual_people
+
+#endif  // SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_IMAGE_MODEL_IMAGE_READER_H_
@@ -0,0 +1,266 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "wfa/virtual_people/training/model_image/model_image_writer.h"
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "common_cpp/macros/macros.h"
+#include "wfa/virtual_people/common/field_filter.pb.h"
+#include "wfa/virtual_people/common/model.pb.h"
+#include "wfa/virtual_people/training/model_evaluator/field_filter_program.h"
+#include "wfa/virtual_people/training/model_image/model_image_format.h"
+
+namespace wfa_virtual_people {
+
+namespace {
+
+absl::StatusOr<uint32_t> ToUint32(const size_t value) {
+  if (value >= std::numeric_limits<uint32_t>::max()) {
+    return absl::InvalidArgumentError(absl::StrCat(
+        "The model is too large for the model image: ", value, " entries."));
+  }
+  return static_cast<uint32_t>(value);
+}
+
+// Collects the tables of a model image.
+class ModelImageBuilder {
+ public:
+  // Append @node and all its descendants to the tables. Return the position of
+  // @node in the node table.
+  absl::StatusOr<uint32_t> AddNode(const CompiledNode& node);
+
+  // Concatenate the header and the tables.
+  std::string Build() const;
+
+ private:
+  // Return the position of @blob in the blob table, adding it if not found.
+  absl::StatusOr<uint32_t> InternBlob(absl::string_view blob);
+
+  // Return the position of @condition compiled to FieldFilterProgram in the
+  // blob table, or kNoBlob if FieldFilterProgram does not support
+  // @condition. @condition_blob is the position of @condition itself.
+  absl::StatusOr<uint32_t> InternProgram(const FieldFilterProto& condition,
+                                         uint32_t condition_blob);
+
+  absl::Status AddBranchNode(const BranchNode& branch_node, ImageNode& node);
+
+  std::vector<ImageNode> nodes_;
+  std::vector<ImageBranch> branches_;
+  std::vector<ImagePool> pools_;
+  std::vector<ImageBlob> blobs_;
+  std::string blob_data_;
+  absl::flat_hash_map<std::string, uint32_t> blob_indexes_;
+  // The program blobs by the condition blobs, so that each distinct condition
+  // is compiled once.
+  absl::flat_hash_map<uint32_t, uint32_t> program_indexes_;
+};
+
+absl::StatusOr<uint32_t> ModelImageBuilder::InternBlob(absl::string_view blob) {
+  auto it = blob_indexes_.find(blob);
+  if (it != blob_indexes_.end()) {
+    return it->second;
+  }
+  ASSIGN_OR_RETURN(uint32_t index, ToUint32(blobs_.size()));
+  blobs_.push_back({blob_data_.size(), blob.size()});
+  blob_data_.append(blob.data(), blob.size());
+  blob_indexes_.emplace(blob, index);
+  return index;
+}
+
+absl::StatusOr<uint32_t> ModelImageBuilder::InternProgram(
+    const FieldFilterProto& condition, const uint32_t condition_blob) {
+  auto it = program_indexes_.find(condition_blob);
+  if (it != program_indexes_.end()) {
+    return it->second;
+  }
+  uint32_t index = kNoBlob;
+  // The conditions not supported by FieldFilterProgram are kept only as
+  // FieldFilterProto.
+  absl::StatusOr<FieldFilterProgram> program =
+      FieldFilterProgram::Compile(condition);
+  if (program.ok()) {
+    ASSIGN_OR_RETURN(index, InternBlob(program->Serialize()));
+  }
+  program_indexes_.emplace(condition_blob, index);
+  return index;
+}
+
+absl::StatusOr<uint32_t> ModelImageBuilder::AddNode(const CompiledNode& node) {
+  ASSIGN_OR_RETURN(uint32_t position, ToUint32(nodes_.size()));
+  // The node is filled locally, as adding the descendants reallocates the
+  // node table.
+  ImageNode image_node = {};
+  nodes_.emplace_back();
+  image_node.name = kNoBlob;
+  image_node.random_seed = kNoBlob;
+  image_node.action = kNoBlob;
+  if (node.has_name()) {
+    ASSIGN_OR_RETURN(image_node.name, InternBlob(node.name()));
+  }
+  if (node.has_index()) {
+    image_node.has_index = 1;
+    image_node.index = node.index();
+  }
+
+  if (node.has_branch_node()) {
+    image_node.type = ImageNodeType::kBranch;
+    RETURN_IF_ERROR(AddBranchNode(node.branch_node(), image_node));
+  } else if (node.has_stop_node()) {
+    image_node.type = ImageNodeType::kStop;
+  } else if (node.has_population_node()) {
+    image_node.type = ImageNodeType::kPopulation;
+    const PopulationNode& population_node = node.population_node();
+    ASSIGN_OR_RETURN(image_node.first, ToUint32(pools_.size()));
+    image_node.count = population_node.pools_size();
+    for (const PopulationNode::VirtualPersonPool& pool :
+         population_node.pools()) {
+      pools_.push_back({pool.population_offset(), pool.total_population()});
+    }
+    if (population_node.has_random_seed()) {
+      ASSIGN_OR_RETURN(image_node.random_seed,
+                       InternBlob(population_node.random_seed()));
+    }
+  } else {
+    image_node.type = ImageNodeType::kNone;
+  }
+
+  nodes_[position] = image_node;
+  return position;
+}
+
+absl::Status ModelImageBuilder::AddBranchNode(const BranchNode& branch_node,
+                                              ImageNode& node) {
+  if (branch_node.has_random_seed()) {
+    ASSIGN_OR_RETURN(node.random_seed, InternBlob(branch_node.random_seed()));
+  }
+  if (branch_node.has_updates()) {
+    node.action_type = ImageActionType::kUpdates;
+    ASSIGN_OR_RETURN(node.action,
+                     InternBlob(branch_node.updates().SerializeAsString()));
+  } else if (branch_node.has_multiplicity()) {
+    node.action_type = ImageActionType::kMultiplicity;
+    ASSIGN_OR_RETURN(
+        node.action,
+        InternBlob(branch_node.multiplicity().SerializeAsString()));
+  } else {
+    node.action_type = ImageActionType::kNone;
+  }
+
+  // Reserve the range first, so the branches of this node are contiguous.
+  ASSIGN_OR_RETURN(node.first, ToUint32(branches_.size()));
+  node.count = branch_node.branches_size();
+  branches_.resize(branches_.size() + branch_node.branches_size());
+  for (int i = 0; i < branch_node.branches_size(); ++i) {
+    const BranchNode::Branch& branch = branch_node.branches(i);
+    ImageBranch image_branch = {};
+    image_branch.condition = kNoBlob;
+    image_branch.program = kNoBlob;
+    if (branch.has_node_index()) {
+      image_branch.child_type = ImageChildType::kNodeIndex;
+      image_branch.child = branch.node_index();
+    } else if (branch.has_node()) {
+      image_branch.child_type = ImageChildType::kNode;
+      ASSIGN_OR_RETURN(image_branch.child, AddNode(branch.node()));
+    } else {
+      image_branch.child_type = ImageChildType::kNone;
+    }
+    if (branch.has_chance()) {
+      image_branch.select_type = ImageSelectType::kChance;
+      image_branch.chance = branch.chance();
+    } else if (branch.has_condition()) {
+      image_branch.select_type = ImageSelectType::kCondition;
+      ASSIGN_OR_RETURN(image_branch.condition,
+                       InternBlob(branch.condition().SerializeAsString()));
+      ASSIGN_OR_RETURN(image_branch.program,
+                       InternProgram(branch.condition(),
+                                     image_branch.condition));
+    } else {
+      image_branch.select_type = ImageSelectType::kNone;
+    }
+    branches_[node.first + i] = image_branch;
+  }
+  return absl::OkStatus();
+}
+
+uint64_t AlignUp(const uint64_t offset) {
+  return (offset + kModelImageAlignment - 1) / kModelImageAlignment *
+         kModelImageAlignment;
+}
+
+template <typename T>
+void AppendTable(const std::vector<T>& table, std::string& image) {
+  image.resize(AlignUp(image.size()), '\0');
+  image.append(reinterpret_cast<const char*>(table.data()),
+               table.size() * sizeof(T));
+}
+
+std::string ModelImageBuilder::Build() const {
+  ModelImageHeader header = {};
+  std::memcpy(header.magic, kModelImageMagic, sizeof(header.magic));
+  header.version = kModelImageVersion;
+  header.byte_order_mark = kModelImageByteOrderMark;
+
+  std::string image(sizeof(ModelImageHeader), '\0');
+  header.nodes = {AlignUp(image.size()), nodes_.size()};
+  AppendTable(nodes_, image);
+  header.branches = {AlignUp(image.size()), branches_.size()};
+  AppendTable(branches_, image);
+  header.pools = {AlignUp(image.size()), pools_.size()};
+  AppendTable(pools_, image);
+  header.blobs = {AlignUp(image.size()), blobs_.size()};
+  AppendTable(blobs_, image);
+  header.blob_data_offset = AlignUp(image.size());
+  header.blob_data_size = blob_data_.size();
+  image.resize(header.blob_data_offset, '\0');
+  image.append(blob_data_);
+
+  std::memcpy(image.data(), &header, sizeof(header));
+  return image;
+}
+
+}  // namespace
+
+absl::StatusOr<std::string> BuildModelImage(const CompiledNode& root) {
+  ModelImageBuilder builder;
+  RETURN_IF_ERROR(builder.AddNode(root).status());
+  return builder.Build();
+}
+
+absl::Status WriteModelImageFile(absl::string_view path,
+                                 const CompiledNode& root) {
+  ASSIGN_OR_RETURN(std::string image, BuildModelImage(root));
+  std::ofstream file(std::string(path), std::ios::binary | std::ios::trunc);
+  if (!file.is_open()) {
+    return absl::InternalError(absl::StrCat("Failed to open ", path));
+  }
+  file.write(image.data(), image.size());
+  file.close();
+  if (!file) {
+    return absl::InternalError(absl::StrCat("Failed to write ", path));
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace wfa_virtual_people
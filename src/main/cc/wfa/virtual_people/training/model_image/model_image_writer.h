@@ -0,0 +1,38 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_IMAGE_MODEL_IMAGE_WRITER_H_
+#define SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_IMAGE_MODEL_IMAGE_WRITER_H_
+
+#include <string>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+#include "wfa/virtual_people/common/model.pb.h"
+
+namespace wfa_virtual_people {
+
+// Convert the tree of @root to a model image. See model_image_format.h for the
+// layout.
+// Return error status if the tree is too large to be indexed by 32 bits.
+absl::StatusOr<std::string> BuildModelImage(const CompiledNode& root);
+
+// Convert the tree of @root to a model image, and write it to @path.
+absl::Status WriteModelImageFile(absl::string_view path,
+                                 const CompiledNode& root);
+
+}  // namespace wfa_virtual_people
+
+#endif  // SRC_MAIN_CC_WFA_VIRTUAL_PEOPLE_TRAINING_MODEL_IMAGE_MODEL_IMAGE_WRITER_H_
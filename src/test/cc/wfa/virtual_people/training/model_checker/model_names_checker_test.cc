@@ -20,6 +20,7 @@
 #include "google/protobuf/text_format.h"
 #include "gtest/gtest.h"
 #include "wfa/virtual_people/common/model.pb.h"
+#include "wfa/virtual_people/training/node_name_map.pb.h"
 
 namespace wfa_virtual_people {
 namespace {
@@ -64,5 +65,65 @@ TEST(CheckNodeNamesTest, DuplicatedName) {
                        "Duplicated node names: node1"));
 }
 
+TEST(CheckNodeNameMapTest, ValidNameMap) {
+  std::vector<CompiledNode> nodes;
+  nodes.emplace_back().set_name("c1");
+  nodes.emplace_back().set_name("c2");
+  NodeNameMap name_map;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(
+      R"pb(
+        entries { compact_name: "c1" name: "node1" }
+        entries { compact_name: "c2" name: "node2" }
+      )pb",
+      &name_map));
+  EXPECT_THAT(CheckNodeNameMap(nodes, name_map), IsOk());
+}
+
+TEST(CheckNodeNameMapTest, NodeNameNotInNameMap) {
+  std::vector<CompiledNode> nodes;
+  nodes.emplace_back().set_name("c1");
+  nodes.emplace_back().set_name("c3");
+  NodeNameMap name_map;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(
+      R"pb(
+        entries { compact_name: "c1" name: "node1" }
+        entries { compact_name: "c2" name: "node2" }
+      )pb",
+      &name_map));
+  EXPECT_THAT(CheckNodeNameMap(nodes, name_map),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       "Node name is not in the name map: c3"));
+}
+
+TEST(CheckNodeNameMapTest, DuplicatedCompactName) {
+  std::vector<CompiledNode> nodes;
+  nodes.emplace_back().set_name("c1");
+  NodeNameMap name_map;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(
+      R"pb(
+        entries { compact_name: "c1" name: "node1" }
+        entries { compact_name: "c1" name: "node2" }
+      )pb",
+      &name_map));
+  EXPECT_THAT(CheckNodeNameMap(nodes, name_map),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       "Duplicated compact names in the name map: c1"));
+}
+
+TEST(CheckNodeNameMapTest, DuplicatedName) {
+  std::vector<CompiledNode> nodes;
+  nodes.emplace_back().set_name("c1");
+  NodeNameMap name_map;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(
+      R"pb(
+        entries { compact_name: "c1" name: "node1" }
+        entries { compact_name: "c2" name: "node1" }
+      )pb",
+      &name_map));
+  EXPECT_THAT(CheckNodeNameMap(nodes, name_map),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       "Duplicated names in the name map: node1"));
+}
+
 }  // namespace
 }  // namespace wfa_virtual_people
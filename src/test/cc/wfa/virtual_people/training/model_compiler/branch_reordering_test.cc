@@ -0,0 +1,263 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "wfa/virtual_people/training/model_compiler/branch_reordering.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "absl/strings/string_view.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "wfa/virtual_people/common/field_filter.pb.h"
+#include "wfa/virtual_people/common/model.pb.h"
+#include "wfa/virtual_people/training/model_compiler/node_profile.h"
+
+namespace wfa_virtual_people {
+namespace {
+
+using ::testing::DoubleEq;
+using ::testing::ElementsAre;
+
+constexpr char kCountryField[] = "person_country_code";
+constexpr char kGenderField[] = "label.demo.gender";
+constexpr char kAgeField[] = "label.demo.age.min_age";
+
+void SetEqualFilter(absl::string_view name, absl::string_view value,
+                    FieldFilterProto& filter) {
+  filter.set_op(FieldFilterProto::EQUAL);
+  filter.set_name(std::string(name));
+  filter.set_value(std::string(value));
+}
+
+// Add a branch to @branch_node with @condition, which selects a population
+// node named @name with @population.
+void AddPoolBranch(const FieldFilterProto& condition, absl::string_view name,
+                   uint64_t population, BranchNode& branch_node) {
+  BranchNode::Branch* branch = branch_node.add_branches();
+  *branch->mutable_condition() = condition;
+  CompiledNode* node = branch->mutable_node();
+  node->set_name(std::string(name));
+  node->mutable_population_node()->add_pools()->set_total_population(
+      population);
+}
+
+FieldFilterProto EqualFilter(absl::string_view name, absl::string_view value) {
+  FieldFilterProto filter;
+  SetEqualFilter(name, value, filter);
+  return filter;
+}
+
+FieldFilterProto GenderAgeFilter(absl::string_view gender,
+                                 absl::string_view age) {
+  FieldFilterProto filter;
+  filter.set_op(FieldFilterProto::AND);
+  SetEqualFilter(kGenderField, gender, *filter.add_sub_filters());
+  SetEqualFilter(kAgeField, age, *filter.add_sub_filters());
+  return filter;
+}
+
+std::vector<std::string> GetChildNames(const CompiledNode& node) {
+  std::vector<std::string> names;
+  for (const BranchNode::Branch& branch : node.branch_node().branches()) {
+    names.push_back(branch.node().name());
+  }
+  return names;
+}
+
+TEST(AreMutuallyExclusiveTest, DifferentValuesOfSameField) {
+  EXPECT_TRUE(AreMutuallyExclusive(EqualFilter(kCountryField, "1"),
+                                   EqualFilter(kCountryField, "2")));
+  EXPECT_TRUE(AreMutuallyExclusive(GenderAgeFilter("GENDER_FEMALE", "18"),
+                                   EqualFilter(kAgeField, "25")));
+}
+
+TEST(AreMutuallyExclusiveTest, NotExclusive) {
+  EXPECT_FALSE(AreMutuallyExclusive(EqualFilter(kCountryField, "1"),
+                                    EqualFilter(kCountryField, "1")));
+  EXPECT_FALSE(AreMutuallyExclusive(EqualFilter(kGenderField, "GENDER_MALE"),
+                                    EqualFilter(kAgeField, "18")));
+  FieldFilterProto true_filter;
+  true_filter.set_op(FieldFilterProto::TRUE);
+  EXPECT_FALSE(
+      AreMutuallyExclusive(true_filter, EqualFilter(kCountryField, "1")));
+}
+
+TEST(AreMutuallyExclusiveTest, SameParsedValueNotExclusive) {
+  EXPECT_FALSE(AreMutuallyExclusive(EqualFilter(kAgeField, "18"),
+                                    EqualFilter(kAgeField, "018")));
+  EXPECT_FALSE(AreMutuallyExclusive(EqualFilter(kGenderField, "GENDER_FEMALE"),
+                                    EqualFilter(kGenderField, "1")));
+  EXPECT_TRUE(AreMutuallyExclusive(EqualFilter(kGenderField, "GENDER_FEMALE"),
+                                   EqualFilter(kGenderField, "2")));
+}
+
+TEST(AreMutuallyExclusiveTest, InvalidValueNotExclusive) {
+  EXPECT_FALSE(AreMutuallyExclusive(EqualFilter(kAgeField, "18"),
+                                    EqualFilter(kAgeField, "eighteen")));
+  EXPECT_FALSE(AreMutuallyExclusive(EqualFilter("label.demo.unknown", "1"),
+                                    EqualFilter("label.demo.unknown", "2")));
+}
+
+TEST(ReorderExclusiveBranchesTest, OrderByPopulation) {
+  CompiledNode node;
+  node.set_name("root");
+  BranchNode& branch_node = *node.mutable_branch_node();
+  AddPoolBranch(EqualFilter(kCountryField, "1"), "country_1", 100,
+                branch_node);
+  AddPoolBranch(EqualFilter(kCountryField, "2"), "country_2", 300,
+                branch_node);
+  AddPoolBranch(EqualFilter(kCountryField, "3"), "country_3", 200,
+                branch_node);
+
+  BranchReorderingReport report = ReorderExclusiveBranches(node);
+  EXPECT_THAT(GetChildNames(node),
+              ElementsAre("country_2", "country_3", "country_1"));
+  EXPECT_EQ(node.branch_node().branches(0).condition().value(), "2");
+  EXPECT_EQ(report.reordered_node_count, 1);
+  EXPECT_THAT(report.expected_filter_evaluations_before,
+              DoubleEq(1300.0 / 600.0));
+  EXPECT_THAT(report.expected_filter_evaluations_after,
+              DoubleEq(1000.0 / 600.0));
+}
+
+TEST(ReorderExclusiveBranchesTest, OrderByHitCount) {
+  CompiledNode node;
+  node.set_name("root");
+  BranchNode& branch_node = *node.mutable_branch_node();
+  AddPoolBranch(EqualFilter(kCountryField, "1"), "country_1", 100,
+                branch_node);
+  AddPoolBranch(EqualFilter(kCountryField, "2"), "country_2", 300,
+                branch_node);
+  AddPoolBranch(EqualFilter(kCountryField, "3"), "country_3", 200,
+                branch_node);
+  NodeHitCounts hit_counts = {
+      {"country_1", 50}, {"country_2", 10}, {"country_3", 40}};
+
+  BranchReorderingReport report = ReorderExclusiveBranches(node, &hit_counts);
+  EXPECT_THAT(GetChildNames(node),
+              ElementsAre("country_1", "country_3", "country_2"));
+  EXPECT_EQ(report.reordered_node_count, 1);
+  EXPECT_THAT(report.expected_filter_evaluations_before, DoubleEq(1.9));
+  EXPECT_THAT(report.expected_filter_evaluations_after, DoubleEq(1.6));
+}
+
+TEST(ReorderExclusiveBranchesTest, EqualHitCountsOrderByPopulation) {
+  CompiledNode node;
+  BranchNode& branch_node = *node.mutable_branch_node();
+  AddPoolBranch(EqualFilter(kCountryField, "1"), "country_1", 100,
+                branch_node);
+  AddPoolBranch(EqualFilter(kCountryField, "2"), "country_2", 300,
+                branch_node);
+  AddPoolBranch(EqualFilter(kCountryField, "3"), "country_3", 200,
+                branch_node);
+  // country_3 is not in the profile.
+  NodeHitCounts hit_counts = {{"country_1", 0}, {"country_2", 0}};
+
+  ReorderExclusiveBranches(node, &hit_counts);
+  EXPECT_THAT(GetChildNames(node),
+              ElementsAre("country_2", "country_3", "country_1"));
+}
+
+TEST(ReorderExclusiveBranchesTest, PairwiseExclusiveOnDifferentFields) {
+  CompiledNode node;
+  BranchNode& branch_node = *node.mutable_branch_node();
+  AddPoolBranch(GenderAgeFilter("GENDER_FEMALE", "18"), "female_18", 10,
+                branch_node);
+  AddPoolBranch(GenderAgeFilter("GENDER_FEMALE", "25"), "female_25", 20,
+                branch_node);
+  AddPoolBranch(EqualFilter(kGenderField, "GENDER_MALE"), "male", 30,
+                branch_node);
+
+  BranchReorderingReport report = ReorderExclusiveBranches(node);
+  EXPECT_THAT(GetChildNames(node),
+              ElementsAre("male", "female_25", "female_18"));
+  EXPECT_EQ(report.reordered_node_count, 1);
+}
+
+TEST(ReorderExclusiveBranchesTest, EqualPopulationsKeepOrder) {
+  CompiledNode node;
+  BranchNode& branch_node = *node.mutable_branch_node();
+  AddPoolBranch(EqualFilter(kCountryField, "1"), "country_1", 100,
+                branch_node);
+  AddPoolBranch(EqualFilter(kCountryField, "2"), "country_2", 100,
+                branch_node);
+  AddPoolBranch(EqualFilter(kCountryField, "3"), "country_3", 200,
+                branch_node);
+
+  ReorderExclusiveBranches(node);
+  EXPECT_THAT(GetChildNames(node),
+              ElementsAre("country_3", "country_1", "country_2"));
+}
+
+TEST(ReorderExclusiveBranchesTest, ReorderDescendants) {
+  CompiledNode node;
+  BranchNode::Branch* branch = node.mutable_branch_node()->add_branches();
+  branch->set_chance(1.0);
+  CompiledNode& child = *branch->mutable_node();
+  AddPoolBranch(EqualFilter(kCountryField, "1"), "country_1", 100,
+                *child.mutable_branch_node());
+  AddPoolBranch(EqualFilter(kCountryField, "2"), "country_2", 300,
+                *child.mutable_branch_node());
+
+  BranchReorderingReport report = ReorderExclusiveBranches(node);
+  EXPECT_THAT(GetChildNames(child), ElementsAre("country_2", "country_1"));
+  EXPECT_EQ(report.reordered_node_count, 1);
+}
+
+TEST(ReorderExclusiveBranchesTest, NotExclusiveNotReordered) {
+  CompiledNode node;
+  BranchNode& branch_node = *node.mutable_branch_node();
+  AddPoolBranch(EqualFilter(kGenderField, "GENDER_FEMALE"), "female", 100,
+                branch_node);
+  AddPoolBranch(EqualFilter(kAgeField, "18"), "age_18", 300, branch_node);
+  CompiledNode expected = node;
+
+  BranchReorderingReport report = ReorderExclusiveBranches(node);
+  EXPECT_EQ(node.SerializeAsString(), expected.SerializeAsString());
+  EXPECT_EQ(report.reordered_node_count, 0);
+  EXPECT_THAT(report.expected_filter_evaluations_after,
+              DoubleEq(report.expected_filter_evaluations_before));
+}
+
+TEST(ReorderExclusiveBranchesTest, SameParsedValueNotReordered) {
+  CompiledNode node;
+  BranchNode& branch_node = *node.mutable_branch_node();
+  AddPoolBranch(EqualFilter(kAgeField, "18"), "age_18", 100, branch_node);
+  AddPoolBranch(EqualFilter(kAgeField, "018"), "age_018", 300, branch_node);
+
+  BranchReorderingReport report = ReorderExclusiveBranches(node);
+  EXPECT_EQ(report.reordered_node_count, 0);
+  EXPECT_THAT(GetChildNames(node), ElementsAre("age_18", "age_018"));
+}
+
+TEST(ReorderExclusiveBranchesTest, ChanceBranchesNotReordered) {
+  CompiledNode node;
+  BranchNode& branch_node = *node.mutable_branch_node();
+  for (double chance : {0.2, 0.8}) {
+    BranchNode::Branch* branch = branch_node.add_branches();
+    branch->set_chance(chance);
+    branch->mutable_node()->mutable_population_node()->add_pools()
+        ->set_total_population(chance * 1000);
+  }
+  CompiledNode expected = node;
+
+  BranchReorderingReport report = ReorderExclusiveBranches(node);
+  EXPECT_EQ(node.SerializeAsString(), expected.SerializeAsString());
+  EXPECT_EQ(report.reordered_node_count, 0);
+}
+
+}  // namespace
+}  // namespace wfa_virtual_people
@@ -466,6 +466,46 @@ TEST(CompileTest, PopulationNodeKappaLessThanOne) {
   EXPECT_THAT(CompileModel(config), IsOkAndHolds(EqualsProto(expected)));
 }
 
+TEST(CompileTest, PopulationNodeCoalesceAdjacentPools) {
+  ModelNodeConfig config;
+  ASSERT_THAT(
+      ReadTextProtoFile(
+          "src/test/cc/wfa/virtual_people/training/model_compiler/test_data/"
+          "model_node_config_population_node_fragmented_census.textproto",
+          config),
+      IsOk());
+  CompiledNode expected;
+  ASSERT_THAT(
+      ReadTextProtoFile(
+          "src/test/cc/wfa/virtual_people/training/model_compiler/test_data/"
+          "compiled_node_for_population_node_fragmented_census.textproto",
+          expected),
+      IsOk());
+  EXPECT_THAT(CompileModel(config), IsOkAndHolds(EqualsProto(expected)));
+}
+
+TEST(CompileTest, PopulationNodeSortCensusRecordsByOffset) {
+  ModelNodeConfig config;
+  ASSERT_THAT(
+      ReadTextProtoFile(
+          "src/test/cc/wfa/virtual_people/training/model_compiler/test_data/"
+          "model_node_config_population_node_fragmented_census.textproto",
+          config),
+      IsOk());
+  CompiledNode expected;
+  ASSERT_THAT(
+      ReadTextProtoFile(
+          "src/test/cc/wfa/virtual_people/training/model_compiler/test_data/"
+          "compiled_node_for_population_node_fragmented_census_sorted."
+          "textproto",
+          expected),
+      IsOk());
+  CompilerOptions options;
+  options.sort_census_records_by_offset = true;
+  EXPECT_THAT(CompileModel(config, options),
+              IsOkAndHolds(EqualsProto(expected)));
+}
+
 TEST(CompileTest, PopulationNodeNoCensus) {
   ModelNodeConfig config;
   ASSERT_THAT(
@@ -13,6 +13,12 @@
 // limitations under the License.
 
 #include "wfa/virtual_people/training/model_compiler/comprehension/comprehension_method.h"
+#include "wfa/virtual_people/training/model_compiler/comprehension/context_scope.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
 
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
@@ -24,12 +30,14 @@
 #include "gtest/gtest.h"
 #include "wfa/virtual_people/training/comprehend.pb.h"
 #include "wfa/virtual_people/training/model_compiler/comprehension/contextual_boolean_expression.h"
+#include "wfa/virtual_people/training/model_compiler/comprehension/spec_util.h"
 #include "wfa/virtual_people/training/model_config.pb.h"
 
 namespace wfa_virtual_people {
 namespace {
 
 using ::wfa::EqualsProto;
+using ::wfa::IsOk;
 
 using ::testing::ElementsAre;
 using ::testing::Pair;
@@ -317,6 +325,105 @@ TEST(ComprehensionMethodTest, Filter) {
   EXPECT_THAT(result, EqualsProto(expected));
 }
 
+TEST(ComprehensionMethodTest, Filter_AfterForEach) {
+  // The filters following a ForEach are evaluated before the nodes are copied,
+  // unless they are formatted with the entity.
+  ModelNodeConfig config;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(
+      R"pb(
+        name: "World"
+        branches {
+          nodes {
+            name: "{x}"
+            comprehend {
+              context {
+                items { key: "A" value: "A" }
+                items { key: "C" value: "C" }
+                items { key: "D" value: "D" }
+                items { key: "yes" value: "yes" }
+                items { key: "is_A" value: "yes" }
+                items { key: "is_B" value: "yes" }
+                items { key: "is_E" value: "no" }
+              }
+              methods {
+                for_each {
+                  entity: "x"
+                  values {
+                    verbatim {
+                      items: "A"
+                      items: "B"
+                      items: "C"
+                      items: "D"
+                      items: "E"
+                    }
+                  }
+                }
+              }
+              methods {
+                filter {
+                  expression {
+                    not_expression {
+                      expression { equality { left_key: "x" right_key: "D" } }
+                    }
+                  }
+                }
+              }
+              methods {
+                apply_if {
+                  condition { equality { left_key: "x" right_key: "A" } }
+                  if_method {
+                    filter {
+                      expression { equality { left_key: "x" right_key: "A" } }
+                    }
+                  }
+                  else_method {
+                    filter {
+                      expression {
+                        not_expression {
+                          expression {
+                            equality { left_key: "x" right_key: "C" }
+                          }
+                        }
+                      }
+                    }
+                  }
+                }
+              }
+              methods {
+                filter {
+                  expression {
+                    equality { left_key: "is_{x}" right_key: "yes" }
+                  }
+                }
+              }
+            }
+          }
+        }
+      )pb",
+      &config));
+  ModelNodeConfig expected;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(
+      R"pb(
+        name: "World"
+        branches {
+          nodes { name: "A" }
+          nodes { name: "B" }
+        }
+      )pb",
+      &expected));
+
+  for (int thread_count : {1, 4}) {
+    ModelNodeConfig copy = config;
+    ComprehensionOptions options;
+    options.thread_count = thread_count;
+    ContextMap context_map;
+    ASSERT_OK_AND_ASSIGN(ModelNodeConfig result,
+                         ComprehensionMethod::ComprehendAndCleanModel(
+                             copy, context_map, options));
+    EXPECT_THAT(result, EqualsProto(expected)) << thread_count << " threads";
+  }
+}
+
 TEST(ComprehensionMethodTest, ApplyIf) {
   ModelNodeConfig config;
   ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(
@@ -705,6 +812,535 @@ TEST(ComprehensionMethodTest, FormatTextFields_Default) {
   EXPECT_THAT(result, EqualsProto(expected));
 }
 
+TEST(ComprehensionMethodTest, FormatTextFields_FailOnUnknownPlaceholders) {
+  ModelNodeConfig config;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(
+      R"pb(
+        name: "{a}"
+        comprehend { context { items { key: "a" value: "A" } } }
+        branches { nodes { name: "{a} {b}" } }
+      )pb",
+      &config));
+  ModelNodeConfig config_copy(config);
+
+  // Unknown placeholders are kept by default.
+  ContextMap context_map;
+  ASSERT_OK_AND_ASSIGN(
+      ModelNodeConfig result,
+      ComprehensionMethod::ComprehendAndCleanModel(config, context_map));
+  EXPECT_EQ(result.branches().nodes(0).name(), "A {b}");
+
+  ComprehensionOptions options;
+  options.fail_on_unknown_placeholders = true;
+  EXPECT_THAT(ComprehensionMethod::ComprehendAndCleanModel(
+                  config_copy, context_map, options)
+                  .status(),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       "Placeholder {b} is not in context"));
+}
+
+TEST(ComprehensionMethodTest, NestedForEach) {
+  // Each level is expanded with the context of its instantiated parent.
+  ModelNodeConfig config;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(
+      R"pb(
+        name: "World"
+        branches {
+          nodes {
+            name: "{country}"
+            comprehend {
+              context {
+                items { key: "US" value: "US" }
+                items { key: "F" value: "F" }
+              }
+              methods {
+                for_each {
+                  entity: "country"
+                  values { verbatim { items: "US" items: "CA" } }
+                }
+              }
+            }
+            branches {
+              nodes {
+                name: "{country} {gender}"
+                comprehend {
+                  methods {
+                    for_each {
+                      entity: "gender"
+                      values { verbatim { items: "F" items: "M" } }
+                    }
+                  }
+                  methods {
+                    filter {
+                      expression {
+                        or_expression {
+                          expressions {
+                            equality { left_key: "gender" right_key: "F" }
+                          }
+                          expressions {
+                            equality { left_key: "country" right_key: "US" }
+                          }
+                        }
+                      }
+                    }
+                  }
+                }
+                branches { nodes { name: "{country} {gender} leaf" } }
+              }
+            }
+          }
+        }
+      )pb",
+      &config));
+  ModelNodeConfig expected;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(
+      R"pb(
+        name: "World"
+        branches {
+          nodes {
+            name: "US"
+            branches {
+              nodes {
+                name: "US F"
+                branches { nodes { name: "US F leaf" } }
+              }
+              nodes {
+                name: "US M"
+                branches { nodes { name: "US M leaf" } }
+              }
+            }
+          }
+          nodes {
+            name: "CA"
+            branches {
+              nodes {
+                name: "CA F"
+                branches { nodes { name: "CA F leaf" } }
+              }
+            }
+          }
+        }
+      )pb",
+      &expected));
+
+  ContextMap context_map;
+  ASSERT_OK_AND_ASSIGN(
+      ModelNodeConfig result,
+      ComprehensionMethod::ComprehendAndCleanModel(config, context_map));
+  EXPECT_THAT(result, EqualsProto(expected));
+}
+
+TEST(ComprehensionMethodTest, NestedForEach_BuildsEachMethodOnce) {
+  // The ForEach of the inner node formats to the same method in every
+  // instance of the outer node, and reads the file once.
+  ModelNodeConfig config;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(
+      R"pb(
+        name: "root"
+        branches {
+          nodes {
+            name: "{x}"
+            comprehend {
+              methods {
+                for_each {
+                  entity: "x"
+                  values { verbatim { items: "1" items: "2" items: "3" } }
+                }
+              }
+            }
+            branches {
+              nodes {
+                name: "{x}{y}"
+                comprehend {
+                  methods {
+                    for_each {
+                      entity: "y"
+                      values {
+                        from_csv {
+                          filename: "src/test/cc/wfa/virtual_people/training/model_compiler/comprehension/test_data/test_csv.csv"
+                          column_name: "b"
+                        }
+                      }
+                    }
+                  }
+                }
+              }
+            }
+          }
+        }
+      )pb",
+      &config));
+
+  for (int thread_count : {1, 4}) {
+    ClearCsvCache();
+    ModelNodeConfig copy = config;
+    ComprehensionOptions options;
+    options.thread_count = thread_count;
+    ContextMap context_map;
+    ASSERT_OK_AND_ASSIGN(ModelNodeConfig result,
+                         ComprehensionMethod::ComprehendAndCleanModel(
+                             copy, context_map, options));
+    ASSERT_EQ(result.branches().nodes_size(), 3);
+    EXPECT_EQ(result.branches().nodes(2).branches().nodes_size(), 4);
+    EXPECT_EQ(result.branches().nodes(2).branches().nodes(3).name(), "3W");
+    CsvCacheStats stats = GetCsvCacheStats();
+    EXPECT_EQ(stats.hits + stats.misses, 1) << thread_count << " threads";
+  }
+}
+
+TEST(ComprehensionMethodTest, ForEach_ApplyInScope) {
+  Comprehend::Method method_config;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(
+      R"pb(
+        for_each {
+          entity: "country"
+          values { verbatim { items: "US" items: "CA" items: "MX" } }
+        }
+      )pb",
+      &method_config));
+  ASSERT_OK_AND_ASSIGN(std::unique_ptr<ComprehensionMethod> method,
+                       ComprehensionMethod::Build(method_config));
+  ModelNodeConfig config;
+  config.set_name("Nation");
+  ContextScopePtr scope =
+      ContextScope::WithNodeContext(nullptr, {{"region", "NA"}});
+
+  // The entity is only added to the scope, and the output can stop the
+  // generation.
+  std::vector<std::string> values;
+  EXPECT_THAT(method->ApplyInScope(
+                  config, scope,
+                  [&values, &scope](ModelNodeConfig& node,
+                                    const ContextScopePtr& node_scope) {
+                    EXPECT_FALSE(node.has_comprehend());
+                    EXPECT_EQ(node_scope->parent(), scope.get());
+                    values.push_back(*node_scope->Find("country"));
+                    if (values.size() == 2) {
+                      return absl::CancelledError("Stop");
+                    }
+                    return absl::OkStatus();
+                  }),
+              StatusIs(absl::StatusCode::kCancelled, "Stop"));
+  EXPECT_THAT(values, ElementsAre("US", "CA"));
+  EXPECT_FALSE(scope->Contains("country"));
+}
+
+// Several levels of ForEach, with a Filter using the keys of the ancestors.
+constexpr char kNestedForEachConfig[] = R"pb(
+  name: "World"
+  comprehend {
+    context {
+      items { key: "A" value: "A" }
+      items { key: "1" value: "1" }
+    }
+  }
+  branches {
+    nodes {
+      name: "{x}"
+      comprehend {
+        methods {
+          for_each {
+            entity: "x"
+            values { verbatim { items: "A" items: "B" items: "C" } }
+          }
+        }
+      }
+      branches {
+        nodes {
+          name: "{x}{y}"
+          comprehend {
+            methods {
+              for_each {
+                entity: "y"
+                values { verbatim { items: "1" items: "2" items: "3" } }
+              }
+            }
+          }
+          branches {
+            nodes {
+              name: "{x}{y}{z}"
+              comprehend {
+                methods {
+                  for_each {
+                    entity: "z"
+                    values { verbatim { items: "a" items: "b" } }
+                  }
+                }
+                methods {
+                  filter {
+                    expression {
+                      or_expression {
+                        expressions {
+                          equality { left_key: "x" right_key: "A" }
+                        }
+                        expressions {
+                          equality { left_key: "y" right_key: "1" }
+                        }
+                      }
+                    }
+                  }
+                }
+              }
+            }
+            nodes { name: "{x}{y} other" }
+          }
+        }
+      }
+    }
+    nodes { name: "Rest" }
+  }
+)pb";
+
+TEST(ComprehensionMethodTest, Parallel_SameAsSequential) {
+  ModelNodeConfig config;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(
+      kNestedForEachConfig, &config));
+  ContextMap context_map;
+  ModelNodeConfig sequential_config = config;
+  ASSERT_OK_AND_ASSIGN(ModelNodeConfig expected,
+                       ComprehensionMethod::ComprehendAndCleanModel(
+                           sequential_config, context_map));
+  // 3 x, 3 y for each x, 2 z for each (x, y) passing the filter, 1 other for
+  // each (x, y).
+  ASSERT_EQ(expected.branches().nodes_size(), 4);
+  EXPECT_EQ(expected.branches().nodes(0).branches().nodes(0).name(), "A1");
+  // Only "B2 other".
+  const ModelNodeConfig& b2 = expected.branches().nodes(1).branches().nodes(1);
+  EXPECT_EQ(b2.name(), "B2");
+  EXPECT_EQ(b2.branches().nodes_size(), 1);
+
+  for (int thread_count : {2, 4, 8}) {
+    ModelNodeConfig parallel_config = config;
+    ComprehensionOptions options;
+    options.thread_count = thread_count;
+    ASSERT_OK_AND_ASSIGN(ModelNodeConfig result,
+                         ComprehensionMethod::ComprehendAndCleanModel(
+                             parallel_config, context_map, options));
+    EXPECT_THAT(result, EqualsProto(expected)) << thread_count << " threads";
+  }
+}
+
+TEST(ComprehensionMethodTest, Parallel_SameErrorAsSequential) {
+  ModelNodeConfig config;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(
+      kNestedForEachConfig, &config));
+  // The second node below each "{x}{y}" fails, as y is already set. Every
+  // subtree fails, and the error of the first one is returned.
+  ModelNodeConfig& other = *config.mutable_branches()
+                                ->mutable_nodes(0)
+                                ->mutable_branches()
+                                ->mutable_nodes(0)
+                                ->mutable_branches()
+                                ->mutable_nodes(1);
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(
+      R"pb(
+        for_each {
+          entity: "y"
+          values { verbatim { items: "{x}" } }
+        }
+      )pb",
+      other.mutable_comprehend()->add_methods()));
+  ContextMap context_map;
+  ModelNodeConfig sequential_config = config;
+  absl::Status expected =
+      ComprehensionMethod::ComprehendAndCleanModel(sequential_config,
+                                                   context_map)
+          .status();
+  EXPECT_THAT(expected, StatusIs(absl::StatusCode::kInvalidArgument,
+                                 "entity is already in context map"));
+
+  for (int thread_count : {2, 4, 8}) {
+    ModelNodeConfig parallel_config = config;
+    ComprehensionOptions options;
+    options.thread_count = thread_count;
+    EXPECT_EQ(ComprehensionMethod::ComprehendAndCleanModel(
+                  parallel_config, context_map, options)
+                  .status(),
+              expected)
+        << thread_count << " threads";
+  }
+}
+
+constexpr char kExpansionConfig[] = R"pb(
+  name: "World"
+  branches {
+    nodes {
+      name: "{x}"
+      comprehend {
+        context { items { key: "2" value: "2" } }
+        methods {
+          for_each {
+            entity: "x"
+            values { verbatim { items: "A" items: "B" } }
+          }
+        }
+      }
+      branches {
+        nodes {
+          name: "{x}{y}"
+          comprehend {
+            methods {
+              for_each {
+                entity: "y"
+                values { verbatim { items: "1" items: "2" items: "3" } }
+              }
+            }
+            methods {
+              filter {
+                expression {
+                  not_expression {
+                    expression { equality { left_key: "y" right_key: "2" } }
+                  }
+                }
+              }
+            }
+          }
+          branches { nodes {} }
+        }
+      }
+    }
+  }
+)pb";
+
+// The sum of the sizes of @node and its descendants, without their child
+// nodes.
+int64_t GetByteCount(const ModelNodeConfig& node) {
+  ModelNodeConfig shell = node;
+  if (shell.has_branches()) {
+    shell.mutable_branches()->clear_nodes();
+  }
+  int64_t byte_count = shell.ByteSizeLong();
+  for (const ModelNodeConfig& child : node.branches().nodes()) {
+    byte_count += GetByteCount(child);
+  }
+  return byte_count;
+}
+
+TEST(ComprehensionMethodTest, EstimateComprehension) {
+  ModelNodeConfig config;
+  ASSERT_TRUE(
+      google::protobuf::TextFormat::ParseFromString(kExpansionConfig, &config));
+  ContextMap context_map;
+  ModelNodeConfig comprehended_config = config;
+  ASSERT_OK_AND_ASSIGN(ModelNodeConfig comprehended,
+                       ComprehensionMethod::ComprehendAndCleanModel(
+                           comprehended_config, context_map));
+
+  for (int thread_count : {1, 4}) {
+    ModelNodeConfig copy = config;
+    ComprehensionOptions options;
+    options.thread_count = thread_count;
+    ASSERT_OK_AND_ASSIGN(
+        ComprehensionReport report,
+        ComprehensionMethod::EstimateComprehension(copy, context_map, options));
+    EXPECT_EQ(report.node_count, 11);
+    EXPECT_EQ(report.byte_count, GetByteCount(comprehended));
+
+    ASSERT_EQ(report.nodes.size(), 4);
+    EXPECT_EQ(report.nodes[0].path, "World");
+    EXPECT_EQ(report.nodes[0].input_count, 1);
+    EXPECT_EQ(report.nodes[0].output_count, 1);
+    EXPECT_EQ(report.nodes[1].path, "World/{x}");
+    EXPECT_EQ(report.nodes[1].input_count, 1);
+    EXPECT_EQ(report.nodes[1].output_count, 2);
+    EXPECT_EQ(report.nodes[2].path, "World/{x}/{x}{y}");
+    EXPECT_EQ(report.nodes[2].input_count, 2);
+    EXPECT_EQ(report.nodes[2].output_count, 4);
+    EXPECT_EQ(report.nodes[3].path, "World/{x}/{x}{y}/#0");
+    EXPECT_EQ(report.nodes[3].input_count, 4);
+    EXPECT_EQ(report.nodes[3].output_count, 4);
+    EXPECT_EQ(report.nodes[3].byte_count, 0);
+
+    // The Filter is applied by the ForEach.
+    const std::vector<NodeExpansion::MethodExpansion>& methods =
+        report.nodes[2].methods;
+    ASSERT_EQ(methods.size(), 2);
+    EXPECT_EQ(methods[0].method, "for_each");
+    EXPECT_EQ(methods[0].input_count, 2);
+    EXPECT_EQ(methods[0].output_count, 4);
+    EXPECT_EQ(methods[1].method, "format_text_fields");
+    EXPECT_EQ(methods[1].input_count, 4);
+    EXPECT_EQ(methods[1].output_count, 4);
+  }
+}
+
+TEST(ComprehensionMethodTest, MaxNodeCount) {
+  ModelNodeConfig config;
+  ASSERT_TRUE(
+      google::protobuf::TextFormat::ParseFromString(kExpansionConfig, &config));
+  ContextMap context_map;
+  ComprehensionOptions options;
+  options.max_node_count = 11;
+  ModelNodeConfig copy = config;
+  EXPECT_THAT(
+      ComprehensionMethod::ComprehendAndCleanModel(copy, context_map, options),
+      IsOk());
+
+  options.max_node_count = 10;
+  copy = config;
+  EXPECT_THAT(
+      ComprehensionMethod::ComprehendAndCleanModel(copy, context_map, options)
+          .status(),
+      StatusIs(absl::StatusCode::kResourceExhausted,
+               "Comprehension exceeds max_node_count 10 at "
+               "World/{x}/{x}{y}/#0"));
+  copy = config;
+  EXPECT_THAT(
+      ComprehensionMethod::EstimateComprehension(copy, context_map, options)
+          .status(),
+      StatusIs(absl::StatusCode::kResourceExhausted, "max_node_count"));
+}
+
+TEST(ComprehensionMethodTest, MaxByteCount) {
+  ModelNodeConfig config;
+  ASSERT_TRUE(
+      google::protobuf::TextFormat::ParseFromString(kExpansionConfig, &config));
+  ContextMap context_map;
+  ModelNodeConfig copy = config;
+  ASSERT_OK_AND_ASSIGN(
+      ComprehensionReport report,
+      ComprehensionMethod::EstimateComprehension(copy, context_map));
+
+  ComprehensionOptions options;
+  options.max_byte_count = report.byte_count;
+  copy = config;
+  EXPECT_THAT(
+      ComprehensionMethod::ComprehendAndCleanModel(copy, context_map, options),
+      IsOk());
+
+  options.max_byte_count = report.byte_count - 1;
+  copy = config;
+  EXPECT_THAT(
+      ComprehensionMethod::ComprehendAndCleanModel(copy, context_map, options)
+          .status(),
+      StatusIs(absl::StatusCode::kResourceExhausted, "max_byte_count"));
+}
+
+TEST(ComprehensionMethodTest, Error_NegativeLimit) {
+  ModelNodeConfig config;
+  config.set_name("a");
+  ContextMap context_map;
+  ComprehensionOptions options;
+  options.max_node_count = -1;
+  EXPECT_THAT(
+      ComprehensionMethod::ComprehendAndCleanModel(config, context_map, options)
+          .status(),
+      StatusIs(absl::StatusCode::kInvalidArgument, "must not be negative"));
+}
+
+TEST(ComprehensionMethodTest, Error_InvalidThreadCount) {
+  ModelNodeConfig config;
+  config.set_name("World");
+  ContextMap context_map;
+  ComprehensionOptions options;
+  options.thread_count = 0;
+  EXPECT_THAT(ComprehensionMethod::ComprehendAndCleanModel(config, context_map,
+                                                           options)
+                  .status(),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       "thread_count must be positive"));
+}
+
 TEST(ComprehensionMethodTest, Error_ApplyWithBaseClass) {
   ComprehensionMethod method;
   ModelNodeConfig config;
@@ -1049,6 +1685,55 @@ TEST(ComprehensionMethodTest, Error_Filter_EvaluationError) {
                        "Key is not found in context map"));
 }
 
+TEST(ComprehensionMethodTest, Error_Filter_EvaluationErrorAfterForEach) {
+  ModelNodeConfig config;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(
+      R"pb(
+        name: "a"
+        branches {
+          nodes {
+            comprehend {
+              context { items { key: "x1" value: "x1" } }
+              methods {
+                for_each {
+                  entity: "x"
+                  values { verbatim { items: "x1" items: "x2" } }
+                }
+              }
+              methods {
+                filter {
+                  expression {
+                    or_expression {
+                      expressions {
+                        equality { left_key: "x" right_key: "x1" }
+                      }
+                      expressions {
+                        equality { left_key: "x" right_key: "y" }
+                      }
+                    }
+                  }
+                }
+              }
+            }
+          }
+        }
+      )pb",
+      &config));
+
+  for (int thread_count : {1, 4}) {
+    ModelNodeConfig copy = config;
+    ComprehensionOptions options;
+    options.thread_count = thread_count;
+    ContextMap context_map;
+    EXPECT_THAT(
+        ComprehensionMethod::ComprehendAndCleanModel(copy, context_map, options)
+            .status(),
+        StatusIs(absl::StatusCode::kInvalidArgument,
+                 "Key is not found in context map:y"))
+        << thread_count << " threads";
+  }
+}
+
 TEST(ComprehensionMethodTest, Error_ApplyIf_ConditionNotSet) {
   ModelNodeConfig config;
   ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(
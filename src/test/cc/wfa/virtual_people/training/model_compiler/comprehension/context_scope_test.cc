@@ -0,0 +1,137 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "wfa/virtual_people/training/model_compiler/comprehension/context_scope.h"
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+#include "wfa/virtual_people/training/comprehend.pb.h"
+
+namespace wfa_virtual_people {
+namespace {
+
+using ::testing::IsNull;
+using ::testing::Pair;
+using ::testing::Pointee;
+using ::testing::UnorderedElementsAre;
+
+TEST(ContextScopeTest, NodeContext) {
+  Comprehend::Context context;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(
+      R"pb(
+        items { key: "a" value: "a1" }
+        items { key: "b" value: "b1" }
+        items { key: "a" value: "a2" }
+      )pb",
+      &context));
+  ContextScopePtr scope = ContextScope::WithNodeContext(nullptr, context);
+  // The last value of a key is used.
+  EXPECT_THAT(scope->Find("a"), Pointee(std::string("a2")));
+  EXPECT_THAT(scope->Find("b"), Pointee(std::string("b1")));
+  EXPECT_THAT(scope->Find("c"), IsNull());
+  EXPECT_THAT(scope->AsMap(),
+              UnorderedElementsAre(Pair("a", "a2"), Pair("b", "b1")));
+}
+
+TEST(ContextScopeTest, Precedence) {
+  ContextScopePtr root =
+      ContextScope::WithNodeContext(nullptr, {{"a", "root"}});
+  ContextScopePtr bindings =
+      ContextScope::WithBindings(root, {{"b", "bound"}});
+  // The context set in the config of a descendant is overridden by both the
+  // ancestors and the bindings.
+  ContextScopePtr child = ContextScope::WithNodeContext(
+      bindings, {{"a", "child"}, {"b", "child"}, {"c", "child"}});
+  ContextScopePtr leaf = ContextScope::WithBindings(child, {{"d", "bound"}});
+
+  EXPECT_THAT(leaf->Find("a"), Pointee(std::string("root")));
+  EXPECT_THAT(leaf->Find("b"), Pointee(std::string("bound")));
+  EXPECT_THAT(leaf->Find("c"), Pointee(std::string("child")));
+  EXPECT_THAT(leaf->Find("d"), Pointee(std::string("bound")));
+  EXPECT_THAT(leaf->AsMap(),
+              UnorderedElementsAre(Pair("a", "root"), Pair("b", "bound"),
+                                   Pair("c", "child"), Pair("d", "bound")));
+  // The parent scopes are not changed.
+  EXPECT_THAT(child->Find("d"), IsNull());
+  EXPECT_THAT(bindings->AsMap(),
+              UnorderedElementsAre(Pair("a", "root"), Pair("b", "bound")));
+  // Finding with the cached map of an ancestor gives the same values.
+  EXPECT_THAT(leaf->Find("a"), Pointee(std::string("root")));
+  EXPECT_THAT(leaf->Find("c"), Pointee(std::string("child")));
+}
+
+TEST(ContextScopeTest, ManyItems) {
+  ContextScope::Items items;
+  for (int i = 0; i < 100; ++i) {
+    items.emplace_back(std::to_string(i), "first");
+  }
+  items.emplace_back("50", "last");
+  ContextScopePtr root =
+      ContextScope::WithNodeContext(nullptr, {{"0", "root"}});
+  ContextScopePtr scope = ContextScope::WithNodeContext(root, items);
+  EXPECT_THAT(scope->Find("0"), Pointee(std::string("root")));
+  EXPECT_THAT(scope->Find("50"), Pointee(std::string("last")));
+  EXPECT_THAT(scope->Find("99"), Pointee(std::string("first")));
+  EXPECT_THAT(scope->Find("100"), IsNull());
+  EXPECT_EQ(scope->AsMap().size(), 100);
+  EXPECT_EQ(scope->AsMap().at("50"), "last");
+}
+
+TEST(ContextScopeTest, EmptyScopeIsShared) {
+  ContextScopePtr root = ContextScope::WithNodeContext(nullptr, {{"a", "1"}});
+  EXPECT_EQ(ContextScope::WithNodeContext(root, Comprehend::Context()), root);
+  EXPECT_EQ(ContextScope::WithBindings(root, {}), root);
+  ContextScopePtr empty_root =
+      ContextScope::WithNodeContext(nullptr, Comprehend::Context());
+  ASSERT_NE(empty_root, nullptr);
+  EXPECT_TRUE(empty_root->AsMap().empty());
+}
+
+TEST(ContextScopeTest, HasBraces) {
+  ContextScopePtr root = ContextScope::WithNodeContext(nullptr, {{"a", "1"}});
+  EXPECT_FALSE(root->has_braces());
+  ContextScopePtr child = ContextScope::WithBindings(root, {{"b", "{a}"}});
+  EXPECT_TRUE(child->has_braces());
+  EXPECT_TRUE(ContextScope::WithBindings(child, {{"c", "1"}})->has_braces());
+}
+
+TEST(ContextScopeTest, ConcurrentMaps) {
+  ContextScopePtr root = ContextScope::WithNodeContext(nullptr, {{"a", "1"}});
+  ContextScopePtr child = ContextScope::WithBindings(root, {{"b", "2"}});
+  std::vector<ContextScopePtr> leaves;
+  for (int i = 0; i < 8; ++i) {
+    leaves.push_back(
+        ContextScope::WithBindings(child, {{"c", std::to_string(i)}}));
+  }
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 8; ++i) {
+    threads.emplace_back([&leaves, i]() {
+      EXPECT_EQ(leaves[i]->AsMap().size(), 3);
+      EXPECT_EQ(leaves[i]->AsMap().at("c"), std::to_string(i));
+      EXPECT_EQ(*leaves[i]->Find("a"), "1");
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+}
+
+}  // namespace
+}  // namespace wfa_virtual_people
@@ -0,0 +1,148 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Measures the throughput of ContextualBooleanProgram against
+// ContextualBooleanExpression, on a filter shaped like the Filter methods of a
+// model config: an OR of ANDs over the keys set by ForEach methods.
+//
+// Example usage:
+// bazel build -c opt \
+// //src/test/cc/wfa/virtual_people/training/model_compiler/comprehension:\
+// contextual_boolean_program_benchmark
+// bazel-bin/src/test/cc/wfa/virtual_people/training/model_compiler/\
+// comprehension/contextual_boolean_program_benchmark \
+// --iterations=1000000 --context_size=100
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "glog/logging.h"
+#include "google/protobuf/text_format.h"
+#include "wfa/virtual_people/training/comprehend.pb.h"
+#include "wfa/virtual_people/training/model_compiler/comprehension/contextual_boolean_expression.h"
+#include "wfa/virtual_people/training/model_compiler/comprehension/contextual_boolean_program.h"
+
+ABSL_FLAG(int64_t, iterations, 1000000,
+          "The number of contexts to evaluate with each implementation.");
+ABSL_FLAG(int, context_size, 100,
+          "The number of keys in each context, besides the filtered keys.");
+
+namespace wfa_virtual_people {
+namespace {
+
+// (country == us && !(gender == unknown)) ||
+// (region == region && country == ca && age == adult)
+constexpr char kExpression[] = R"pb(
+  or_expression {
+    expressions {
+      and_expression {
+        expressions { equality { left_key: "country" right_key: "us" } }
+        expressions {
+          not_expression {
+            expression { equality { left_key: "gender" right_key: "unknown" } }
+          }
+        }
+      }
+    }
+    expressions {
+      and_expression {
+        expressions { equality { left_key: "region" right_key: "region" } }
+        expressions { equality { left_key: "country" right_key: "ca" } }
+        expressions { equality { left_key: "age" right_key: "adult" } }
+      }
+    }
+  }
+)pb";
+
+std::vector<ContextMap> GetContexts(int context_size) {
+  std::vector<ContextMap> contexts;
+  for (const char* country : {"US", "CA", "MX"}) {
+    for (const char* gender : {"F", "M", "U"}) {
+      for (const char* age : {"18+", "18-"}) {
+        ContextMap& context = contexts.emplace_back();
+        for (int i = 0; i < context_size; ++i) {
+          context[absl::StrCat("key_", i)] = absl::StrCat("value_", i);
+        }
+        context["us"] = "US";
+        context["ca"] = "CA";
+        context["unknown"] = "U";
+        context["adult"] = "18+";
+        context["region"] = "NA";
+        context["country"] = country;
+        context["gender"] = gender;
+        context["age"] = age;
+      }
+    }
+  }
+  return contexts;
+}
+
+template <typename Expression>
+void Run(const char* name, const Expression& expression,
+         const std::vector<ContextMap>& contexts, const int64_t iterations) {
+  int64_t matched = 0;
+  absl::Time start = absl::Now();
+  for (int64_t i = 0; i < iterations; ++i) {
+    absl::StatusOr<bool> result =
+        expression.Evaluate(contexts[i % contexts.size()]);
+    CHECK(result.ok()) << result.status();
+    matched += *result;
+  }
+  absl::Duration elapsed = absl::Now() - start;
+  LOG(INFO) << name << ": "
+            << absl::ToDoubleNanoseconds(elapsed) / iterations
+            << " ns/evaluation, " << matched << " matched";
+}
+
+}  // namespace
+}  // namespace wfa_virtual_people
+
+int main(int argc, char** argv) {
+  absl::ParseCommandLine(argc, argv);
+
+  using ::wfa_virtual_people::Comprehend;
+  using ::wfa_virtual_people::ContextMap;
+  using ::wfa_virtual_people::ContextualBooleanExpression;
+  using ::wfa_virtual_people::ContextualBooleanProgram;
+
+  Comprehend::ContextualBooleanExpression config;
+  CHECK(google::protobuf::TextFormat::ParseFromString(
+      wfa_virtual_people::kExpression, &config));
+  absl::StatusOr<std::unique_ptr<ContextualBooleanExpression>> expression =
+      ContextualBooleanExpression::Build(config);
+  CHECK(expression.ok()) << expression.status();
+  absl::StatusOr<ContextualBooleanProgram> program =
+      ContextualBooleanProgram::Compile(config);
+  CHECK(program.ok()) << program.status();
+  LOG(INFO) << "Program: " << program->instruction_count()
+            << " instructions, " << program->keys().size() << " keys";
+
+  std::vector<ContextMap> contexts =
+      wfa_virtual_people::GetContexts(absl::GetFlag(FLAGS_context_size));
+  const int64_t iterations = absl::GetFlag(FLAGS_iterations);
+  wfa_virtual_people::Run("ContextualBooleanExpression", **expression,
+                          contexts, iterations);
+  wfa_virtual_people::Run("ContextualBooleanProgram", *program, contexts,
+                          iterations);
+  return 0;
+}
@@ -0,0 +1,218 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "wfa/virtual_people/training/model_compiler/comprehension/contextual_boolean_program.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "common_cpp/testing/status_macros.h"
+#include "common_cpp/testing/status_matchers.h"
+#include "gmock/gmock.h"
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+#include "wfa/virtual_people/training/comprehend.pb.h"
+#include "wfa/virtual_people/training/model_compiler/comprehension/contextual_boolean_expression.h"
+
+namespace wfa_virtual_people {
+namespace {
+
+using ::testing::ElementsAre;
+using ::wfa::IsOkAndHolds;
+using ::wfa::StatusIs;
+
+Comprehend::ContextualBooleanExpression ParseExpression(const char* text) {
+  Comprehend::ContextualBooleanExpression config;
+  EXPECT_TRUE(google::protobuf::TextFormat::ParseFromString(text, &config));
+  return config;
+}
+
+TEST(ContextualBooleanProgramTest, NestedExpression) {
+  // expression: a == b && !(c == d)
+  Comprehend::ContextualBooleanExpression config = ParseExpression(R"pb(
+    and_expression {
+      expressions { equality { left_key: "a" right_key: "b" } }
+      expressions {
+        not_expression {
+          expression { equality { left_key: "c" right_key: "d" } }
+        }
+      }
+    }
+  )pb");
+  ASSERT_OK_AND_ASSIGN(ContextualBooleanProgram program,
+                       ContextualBooleanProgram::Compile(config));
+  EXPECT_THAT(program.keys(), ElementsAre("a", "b", "c", "d"));
+
+  ContextMap context_map(
+      {{"a", "123"}, {"b", "123"}, {"c", "789"}, {"d", "456"}});
+  EXPECT_THAT(program.Evaluate(context_map), IsOkAndHolds(true));
+  context_map["a"] = "456";
+  EXPECT_THAT(program.Evaluate(context_map), IsOkAndHolds(false));
+  context_map["a"] = "123";
+  context_map["c"] = "456";
+  EXPECT_THAT(program.Evaluate(context_map), IsOkAndHolds(false));
+}
+
+TEST(ContextualBooleanProgramTest, InternedKeys) {
+  Comprehend::ContextualBooleanExpression config = ParseExpression(R"pb(
+    or_expression {
+      expressions { equality { left_key: "a" right_key: "b" } }
+      expressions { equality { left_key: "b" right_key: "a" } }
+    }
+  )pb");
+  ASSERT_OK_AND_ASSIGN(ContextualBooleanProgram program,
+                       ContextualBooleanProgram::Compile(config));
+  EXPECT_THAT(program.keys(), ElementsAre("a", "b"));
+}
+
+TEST(ContextualBooleanProgramTest, ConstantFolding) {
+  // (a == a || c == d) && !(b == b && e == f) is always false.
+  Comprehend::ContextualBooleanExpression config = ParseExpression(R"pb(
+    and_expression {
+      expressions {
+        or_expression {
+          expressions { equality { left_key: "a" right_key: "a" } }
+          expressions { equality { left_key: "c" right_key: "d" } }
+        }
+      }
+      expressions {
+        not_expression {
+          expression {
+            or_expression {
+              expressions { equality { left_key: "b" right_key: "b" } }
+              expressions { equality { left_key: "e" right_key: "f" } }
+            }
+          }
+        }
+      }
+    }
+  )pb");
+  ASSERT_OK_AND_ASSIGN(ContextualBooleanProgram program,
+                       ContextualBooleanProgram::Compile(config));
+  EXPECT_EQ(program.instruction_count(), 1);
+
+  // The keys of the folded expressions must still be in the context.
+  ContextMap context_map({{"a", "1"}, {"b", "1"}, {"c", "1"}, {"d", "1"}});
+  EXPECT_THAT(program.Evaluate(context_map),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       "Key is not found in context map:e"));
+  context_map["e"] = "1";
+  context_map["f"] = "1";
+  EXPECT_THAT(program.Evaluate(context_map), IsOkAndHolds(false));
+}
+
+TEST(ContextualBooleanProgramTest, EmptyConnectives) {
+  ASSERT_OK_AND_ASSIGN(
+      ContextualBooleanProgram and_program,
+      ContextualBooleanProgram::Compile(ParseExpression("and_expression {}")));
+  EXPECT_THAT(and_program.Evaluate(ContextMap()), IsOkAndHolds(true));
+  ASSERT_OK_AND_ASSIGN(
+      ContextualBooleanProgram or_program,
+      ContextualBooleanProgram::Compile(ParseExpression("or_expression {}")));
+  EXPECT_THAT(or_program.Evaluate(ContextMap()), IsOkAndHolds(false));
+}
+
+TEST(ContextualBooleanProgramTest, ShortCircuitKeepsKeyErrors) {
+  Comprehend::ContextualBooleanExpression config = ParseExpression(R"pb(
+    and_expression {
+      expressions { equality { left_key: "a" right_key: "b" } }
+      expressions { equality { left_key: "c" right_key: "d" } }
+    }
+  )pb");
+  ASSERT_OK_AND_ASSIGN(ContextualBooleanProgram program,
+                       ContextualBooleanProgram::Compile(config));
+  int lookup_count = 0;
+  ContextMap context_map({{"a", "123"}, {"b", "456"}});
+  auto lookup = [&](absl::string_view key) -> const std::string* {
+    ++lookup_count;
+    auto it = context_map.find(key);
+    return it == context_map.end() ? nullptr : &it->second;
+  };
+  EXPECT_THAT(program.Evaluate(lookup),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       "Key is not found in context map:c"));
+  EXPECT_EQ(lookup_count, 3);
+}
+
+TEST(ContextualBooleanProgramTest, SameErrorsAsExpression) {
+  for (const char* text : {
+           "",
+           "equality { left_key: \"a\" }",
+           "not_expression {}",
+           "and_expression { expressions { not_expression {} } }",
+           "or_expression { expressions { or_expression { expressions {} } } }",
+       }) {
+    Comprehend::ContextualBooleanExpression config = ParseExpression(text);
+    absl::Status expected = ContextualBooleanExpression::Build(config).status();
+    ASSERT_FALSE(expected.ok());
+    EXPECT_EQ(ContextualBooleanProgram::Compile(config).status(), expected)
+        << text;
+  }
+}
+
+TEST(ContextualBooleanProgramTest, SameResultsAsExpression) {
+  // All the combinations of (x1 == x2) for the keys below.
+  const std::vector<std::string> keys = {"a", "b", "c"};
+  Comprehend::ContextualBooleanExpression config = ParseExpression(R"pb(
+    or_expression {
+      expressions {
+        and_expression {
+          expressions { equality { left_key: "a" right_key: "b" } }
+          expressions {
+            not_expression {
+              expression { equality { left_key: "b" right_key: "c" } }
+            }
+          }
+        }
+      }
+      expressions {
+        and_expression {
+          expressions { equality { left_key: "c" right_key: "a" } }
+          expressions { or_expression {} }
+        }
+      }
+      expressions {
+        not_expression {
+          expression {
+            or_expression {
+              expressions { equality { left_key: "a" right_key: "c" } }
+              expressions { equality { left_key: "b" right_key: "b" } }
+            }
+          }
+        }
+      }
+      expressions { equality { left_key: "b" right_key: "c" } }
+    }
+  )pb");
+  ASSERT_OK_AND_ASSIGN(std::unique_ptr<ContextualBooleanExpression> expression,
+                       ContextualBooleanExpression::Build(config));
+  ASSERT_OK_AND_ASSIGN(ContextualBooleanProgram program,
+                       ContextualBooleanProgram::Compile(config));
+  for (int values = 0; values < 27; ++values) {
+    ContextMap context_map;
+    for (int i = 0, rest = values; i < keys.size(); ++i, rest /= 3) {
+      context_map[keys[i]] = std::to_string(rest % 3);
+    }
+    ASSERT_OK_AND_ASSIGN(bool expected, expression->Evaluate(context_map));
+    EXPECT_THAT(program.Evaluate(context_map), IsOkAndHolds(expected))
+        << values;
+  }
+}
+
+}  // namespace
+}  // namespace wfa_virtual_people
@@ -0,0 +1,143 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "wfa/virtual_people/training/model_compiler/comprehension/formatting_plan.h"
+
+#include "absl/status/status.h"
+#include "common_cpp/testing/common_matchers.h"
+#include "common_cpp/testing/status_matchers.h"
+#include "gmock/gmock.h"
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+#include "wfa/virtual_people/common/model.pb.h"
+#include "wfa/virtual_people/training/model_compiler/comprehension/contextual_boolean_expression.h"
+#include "wfa/virtual_people/training/model_config.pb.h"
+
+namespace wfa_virtual_people {
+namespace {
+
+using ::wfa::EqualsProto;
+using ::wfa::IsOk;
+using ::wfa::StatusIs;
+
+TEST(FormattingPlanTest, Format) {
+  ModelNodeConfig config;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(
+      R"pb(
+        name: "{a} {b} {c}"
+        random_seed: "no placeholder"
+        comprehend {
+          methods {
+            for_each {
+              entity: "{a}"
+              values { verbatim { items: "{b}" items: "b" } }
+            }
+          }
+        }
+        branches {
+          nodes { name: "{a}" random_seed: "{b}" }
+          nodes { name: "{b}" chance: 1 }
+        }
+      )pb",
+      &config));
+  ModelNodeConfig expected;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(
+      R"pb(
+        name: "A B {c}"
+        random_seed: "no placeholder"
+        comprehend {
+          methods {
+            for_each {
+              entity: "A"
+              values { verbatim { items: "B" items: "b" } }
+            }
+          }
+        }
+        branches {
+          nodes { name: "{a}" random_seed: "B" }
+          nodes { name: "{b}" chance: 1 }
+        }
+      )pb",
+      &expected));
+  ContextMap context_map({{"a", "A"}, {"b", "B"}});
+  EXPECT_THAT(FormattingPlan::Get(ModelNodeConfig::descriptor(),
+                                  {"branches.nodes.name"})
+                  .Format(config, context_map),
+              IsOk());
+  EXPECT_THAT(config, EqualsProto(expected));
+}
+
+TEST(FormattingPlanTest, ExcludeField) {
+  ModelNodeConfig config;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(
+      R"pb(
+        name: "{a}"
+        branches { nodes { name: "{a}" } }
+      )pb",
+      &config));
+  ModelNodeConfig expected;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(
+      R"pb(
+        name: "A"
+        branches { nodes { name: "{a}" } }
+      )pb",
+      &expected));
+  ContextMap context_map({{"a", "A"}});
+  EXPECT_THAT(FormattingPlan::Get(ModelNodeConfig::descriptor(), {"branches"})
+                  .Format(config, context_map),
+              IsOk());
+  EXPECT_THAT(config, EqualsProto(expected));
+}
+
+TEST(FormattingPlanTest, FailOnUnknownPlaceholder) {
+  ModelNodeConfig config;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(
+      R"pb(
+        name: "{a}"
+        branches { nodes { name: "{b}" } }
+      )pb",
+      &config));
+  ContextMap context_map({{"a", "A"}});
+  const FormattingPlan& plan =
+      FormattingPlan::Get(ModelNodeConfig::descriptor(), {});
+  EXPECT_THAT(plan.Format(config, context_map, UnknownPlaceholderPolicy::kFail),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       "Placeholder {b} is not in context"));
+  EXPECT_THAT(FormattingPlan::Get(ModelNodeConfig::descriptor(), {"branches"})
+                  .Format(config, context_map, UnknownPlaceholderPolicy::kFail),
+              IsOk());
+}
+
+TEST(FormattingPlanTest, SharedByEquivalentExcludeFields) {
+  const FormattingPlan& plan = FormattingPlan::Get(
+      ModelNodeConfig::descriptor(), {"name", "branches.nodes.name"});
+  EXPECT_EQ(&plan,
+            &FormattingPlan::Get(ModelNodeConfig::descriptor(),
+                                 {"branches.nodes.name", "name", "name"}));
+  EXPECT_NE(&plan, &FormattingPlan::Get(ModelNodeConfig::descriptor(),
+                                        {"branches.nodes.name"}));
+}
+
+TEST(FormattingPlanTest, EmptyPlan) {
+  // No string field.
+  EXPECT_TRUE(FormattingPlan::Get(StopNode::descriptor(), {}).empty());
+  // All string fields are excluded.
+  EXPECT_TRUE(
+      FormattingPlan::Get(ModelNodeConfigs::descriptor(), {"nodes"}).empty());
+  EXPECT_FALSE(FormattingPlan::Get(ModelNodeConfig::descriptor(), {}).empty());
+}
+
+}  // namespace
+}  // namespace wfa_virtual_people
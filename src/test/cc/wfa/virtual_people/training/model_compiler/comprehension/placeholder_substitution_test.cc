@@ -0,0 +1,99 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "wfa/virtual_people/training/model_compiler/comprehension/placeholder_substitution.h"
+
+#include <string>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+#include "common_cpp/testing/status_matchers.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "wfa/virtual_people/training/model_compiler/comprehension/contextual_boolean_expression.h"
+
+namespace wfa_virtual_people {
+namespace {
+
+using ::wfa::IsOkAndHolds;
+using ::wfa::StatusIs;
+
+class PlaceholderSubstitutionTest : public ::testing::Test {
+ protected:
+  absl::StatusOr<bool> Substitute(
+      std::string& text,
+      UnknownPlaceholderPolicy policy = UnknownPlaceholderPolicy::kKeep) {
+    return SubstitutePlaceholders(
+        [this](absl::string_view key) -> const std::string* {
+          ++lookup_count_;
+          auto it = context_map_.find(key);
+          return it == context_map_.end() ? nullptr : &it->second;
+        },
+        policy, text);
+  }
+
+  ContextMap context_map_ = {{"a", "A"}, {"b", "{a}"}, {"", "empty"}};
+  int lookup_count_ = 0;
+};
+
+TEST_F(PlaceholderSubstitutionTest, Substitute) {
+  std::string text = "{a}-{b}-{a}{a} {c}";
+  EXPECT_THAT(Substitute(text), IsOkAndHolds(true));
+  // The substituted values are not formatted again.
+  EXPECT_EQ(text, "A-{a}-AA {c}");
+  EXPECT_EQ(lookup_count_, 5);
+}
+
+TEST_F(PlaceholderSubstitutionTest, NoPlaceholder) {
+  std::string text = "no placeholder }";
+  EXPECT_THAT(Substitute(text), IsOkAndHolds(false));
+  EXPECT_EQ(text, "no placeholder }");
+  EXPECT_EQ(lookup_count_, 0);
+}
+
+TEST_F(PlaceholderSubstitutionTest, UnknownKeysAreKept) {
+  std::string text = "{c} {d";
+  EXPECT_THAT(Substitute(text), IsOkAndHolds(false));
+  EXPECT_EQ(text, "{c} {d");
+}
+
+TEST_F(PlaceholderSubstitutionTest, NestedBraces) {
+  // The placeholder starts at the last '{' before '}'.
+  std::string text = "{{a}} {x{a}";
+  EXPECT_THAT(Substitute(text), IsOkAndHolds(true));
+  EXPECT_EQ(text, "{A} {xA");
+}
+
+TEST_F(PlaceholderSubstitutionTest, EmptyKey) {
+  std::string text = "{}";
+  EXPECT_THAT(Substitute(text), IsOkAndHolds(true));
+  EXPECT_EQ(text, "empty");
+}
+
+TEST_F(PlaceholderSubstitutionTest, FailOnUnknownKey) {
+  std::string text = "{a} {c}";
+  EXPECT_THAT(Substitute(text, UnknownPlaceholderPolicy::kFail),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       "Placeholder {c} is not in context"));
+  // An unclosed brace is not a placeholder.
+  text = "{a} {c";
+  EXPECT_THAT(Substitute(text, UnknownPlaceholderPolicy::kFail),
+              IsOkAndHolds(true));
+  EXPECT_EQ(text, "A {c");
+}
+
+}  // namespace
+}  // namespace wfa_virtual_people
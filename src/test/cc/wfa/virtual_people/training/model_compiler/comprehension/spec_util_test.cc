@@ -14,6 +14,14 @@
 
 #include "wfa/virtual_people/training/model_compiler/comprehension/spec_util.h"
 
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
 #include "common_cpp/testing/status_macros.h"
@@ -267,5 +275,151 @@ TEST(SpecUtilTest, MapSpec_FromCsv) {
                                    Pair("Z", ElementsAre("3", "7", "8"))));
 }
 
+TEST(SpecUtilTest, CsvCache_SharedByListAndMap) {
+  ClearCsvCache();
+  ListSpec list_config;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(
+      R"pb(
+        from_csv { column_name: "b" }
+      )pb",
+      &list_config));
+  list_config.mutable_from_csv()->set_filename(kTestCsvPath);
+  MapSpec map_config;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(
+      R"pb(
+        from_csv {
+          key_column_name: "b"
+          value_column_names { items: "a" }
+        }
+      )pb",
+      &map_config));
+  map_config.mutable_from_csv()->set_filename(kTestCsvPath);
+
+  ASSERT_OK_AND_ASSIGN(std::vector<std::string> items,
+                       ReadListFromSpec(list_config));
+  EXPECT_THAT(items, ElementsAre("X", "Y", "Z", "W"));
+  ASSERT_OK_AND_ASSIGN(items, ReadListFromSpec(list_config));
+  EXPECT_THAT(items, ElementsAre("X", "Y", "Z", "W"));
+  ASSERT_OK_AND_ASSIGN(StringToStringsMap mapping,
+                       ReadMapFromSpec(map_config));
+  EXPECT_EQ(mapping.size(), 4);
+
+  CsvCacheStats stats = GetCsvCacheStats();
+  EXPECT_EQ(stats.misses, 1);
+  EXPECT_EQ(stats.hits, 2);
+
+  ClearCsvCache();
+  stats = GetCsvCacheStats();
+  EXPECT_EQ(stats.misses, 0);
+  EXPECT_EQ(stats.hits, 0);
+}
+
+TEST(SpecUtilTest, CsvCache_ContentChanged) {
+  ClearCsvCache();
+  std::string path = ::testing::TempDir() + "/spec_util_test.csv";
+  {
+    std::ofstream output(path);
+    output << "a\nfirst\n";
+  }
+  ListSpec config;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(
+      R"pb(
+        from_csv { column_name: "a" }
+      )pb",
+      &config));
+  config.mutable_from_csv()->set_filename(path);
+  ASSERT_OK_AND_ASSIGN(std::vector<std::string> items,
+                       ReadListFromSpec(config));
+  EXPECT_THAT(items, ElementsAre("first"));
+
+  {
+    std::ofstream output(path);
+    output << "a\nsecond\n";
+  }
+  ASSERT_OK_AND_ASSIGN(items, ReadListFromSpec(config));
+  EXPECT_THAT(items, ElementsAre("second"));
+
+  CsvCacheStats stats = GetCsvCacheStats();
+  EXPECT_EQ(stats.misses, 2);
+  EXPECT_EQ(stats.hits, 0);
+}
+
+TEST(SpecUtilTest, CsvCache_TouchedOrChangedInPlace) {
+  ClearCsvCache();
+  std::string path = ::testing::TempDir() + "/spec_util_test_touched.csv";
+  {
+    std::ofstream output(path);
+    output << "a\nfirst\n";
+  }
+  ListSpec config;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(
+      R"pb(
+        from_csv { column_name: "a" }
+      )pb",
+      &config));
+  config.mutable_from_csv()->set_filename(path);
+  ASSERT_OK_AND_ASSIGN(std::vector<std::string> items,
+                       ReadListFromSpec(config));
+  EXPECT_THAT(items, ElementsAre("first"));
+
+  // The content is compared when the modification time changes.
+  std::filesystem::file_time_type modified =
+      std::filesystem::last_write_time(path);
+  std::filesystem::last_write_time(path, modified + std::chrono::hours(1));
+  ASSERT_OK_AND_ASSIGN(items, ReadListFromSpec(config));
+  EXPECT_THAT(items, ElementsAre("first"));
+  CsvCacheStats stats = GetCsvCacheStats();
+  EXPECT_EQ(stats.misses, 1);
+  EXPECT_EQ(stats.hits, 1);
+
+  // A change keeping the size is parsed again.
+  {
+    std::ofstream output(path);
+    output << "a\nfifth\n";
+  }
+  std::filesystem::last_write_time(path, modified + std::chrono::hours(2));
+  ASSERT_OK_AND_ASSIGN(items, ReadListFromSpec(config));
+  EXPECT_THAT(items, ElementsAre("fifth"));
+  stats = GetCsvCacheStats();
+  EXPECT_EQ(stats.misses, 2);
+  EXPECT_EQ(stats.hits, 1);
+}
+
+TEST(SpecUtilTest, CsvCache_ConcurrentReads) {
+  ClearCsvCache();
+  ListSpec config;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(
+      R"pb(
+        from_csv { column_name: "b" }
+      )pb",
+      &config));
+  config.mutable_from_csv()->set_filename(kTestCsvPath);
+
+  constexpr int kThreadCount = 8;
+  constexpr int kReadCount = 10;
+  std::atomic<int> failure_count = 0;
+  std::vector<std::thread> threads;
+  for (int i = 0; i < kThreadCount; ++i) {
+    threads.emplace_back([&config, &failure_count]() {
+      for (int j = 0; j < kReadCount; ++j) {
+        absl::StatusOr<std::vector<std::string>> items =
+            ReadListFromSpec(config);
+        if (!items.ok() ||
+            *items != std::vector<std::string>{"X", "Y", "Z", "W"}) {
+          ++failure_count;
+        }
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(failure_count, 0);
+
+  CsvCacheStats stats = GetCsvCacheStats();
+  EXPECT_GE(stats.misses, 1);
+  EXPECT_EQ(stats.hits + stats.misses, kThreadCount * kReadCount);
+}
+
 }  // namespace
 }  // namespace wfa_virtual_people
@@ -0,0 +1,82 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "wfa/virtual_people/training/model_compiler/comprehension/work_stealing_pool.h"
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace wfa_virtual_people {
+namespace {
+
+// Sum the leaves of a complete tree with @fanout and @depth, one task per
+// node.
+int64_t CountLeaves(WorkStealingPool& pool, int fanout, int depth) {
+  if (depth == 0) {
+    return 1;
+  }
+  std::vector<int64_t> counts(fanout, 0);
+  WorkStealingPool::TaskGroup group;
+  for (int i = 0; i < fanout; ++i) {
+    pool.Schedule(group, [&pool, &counts, fanout, depth, i]() {
+      counts[i] = CountLeaves(pool, fanout, depth - 1);
+    });
+  }
+  pool.Wait(group);
+  int64_t count = 0;
+  for (int64_t c : counts) {
+    count += c;
+  }
+  return count;
+}
+
+TEST(WorkStealingPoolTest, SingleThread) {
+  WorkStealingPool pool(1);
+  EXPECT_EQ(pool.thread_count(), 1);
+  EXPECT_EQ(CountLeaves(pool, 3, 4), 81);
+}
+
+TEST(WorkStealingPoolTest, NestedTasks) {
+  for (int thread_count : {2, 4, 8}) {
+    WorkStealingPool pool(thread_count);
+    EXPECT_EQ(CountLeaves(pool, 4, 6), 4096) << thread_count << " threads";
+  }
+}
+
+TEST(WorkStealingPoolTest, WaitForEmptyGroup) {
+  WorkStealingPool pool(4);
+  WorkStealingPool::TaskGroup group;
+  pool.Wait(group);
+}
+
+TEST(WorkStealingPoolTest, RunsEveryTaskOnce) {
+  WorkStealingPool pool(4);
+  constexpr int kTaskCount = 10000;
+  std::vector<std::atomic<int>> runs(kTaskCount);
+  WorkStealingPool::TaskGroup group;
+  for (int i = 0; i < kTaskCount; ++i) {
+    pool.Schedule(group, [&runs, i]() { ++runs[i]; });
+  }
+  pool.Wait(group);
+  for (int i = 0; i < kTaskCount; ++i) {
+    EXPECT_EQ(runs[i], 1) << i;
+  }
+}
+
+}  // namespace
+}  // namespace wfa_virtual_people
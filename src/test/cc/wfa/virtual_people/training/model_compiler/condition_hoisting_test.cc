@@ -0,0 +1,188 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "wfa/virtual_people/training/model_compiler/condition_hoisting.h"
+
+#include <string>
+
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "common_cpp/testing/common_matchers.h"
+#include "gmock/gmock.h"
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+#include "wfa/virtual_people/common/field_filter.pb.h"
+#include "wfa/virtual_people/common/model.pb.h"
+
+namespace wfa_virtual_people {
+namespace {
+
+using ::wfa::EqualsProto;
+
+constexpr char kGenderField[] = "label.demo.gender";
+constexpr char kAgeField[] = "label.demo.age.min_age";
+
+void SetEqualFilter(absl::string_view name, absl::string_view value,
+                    FieldFilterProto& filter) {
+  filter.set_op(FieldFilterProto::EQUAL);
+  filter.set_name(std::string(name));
+  filter.set_value(std::string(value));
+}
+
+// Add a branch to @branch_node, which selects a population node by @gender and
+// @age.
+void AddPoolBranch(absl::string_view gender, absl::string_view age,
+                   BranchNode& branch_node) {
+  BranchNode::Branch* branch = branch_node.add_branches();
+  FieldFilterProto* condition = branch->mutable_condition();
+  condition->set_op(FieldFilterProto::AND);
+  SetEqualFilter(kGenderField, gender, *condition->add_sub_filters());
+  SetEqualFilter(kAgeField, age, *condition->add_sub_filters());
+  CompiledNode* node = branch->mutable_node();
+  node->set_name(absl::StrCat("pool_", gender, "_", age));
+  node->mutable_population_node()->add_pools()->set_total_population(1000);
+}
+
+// Add a branch to @branch_node, which selects a population node by @age.
+void AddAgePoolBranch(absl::string_view gender, absl::string_view age,
+                      BranchNode& branch_node) {
+  BranchNode::Branch* branch = branch_node.add_branches();
+  SetEqualFilter(kAgeField, age, *branch->mutable_condition());
+  CompiledNode* node = branch->mutable_node();
+  node->set_name(absl::StrCat("pool_", gender, "_", age));
+  node->mutable_population_node()->add_pools()->set_total_population(1000);
+}
+
+TEST(HoistConditionsTest, HoistSharedEqualFilter) {
+  CompiledNode node;
+  node.set_name("region");
+  for (absl::string_view age : {"18", "25", "35", "50"}) {
+    for (absl::string_view gender : {"GENDER_FEMALE", "GENDER_MALE"}) {
+      AddPoolBranch(gender, age, *node.mutable_branch_node());
+    }
+  }
+
+  // Both gender and age reduce the evaluations the same, and gender is the
+  // first field in the conditions.
+  CompiledNode expected;
+  expected.set_name("region");
+  for (absl::string_view gender : {"GENDER_FEMALE", "GENDER_MALE"}) {
+    BranchNode::Branch* branch = expected.mutable_branch_node()->add_branches();
+    SetEqualFilter(kGenderField, gender, *branch->mutable_condition());
+    CompiledNode* group_node = branch->mutable_node();
+    group_node->set_name(
+        absl::StrCat("region_hoisted_label.demo.gender_", gender));
+    for (absl::string_view age : {"18", "25", "35", "50"}) {
+      AddAgePoolBranch(gender, age, *group_node->mutable_branch_node());
+    }
+  }
+
+  ConditionHoistingReport report = HoistConditions(node);
+  EXPECT_THAT(node, EqualsProto(expected));
+  EXPECT_EQ(report.hoisted_node_count, 2);
+  // The flat list costs (1 + 2 + ... + 8) / 8 evaluations. After hoisting,
+  // the female pools cost 2 to 5 evaluations, and the male pools cost 3 to 6
+  // evaluations.
+  EXPECT_DOUBLE_EQ(report.expected_filter_evaluations_before, 4.5);
+  EXPECT_DOUBLE_EQ(report.expected_filter_evaluations_after, 4.0);
+}
+
+TEST(HoistConditionsTest, GroupByParsedValue) {
+  // The male branches spell the gender by name or by number, which are the
+  // same value.
+  auto male_spelling = [](absl::string_view age) {
+    return age == "18" ? "GENDER_MALE" : "2";
+  };
+  CompiledNode node;
+  node.set_name("region");
+  for (absl::string_view age : {"18", "25", "35", "50"}) {
+    AddPoolBranch("GENDER_FEMALE", age, *node.mutable_branch_node());
+    AddPoolBranch(male_spelling(age), age, *node.mutable_branch_node());
+  }
+
+  CompiledNode expected;
+  expected.set_name("region");
+  for (absl::string_view gender : {"GENDER_FEMALE", "GENDER_MALE"}) {
+    BranchNode::Branch* branch = expected.mutable_branch_node()->add_branches();
+    SetEqualFilter(kGenderField, gender, *branch->mutable_condition());
+    CompiledNode* group_node = branch->mutable_node();
+    group_node->set_name(
+        absl::StrCat("region_hoisted_label.demo.gender_", gender));
+    for (absl::string_view age : {"18", "25", "35", "50"}) {
+      AddAgePoolBranch(gender == "GENDER_MALE" ? male_spelling(age) : gender,
+                       age, *group_node->mutable_branch_node());
+    }
+  }
+
+  ConditionHoistingReport report = HoistConditions(node);
+  EXPECT_THAT(node, EqualsProto(expected));
+  EXPECT_EQ(report.hoisted_node_count, 2);
+}
+
+TEST(HoistConditionsTest, NoImprovement) {
+  CompiledNode node;
+  node.set_name("region");
+  for (absl::string_view age : {"18", "25"}) {
+    for (absl::string_view gender : {"GENDER_FEMALE", "GENDER_MALE"}) {
+      AddPoolBranch(gender, age, *node.mutable_branch_node());
+    }
+  }
+  CompiledNode expected = node;
+
+  ConditionHoistingReport report = HoistConditions(node);
+  EXPECT_THAT(node, EqualsProto(expected));
+  EXPECT_EQ(report.hoisted_node_count, 0);
+  EXPECT_DOUBLE_EQ(report.expected_filter_evaluations_before, 2.5);
+  EXPECT_DOUBLE_EQ(report.expected_filter_evaluations_after, 2.5);
+}
+
+TEST(HoistConditionsTest, FieldNotRequiredByAllBranches) {
+  CompiledNode node;
+  node.set_name("region");
+  for (absl::string_view age : {"18", "25", "35", "50"}) {
+    for (absl::string_view gender : {"GENDER_FEMALE", "GENDER_MALE"}) {
+      AddPoolBranch(gender, age, *node.mutable_branch_node());
+    }
+  }
+  // The last branch does not require gender or age, so hoisting either of
+  // them might change the first matching branch.
+  BranchNode::Branch* branch = node.mutable_branch_node()->add_branches();
+  branch->mutable_condition()->set_op(FieldFilterProto::TRUE);
+  branch->mutable_node()->set_name("pool_other");
+  CompiledNode expected = node;
+
+  ConditionHoistingReport report = HoistConditions(node);
+  EXPECT_THAT(node, EqualsProto(expected));
+  EXPECT_EQ(report.hoisted_node_count, 0);
+}
+
+TEST(HoistConditionsTest, LessThanMinBranches) {
+  CompiledNode node;
+  node.set_name("region");
+  for (absl::string_view age : {"18", "25", "35", "50"}) {
+    for (absl::string_view gender : {"GENDER_FEMALE", "GENDER_MALE"}) {
+      AddPoolBranch(gender, age, *node.mutable_branch_node());
+    }
+  }
+  CompiledNode expected = node;
+
+  ConditionHoistingOptions options;
+  options.min_branches = 10;
+  ConditionHoistingReport report = HoistConditions(node, options);
+  EXPECT_THAT(node, EqualsProto(expected));
+  EXPECT_EQ(report.hoisted_node_count, 0);
+}
+
+}  // namespace
+}  // namespace wfa_virtual_people
@@ -0,0 +1,36 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "wfa/virtual_people/training/model_compiler/csv_field.h"
+
+#include "gtest/gtest.h"
+
+namespace wfa_virtual_people {
+namespace {
+
+TEST(ToCsvFieldTest, PlainField) {
+  EXPECT_EQ(ToCsvField("root.us_female"), "root.us_female");
+  EXPECT_EQ(ToCsvField(""), "");
+}
+
+TEST(ToCsvFieldTest, QuotedField) {
+  EXPECT_EQ(ToCsvField("a,b"), "\"a,b\"");
+  EXPECT_EQ(ToCsvField("say \"hi\""), "\"say \"\"hi\"\"\"");
+  EXPECT_EQ(ToCsvField("line\nbreak"), "\"line\nbreak\"");
+  EXPECT_EQ(ToCsvField("carriage\rreturn"), "\"carriage\rreturn\"");
+}
+
+}  // namespace
+}  // namespace wfa_virtual_people
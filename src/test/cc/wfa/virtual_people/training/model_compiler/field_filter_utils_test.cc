@@ -26,6 +26,9 @@
 namespace wfa_virtual_people {
 namespace {
 
+using ::testing::ElementsAre;
+using ::testing::IsEmpty;
+using ::testing::Pair;
 using ::wfa::EqualsProto;
 using ::wfa::IsOkAndHolds;
 using ::wfa::StatusIs;
@@ -200,5 +203,87 @@ TEST(RemoveEqualFilterTest, HasMatchingSubFilterAllRemoved) {
   EXPECT_THAT(filter, EqualsProto(expected));
 }
 
+TEST(GetRequiredEqualFiltersTest, EqualFilter) {
+  FieldFilterProto filter;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(
+      R"pb(
+        op: EQUAL name: "person_country_code" value: "COUNTRY_CODE_1"
+      )pb",
+      &filter));
+  EXPECT_THAT(GetRequiredEqualFilters(filter),
+              ElementsAre(Pair("person_country_code", "COUNTRY_CODE_1")));
+}
+
+TEST(GetRequiredEqualFiltersTest, NestedAndFilter) {
+  FieldFilterProto filter;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(
+      R"pb(
+        op: AND
+        sub_filters {
+          op: EQUAL
+          name: "person_country_code"
+          value: "COUNTRY_CODE_1"
+        }
+        sub_filters {
+          op: AND
+          sub_filters {
+            op: EQUAL
+            name: "person_region_code"
+            value: "REGION_CODE_1"
+          }
+        }
+        sub_filters {
+          op: OR
+          sub_filters {
+            op: EQUAL
+            name: "label.demo.gender"
+            value: "GENDER_FEMALE"
+          }
+        }
+      )pb",
+      &filter));
+  EXPECT_THAT(GetRequiredEqualFilters(filter),
+              ElementsAre(Pair("person_country_code", "COUNTRY_CODE_1"),
+                          Pair("person_region_code", "REGION_CODE_1")));
+}
+
+TEST(GetRequiredEqualFiltersTest, NoEqualFilter) {
+  FieldFilterProto filter;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(
+      R"pb(
+        op: TRUE
+      )pb",
+      &filter));
+  EXPECT_THAT(GetRequiredEqualFilters(filter), IsEmpty());
+}
+
+TEST(NormalizeEqualFilterValueTest, ParsedValues) {
+  EXPECT_THAT(NormalizeEqualFilterValue("label.demo.age.min_age", "018"),
+              IsOkAndHolds("18"));
+  EXPECT_THAT(NormalizeEqualFilterValue("label.demo.gender", "GENDER_FEMALE"),
+              IsOkAndHolds("1"));
+  EXPECT_THAT(NormalizeEqualFilterValue("label.demo.gender", "1"),
+              IsOkAndHolds("1"));
+  EXPECT_THAT(NormalizeEqualFilterValue("expected_multiplicity", "1.50"),
+              IsOkAndHolds("1.5"));
+  EXPECT_THAT(NormalizeEqualFilterValue("person_country_code", "018"),
+              IsOkAndHolds("018"));
+}
+
+TEST(NormalizeEqualFilterValueTest, InvalidValue) {
+  EXPECT_THAT(NormalizeEqualFilterValue("label.demo.age.min_age", "eighteen"),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       "Invalid value eighteen for "
+                       "wfa_virtual_people.AgeRange.min_age"));
+  EXPECT_THAT(NormalizeEqualFilterValue("label.demo.gender", "GENDER_OTHER"),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       "Invalid value GENDER_OTHER for "
+                       "wfa_virtual_people.DemoBucket.gender"));
+  EXPECT_THAT(NormalizeEqualFilterValue("label.demo.unknown", "1"),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       "The field unknown is not found in "
+                       "wfa_virtual_people.DemoBucket"));
+}
+
 }  // namespace
 }  // namespace wfa_virtual_people
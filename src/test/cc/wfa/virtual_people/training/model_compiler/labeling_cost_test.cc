@@ -0,0 +1,326 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "wfa/virtual_people/training/model_compiler/labeling_cost.h"
+
+#include "gmock/gmock.h"
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+#include "wfa/virtual_people/common/model.pb.h"
+#include "wfa/virtual_people/training/model_compiler/node_profile.h"
+
+namespace wfa_virtual_people {
+namespace {
+
+using ::testing::DoubleEq;
+using ::testing::ElementsAre;
+using ::testing::Field;
+
+TEST(GetPopulationTest, CookieMonsterPoolNotCounted) {
+  CompiledNode node;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(
+      R"pb(
+        name: "node1"
+        branch_node {
+          branches {
+            node {
+              name: "node2"
+              population_node {
+                pools { population_offset: 0 total_population: 1000 }
+                pools { population_offset: 5000 total_population: 2000 }
+              }
+            }
+            chance: 0.5
+          }
+          branches {
+            node {
+              name: "node3"
+              population_node {
+                pools {
+                  population_offset: 1000000000000000000
+                  total_population: 100000000000000
+                }
+              }
+            }
+            chance: 0.5
+          }
+          random_seed: "seed1"
+        }
+      )pb",
+      &node));
+  EXPECT_EQ(GetPopulation(node), 3000);
+}
+
+TEST(GetBranchProbabilitiesTest, ByChance) {
+  BranchNode branch_node;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(
+      R"pb(
+        branches { node { name: "node1" } chance: 0.2 }
+        branches { node { name: "node2" } chance: 0.6 }
+      )pb",
+      &branch_node));
+  EXPECT_THAT(GetBranchProbabilities(branch_node),
+              ElementsAre(DoubleEq(0.25), DoubleEq(0.75)));
+}
+
+TEST(GetBranchProbabilitiesTest, ByConditionNoPopulation) {
+  BranchNode branch_node;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(
+      R"pb(
+        branches {
+          node { name: "node1" }
+          condition { op: TRUE }
+        }
+        branches {
+          node { name: "node2" }
+          condition { op: TRUE }
+        }
+      )pb",
+      &branch_node));
+  EXPECT_THAT(GetBranchProbabilities(branch_node),
+              ElementsAre(DoubleEq(0.5), DoubleEq(0.5)));
+}
+
+TEST(GetBranchProbabilitiesTest, ByConditionHitCounts) {
+  BranchNode branch_node;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(
+      R"pb(
+        branches {
+          node {
+            name: "node1"
+            population_node {
+              pools { population_offset: 0 total_population: 1000 }
+            }
+          }
+          condition { op: TRUE }
+        }
+        branches {
+          node {
+            name: "node2"
+            population_node {
+              pools { population_offset: 1000 total_population: 3000 }
+            }
+          }
+          condition { op: TRUE }
+        }
+      )pb",
+      &branch_node));
+  NodeHitCounts hit_counts = {{"node1", 30}, {"node2", 10}};
+  EXPECT_THAT(GetBranchProbabilities(branch_node, &hit_counts),
+              ElementsAre(DoubleEq(0.75), DoubleEq(0.25)));
+  // Fall back to the populations if no child node is hit.
+  NodeHitCounts no_hits = {{"node1", 0}};
+  EXPECT_THAT(GetBranchProbabilities(branch_node, &no_hits),
+              ElementsAre(DoubleEq(0.25), DoubleEq(0.75)));
+}
+
+TEST(GetExpectedFilterEvaluationsTest, WeightedByPopulation) {
+  CompiledNode node;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(
+      R"pb(
+        name: "node1"
+        branch_node {
+          branches {
+            node {
+              name: "node2"
+              population_node {
+                pools { population_offset: 0 total_population: 1000 }
+              }
+            }
+            condition { op: EQUAL name: "person_country_code" value: "1" }
+          }
+          branches {
+            node {
+              name: "node3"
+              branch_node {
+                branches {
+                  node {
+                    name: "node4"
+                    population_node {
+                      pools { population_offset: 1000 total_population: 1000 }
+                    }
+                  }
+                  chance: 0.5
+                }
+                branches {
+                  node {
+                    name: "node5"
+                    population_node {
+                      pools { population_offset: 2000 total_population: 2000 }
+                    }
+                  }
+                  chance: 0.5
+                }
+                random_seed: "seed1"
+              }
+            }
+            condition { op: EQUAL name: "person_country_code" value: "2" }
+          }
+        }
+      )pb",
+      &node));
+  // 1/4 of the population is in node2, which costs 1 evaluation, and 3/4 is in
+  // node3, which costs 2 evaluations.
+  EXPECT_DOUBLE_EQ(GetExpectedFilterEvaluations(node), 1.75);
+}
+
+TEST(GetLabelingCostReportTest, TrafficAndCosts) {
+  CompiledNode node;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(
+      R"pb(
+        name: "root"
+        branch_node {
+          branches {
+            node {
+              name: "pools"
+              population_node {
+                pools { population_offset: 0 total_population: 500 }
+                pools { population_offset: 1000 total_population: 500 }
+              }
+            }
+            condition { op: EQUAL name: "person_country_code" value: "1" }
+          }
+          branches {
+            node {
+              name: "updated"
+              branch_node {
+                branches {
+                  node {
+                    name: "pool"
+                    population_node {
+                      pools { population_offset: 2000 total_population: 1000 }
+                    }
+                  }
+                  chance: 0.25
+                }
+                branches {
+                  node { name: "stop" stop_node {} }
+                  chance: 0.75
+                }
+                random_seed: "seed1"
+                updates {
+                  updates {
+                    conditional_assignment {
+                      condition {
+                        op: EQUAL
+                        name: "person_country_code"
+                        value: "2"
+                      }
+                      assignments {
+                        source_field: "person_country_code"
+                        target_field: "person_region_code"
+                      }
+                      assignments {
+                        source_field: "person_country_code"
+                        target_field: "label.demo.gender"
+                      }
+                    }
+                  }
+                }
+              }
+            }
+            condition {
+              op: AND
+              sub_filters {
+                op: EQUAL
+                name: "person_country_code"
+                value: "2"
+              }
+              sub_filters { op: HAS name: "label.demo.gender" }
+            }
+          }
+        }
+      )pb",
+      &node));
+  LabelingCostReport report = GetLabelingCostReport(node);
+  ASSERT_EQ(report.nodes.size(), 5);
+
+  const NodeLabelingCost& root = report.nodes[0];
+  EXPECT_EQ(root.depth, 0);
+  EXPECT_DOUBLE_EQ(root.traffic_fraction, 1.0);
+  // Half of the events evaluate 1 term, and the other half evaluate 3 terms.
+  EXPECT_DOUBLE_EQ(root.filter_terms, 2.0);
+
+  const NodeLabelingCost& pools = report.nodes[1];
+  EXPECT_EQ(pools.name, "pools");
+  EXPECT_DOUBLE_EQ(pools.traffic_fraction, 0.5);
+  EXPECT_EQ(pools.pool_count, 2);
+
+  const NodeLabelingCost& updated = report.nodes[2];
+  EXPECT_EQ(updated.depth, 1);
+  EXPECT_DOUBLE_EQ(updated.filter_terms, 0.0);
+  EXPECT_DOUBLE_EQ(updated.updater_work, 3.0);
+  EXPECT_DOUBLE_EQ(updated.GetWeightedCost(), 1.5);
+
+  EXPECT_DOUBLE_EQ(report.nodes[3].traffic_fraction, 0.125);
+  EXPECT_DOUBLE_EQ(report.nodes[4].traffic_fraction, 0.375);
+
+  EXPECT_DOUBLE_EQ(report.GetExpectedCostPerEvent(), 4.625);
+  EXPECT_THAT(report.GetHotSpots(3),
+              ElementsAre(Field(&NodeLabelingCost::name, "root"),
+                          Field(&NodeLabelingCost::name, "updated"),
+                          Field(&NodeLabelingCost::name, "pools")));
+  EXPECT_EQ(report.GetHotSpots(100).size(), 5);
+}
+
+TEST(GetLabelingCostReportTest, UpdateTreeAndMatrix) {
+  CompiledNode node;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(
+      R"pb(
+        name: "root"
+        branch_node {
+          branches {
+            node { name: "stop" stop_node {} }
+            chance: 1
+          }
+          random_seed: "seed1"
+          updates {
+            updates {
+              update_matrix {
+                columns { person_country_code: "1" }
+                columns { person_country_code: "2" }
+                columns { person_country_code: "3" }
+              }
+            }
+            updates {
+              update_tree {
+                root {
+                  name: "tree_root"
+                  branch_node {
+                    branches {
+                      node { name: "tree_leaf_1" stop_node {} }
+                      condition { op: TRUE }
+                    }
+                    branches {
+                      node { name: "tree_leaf_2" stop_node {} }
+                      condition { op: TRUE }
+                    }
+                  }
+                }
+              }
+            }
+          }
+        }
+      )pb",
+      &node));
+  LabelingCostReport report = GetLabelingCostReport(node);
+  // The nodes of the update tree are not listed.
+  ASSERT_EQ(report.nodes.size(), 2);
+  // 3 matrix columns, and 1.5 filter terms expected in the update tree.
+  EXPECT_DOUBLE_EQ(report.nodes[0].updater_work, 4.5);
+  EXPECT_DOUBLE_EQ(report.GetExpectedCostPerEvent(), 4.5);
+}
+
+}  // namespace
+}  // namespace wfa_virtual_people
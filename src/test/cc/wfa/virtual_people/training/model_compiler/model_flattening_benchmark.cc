@@ -0,0 +1,212 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Compares the memory locality of the node orders of FlattenModel. A local
+// walker labels random events through the flattened node list, selecting
+// branches by census population share and chance, and counts the misses of a
+// simulated LRU cache, assuming the nodes are stored in list order with a
+// fixed size.
+//
+// Example usage:
+// bazel build -c opt \
+// //src/test/cc/wfa/virtual_people/training/model_compiler:\
+// model_flattening_benchmark
+// bazel-bin/src/test/cc/wfa/virtual_people/training/model_compiler/\
+// model_flattening_benchmark \
+// --depth=6 --fanout=6 --events=100000
+
+#include <cstdint>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "common_cpp/protobuf_util/textproto_io.h"
+#include "glog/logging.h"
+#include "wfa/virtual_people/common/model.pb.h"
+#include "wfa/virtual_people/training/model_compiler/model_flattening.h"
+
+ABSL_FLAG(std::string, model_path, "",
+          "Path to a CompiledNode textproto of the model root. If not set, a "
+          "synthetic model of --depth and --fanout is used.");
+ABSL_FLAG(int, depth, 6, "The depth of the synthetic model.");
+ABSL_FLAG(int, fanout, 6, "The number of branches of each synthetic node.");
+ABSL_FLAG(int64_t, events, 100000, "The number of events to label.");
+ABSL_FLAG(int, node_bytes, 16, "The simulated size of a node in bytes.");
+ABSL_FLAG(int, cache_lines, 64, "The number of lines of the simulated cache.");
+
+namespace wfa_virtual_people {
+namespace {
+
+constexpr int kCacheLineBytes = 64;
+
+// Build a synthetic tree, where the leaf populations are skewed.
+void BuildNode(int depth, int fanout, std::mt19937_64& rng, uint64_t& offset,
+               CompiledNode& node) {
+  if (depth == 0) {
+    uint64_t population = 1000000 / (1 + rng() % 1000);
+    PopulationNode::VirtualPersonPool* pool =
+        node.mutable_population_node()->add_pools();
+    pool->set_population_offset(offset);
+    pool->set_total_population(population);
+    offset += population;
+    return;
+  }
+  for (int i = 0; i < fanout; ++i) {
+    BranchNode::Branch* branch = node.mutable_branch_node()->add_branches();
+    FieldFilterProto* condition = branch->mutable_condition();
+    condition->set_op(FieldFilterProto::EQUAL);
+    condition->set_name("person_country_code");
+    condition->set_value(absl::StrCat(i));
+    CompiledNode* child = branch->mutable_node();
+    child->set_name(absl::StrCat(node.name(), "_", i));
+    BuildNode(depth - 1, fanout, rng, offset, *child);
+  }
+}
+
+// The branches of a flattened node, as cumulative probabilities and the
+// indexes of the child nodes.
+using FlatBranches = std::vector<std::pair<double, int>>;
+
+// Return the branches of each node of @nodes, which lists the child nodes
+// before their parents.
+std::vector<FlatBranches> GetFlatBranches(
+    const std::vector<CompiledNode>& nodes) {
+  std::vector<uint64_t> populations(nodes.size(), 0);
+  std::vector<FlatBranches> flat_branches(nodes.size());
+  for (int i = 0; i < nodes.size(); ++i) {
+    const CompiledNode& node = nodes[i];
+    for (const PopulationNode::VirtualPersonPool& pool :
+         node.population_node().pools()) {
+      populations[i] += pool.total_population();
+    }
+    std::vector<double> weights;
+    double total = 0.0;
+    for (const BranchNode::Branch& branch : node.branch_node().branches()) {
+      populations[i] += populations[branch.node_index()];
+      weights.push_back(branch.has_chance()
+                            ? branch.chance()
+                            : populations[branch.node_index()]);
+      total += weights.back();
+    }
+    double cumulative = 0.0;
+    for (int j = 0; j < weights.size(); ++j) {
+      cumulative += total > 0.0 ? weights[j] / total : 1.0 / weights.size();
+      flat_branches[i].emplace_back(
+          cumulative, node.branch_node().branches(j).node_index());
+    }
+  }
+  return flat_branches;
+}
+
+// A fully associative cache with LRU eviction.
+class LruCache {
+ public:
+  explicit LruCache(int line_count) : lines_(line_count, {-1, 0}) {}
+
+  // Return whether @line is missed.
+  bool Access(int64_t line) {
+    ++time_;
+    int victim = 0;
+    for (int i = 0; i < lines_.size(); ++i) {
+      if (lines_[i].first == line) {
+        lines_[i].second = time_;
+        return false;
+      }
+      if (lines_[i].second < lines_[victim].second) {
+        victim = i;
+      }
+    }
+    lines_[victim] = {line, time_};
+    return true;
+  }
+
+ private:
+  // The cached lines and their last access times.
+  std::vector<std::pair<int64_t, int64_t>> lines_;
+  int64_t time_ = 0;
+};
+
+void Run(const char* name, const CompiledNode& root, NodeOrder node_order) {
+  FlatteningOptions options;
+  options.node_order = node_order;
+  absl::StatusOr<std::vector<CompiledNode>> nodes =
+      FlattenModel(root, options);
+  CHECK(nodes.ok()) << nodes.status();
+  std::vector<FlatBranches> flat_branches = GetFlatBranches(*nodes);
+
+  const int64_t events = absl::GetFlag(FLAGS_events);
+  const int node_bytes = absl::GetFlag(FLAGS_node_bytes);
+  LruCache cache(absl::GetFlag(FLAGS_cache_lines));
+  // The same seed for all orders, so the same paths are walked.
+  std::mt19937_64 rng(1);
+  std::uniform_real_distribution<double> uniform(0.0, 1.0);
+  int64_t visits = 0;
+  int64_t misses = 0;
+  for (int64_t i = 0; i < events; ++i) {
+    int index = nodes->size() - 1;
+    while (true) {
+      ++visits;
+      misses += cache.Access(int64_t{index} * node_bytes / kCacheLineBytes);
+      const FlatBranches& branches = flat_branches[index];
+      if (branches.empty()) {
+        break;
+      }
+      const double draw = uniform(rng);
+      index = branches.back().second;
+      for (const auto& [cumulative, child] : branches) {
+        if (draw < cumulative) {
+          index = child;
+          break;
+        }
+      }
+    }
+  }
+  LOG(INFO) << name << ": " << static_cast<double>(misses) / events
+            << " cache misses/event, "
+            << static_cast<double>(visits) / events << " nodes/event";
+}
+
+}  // namespace
+}  // namespace wfa_virtual_people
+
+int main(int argc, char** argv) {
+  absl::ParseCommandLine(argc, argv);
+
+  using ::wfa_virtual_people::CompiledNode;
+  using ::wfa_virtual_people::NodeOrder;
+
+  CompiledNode root;
+  std::string model_path = absl::GetFlag(FLAGS_model_path);
+  if (model_path.empty()) {
+    root.set_name("root");
+    std::mt19937_64 rng(0);
+    uint64_t offset = 0;
+    wfa_virtual_people::BuildNode(absl::GetFlag(FLAGS_depth),
+                                  absl::GetFlag(FLAGS_fanout), rng, offset,
+                                  root);
+  } else {
+    absl::Status read_status = wfa::ReadTextProtoFile(model_path, root);
+    CHECK(read_status.ok()) << read_status;
+  }
+
+  wfa_virtual_people::Run("dfs", root, NodeOrder::kDepthFirst);
+  wfa_virtual_people::Run("bfs", root, NodeOrder::kBreadthFirst);
+  wfa_virtual_people::Run("hot_path", root, NodeOrder::kHotPathFirst);
+  return 0;
+}
@@ -0,0 +1,183 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "wfa/virtual_people/training/model_compiler/model_flattening.h"
+
+#include <string>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "common_cpp/testing/common_matchers.h"
+#include "common_cpp/testing/status_macros.h"
+#include "common_cpp/testing/status_matchers.h"
+#include "gmock/gmock.h"
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+#include "wfa/virtual_people/common/model.pb.h"
+#include "wfa/virtual_people/training/model_compiler/node_profile.h"
+
+namespace wfa_virtual_people {
+namespace {
+
+using ::testing::ElementsAre;
+using ::wfa::EqualsProto;
+using ::wfa::IsOkAndHolds;
+using ::wfa::StatusIs;
+
+constexpr char kModel[] = R"pb(
+  name: "root"
+  branch_node {
+    branches {
+      node {
+        name: "country_1"
+        branch_node {
+          branches {
+            node { name: "leaf_1" stop_node {} }
+            chance: 0.25
+          }
+          branches {
+            node { name: "leaf_2" stop_node {} }
+            chance: 0.75
+          }
+          random_seed: "seed"
+        }
+      }
+      condition { op: EQUAL name: "person_country_code" value: "1" }
+    }
+    branches {
+      node { name: "leaf_3" stop_node {} }
+      condition { op: TRUE }
+    }
+  }
+)pb";
+
+std::vector<std::string> GetNames(const std::vector<CompiledNode>& nodes) {
+  std::vector<std::string> names;
+  for (const CompiledNode& node : nodes) {
+    names.push_back(node.name());
+  }
+  return names;
+}
+
+TEST(FlattenModelTest, ChildrenBeforeParents) {
+  CompiledNode model;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(kModel, &model));
+  ASSERT_OK_AND_ASSIGN(std::vector<CompiledNode> nodes, FlattenModel(model));
+  EXPECT_THAT(GetNames(nodes),
+              ElementsAre("leaf_3", "leaf_2", "leaf_1", "country_1", "root"));
+  for (int i = 0; i < nodes.size(); ++i) {
+    EXPECT_EQ(nodes[i].index(), i);
+  }
+
+  CompiledNode expected_root;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(
+      R"pb(
+        name: "root"
+        index: 4
+        branch_node {
+          branches {
+            node_index: 3
+            condition { op: EQUAL name: "person_country_code" value: "1" }
+          }
+          branches {
+            node_index: 0
+            condition { op: TRUE }
+          }
+        }
+      )pb",
+      &expected_root));
+  EXPECT_THAT(nodes[4], EqualsProto(expected_root));
+  EXPECT_EQ(nodes[3].branch_node().branches(0).node_index(), 2);
+  EXPECT_EQ(nodes[3].branch_node().branches(1).node_index(), 1);
+}
+
+TEST(FlattenModelTest, HotPathNextToRoot) {
+  CompiledNode model;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(kModel, &model));
+  NodeHitCounts hit_counts = {
+      {"leaf_1", 10}, {"leaf_2", 30}, {"leaf_3", 100}};
+  FlatteningOptions options;
+  options.node_order = NodeOrder::kHotPathFirst;
+  options.hit_counts = &hit_counts;
+  ASSERT_OK_AND_ASSIGN(std::vector<CompiledNode> nodes,
+                       FlattenModel(model, options));
+  EXPECT_THAT(GetNames(nodes),
+              ElementsAre("leaf_1", "leaf_2", "country_1", "leaf_3", "root"));
+  // The branches keep their order.
+  EXPECT_EQ(nodes[4].branch_node().branches(0).node_index(), 2);
+  EXPECT_EQ(nodes[4].branch_node().branches(1).node_index(), 3);
+  EXPECT_EQ(nodes[2].branch_node().branches(0).node_index(), 0);
+  EXPECT_EQ(nodes[2].branch_node().branches(1).node_index(), 1);
+}
+
+TEST(FlattenModelTest, HotPathByChance) {
+  CompiledNode model;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(kModel, &model));
+  FlatteningOptions options;
+  options.node_order = NodeOrder::kHotPathFirst;
+  ASSERT_OK_AND_ASSIGN(std::vector<CompiledNode> nodes,
+                       FlattenModel(model, options));
+  // Without populations, the condition branches are equally likely.
+  EXPECT_THAT(GetNames(nodes),
+              ElementsAre("leaf_3", "leaf_1", "leaf_2", "country_1", "root"));
+}
+
+TEST(FlattenModelTest, BreadthFirst) {
+  CompiledNode model;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(kModel, &model));
+  FlatteningOptions options;
+  options.node_order = NodeOrder::kBreadthFirst;
+  ASSERT_OK_AND_ASSIGN(std::vector<CompiledNode> nodes,
+                       FlattenModel(model, options));
+  EXPECT_THAT(GetNames(nodes),
+              ElementsAre("leaf_2", "leaf_1", "leaf_3", "country_1", "root"));
+  for (int i = 0; i < nodes.size(); ++i) {
+    EXPECT_EQ(nodes[i].index(), i);
+  }
+  EXPECT_EQ(nodes[4].branch_node().branches(0).node_index(), 3);
+  EXPECT_EQ(nodes[4].branch_node().branches(1).node_index(), 2);
+  EXPECT_EQ(nodes[3].branch_node().branches(0).node_index(), 1);
+  EXPECT_EQ(nodes[3].branch_node().branches(1).node_index(), 0);
+}
+
+TEST(FlattenModelTest, AlreadyFlattened) {
+  CompiledNode model;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(
+      R"pb(
+        name: "root"
+        branch_node {
+          branches {
+            node_index: 0
+            condition { op: TRUE }
+          }
+        }
+      )pb",
+      &model));
+  EXPECT_THAT(FlattenModel(model).status(),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       "already flattened"));
+}
+
+TEST(ParseNodeOrderTest, Parse) {
+  EXPECT_THAT(ParseNodeOrder("dfs"), IsOkAndHolds(NodeOrder::kDepthFirst));
+  EXPECT_THAT(ParseNodeOrder("bfs"), IsOkAndHolds(NodeOrder::kBreadthFirst));
+  EXPECT_THAT(ParseNodeOrder("hot_path"),
+              IsOkAndHolds(NodeOrder::kHotPathFirst));
+  EXPECT_THAT(ParseNodeOrder("random").status(),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       "Unknown node order: random"));
+}
+
+}  // namespace
+}  // namespace wfa_virtual_people
@@ -0,0 +1,175 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "wfa/virtual_people/training/model_compiler/node_name_compaction.h"
+
+#include <vector>
+
+#include "common_cpp/testing/common_matchers.h"
+#include "common_cpp/testing/status_macros.h"
+#include "common_cpp/testing/status_matchers.h"
+#include "gmock/gmock.h"
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+#include "wfa/virtual_people/common/model.pb.h"
+#include "wfa/virtual_people/training/model_checker/model_names_checker.h"
+#include "wfa/virtual_people/training/model_compiler/model_flattening.h"
+#include "wfa/virtual_people/training/node_name_map.pb.h"
+
+namespace wfa_virtual_people {
+namespace {
+
+using ::testing::MatchesRegex;
+using ::wfa::EqualsProto;
+using ::wfa::IsOk;
+using ::testing::Ne;
+
+TEST(GetCompactNodeNameTest, StableFingerprint) {
+  // The FNV-1a fingerprint of an empty string is the offset basis.
+  EXPECT_EQ(GetCompactNodeName(""), "cbf29ce484222325");
+  EXPECT_EQ(GetCompactNodeName("a"), "af63dc4c8601ec8c");
+  EXPECT_THAT(GetCompactNodeName("node1_country_COUNTRY_CODE_1"),
+              MatchesRegex("[0-9a-f]{16}"));
+  EXPECT_THAT(GetCompactNodeName("node1"), Ne(GetCompactNodeName("node2")));
+}
+
+TEST(CompactNodeNamesTest, CompactAllNames) {
+  CompiledNode node;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(
+      R"pb(
+        name: "root"
+        branch_node {
+          branches {
+            node { name: "root_child_1" stop_node {} }
+            chance: 0.5
+          }
+          branches {
+            node { name: "root_child_2" stop_node {} }
+            chance: 0.5
+          }
+          updates {
+            updates {
+              update_tree {
+                root {
+                  name: "root_update_tree"
+                  branch_node {
+                    branches {
+                      node { stop_node {} }
+                      chance: 1
+                    }
+                  }
+                }
+              }
+            }
+          }
+          random_seed: "root"
+        }
+      )pb",
+      &node));
+
+  ASSERT_OK_AND_ASSIGN(NodeNameMap name_map, CompactNodeNames(node));
+
+  EXPECT_EQ(node.name(), GetCompactNodeName("root"));
+  EXPECT_EQ(node.branch_node().branches(0).node().name(),
+            GetCompactNodeName("root_child_1"));
+  EXPECT_EQ(node.branch_node().branches(1).node().name(),
+            GetCompactNodeName("root_child_2"));
+  const CompiledNode& update_tree_root =
+      node.branch_node().updates().updates(0).update_tree().root();
+  EXPECT_EQ(update_tree_root.name(), GetCompactNodeName("root_update_tree"));
+  // Empty names are kept, and the random seeds are not changed.
+  EXPECT_TRUE(update_tree_root.branch_node().branches(0).node().name().empty());
+  EXPECT_EQ(node.branch_node().random_seed(), "root");
+
+  ASSERT_EQ(name_map.entries_size(), 4);
+  for (int i = 0; i < name_map.entries_size(); ++i) {
+    EXPECT_EQ(name_map.entries(i).compact_name(),
+              GetCompactNodeName(name_map.entries(i).name()));
+    if (i > 0) {
+      EXPECT_LT(name_map.entries(i - 1).compact_name(),
+                name_map.entries(i).compact_name());
+    }
+  }
+}
+
+TEST(CompactNodeNamesTest, DuplicatedNamesKeptDuplicated) {
+  CompiledNode node;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(
+      R"pb(
+        name: "root"
+        branch_node {
+          branches {
+            node { name: "child" stop_node {} }
+            chance: 0.5
+          }
+          branches {
+            node { name: "child" stop_node {} }
+            chance: 0.5
+          }
+        }
+      )pb",
+      &node));
+
+  ASSERT_OK_AND_ASSIGN(NodeNameMap name_map, CompactNodeNames(node));
+  EXPECT_EQ(node.branch_node().branches(0).node().name(),
+            node.branch_node().branches(1).node().name());
+  EXPECT_EQ(name_map.entries_size(), 2);
+}
+
+TEST(CompactNodeNamesTest, FlattenedNodesMatchNameMap) {
+  CompiledNode root;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(
+      R"pb(
+        name: "root"
+        branch_node {
+          branches {
+            node {
+              name: "root_child"
+              branch_node {
+                branches {
+                  node { name: "root_grandchild" stop_node {} }
+                  chance: 1
+                }
+                updates {
+                  updates {
+                    update_tree {
+                      root { name: "root_update_tree" stop_node {} }
+                    }
+                  }
+                }
+              }
+            }
+            chance: 0.5
+          }
+          branches {
+            node { name: "root_stop" stop_node {} }
+            chance: 0.5
+          }
+        }
+      )pb",
+      &root));
+  ASSERT_OK_AND_ASSIGN(std::vector<CompiledNode> nodes, FlattenModel(root));
+
+  // The flattened nodes are compacted as compiler_main does before writing
+  // them, and must be valid against the name map written for the tree.
+  ASSERT_OK_AND_ASSIGN(NodeNameMap tree_name_map, CompactNodeNames(root));
+  ASSERT_OK_AND_ASSIGN(NodeNameMap flattened_name_map,
+                       CompactNodeNames(nodes));
+  EXPECT_THAT(flattened_name_map, EqualsProto(tree_name_map));
+  EXPECT_THAT(CheckNodeNameMap(nodes, tree_name_map), IsOk());
+  EXPECT_EQ(nodes.back().name(), GetCompactNodeName("root"));
+}
+
+}  // namespace
+}  // namespace wfa_virtual_people
@@ -0,0 +1,116 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "wfa/virtual_people/training/model_compiler/node_profile.h"
+
+#include <fstream>
+#include <string>
+#include <utility>
+
+#include "absl/status/status.h"
+#include "common_cpp/testing/status_matchers.h"
+#include "gmock/gmock.h"
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+#include "wfa/virtual_people/common/model.pb.h"
+
+namespace wfa_virtual_people {
+namespace {
+
+using ::testing::Pair;
+using ::testing::UnorderedElementsAre;
+using ::wfa::IsOkAndHolds;
+using ::wfa::StatusIs;
+
+TEST(ParseNodeHitCountsTest, Parse) {
+  EXPECT_THAT(ParseNodeHitCounts("name,visit_count\n"
+                                 "root,10\r\n"
+                                 "a,b,3\n"
+                                 "\n"
+                                 "leaf,7\n"),
+              IsOkAndHolds(UnorderedElementsAre(
+                  Pair("root", 10), Pair("a,b", 3), Pair("leaf", 7))));
+}
+
+TEST(ParseNodeHitCountsTest, SumDuplicatedNames) {
+  EXPECT_THAT(ParseNodeHitCounts("name,visit_count\nleaf,3\nleaf,4\n"),
+              IsOkAndHolds(UnorderedElementsAre(Pair("leaf", 7))));
+}
+
+TEST(ParseNodeHitCountsTest, HeaderOnly) {
+  EXPECT_THAT(ParseNodeHitCounts("name,visit_count\n"),
+              IsOkAndHolds(UnorderedElementsAre()));
+}
+
+TEST(ParseNodeHitCountsTest, InvalidLine) {
+  EXPECT_THAT(ParseNodeHitCounts("name,visit_count\nroot\n").status(),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       "Invalid hit count line: root"));
+  EXPECT_THAT(ParseNodeHitCounts("name,visit_count\nroot,x\n").status(),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       "Invalid hit count line: root,x"));
+  EXPECT_THAT(ParseNodeHitCounts("name,visit_count\nroot,-1\n").status(),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       "Invalid hit count line: root,-1"));
+}
+
+TEST(ReadNodeHitCountsTest, ReadFile) {
+  std::string path = ::testing::TempDir() + "/node_profile_test.csv";
+  {
+    std::ofstream file(path);
+    file << "name,visit_count\nroot,10\n";
+  }
+  EXPECT_THAT(ReadNodeHitCounts(path),
+              IsOkAndHolds(UnorderedElementsAre(Pair("root", 10))));
+}
+
+TEST(ReadNodeHitCountsTest, FileNotFound) {
+  EXPECT_THAT(
+      ReadNodeHitCounts(::testing::TempDir() + "/not_exist.csv").status(),
+      StatusIs(absl::StatusCode::kNotFound, "Failed to open"));
+}
+
+TEST(GetHitCountTest, SumChildrenIfNotFound) {
+  CompiledNode node;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(
+      R"pb(
+        name: "hoisted"
+        branch_node {
+          branches {
+            node { name: "node1" }
+            condition { op: TRUE }
+          }
+          branches {
+            node {
+              name: "node2"
+              branch_node {
+                branches {
+                  node { name: "node3" }
+                  chance: 1
+                }
+              }
+            }
+            condition { op: TRUE }
+          }
+        }
+      )pb",
+      &node));
+  NodeHitCounts hit_counts = {{"node1", 3}, {"node3", 4}};
+  EXPECT_EQ(GetHitCount(node, hit_counts), 7);
+  hit_counts["hoisted"] = 10;
+  EXPECT_EQ(GetHitCount(node, hit_counts), 10);
+}
+
+}  // namespace
+}  // namespace wfa_virtual_people
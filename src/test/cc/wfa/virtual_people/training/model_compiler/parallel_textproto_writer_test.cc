@@ -0,0 +1,145 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "wfa/virtual_people/training/model_compiler/parallel_textproto_writer.h"
+
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "common_cpp/protobuf_util/textproto_io.h"
+#include "common_cpp/testing/common_matchers.h"
+#include "common_cpp/testing/status_matchers.h"
+#include "gmock/gmock.h"
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+#include "wfa/virtual_people/common/model.pb.h"
+
+namespace wfa_virtual_people {
+namespace {
+
+using ::wfa::EqualsProto;
+using ::wfa::IsOk;
+using ::wfa::IsOkAndHolds;
+using ::wfa::ReadTextProtoFile;
+using ::wfa::StatusIs;
+
+// Build a tree with @depth levels of branch nodes, each with @fanout
+// branches.
+void BuildNode(int depth, int fanout, CompiledNode& node) {
+  if (depth == 0) {
+    PopulationNode::VirtualPersonPool* pool =
+        node.mutable_population_node()->add_pools();
+    pool->set_population_offset(node.name().size() * 1000);
+    pool->set_total_population(10);
+    node.mutable_population_node()->set_random_seed(node.name());
+    return;
+  }
+  BranchNode& branch_node = *node.mutable_branch_node();
+  for (int i = 0; i < fanout; ++i) {
+    BranchNode::Branch* branch = branch_node.add_branches();
+    if (i % 2 == 0) {
+      branch->set_chance(1.0 / fanout);
+    } else {
+      FieldFilterProto* condition = branch->mutable_condition();
+      condition->set_op(FieldFilterProto::EQUAL);
+      condition->set_name("person_country_code");
+      condition->set_value(absl::StrCat("\"", i, "\"\n"));
+    }
+    CompiledNode* child = branch->mutable_node();
+    child->set_name(absl::StrCat(node.name(), "/", i));
+    BuildNode(depth - 1, fanout, *child);
+  }
+  branch_node.set_random_seed(node.name());
+}
+
+TEST(PrintTextProtoInParallelTest, SameAsPrintToString) {
+  CompiledNode model;
+  model.set_name("root");
+  BuildNode(4, 3, model);
+  // An update tree with nested nodes.
+  *model.mutable_branch_node()
+       ->mutable_updates()
+       ->add_updates()
+       ->mutable_update_tree()
+       ->mutable_root() = model.branch_node().branches(0).node();
+  const CompiledNode original = model;
+  std::string expected;
+  ASSERT_TRUE(google::protobuf::TextFormat::PrintToString(model, &expected));
+
+  for (int thread_count : {1, 2, 8}) {
+    for (int min_chunk_count : {0, 1, 5, 1000}) {
+      ParallelTextProtoOptions options;
+      options.thread_count = thread_count;
+      options.min_chunk_count = min_chunk_count;
+      EXPECT_THAT(PrintTextProtoInParallel(model, options),
+                  IsOkAndHolds(expected))
+          << thread_count << " threads, " << min_chunk_count << " chunks";
+      EXPECT_THAT(model, EqualsProto(original));
+    }
+  }
+}
+
+TEST(PrintTextProtoInParallelTest, SameAsPrintToStringForTestModel) {
+  CompiledNode model;
+  ASSERT_THAT(
+      ReadTextProtoFile(
+          "src/test/cc/wfa/virtual_people/training/model_compiler/test_data/"
+          "stop_node_tree.textproto",
+          model),
+      IsOk());
+  std::string expected;
+  ASSERT_TRUE(google::protobuf::TextFormat::PrintToString(model, &expected));
+  ParallelTextProtoOptions options;
+  options.thread_count = 4;
+  EXPECT_THAT(PrintTextProtoInParallel(model, options),
+              IsOkAndHolds(expected));
+}
+
+TEST(PrintTextProtoInParallelTest, SingleNode) {
+  CompiledNode model;
+  model.set_name("root");
+  model.mutable_stop_node();
+  ParallelTextProtoOptions options;
+  options.thread_count = 4;
+  EXPECT_THAT(PrintTextProtoInParallel(model, options),
+              IsOkAndHolds("name: \"root\"\nstop_node {\n}\n"));
+}
+
+TEST(PrintTextProtoInParallelTest, InvalidThreadCount) {
+  CompiledNode model;
+  ParallelTextProtoOptions options;
+  options.thread_count = 0;
+  EXPECT_THAT(PrintTextProtoInParallel(model, options).status(),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       "thread_count must be positive."));
+}
+
+TEST(WriteTextProtoFileInParallelTest, ReadBack) {
+  CompiledNode model;
+  model.set_name("root");
+  BuildNode(3, 4, model);
+  std::string path = ::testing::TempDir() + "/parallel_textproto_test.txt";
+  ParallelTextProtoOptions options;
+  options.thread_count = 3;
+  ASSERT_THAT(WriteTextProtoFileInParallel(path, model, options), IsOk());
+  CompiledNode read_model;
+  ASSERT_THAT(ReadTextProtoFile(path, read_model), IsOk());
+  EXPECT_THAT(read_model, EqualsProto(model));
+}
+
+}  // namespace
+}  // namespace wfa_virtual_people
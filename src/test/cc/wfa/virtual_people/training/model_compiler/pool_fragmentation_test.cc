@@ -0,0 +1,97 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "wfa/virtual_people/training/model_compiler/pool_fragmentation.h"
+
+#include "gmock/gmock.h"
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+#include "wfa/virtual_people/common/model.pb.h"
+
+namespace wfa_virtual_people {
+namespace {
+
+using ::testing::DoubleEq;
+
+TEST(GetPoolFragmentationReportTest, CountPoolsOfPopulationNodes) {
+  CompiledNode node;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(
+      R"pb(
+        name: "root"
+        branch_node {
+          branches {
+            node {
+              name: "delta_0"
+              population_node {
+                pools { population_offset: 0 total_population: 1000 }
+                pools { population_offset: 5000 total_population: 2000 }
+                pools { population_offset: 9000 total_population: 3000 }
+              }
+            }
+            chance: 0.5
+          }
+          branches {
+            node {
+              name: "delta_1"
+              population_node {
+                pools { population_offset: 1000 total_population: 4000 }
+              }
+            }
+            chance: 0.3
+          }
+          branches {
+            node {
+              name: "cookie_monster_pool"
+              population_node {
+                pools {
+                  population_offset: 1000000000000000000
+                  total_population: 100000000000000
+                }
+              }
+            }
+            chance: 0.2
+          }
+        }
+      )pb",
+      &node));
+
+  PoolFragmentationReport report = GetPoolFragmentationReport(node);
+  ASSERT_EQ(report.nodes.size(), 2);
+  EXPECT_EQ(report.nodes[0].name, "delta_0");
+  EXPECT_EQ(report.nodes[0].pool_count, 3);
+  EXPECT_EQ(report.nodes[0].total_population, 6000);
+  EXPECT_THAT(report.nodes[0].GetAveragePoolSize(), DoubleEq(2000.0));
+  EXPECT_EQ(report.nodes[1].name, "delta_1");
+  EXPECT_EQ(report.nodes[1].pool_count, 1);
+  EXPECT_THAT(report.nodes[1].GetAveragePoolSize(), DoubleEq(4000.0));
+  EXPECT_EQ(report.pool_count, 4);
+  EXPECT_EQ(report.total_population, 10000);
+  EXPECT_THAT(report.GetAveragePoolsPerNode(), DoubleEq(2.0));
+  EXPECT_THAT(report.GetAveragePoolSize(), DoubleEq(2500.0));
+}
+
+TEST(GetPoolFragmentationReportTest, NoPopulationNode) {
+  CompiledNode node;
+  node.set_name("stop");
+  node.mutable_stop_node();
+
+  PoolFragmentationReport report = GetPoolFragmentationReport(node);
+  EXPECT_TRUE(report.nodes.empty());
+  EXPECT_EQ(report.pool_count, 0);
+  EXPECT_THAT(report.GetAveragePoolsPerNode(), DoubleEq(0.0));
+  EXPECT_THAT(report.GetAveragePoolSize(), DoubleEq(0.0));
+}
+
+}  // namespace
+}  // namespace wfa_virtual_people
@@ -0,0 +1,178 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "wfa/virtual_people/training/model_compiler/update_matrix_sparsification.h"
+
+#include "absl/status/status.h"
+#include "common_cpp/testing/common_matchers.h"
+#include "common_cpp/testing/status_macros.h"
+#include "common_cpp/testing/status_matchers.h"
+#include "gmock/gmock.h"
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+#include "wfa/virtual_people/common/model.pb.h"
+
+namespace wfa_virtual_people {
+namespace {
+
+using ::wfa::EqualsProto;
+using ::wfa::IsOkAndHolds;
+using ::wfa::StatusIs;
+
+// A matrix of 4 rows and 2 columns, with most probabilities being zero.
+constexpr char kUpdateMatrixWithZeros[] = R"pb(
+  columns { person_country_code: "COUNTRY_1" }
+  columns { person_country_code: "COUNTRY_2" }
+  rows { person_country_code: "UPDATED_COUNTRY_1" }
+  rows { person_country_code: "UPDATED_COUNTRY_2" }
+  rows { person_country_code: "UPDATED_COUNTRY_3" }
+  rows { person_country_code: "UPDATED_COUNTRY_4" }
+  probabilities: 1
+  probabilities: 0
+  probabilities: 0
+  probabilities: 0
+  probabilities: 0
+  probabilities: 0.6
+  probabilities: 0
+  probabilities: 0.4
+  pass_through_non_matches: false
+  random_seed: "TestSeed"
+)pb";
+
+constexpr char kExpectedSparseUpdateMatrix[] = R"pb(
+  columns {
+    column_attrs { person_country_code: "COUNTRY_1" }
+    rows { person_country_code: "UPDATED_COUNTRY_1" }
+    probabilities: 1
+  }
+  columns {
+    column_attrs { person_country_code: "COUNTRY_2" }
+    rows { person_country_code: "UPDATED_COUNTRY_3" }
+    rows { person_country_code: "UPDATED_COUNTRY_4" }
+    probabilities: 0.6
+    probabilities: 0.4
+  }
+  pass_through_non_matches: false
+  random_seed: "TestSeed"
+)pb";
+
+TEST(ToSparseUpdateMatrixTest, DropZeroProbabilities) {
+  UpdateMatrix matrix;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(
+      kUpdateMatrixWithZeros, &matrix));
+  SparseUpdateMatrix expected;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(
+      kExpectedSparseUpdateMatrix, &expected));
+  EXPECT_THAT(ToSparseUpdateMatrix(matrix),
+              IsOkAndHolds(EqualsProto(expected)));
+}
+
+TEST(ToSparseUpdateMatrixTest, InvalidProbabilitiesCount) {
+  UpdateMatrix matrix;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(
+      R"pb(
+        columns { person_country_code: "COUNTRY_1" }
+        rows { person_country_code: "UPDATED_COUNTRY_1" }
+        rows { person_country_code: "UPDATED_COUNTRY_2" }
+        probabilities: 1
+      )pb",
+      &matrix));
+  EXPECT_THAT(ToSparseUpdateMatrix(matrix).status(),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       "The count of probabilities does not equal"));
+}
+
+TEST(ToSparseUpdateMatrixTest, AllZeroColumn) {
+  UpdateMatrix matrix;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(
+      R"pb(
+        columns { person_country_code: "COUNTRY_1" }
+        rows { person_country_code: "UPDATED_COUNTRY_1" }
+        probabilities: 0
+      )pb",
+      &matrix));
+  EXPECT_THAT(ToSparseUpdateMatrix(matrix).status(),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       "All probabilities are zero"));
+}
+
+TEST(SparsifyUpdateMatricesTest, ConvertSparseMatrices) {
+  CompiledNode node;
+  BranchNode& branch_node = *node.mutable_branch_node();
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(
+      kUpdateMatrixWithZeros, branch_node.mutable_updates()
+                               ->add_updates()
+                               ->mutable_update_matrix()));
+  // The sparse matrix is in the UpdateTree of the child node.
+  CompiledNode& child = *branch_node.add_branches()->mutable_node();
+  branch_node.mutable_branches(0)->set_chance(1.0);
+  CompiledNode& root = *child.mutable_branch_node()
+                            ->mutable_updates()
+                            ->add_updates()
+                            ->mutable_update_tree()
+                            ->mutable_root();
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(
+      kUpdateMatrixWithZeros,
+      root.mutable_branch_node()->mutable_updates()->add_updates()
+          ->mutable_update_matrix()));
+  size_t dense_size =
+      branch_node.updates().updates(0).update_matrix().ByteSizeLong();
+
+  SparseUpdateMatrix expected;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(
+      kExpectedSparseUpdateMatrix, &expected));
+
+  ASSERT_OK_AND_ASSIGN(UpdateMatrixSparsificationReport report,
+                       SparsifyUpdateMatrices(node));
+  EXPECT_THAT(branch_node.updates().updates(0).sparse_update_matrix(),
+              EqualsProto(expected));
+  EXPECT_THAT(root.branch_node().updates().updates(0).sparse_update_matrix(),
+              EqualsProto(expected));
+  EXPECT_EQ(report.update_matrix_count, 2);
+  EXPECT_EQ(report.converted_count, 2);
+  EXPECT_EQ(report.bytes_before, 2 * dense_size);
+  EXPECT_LT(report.bytes_after, report.bytes_before);
+}
+
+TEST(SparsifyUpdateMatricesTest, KeepMatricesWithoutZeros) {
+  CompiledNode node;
+  UpdateMatrix& matrix = *node.mutable_branch_node()
+                              ->mutable_updates()
+                              ->add_updates()
+                              ->mutable_update_matrix();
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(
+      R"pb(
+        columns { person_country_code: "COUNTRY_1" }
+        columns { person_country_code: "COUNTRY_2" }
+        rows { person_country_code: "UPDATED_COUNTRY_1" }
+        rows { person_country_code: "UPDATED_COUNTRY_2" }
+        probabilities: 0.8
+        probabilities: 0.2
+        probabilities: 0.2
+        probabilities: 0.8
+        random_seed: "TestSeed"
+      )pb",
+      &matrix));
+  CompiledNode expected = node;
+
+  ASSERT_OK_AND_ASSIGN(UpdateMatrixSparsificationReport report,
+                       SparsifyUpdateMatrices(node));
+  EXPECT_THAT(node, EqualsProto(expected));
+  EXPECT_EQ(report.update_matrix_count, 1);
+  EXPECT_EQ(report.converted_count, 0);
+  EXPECT_EQ(report.bytes_before, report.bytes_after);
+}
+
+}  // namespace
+}  // namespace wfa_virtual_people
@@ -0,0 +1,217 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "wfa/virtual_people/training/model_compiler/vid_pool_index.h"
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "common_cpp/testing/common_matchers.h"
+#include "common_cpp/testing/status_macros.h"
+#include "common_cpp/testing/status_matchers.h"
+#include "gmock/gmock.h"
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+#include "wfa/virtual_people/common/model.pb.h"
+#include "wfa/virtual_people/training/vid_pool_index.pb.h"
+
+namespace wfa_virtual_people {
+namespace {
+
+using ::testing::ElementsAre;
+using ::testing::IsEmpty;
+using ::wfa::EqualsProto;
+using ::wfa::IsOkAndHolds;
+using ::wfa::StatusIs;
+
+constexpr char kModel[] = R"pb(
+  name: "root"
+  branch_node {
+    branches {
+      node {
+        name: "country_1"
+        branch_node {
+          branches {
+            node {
+              name: "delta_0"
+              population_node {
+                pools { population_offset: 3000 total_population: 1000 }
+                pools { population_offset: 500 total_population: 0 }
+                pools { population_offset: 1000 total_population: 500 }
+              }
+            }
+            chance: 0.5
+          }
+          branches {
+            node { name: "stop" stop_node {} }
+            chance: 0.5
+          }
+        }
+      }
+      condition { op: TRUE }
+    }
+    branches {
+      node {
+        name: "country_2"
+        population_node {
+          pools { population_offset: 2000 total_population: 500 }
+        }
+      }
+      condition { op: TRUE }
+    }
+  }
+)pb";
+
+constexpr char kIndex[] = R"pb(
+  node_paths { node_names: [ "root", "country_1", "delta_0" ] }
+  node_paths { node_names: [ "root", "country_2" ] }
+  entries {
+    population_offset: 1000
+    total_population: 500
+    node_path_index: 0
+    pool_index: 2
+  }
+  entries {
+    population_offset: 2000
+    total_population: 500
+    node_path_index: 1
+    pool_index: 0
+  }
+  entries {
+    population_offset: 3000
+    total_population: 1000
+    node_path_index: 0
+    pool_index: 0
+  }
+)pb";
+
+TEST(BuildVidPoolIndexTest, SortedByOffset) {
+  CompiledNode root;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(kModel, &root));
+  VidPoolIndex expected;
+  ASSERT_TRUE(
+      google::protobuf::TextFormat::ParseFromString(kIndex, &expected));
+  EXPECT_THAT(BuildVidPoolIndex(root), IsOkAndHolds(EqualsProto(expected)));
+}
+
+TEST(BuildVidPoolIndexTest, NodeIndexNotSupported) {
+  CompiledNode root;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(
+      R"pb(
+        name: "root"
+        branch_node { branches { node_index: 1 chance: 1 } }
+      )pb",
+      &root));
+  EXPECT_THAT(BuildVidPoolIndex(root).status(),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       "Only nested child nodes are supported: root"));
+}
+
+// Return the pool indexes and node path indexes of the entries found for
+// @virtual_person_id.
+std::vector<std::pair<int, int>> LookupPools(const VidPoolLookup& lookup,
+                                             uint64_t virtual_person_id) {
+  std::vector<std::pair<int, int>> pools;
+  for (const VidPoolIndex::Entry* entry : lookup.Lookup(virtual_person_id)) {
+    pools.emplace_back(entry->node_path_index(), entry->pool_index());
+  }
+  return pools;
+}
+
+TEST(VidPoolLookupTest, Lookup) {
+  VidPoolIndex index;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(kIndex, &index));
+  ASSERT_OK_AND_ASSIGN(VidPoolLookup lookup, VidPoolLookup::Create(index));
+
+  EXPECT_THAT(LookupPools(lookup, 999), IsEmpty());
+  EXPECT_THAT(LookupPools(lookup, 1000), ElementsAre(std::make_pair(0, 2)));
+  EXPECT_THAT(LookupPools(lookup, 1499), ElementsAre(std::make_pair(0, 2)));
+  EXPECT_THAT(LookupPools(lookup, 1500), IsEmpty());
+  EXPECT_THAT(LookupPools(lookup, 2000), ElementsAre(std::make_pair(1, 0)));
+  EXPECT_THAT(LookupPools(lookup, 3999), ElementsAre(std::make_pair(0, 0)));
+  EXPECT_THAT(LookupPools(lookup, 4000), IsEmpty());
+
+  const VidPoolIndex::Entry* entry = lookup.Lookup(2100).front();
+  EXPECT_THAT(lookup.GetNodePath(*entry).node_names(),
+              ElementsAre("root", "country_2"));
+}
+
+TEST(VidPoolLookupTest, OverlappingRanges) {
+  VidPoolIndex index;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(
+      R"pb(
+        node_paths { node_names: "a" }
+        entries {
+          population_offset: 0
+          total_population: 1000
+          node_path_index: 0
+          pool_index: 0
+        }
+        entries {
+          population_offset: 100
+          total_population: 10
+          node_path_index: 0
+          pool_index: 1
+        }
+        entries {
+          population_offset: 200
+          total_population: 10
+          node_path_index: 0
+          pool_index: 2
+        }
+      )pb",
+      &index));
+  ASSERT_OK_AND_ASSIGN(VidPoolLookup lookup, VidPoolLookup::Create(index));
+
+  EXPECT_THAT(LookupPools(lookup, 105),
+              ElementsAre(std::make_pair(0, 0), std::make_pair(0, 1)));
+  EXPECT_THAT(LookupPools(lookup, 500), ElementsAre(std::make_pair(0, 0)));
+  EXPECT_THAT(LookupPools(lookup, 1000), IsEmpty());
+}
+
+TEST(VidPoolLookupTest, UnsortedIndex) {
+  VidPoolIndex index;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(
+      R"pb(
+        node_paths { node_names: "a" }
+        entries { population_offset: 100 total_population: 10 }
+        entries { population_offset: 0 total_population: 10 }
+      )pb",
+      &index));
+  EXPECT_THAT(VidPoolLookup::Create(index).status(),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       "The entries are not sorted by population_offset."));
+}
+
+TEST(VidPoolLookupTest, NodePathIndexOutOfRange) {
+  VidPoolIndex index;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(
+      R"pb(
+        node_paths { node_names: "a" }
+        entries {
+          population_offset: 0
+          total_population: 10
+          node_path_index: 1
+        }
+      )pb",
+      &index));
+  EXPECT_THAT(VidPoolLookup::Create(index).status(),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       "The node_path_index is out of range"));
+}
+
+}  // namespace
+}  // namespace wfa_virtual_people
@@ -0,0 +1,265 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "wfa/virtual_people/training/model_evaluator/branch_action.h"
+
+#include <cstdint>
+#include <memory>
+
+#include "absl/status/status.h"
+#include "common_cpp/testing/status_macros.h"
+#include "common_cpp/testing/status_matchers.h"
+#include "gmock/gmock.h"
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+#include "wfa/virtual_people/common/event.pb.h"
+#include "wfa/virtual_people/common/model.pb.h"
+#include "wfa/virtual_people/training/model_evaluator/labeler_hash.h"
+
+namespace wfa_virtual_people {
+namespace {
+
+using ::wfa::IsOk;
+using ::wfa::StatusIs;
+
+BranchNode::AttributesUpdater ParseUpdater(const char* textproto) {
+  BranchNode::AttributesUpdater config;
+  EXPECT_TRUE(
+      google::protobuf::TextFormat::ParseFromString(textproto, &config));
+  return config;
+}
+
+TEST(AttributesUpdaterTest, SparseUpdateMatrix) {
+  ASSERT_OK_AND_ASSIGN(std::unique_ptr<AttributesUpdater> updater,
+                       AttributesUpdater::New(ParseUpdater(R"pb(
+                         sparse_update_matrix {
+                           columns {
+                             column_attrs { person_country_code: "US" }
+                             rows { person_region_code: "us_1" }
+                             rows { person_region_code: "us_2" }
+                             probabilities: [ 0.5, 0.5 ]
+                           }
+                           columns {
+                             column_attrs {
+                               person_country_code: "US"
+                               label { demo { gender: GENDER_MALE } }
+                             }
+                             rows { person_region_code: "us_male" }
+                             probabilities: 1
+                           }
+                           random_seed: "sparse"
+                         }
+                       )pb")));
+
+  int us_1_count = 0;
+  constexpr int kEventCount = 10000;
+  for (uint64_t fingerprint = 0; fingerprint < kEventCount; ++fingerprint) {
+    LabelerEvent event;
+    event.set_person_country_code("US");
+    event.set_acting_fingerprint(fingerprint);
+    ASSERT_THAT(updater->Update(&LabelerFingerprint64, event), IsOk());
+    if (event.person_region_code() == "us_1") {
+      ++us_1_count;
+    } else {
+      EXPECT_EQ(event.person_region_code(), "us_2");
+    }
+  }
+  EXPECT_NEAR(us_1_count, kEventCount * 0.5, kEventCount * 0.02);
+
+  // The columns are matched on all the fields set in any column, so the first
+  // column does not match the events with gender.
+  LabelerEvent event;
+  event.set_person_country_code("US");
+  event.mutable_label()->mutable_demo()->set_gender(GENDER_MALE);
+  ASSERT_THAT(updater->Update(&LabelerFingerprint64, event), IsOk());
+  EXPECT_EQ(event.person_region_code(), "us_male");
+  event.mutable_label()->mutable_demo()->set_gender(GENDER_FEMALE);
+  EXPECT_THAT(updater->Update(&LabelerFingerprint64, event),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       "No column of the update matrix matches the event "
+                       "with seed sparse"));
+}
+
+TEST(AttributesUpdaterTest, UpdateMatrixPassThroughNonMatches) {
+  ASSERT_OK_AND_ASSIGN(std::unique_ptr<AttributesUpdater> updater,
+                       AttributesUpdater::New(ParseUpdater(R"pb(
+                         update_matrix {
+                           columns { person_country_code: "US" }
+                           rows { person_region_code: "us" }
+                           probabilities: 1
+                           pass_through_non_matches: true
+                         }
+                       )pb")));
+  LabelerEvent event;
+  event.set_person_country_code("FR");
+  ASSERT_THAT(updater->Update(&LabelerFingerprint64, event), IsOk());
+  EXPECT_FALSE(event.has_person_region_code());
+}
+
+TEST(AttributesUpdaterTest, InvalidUpdateMatrix) {
+  EXPECT_THAT(AttributesUpdater::New(ParseUpdater(R"pb(
+                update_matrix {
+                  columns { person_country_code: "US" }
+                  columns { person_country_code: "CA" }
+                  rows { person_region_code: "north_america" }
+                  probabilities: 1
+                }
+              )pb"))
+                  .status(),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       "UpdateMatrix has 1 probabilities, expected 2"));
+  EXPECT_THAT(AttributesUpdater::New(ParseUpdater(R"pb(
+                update_matrix {
+                  columns { person_country_code: "US" }
+                  columns { person_country_code: "US" }
+                  rows { person_region_code: "us" }
+                  probabilities: [ 1, 1 ]
+                }
+              )pb"))
+                  .status(),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       "Duplicated update matrix column"));
+  EXPECT_THAT(AttributesUpdater::New(ParseUpdater(R"pb(
+                update_matrix {
+                  columns { person_country_code: "US" }
+                  rows { person_region_code: "us" }
+                  probabilities: 0
+                }
+              )pb"))
+                  .status(),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       "No positive probability in the update matrix column"));
+}
+
+TEST(AttributesUpdaterTest, ConditionalMergeNoMatch) {
+  ASSERT_OK_AND_ASSIGN(std::unique_ptr<AttributesUpdater> updater,
+                       AttributesUpdater::New(ParseUpdater(R"pb(
+                         conditional_merge {
+                           nodes {
+                             condition {
+                               op: EQUAL
+                               name: "person_country_code"
+                               value: "US"
+                             }
+                             update { person_region_code: "us" }
+                           }
+                         }
+                       )pb")));
+  LabelerEvent event;
+  event.set_person_country_code("FR");
+  EXPECT_THAT(updater->Update(&LabelerFingerprint64, event),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       "No node of ConditionalMerge matches the event."));
+}
+
+TEST(AttributesUpdaterTest, ConditionalAssignment) {
+  ASSERT_OK_AND_ASSIGN(std::unique_ptr<AttributesUpdater> updater,
+                       AttributesUpdater::New(ParseUpdater(R"pb(
+                         conditional_assignment {
+                           condition { op: TRUE }
+                           assignments {
+                             source_field: "corrected_demo"
+                             target_field: "label.demo"
+                           }
+                           assignments {
+                             source_field: "person_region_code"
+                             target_field: "person_country_code"
+                           }
+                         }
+                       )pb")));
+  LabelerEvent event;
+  event.set_person_country_code("US");
+  event.mutable_corrected_demo()->set_gender(GENDER_FEMALE);
+  ASSERT_THAT(updater->Update(&LabelerFingerprint64, event), IsOk());
+  EXPECT_EQ(event.label().demo().gender(), GENDER_FEMALE);
+  // The source field is not set.
+  EXPECT_EQ(event.person_country_code(), "US");
+}
+
+TEST(AttributesUpdaterTest, ConditionalAssignmentDifferentTypes) {
+  EXPECT_THAT(AttributesUpdater::New(ParseUpdater(R"pb(
+                conditional_assignment {
+                  condition { op: TRUE }
+                  assignments {
+                    source_field: "person_country_code"
+                    target_field: "label.demo.gender"
+                  }
+                }
+              )pb"))
+                  .status(),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       "The source and target fields of an assignment have "
+                       "different types"));
+}
+
+TEST(AttributesUpdaterTest, NotSupported) {
+  EXPECT_THAT(AttributesUpdater::New(ParseUpdater(R"pb(
+                geometric_shredder { psi: 0.5 }
+              )pb"))
+                  .status(),
+              StatusIs(absl::StatusCode::kUnimplemented,
+                       "AttributesUpdater is not supported"));
+  EXPECT_THAT(
+      AttributesUpdater::New(ParseUpdater("")).status(),
+      StatusIs(absl::StatusCode::kInvalidArgument,
+               "The update of the AttributesUpdater is not set."));
+}
+
+TEST(EventMultiplicityTest, SetClone) {
+  Multiplicity config;
+  config.set_expected_multiplicity(2);
+  config.set_person_index_field("multiplicity_person_index");
+  ASSERT_OK_AND_ASSIGN(EventMultiplicity multiplicity,
+                       EventMultiplicity::Create(config));
+  LabelerEvent event;
+  event.set_acting_fingerprint(12345);
+  ASSERT_OK_AND_ASSIGN(
+      int clone_count,
+      multiplicity.GetCloneCount(&LabelerFingerprint64, event));
+  EXPECT_EQ(clone_count, 2);
+
+  LabelerEvent clone = event;
+  multiplicity.SetClone(&LabelerFingerprint64, 0, clone);
+  EXPECT_EQ(clone.multiplicity_person_index(), 0);
+  EXPECT_EQ(clone.acting_fingerprint(), 12345);
+  clone = event;
+  multiplicity.SetClone(&LabelerFingerprint64, 1, clone);
+  EXPECT_EQ(clone.multiplicity_person_index(), 1);
+  EXPECT_EQ(clone.acting_fingerprint(), LabelerFingerprint64("12345-1"));
+}
+
+TEST(EventMultiplicityTest, NegativeMultiplicity) {
+  Multiplicity config;
+  config.set_expected_multiplicity(-1);
+  config.set_person_index_field("multiplicity_person_index");
+  ASSERT_OK_AND_ASSIGN(EventMultiplicity multiplicity,
+                       EventMultiplicity::Create(config));
+  EXPECT_THAT(
+      multiplicity.GetCloneCount(&LabelerFingerprint64, LabelerEvent())
+          .status(),
+      StatusIs(absl::StatusCode::kInvalidArgument,
+               "Invalid expected multiplicity: -1"));
+}
+
+TEST(EventMultiplicityTest, MultiplicityNotSet) {
+  Multiplicity config;
+  config.set_person_index_field("multiplicity_person_index");
+  EXPECT_THAT(EventMultiplicity::Create(config).status(),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       "Multiplicity must have expected_multiplicity or "
+                       "expected_multiplicity_field."));
+}
+
+}  // namespace
+}  // namespace wfa_virtual_people
@@ -0,0 +1,190 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "wfa/virtual_people/training/model_evaluator/event_replay.h"
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "common_cpp/protobuf_util/textproto_io.h"
+#include "common_cpp/testing/status_macros.h"
+#include "common_cpp/testing/status_matchers.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "wfa/virtual_people/common/event.pb.h"
+#include "wfa/virtual_people/common/model.pb.h"
+#include "wfa/virtual_people/training/model_evaluator/model_walker.h"
+
+namespace wfa_virtual_people {
+namespace {
+
+using ::testing::ElementsAre;
+using ::wfa::IsOk;
+using ::wfa::ReadTextProtoFile;
+using ::wfa::StatusIs;
+
+constexpr char kModelPath[] =
+    "src/test/cc/wfa/virtual_people/training/model_evaluator/test_data/"
+    "labeling_model.textproto";
+constexpr char kModelWithUpdatesPath[] =
+    "src/test/cc/wfa/virtual_people/training/model_evaluator/test_data/"
+    "labeling_model_with_updates.textproto";
+
+// 3 events reaching us_male, 2 reaching other, and 1 with no matching
+// condition at north_america.
+std::vector<LabelerEvent> GetEvents() {
+  std::vector<LabelerEvent> events;
+  for (int i = 0; i < 3; ++i) {
+    LabelerEvent& event = events.emplace_back();
+    event.set_person_country_code("US");
+    event.mutable_label()->mutable_demo()->set_gender(GENDER_MALE);
+    event.set_acting_fingerprint(i);
+  }
+  events.emplace_back().set_person_country_code("FR");
+  events.emplace_back();
+  events.emplace_back().set_person_country_code("CA");
+  return events;
+}
+
+TEST(EventReplayTest, ReportVisitsAndDepth) {
+  CompiledNode root;
+  ASSERT_THAT(ReadTextProtoFile(kModelPath, root), IsOk());
+  ASSERT_OK_AND_ASSIGN(ModelWalker walker, ModelWalker::Create(root));
+
+  for (int thread_count : {1, 2, 4, 16}) {
+    ReplayOptions options;
+    options.thread_count = thread_count;
+    ASSERT_OK_AND_ASSIGN(ReplayReport report,
+                         ReplayEvents(walker, GetEvents(), options));
+    EXPECT_EQ(report.event_count, 6);
+    EXPECT_EQ(report.error_count, 1);
+    EXPECT_THAT(report.visit_counts,
+                ElementsAre(6, 3, 0, 0, 0, 3, 0, 1, 0, 0, 2));
+    // 3 walks of depth 3, and 2 walks of depth 2.
+    EXPECT_EQ(report.total_depth, 13);
+    EXPECT_DOUBLE_EQ(report.GetAverageDepth(), 13.0 / 5);
+    EXPECT_LE(report.latency_p50, report.latency_p90);
+    EXPECT_LE(report.latency_p90, report.latency_p99);
+    EXPECT_LE(report.latency_p99, report.latency_max);
+  }
+}
+
+TEST(EventReplayTest, ReportVisitsOfUpdateTreesAndClones) {
+  CompiledNode root;
+  ASSERT_THAT(ReadTextProtoFile(kModelWithUpdatesPath, root), IsOk());
+  ASSERT_OK_AND_ASSIGN(ModelWalker walker, ModelWalker::Create(root));
+  ASSERT_EQ(walker.node_name(2), "gender_known");
+  ASSERT_EQ(walker.node_name(3), "gender_imputation");
+  ASSERT_EQ(walker.node_name(8), "us");
+  ASSERT_EQ(walker.node_name(10), "us_first_female");
+  ASSERT_EQ(walker.node_name(12), "us_clone");
+  ASSERT_EQ(walker.node_name(13), "ca");
+  ASSERT_EQ(walker.node_name(14), "other");
+  // 10 events reaching us, whose gender is known, 1 reaching ca, and 1 with
+  // imputed gender reaching other.
+  std::vector<LabelerEvent> events;
+  for (int i = 0; i < 10; ++i) {
+    LabelerEvent& event = events.emplace_back();
+    event.set_person_country_code("US");
+    event.mutable_label()->mutable_demo()->set_gender(GENDER_FEMALE);
+    event.set_acting_fingerprint(i);
+  }
+  LabelerEvent& ca_event = events.emplace_back();
+  ca_event.set_person_country_code("CA");
+  ca_event.mutable_label()->mutable_demo()->set_gender(GENDER_MALE);
+  events.emplace_back().set_person_country_code("FR");
+
+  ASSERT_OK_AND_ASSIGN(ReplayReport report,
+                       ReplayEvents(walker, events, ReplayOptions()));
+  EXPECT_EQ(report.error_count, 0);
+  EXPECT_EQ(report.visit_counts[0], 12);
+  EXPECT_EQ(report.visit_counts[2], 11);
+  EXPECT_EQ(report.visit_counts[3], 1);
+  EXPECT_EQ(report.visit_counts[8], 10);
+  // The first clone of each event reaches us_first_female, and the others
+  // reach us_clone.
+  EXPECT_EQ(report.visit_counts[10], 10);
+  EXPECT_GT(report.visit_counts[12], 0);
+  EXPECT_LT(report.visit_counts[12], 10);
+  EXPECT_EQ(report.visit_counts[13], 1);
+  EXPECT_EQ(report.visit_counts[14], 1);
+  // The walks of depth 6 to us_first_female, plus 1 for each other clone, of
+  // depth 4 to ca, and of depth 6 to other.
+  EXPECT_EQ(report.total_depth, 6 * 10 + report.visit_counts[12] + 4 + 6);
+}
+
+TEST(EventReplayTest, SampledLatencies) {
+  // A sample of the events is timed, and the counts include all the events.
+  CompiledNode root;
+  ASSERT_THAT(ReadTextProtoFile(kModelPath, root), IsOk());
+  ASSERT_OK_AND_ASSIGN(ModelWalker walker, ModelWalker::Create(root));
+  std::vector<LabelerEvent> events;
+  for (int i = 0; i < 50; ++i) {
+    for (LabelerEvent& event : GetEvents()) {
+      events.push_back(std::move(event));
+    }
+  }
+
+  for (int thread_count : {1, 3}) {
+    ReplayOptions options;
+    options.thread_count = thread_count;
+    options.latency_sample_interval = 7;
+    ASSERT_OK_AND_ASSIGN(ReplayReport report,
+                         ReplayEvents(walker, events, options));
+    EXPECT_EQ(report.event_count, 300);
+    EXPECT_EQ(report.error_count, 50);
+    EXPECT_EQ(report.visit_counts[0], 300);
+    EXPECT_EQ(report.total_depth, 13 * 50);
+    EXPECT_LE(report.latency_p50, report.latency_max);
+  }
+}
+
+TEST(EventReplayTest, NoEvents) {
+  CompiledNode root;
+  ASSERT_THAT(ReadTextProtoFile(kModelPath, root), IsOk());
+  ASSERT_OK_AND_ASSIGN(ModelWalker walker, ModelWalker::Create(root));
+  ReplayOptions options;
+  options.thread_count = 4;
+  ASSERT_OK_AND_ASSIGN(ReplayReport report,
+                       ReplayEvents(walker, {}, options));
+  EXPECT_EQ(report.event_count, 0);
+  EXPECT_EQ(report.GetAverageDepth(), 0);
+}
+
+TEST(EventReplayTest, InvalidThreadCount) {
+  CompiledNode root;
+  ASSERT_THAT(ReadTextProtoFile(kModelPath, root), IsOk());
+  ASSERT_OK_AND_ASSIGN(ModelWalker walker, ModelWalker::Create(root));
+  ReplayOptions options;
+  options.thread_count = 0;
+  EXPECT_THAT(ReplayEvents(walker, GetEvents(), options).status(),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       "thread_count must be positive."));
+}
+
+TEST(EventReplayTest, InvalidLatencySampleInterval) {
+  CompiledNode root;
+  ASSERT_THAT(ReadTextProtoFile(kModelPath, root), IsOk());
+  ASSERT_OK_AND_ASSIGN(ModelWalker walker, ModelWalker::Create(root));
+  ReplayOptions options;
+  options.latency_sample_interval = 0;
+  EXPECT_THAT(ReplayEvents(walker, GetEvents(), options).status(),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       "latency_sample_interval must be positive."));
+}
+
+}  // namespace
+}  // namespace wfa_virtual_people
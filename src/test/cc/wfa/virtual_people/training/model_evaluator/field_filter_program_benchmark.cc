@@ -0,0 +1,125 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Measures the throughput of FieldFilterProgram against FieldFilter, on a
+// filter shaped like the conditions of a compiled model.
+//
+// Example usage:
+// bazel build -c opt \
+// //src/test/cc/wfa/virtual_people/training/model_evaluator:\
+// field_filter_program_benchmark
+// bazel-bin/src/test/cc/wfa/virtual_people/training/model_evaluator/\
+// field_filter_program_benchmark \
+// --iterations=1000000
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "glog/logging.h"
+#include "google/protobuf/text_format.h"
+#include "wfa/virtual_people/common/event.pb.h"
+#include "wfa/virtual_people/common/field_filter.pb.h"
+#include "wfa/virtual_people/common/field_filter/field_filter.h"
+#include "wfa/virtual_people/training/model_evaluator/field_filter_program.h"
+
+ABSL_FLAG(int64_t, iterations, 1000000,
+          "The number of events to match with each implementation.");
+
+namespace wfa_virtual_people {
+namespace {
+
+constexpr char kFilter[] = R"pb(
+  op: OR
+  sub_filters {
+    op: AND
+    sub_filters { op: EQUAL name: "person_country_code" value: "US" }
+    sub_filters {
+      op: IN
+      name: "label.demo.gender"
+      value: "GENDER_FEMALE,GENDER_MALE"
+    }
+    sub_filters { op: GT name: "label.demo.age.min_age" value: "17" }
+  }
+  sub_filters {
+    op: PARTIAL
+    name: "label.demo"
+    sub_filters { op: EQUAL name: "gender" value: "GENDER_FEMALE" }
+    sub_filters { op: LT name: "age.max_age" value: "25" }
+  }
+)pb";
+
+std::vector<LabelerEvent> GetEvents() {
+  std::vector<LabelerEvent> events;
+  for (const char* country : {"US", "CA", "MX"}) {
+    for (Gender gender : {GENDER_FEMALE, GENDER_MALE}) {
+      for (int age = 0; age < 80; age += 10) {
+        LabelerEvent& event = events.emplace_back();
+        event.set_person_country_code(country);
+        DemoBucket* demo = event.mutable_label()->mutable_demo();
+        demo->set_gender(gender);
+        demo->mutable_age()->set_min_age(age);
+        demo->mutable_age()->set_max_age(age + 9);
+      }
+    }
+  }
+  return events;
+}
+
+template <typename Filter>
+void Run(const char* name, const Filter& filter,
+         const std::vector<LabelerEvent>& events, const int64_t iterations) {
+  int64_t matched = 0;
+  absl::Time start = absl::Now();
+  for (int64_t i = 0; i < iterations; ++i) {
+    matched += filter.IsMatch(events[i % events.size()]);
+  }
+  absl::Duration elapsed = absl::Now() - start;
+  LOG(INFO) << name << ": "
+            << absl::ToDoubleNanoseconds(elapsed) / iterations
+            << " ns/event, " << matched << " matched";
+}
+
+}  // namespace
+}  // namespace wfa_virtual_people
+
+int main(int argc, char** argv) {
+  absl::ParseCommandLine(argc, argv);
+
+  using ::wfa_virtual_people::FieldFilter;
+  using ::wfa_virtual_people::FieldFilterProgram;
+  using ::wfa_virtual_people::FieldFilterProto;
+  using ::wfa_virtual_people::LabelerEvent;
+
+  FieldFilterProto config;
+  CHECK(google::protobuf::TextFormat::ParseFromString(
+      wfa_virtual_people::kFilter, &config));
+  absl::StatusOr<std::unique_ptr<FieldFilter>> field_filter =
+      FieldFilter::New(LabelerEvent().GetDescriptor(), config);
+  CHECK(field_filter.ok()) << field_filter.status();
+  absl::StatusOr<FieldFilterProgram> program =
+      FieldFilterProgram::Compile(config);
+  CHECK(program.ok()) << program.status();
+
+  std::vector<LabelerEvent> events = wfa_virtual_people::GetEvents();
+  const int64_t iterations = absl::GetFlag(FLAGS_iterations);
+  wfa_virtual_people::Run("FieldFilter", **field_filter, events, iterations);
+  wfa_virtual_people::Run("FieldFilterProgram", *program, events, iterations);
+  return 0;
+}
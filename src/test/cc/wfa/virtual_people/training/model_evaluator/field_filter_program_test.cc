@@ -0,0 +1,308 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "wfa/virtual_people/training/model_evaluator/field_filter_program.h"
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "common_cpp/testing/status_macros.h"
+#include "common_cpp/testing/status_matchers.h"
+#include "gmock/gmock.h"
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+#include "wfa/virtual_people/common/event.pb.h"
+#include "wfa/virtual_people/common/field_filter.pb.h"
+#include "wfa/virtual_people/common/field_filter/field_filter.h"
+
+namespace wfa_virtual_people {
+namespace {
+
+using ::wfa::StatusIs;
+
+FieldFilterProto ParseFilter(const std::string& textproto) {
+  FieldFilterProto filter;
+  EXPECT_TRUE(
+      google::protobuf::TextFormat::ParseFromString(textproto, &filter));
+  return filter;
+}
+
+// Events covering set and unset fields of each type used by the filters.
+std::vector<LabelerEvent> GetTestEvents() {
+  std::vector<LabelerEvent> events;
+  events.emplace_back();
+  for (const char* country : {"", "US", "CA"}) {
+    for (const char* region : {"", "US-CA"}) {
+      for (int gender = -1; gender <= 2; ++gender) {
+        for (int age = -1; age <= 60; age += 15) {
+          for (int64_t timestamp : {-1, 0, 200, 300}) {
+            LabelerEvent event;
+            if (*country) event.set_person_country_code(country);
+            if (*region) event.set_person_region_code(region);
+            if (gender >= 0) {
+              event.mutable_label()->mutable_demo()->set_gender(
+                  static_cast<Gender>(gender));
+            }
+            if (age >= 0) {
+              AgeRange* age_range =
+                  event.mutable_label()->mutable_demo()->mutable_age();
+              age_range->set_min_age(age);
+              age_range->set_max_age(age + 9);
+            }
+            if (timestamp >= 0) {
+              event.mutable_labeler_input()->set_timestamp_usec(timestamp);
+            }
+            events.push_back(event);
+          }
+        }
+      }
+    }
+  }
+  return events;
+}
+
+const char* const kEquivalenceFilters[] = {
+    R"pb(op: TRUE)pb",
+    R"pb(op: HAS name: "person_country_code")pb",
+    R"pb(op: HAS name: "label.demo.age")pb",
+    R"pb(op: EQUAL name: "person_country_code" value: "US")pb",
+    R"pb(op: EQUAL name: "label.demo.gender" value: "GENDER_FEMALE")pb",
+    R"pb(op: EQUAL name: "label.demo.age.min_age" value: "30")pb",
+    R"pb(op: IN name: "person_country_code" value: "US,CA")pb",
+    R"pb(op: IN
+         name: "label.demo.gender"
+         value: "GENDER_FEMALE,GENDER_MALE")pb",
+    R"pb(op: IN name: "label.demo.age.max_age" value: "9,39,69")pb",
+    R"pb(op: GT name: "label.demo.age.min_age" value: "15")pb",
+    R"pb(op: LT name: "labeler_input.timestamp_usec" value: "250")pb",
+    R"pb(op: NOT
+         sub_filters { op: EQUAL name: "person_country_code" value: "US" })pb",
+    R"pb(op: AND
+         sub_filters { op: EQUAL name: "person_country_code" value: "US" }
+         sub_filters { op: GT name: "label.demo.age.min_age" value: "20" }
+         sub_filters { op: HAS name: "person_region_code" })pb",
+    R"pb(op: OR
+         sub_filters { op: EQUAL name: "person_country_code" value: "CA" }
+         sub_filters { op: LT name: "label.demo.age.max_age" value: "30" }
+         sub_filters {
+           op: NOT
+           sub_filters { op: HAS name: "labeler_input" }
+         })pb",
+    R"pb(op: PARTIAL
+         name: "label.demo"
+         sub_filters { op: EQUAL name: "gender" value: "GENDER_MALE" }
+         sub_filters { op: GT name: "age.min_age" value: "0" })pb",
+    R"pb(op: PARTIAL
+         name: "label"
+         sub_filters {
+           op: PARTIAL
+           name: "demo"
+           sub_filters { op: HAS name: "age" }
+         })pb",
+    R"pb(op: OR
+         sub_filters {
+           op: AND
+           sub_filters { op: EQUAL name: "person_country_code" value: "US" }
+           sub_filters {
+             op: IN
+             name: "label.demo.gender"
+             value: "GENDER_FEMALE"
+           }
+         }
+         sub_filters {
+           op: AND
+           sub_filters { op: EQUAL name: "person_country_code" value: "CA" }
+           sub_filters {
+             op: NOT
+             sub_filters {
+               op: LT
+               name: "labeler_input.timestamp_usec"
+               value: "200"
+             }
+           }
+         })pb",
+};
+
+TEST(FieldFilterProgramTest, MatchesFieldFilter) {
+  std::vector<LabelerEvent> events = GetTestEvents();
+  for (const char* textproto : kEquivalenceFilters) {
+    FieldFilterProto filter = ParseFilter(textproto);
+    ASSERT_OK_AND_ASSIGN(
+        std::unique_ptr<FieldFilter> field_filter,
+        FieldFilter::New(LabelerEvent().GetDescriptor(), filter));
+    ASSERT_OK_AND_ASSIGN(FieldFilterProgram program,
+                         FieldFilterProgram::Compile(filter));
+    for (const LabelerEvent& event : events) {
+      EXPECT_EQ(program.IsMatch(event), field_filter->IsMatch(event))
+          << "Filter: " << filter.DebugString()
+          << "Event: " << event.DebugString();
+    }
+  }
+}
+
+TEST(FieldFilterProgramTest, SerializeRoundTrip) {
+  std::vector<LabelerEvent> events = GetTestEvents();
+  for (const char* textproto : kEquivalenceFilters) {
+    FieldFilterProto filter = ParseFilter(textproto);
+    ASSERT_OK_AND_ASSIGN(FieldFilterProgram program,
+                         FieldFilterProgram::Compile(filter));
+    std::string data = program.Serialize();
+    ASSERT_OK_AND_ASSIGN(FieldFilterProgram loaded,
+                         FieldFilterProgram::Deserialize(data));
+    EXPECT_EQ(loaded.Serialize(), data);
+    for (const LabelerEvent& event : events) {
+      EXPECT_EQ(loaded.IsMatch(event), program.IsMatch(event))
+          << "Filter: " << filter.DebugString()
+          << "Event: " << event.DebugString();
+    }
+  }
+}
+
+TEST(FieldFilterProgramTest, DeserializeTruncated) {
+  ASSERT_OK_AND_ASSIGN(
+      FieldFilterProgram program,
+      FieldFilterProgram::Compile(ParseFilter(
+          R"pb(op: IN name: "person_country_code" value: "US,CA")pb")));
+  std::string data = program.Serialize();
+  data.pop_back();
+  EXPECT_THAT(FieldFilterProgram::Deserialize(data).status(),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       "Invalid FieldFilterProgram data: Truncated."));
+  data.append("AB");
+  EXPECT_THAT(FieldFilterProgram::Deserialize(data).status(),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       "Invalid FieldFilterProgram data: Trailing bytes."));
+}
+
+TEST(FieldFilterProgramTest, DeserializeBackwardJump) {
+  ASSERT_OK_AND_ASSIGN(FieldFilterProgram program,
+                       FieldFilterProgram::Compile(ParseFilter(R"pb(
+                         op: AND
+                         sub_filters { op: TRUE }
+                         sub_filters { op: TRUE }
+                       )pb")));
+  std::string data = program.Serialize();
+  // No field, then the instruction count, and the instructions of 13 bytes:
+  // the opcode, the field, the operand and the count. Point the jump, which
+  // is the second instruction, back to the first.
+  const uint32_t target = 0;
+  std::memcpy(data.data() + 8 + 13 + 1 + 4, &target, sizeof(target));
+  EXPECT_THAT(FieldFilterProgram::Deserialize(data).status(),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       "Invalid FieldFilterProgram data: Invalid instruction "
+                       "1"));
+}
+
+TEST(FieldFilterProgramTest, InternFields) {
+  ASSERT_OK_AND_ASSIGN(
+      FieldFilterProgram program,
+      FieldFilterProgram::Compile(ParseFilter(R"pb(
+        op: OR
+        sub_filters { op: EQUAL name: "person_country_code" value: "US" }
+        sub_filters { op: EQUAL name: "person_country_code" value: "CA" }
+        sub_filters {
+          op: PARTIAL
+          name: "label.demo"
+          sub_filters { op: GT name: "age.min_age" value: "20" }
+        }
+        sub_filters { op: LT name: "label.demo.age.min_age" value: "10" }
+      )pb")));
+  // person_country_code, label.demo and label.demo.age.min_age.
+  EXPECT_EQ(program.field_count(), 3);
+  // 4 sub-filters, 3 jumps between them, and HAS + jump in PARTIAL.
+  EXPECT_EQ(program.instruction_count(), 9);
+}
+
+TEST(FieldFilterProgramTest, ShortCircuit) {
+  ASSERT_OK_AND_ASSIGN(
+      FieldFilterProgram program,
+      FieldFilterProgram::Compile(ParseFilter(R"pb(
+        op: AND
+        sub_filters { op: EQUAL name: "person_country_code" value: "US" }
+        sub_filters {
+          op: OR
+          sub_filters { op: TRUE }
+          sub_filters { op: EQUAL name: "person_region_code" value: "US-CA" }
+        }
+      )pb")));
+  LabelerEvent event;
+  event.set_person_country_code("US");
+  EXPECT_TRUE(program.IsMatch(event));
+  event.set_person_country_code("CA");
+  EXPECT_FALSE(program.IsMatch(event));
+}
+
+TEST(FieldFilterProgramTest, UnknownField) {
+  EXPECT_THAT(FieldFilterProgram::Compile(ParseFilter(
+                  R"pb(op: EQUAL name: "bad_field" value: "1")pb"))
+                  .status(),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       "The field bad_field is not found in "
+                       "wfa_virtual_people.LabelerEvent"));
+}
+
+TEST(FieldFilterProgramTest, InvalidValue) {
+  EXPECT_THAT(FieldFilterProgram::Compile(ParseFilter(
+                  R"pb(op: EQUAL name: "label.demo.age.min_age" value: "a")pb"))
+                  .status(),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       "Invalid value a for "
+                       "wfa_virtual_people.AgeRange.min_age"));
+  EXPECT_THAT(FieldFilterProgram::Compile(ParseFilter(
+                  R"pb(op: EQUAL name: "label.demo.gender" value: "BAD")pb"))
+                  .status(),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       "Invalid value BAD for "
+                       "wfa_virtual_people.DemoBucket.gender"));
+}
+
+TEST(FieldFilterProgramTest, GreaterThanNonNumericField) {
+  EXPECT_THAT(FieldFilterProgram::Compile(ParseFilter(
+                  R"pb(op: GT name: "person_country_code" value: "US")pb"))
+                  .status(),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       "GT and LT require a numeric field"));
+}
+
+TEST(FieldFilterProgramTest, MissingSubFilters) {
+  EXPECT_THAT(FieldFilterProgram::Compile(ParseFilter(R"pb(op: AND)pb"))
+                  .status(),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       "sub_filters must be set when op is AND"));
+}
+
+TEST(FieldFilterProgramTest, RepeatedFieldNotSupported) {
+  EXPECT_THAT(
+      FieldFilterProgram::Compile(ParseFilter(
+          R"pb(op: HAS name: "virtual_person_activities")pb"))
+          .status(),
+      StatusIs(absl::StatusCode::kUnimplemented,
+               "Repeated field is not supported: "
+               "wfa_virtual_people.LabelerEvent.virtual_person_activities"));
+}
+
+TEST(FieldFilterProgramTest, RegexpNotSupported) {
+  EXPECT_THAT(FieldFilterProgram::Compile(ParseFilter(
+                  R"pb(op: REGEXP name: "person_country_code" value: "U.*")pb"))
+                  .status(),
+              StatusIs(absl::StatusCode::kUnimplemented,
+                       "Op is not supported by FieldFilterProgram: REGEXP"));
+}
+
+}  // namespace
+}  // namespace wfa_virtual_people
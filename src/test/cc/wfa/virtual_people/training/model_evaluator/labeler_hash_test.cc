@@ -0,0 +1,86 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "wfa/virtual_people/training/model_evaluator/labeler_hash.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "gtest/gtest.h"
+
+namespace wfa_virtual_people {
+namespace {
+
+TEST(LabelerHashTest, GetEventSeed) {
+  EXPECT_EQ(GetEventSeed("seed", 12345), "seed12345");
+  EXPECT_EQ(GetEventSeed("", 0), "0");
+}
+
+TEST(LabelerHashTest, GetUniformHash) {
+  EXPECT_EQ(GetUniformHash([](absl::string_view) -> uint64_t { return 0; },
+                           "seed"),
+            0);
+  EXPECT_EQ(GetUniformHash([](absl::string_view) { return ~uint64_t{0}; },
+                           "seed"),
+            1);
+  for (int i = 0; i < 100; ++i) {
+    double uniform = GetUniformHash(&LabelerFingerprint64, absl::StrCat(i));
+    EXPECT_GE(uniform, 0);
+    EXPECT_LE(uniform, 1);
+  }
+}
+
+TEST(LabelerHashTest, SelectByConsistentHashingDistribution) {
+  const std::vector<double> probabilities = {0.2, 0.0, 0.5, 0.3};
+  std::vector<int> counts(probabilities.size());
+  constexpr int kSeedCount = 20000;
+  for (int i = 0; i < kSeedCount; ++i) {
+    int selected = SelectByConsistentHashing(
+        &LabelerFingerprint64, GetEventSeed("seed", i), probabilities);
+    ASSERT_GE(selected, 0);
+    ASSERT_LT(selected, probabilities.size());
+    ++counts[selected];
+  }
+  for (int i = 0; i < probabilities.size(); ++i) {
+    EXPECT_NEAR(counts[i], kSeedCount * probabilities[i], kSeedCount * 0.02)
+        << i;
+  }
+}
+
+TEST(LabelerHashTest, SelectByConsistentHashingIsConsistent) {
+  // Adding a choice only moves seeds to the new choice.
+  const std::vector<double> before = {0.5, 0.5};
+  const std::vector<double> after = {0.5, 0.5, 0.5};
+  for (int i = 0; i < 1000; ++i) {
+    const std::string seed = GetEventSeed("seed", i);
+    int selected_after =
+        SelectByConsistentHashing(&LabelerFingerprint64, seed, after);
+    if (selected_after != 2) {
+      EXPECT_EQ(selected_after,
+                SelectByConsistentHashing(&LabelerFingerprint64, seed, before));
+    }
+  }
+}
+
+TEST(LabelerHashTest, SelectByConsistentHashingNoPositiveProbability) {
+  EXPECT_EQ(SelectByConsistentHashing(&LabelerFingerprint64, "seed", {0, 0}),
+            -1);
+  EXPECT_EQ(SelectByConsistentHashing(&LabelerFingerprint64, "seed", {}), -1);
+}
+
+}  // namespace
+}  // namespace wfa_virtual_people
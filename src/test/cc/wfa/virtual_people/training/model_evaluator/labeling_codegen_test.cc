@@ -0,0 +1,289 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "wfa/virtual_people/training/model_evaluator/labeling_codegen.h"
+
+#include <cstdint>
+#include <string>
+
+#include "absl/random/random.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+#include "common_cpp/protobuf_util/textproto_io.h"
+#include "common_cpp/testing/status_macros.h"
+#include "common_cpp/testing/status_matchers.h"
+#include "gmock/gmock.h"
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+#include "wfa/virtual_people/common/event.pb.h"
+#include "wfa/virtual_people/common/model.pb.h"
+#include "wfa/virtual_people/training/model_evaluator/labeler_hash.h"
+#include "wfa/virtual_people/training/model_evaluator/model_walker.h"
+
+namespace wfa_virtual_people {
+
+// Generated from test_data/labeling_model.textproto by the genrule
+// generated_labeling_function.
+absl::StatusOr<WalkResult> LabelTestModel(const LabelerEvent& event,
+                                          SeedHashFunction hash);
+
+// Generated from test_data/labeling_model_with_updates.textproto by the
+// genrule generated_labeling_function_with_updates.
+absl::StatusOr<WalkResult> LabelTestModelWithUpdates(const LabelerEvent& event,
+                                                     SeedHashFunction hash);
+
+namespace {
+
+using ::testing::HasSubstr;
+using ::wfa::IsOk;
+using ::wfa::ReadTextProtoFile;
+using ::wfa::StatusIs;
+
+constexpr char kModelPath[] =
+    "src/test/cc/wfa/virtual_people/training/model_evaluator/test_data/"
+    "labeling_model.textproto";
+constexpr char kModelWithUpdatesPath[] =
+    "src/test/cc/wfa/virtual_people/training/model_evaluator/test_data/"
+    "labeling_model_with_updates.textproto";
+
+// Return an event with attributes sampled from the values used by the
+// conditions of the test model, each of which may be unset.
+LabelerEvent SampleEvent(absl::BitGen& gen) {
+  LabelerEvent event;
+  event.set_acting_fingerprint(absl::Uniform<uint64_t>(gen));
+  const char* kCountries[] = {"", "US", "CA", "MX", "FR"};
+  const char* country = kCountries[absl::Uniform(gen, 0, 5)];
+  if (*country) {
+    event.set_person_country_code(country);
+  }
+  int gender = absl::Uniform(gen, -1, 3);
+  if (gender >= 0) {
+    event.mutable_label()->mutable_demo()->set_gender(
+        static_cast<Gender>(gender));
+  }
+  int age = absl::Uniform(gen, -1, 60);
+  if (age >= 0) {
+    event.mutable_label()->mutable_demo()->mutable_age()->set_min_age(age);
+  }
+  int corrected_gender = absl::Uniform(gen, -1, 3);
+  if (corrected_gender >= 0) {
+    event.mutable_corrected_demo()->set_gender(
+        static_cast<Gender>(corrected_gender));
+  }
+  return event;
+}
+
+// Expect the generated function @label to return the same results as
+// ModelWalker for the model at @model_path.
+void ExpectSameResultsAsModelWalker(
+    absl::string_view model_path,
+    absl::StatusOr<WalkResult> (*label)(const LabelerEvent&,
+                                        SeedHashFunction)) {
+  CompiledNode root;
+  ASSERT_THAT(ReadTextProtoFile(model_path, root), IsOk());
+  ASSERT_OK_AND_ASSIGN(ModelWalker walker, ModelWalker::Create(root));
+
+  absl::BitGen gen;
+  for (int i = 0; i < 10000; ++i) {
+    LabelerEvent event = SampleEvent(gen);
+    absl::StatusOr<WalkResult> expected = walker.Walk(event);
+    absl::StatusOr<WalkResult> actual = label(event, &LabelerFingerprint64);
+    ASSERT_EQ(actual.ok(), expected.ok()) << event.DebugString();
+    if (!expected.ok()) {
+      EXPECT_EQ(actual.status(), expected.status());
+      continue;
+    }
+    ASSERT_EQ(actual->leaves.size(), expected->leaves.size())
+        << event.DebugString();
+    for (int j = 0; j < expected->leaves.size(); ++j) {
+      EXPECT_EQ(actual->leaves[j].name, expected->leaves[j].name)
+          << event.DebugString();
+      EXPECT_EQ(actual->leaves[j].virtual_person_id,
+                expected->leaves[j].virtual_person_id)
+          << event.DebugString();
+    }
+    EXPECT_EQ(actual->depth, expected->depth) << event.DebugString();
+  }
+}
+
+TEST(LabelingCodegenTest, GeneratedFunctionMatchesModelWalker) {
+  ExpectSameResultsAsModelWalker(kModelPath, &LabelTestModel);
+}
+
+TEST(LabelingCodegenTest, GeneratedFunctionWithUpdatesMatchesModelWalker) {
+  ExpectSameResultsAsModelWalker(kModelWithUpdatesPath,
+                                 &LabelTestModelWithUpdates);
+}
+
+TEST(LabelingCodegenTest, GenerateSwitchAndPoolTable) {
+  CompiledNode root;
+  ASSERT_THAT(ReadTextProtoFile(kModelPath, root), IsOk());
+  ASSERT_OK_AND_ASSIGN(std::string source,
+                       GenerateLabelingFunction(root, "LabelModel"));
+  EXPECT_THAT(source, HasSubstr("absl::StatusOr<WalkResult> LabelModel("
+                                "const LabelerEvent& event, "
+                                "SeedHashFunction hash)"));
+  // The gender branches of node us.
+  EXPECT_THAT(source,
+              HasSubstr("switch (static_cast<int64_t>(static_cast<int>("
+                        "event.label().demo().gender())))"));
+  // The pools of node us_female_2, without the empty pool.
+  EXPECT_THAT(source, HasSubstr("constexpr PoolRange kPools4[] = {\n"
+                                "    {1000ULL, 20ULL},\n"
+                                "    {2000ULL, 30ULL},\n"
+                                "    {4000ULL, 10ULL},\n"
+                                "};"));
+  // The chances of node us_female.
+  EXPECT_THAT(source, HasSubstr("constexpr double kChances2[] = {"));
+  EXPECT_THAT(source, HasSubstr("GetEventSeed(\"us_female\", fingerprint)"));
+}
+
+TEST(LabelingCodegenTest, InvalidFunctionName) {
+  CompiledNode root;
+  root.set_name("root");
+  root.mutable_stop_node();
+  EXPECT_THAT(GenerateLabelingFunction(root, "1Label").status(),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       "Invalid function name: 1Label"));
+  EXPECT_THAT(GenerateLabelingFunction(root, "Label-Model").status(),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       "Invalid function name: Label-Model"));
+}
+
+TEST(LabelingCodegenTest, RegexpNotSupported) {
+  CompiledNode root;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(
+      R"pb(
+        name: "root"
+        branch_node {
+          branches {
+            node { name: "a" stop_node {} }
+            condition {
+              op: REGEXP
+              name: "person_country_code"
+              value: "U.*"
+            }
+          }
+        }
+      )pb",
+      &root));
+  EXPECT_THAT(GenerateLabelingFunction(root, "LabelModel").status(),
+              StatusIs(absl::StatusCode::kUnimplemented,
+                       "Op is not supported by code generation: REGEXP"));
+}
+
+TEST(LabelingCodegenTest, InvalidConditionValue) {
+  CompiledNode root;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(
+      R"pb(
+        name: "root"
+        branch_node {
+          branches {
+            node { name: "a" stop_node {} }
+            condition { op: EQUAL name: "label.demo.gender" value: "BAD" }
+          }
+          branches {
+            node { name: "b" stop_node {} }
+            condition { op: EQUAL name: "label.demo.gender" value: "MALE" }
+          }
+        }
+      )pb",
+      &root));
+  EXPECT_THAT(GenerateLabelingFunction(root, "LabelModel").status(),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       "Invalid value BAD for "
+                       "wfa_virtual_people.DemoBucket.gender"));
+}
+
+TEST(LabelingCodegenTest, GenerateUpdatesAndMultiplicity) {
+  CompiledNode root;
+  ASSERT_THAT(ReadTextProtoFile(kModelWithUpdatesPath, root), IsOk());
+  ASSERT_OK_AND_ASSIGN(std::string source,
+                       GenerateLabelingFunction(root, "LabelModel"));
+  EXPECT_THAT(source,
+              HasSubstr("#include \"wfa/virtual_people/training/"
+                        "model_evaluator/branch_action.h\""));
+  // The updaters of node root, and the update tree at position 1, which goes
+  // back to the root at its stop nodes.
+  EXPECT_THAT(source, HasSubstr("NewUpdater(kUpdater0_0)"));
+  EXPECT_THAT(source, HasSubstr("NewUpdater(kUpdater0_1)"));
+  EXPECT_THAT(source, HasSubstr("  goto node_1;\nnode_0_update_2:\n"));
+  EXPECT_THAT(source, HasSubstr("  goto node_0_update_2;\n"));
+  // The clones of node us, at position 8.
+  EXPECT_THAT(source, HasSubstr("NewMultiplicity(kMultiplicity8)"));
+  EXPECT_THAT(source, HasSubstr("absl::Status WalkCloneFromNode8("
+                                "LabelerEvent& event, SeedHashFunction hash,"));
+  EXPECT_THAT(source, HasSubstr("WalkCloneFromNode8(clone, hash, result)"));
+}
+
+TEST(LabelingCodegenTest, InvalidUpdateMatrix) {
+  CompiledNode root;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(
+      R"pb(
+        name: "root"
+        branch_node {
+          branches {
+            node { name: "a" stop_node {} }
+            chance: 1
+          }
+          updates { updates { update_matrix {} } }
+        }
+      )pb",
+      &root));
+  EXPECT_THAT(GenerateLabelingFunction(root, "LabelModel").status(),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       "UpdateMatrix must have columns and rows. at root"));
+}
+
+TEST(LabelingCodegenTest, MultiplicityInUpdateTreeNotSupported) {
+  CompiledNode root;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(
+      R"pb(
+        name: "root"
+        branch_node {
+          branches {
+            node { name: "a" stop_node {} }
+            chance: 1
+          }
+          updates {
+            updates {
+              update_tree {
+                root {
+                  name: "tree"
+                  branch_node {
+                    branches {
+                      node { name: "tree_end" stop_node {} }
+                      chance: 1
+                    }
+                    multiplicity {
+                      expected_multiplicity: 2
+                      person_index_field: "multiplicity_person_index"
+                    }
+                  }
+                }
+              }
+            }
+          }
+        }
+      )pb",
+      &root));
+  EXPECT_THAT(GenerateLabelingFunction(root, "LabelModel").status(),
+              StatusIs(absl::StatusCode::kUnimplemented,
+                       "Multiplicity in an update tree is not supported: "
+                       "tree"));
+}
+
+}  // namespace
+}  // namespace wfa_virtual_people
@@ -0,0 +1,708 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "wfa/virtual_people/training/model_evaluator/model_walker.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "common_cpp/protobuf_util/textproto_io.h"
+#include "common_cpp/testing/status_macros.h"
+#include "common_cpp/testing/status_matchers.h"
+#include "gmock/gmock.h"
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+#include "wfa/virtual_people/common/event.pb.h"
+#include "wfa/virtual_people/common/model.pb.h"
+
+namespace wfa_virtual_people {
+namespace {
+
+using ::wfa::IsOk;
+using ::wfa::ReadTextProtoFile;
+using ::wfa::StatusIs;
+
+constexpr char kModelPath[] =
+    "src/test/cc/wfa/virtual_people/training/model_evaluator/test_data/"
+    "labeling_model.textproto";
+
+LabelerEvent GetEvent(const std::string& country, Gender gender,
+                      uint64_t fingerprint) {
+  LabelerEvent event;
+  event.set_person_country_code(country);
+  event.mutable_label()->mutable_demo()->set_gender(gender);
+  event.set_acting_fingerprint(fingerprint);
+  return event;
+}
+
+TEST(ModelWalkerTest, SelectByCondition) {
+  CompiledNode root;
+  ASSERT_THAT(ReadTextProtoFile(kModelPath, root), IsOk());
+  ASSERT_OK_AND_ASSIGN(ModelWalker walker, ModelWalker::Create(root));
+
+  ASSERT_OK_AND_ASSIGN(WalkResult result,
+                       walker.Walk(GetEvent("US", GENDER_MALE, 1)));
+  ASSERT_EQ(result.leaves.size(), 1);
+  EXPECT_EQ(result.leaves[0].name, "us_male");
+  EXPECT_EQ(result.depth, 3);
+  ASSERT_TRUE(result.leaves[0].virtual_person_id.has_value());
+  EXPECT_GE(*result.leaves[0].virtual_person_id, 5000);
+  EXPECT_LT(*result.leaves[0].virtual_person_id, 5100);
+
+  ASSERT_OK_AND_ASSIGN(result, walker.Walk(GetEvent("FR", GENDER_MALE, 1)));
+  ASSERT_EQ(result.leaves.size(), 1);
+  EXPECT_EQ(result.leaves[0].name, "other");
+  EXPECT_EQ(result.depth, 2);
+  EXPECT_FALSE(result.leaves[0].virtual_person_id.has_value());
+}
+
+TEST(ModelWalkerTest, SelectByChance) {
+  CompiledNode root;
+  ASSERT_THAT(ReadTextProtoFile(kModelPath, root), IsOk());
+  ASSERT_OK_AND_ASSIGN(ModelWalker walker, ModelWalker::Create(root));
+
+  int first_branch_count = 0;
+  constexpr int kEventCount = 10000;
+  for (uint64_t fingerprint = 0; fingerprint < kEventCount; ++fingerprint) {
+    ASSERT_OK_AND_ASSIGN(
+        WalkResult result,
+        walker.Walk(GetEvent("US", GENDER_FEMALE, fingerprint)));
+    EXPECT_EQ(result.depth, 4);
+    ASSERT_EQ(result.leaves.size(), 1);
+    const WalkResult::Leaf& leaf = result.leaves[0];
+    ASSERT_TRUE(leaf.virtual_person_id.has_value());
+    uint64_t id = *leaf.virtual_person_id;
+    if (leaf.name == "us_female_1") {
+      ++first_branch_count;
+      EXPECT_TRUE(id >= 100 && id < 150) << id;
+    } else {
+      EXPECT_EQ(leaf.name, "us_female_2");
+      EXPECT_TRUE((id >= 1000 && id < 1020) || (id >= 2000 && id < 2030) ||
+                  (id >= 4000 && id < 4010))
+          << id;
+    }
+  }
+  EXPECT_NEAR(first_branch_count, kEventCount * 0.3, kEventCount * 0.02);
+}
+
+// A hash function with the same value for all seeds, with which the branch
+// with the greatest chance is always selected.
+uint64_t ConstantHash(absl::string_view seed) { return 1ULL << 63; }
+
+TEST(ModelWalkerTest, SelectByChanceWithHashFunction) {
+  CompiledNode root;
+  ASSERT_THAT(ReadTextProtoFile(kModelPath, root), IsOk());
+  ASSERT_OK_AND_ASSIGN(ModelWalker walker,
+                       ModelWalker::Create(root, &ConstantHash));
+  for (uint64_t fingerprint = 0; fingerprint < 100; ++fingerprint) {
+    ASSERT_OK_AND_ASSIGN(
+        WalkResult result,
+        walker.Walk(GetEvent("US", GENDER_FEMALE, fingerprint)));
+    ASSERT_EQ(result.leaves.size(), 1);
+    EXPECT_EQ(result.leaves[0].name, "us_female_2");
+    // (1 << 63) % 60 is 8, which is in the first pool.
+    EXPECT_EQ(result.leaves[0].virtual_person_id, 1008);
+  }
+}
+
+TEST(ModelWalkerTest, SameFingerprintSameResult) {
+  CompiledNode root;
+  ASSERT_THAT(ReadTextProtoFile(kModelPath, root), IsOk());
+  ASSERT_OK_AND_ASSIGN(ModelWalker walker, ModelWalker::Create(root));
+  ASSERT_OK_AND_ASSIGN(WalkResult result1,
+                       walker.Walk(GetEvent("US", GENDER_FEMALE, 12345)));
+  ASSERT_OK_AND_ASSIGN(WalkResult result2,
+                       walker.Walk(GetEvent("US", GENDER_FEMALE, 12345)));
+  ASSERT_EQ(result1.leaves.size(), 1);
+  ASSERT_EQ(result2.leaves.size(), 1);
+  EXPECT_EQ(result1.leaves[0].name, result2.leaves[0].name);
+  EXPECT_EQ(result1.leaves[0].virtual_person_id,
+            result2.leaves[0].virtual_person_id);
+}
+
+TEST(ModelWalkerTest, VisitCounts) {
+  CompiledNode root;
+  ASSERT_THAT(ReadTextProtoFile(kModelPath, root), IsOk());
+  ASSERT_OK_AND_ASSIGN(ModelWalker walker, ModelWalker::Create(root));
+  ASSERT_EQ(walker.node_count(), 11);
+  EXPECT_EQ(walker.node_name(0), "root");
+  EXPECT_EQ(walker.node_name(1), "us");
+  EXPECT_EQ(walker.node_name(5), "us_male");
+
+  std::vector<int64_t> visit_counts(walker.node_count());
+  ASSERT_THAT(walker.Walk(GetEvent("US", GENDER_MALE, 1), visit_counts),
+              IsOk());
+  ASSERT_THAT(walker.Walk(GetEvent("FR", GENDER_MALE, 1), visit_counts),
+              IsOk());
+  EXPECT_THAT(visit_counts,
+              testing::ElementsAre(2, 1, 0, 0, 0, 1, 0, 0, 0, 0, 1));
+
+  std::vector<int64_t> wrong_size(1);
+  EXPECT_THAT(
+      walker.Walk(GetEvent("US", GENDER_MALE, 1), wrong_size).status(),
+      StatusIs(absl::StatusCode::kInvalidArgument,
+               "The size of visit_counts does not match the node count."));
+}
+
+TEST(ModelWalkerTest, NoMatchingCondition) {
+  CompiledNode root;
+  ASSERT_THAT(ReadTextProtoFile(kModelPath, root), IsOk());
+  ASSERT_OK_AND_ASSIGN(ModelWalker walker, ModelWalker::Create(root));
+  // north_america has no branch for events without age.
+  EXPECT_THAT(walker.Walk(GetEvent("CA", GENDER_MALE, 1)).status(),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       "No condition matches the event at north_america"));
+}
+
+TEST(ModelWalkerTest, ChancesNotSumToOne) {
+  CompiledNode root;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(
+      R"pb(
+        name: "root"
+        branch_node {
+          branches {
+            node { name: "a" stop_node {} }
+            chance: 0.5
+          }
+          branches {
+            node { name: "b" stop_node {} }
+            chance: 0.4
+          }
+        }
+      )pb",
+      &root));
+  EXPECT_THAT(ModelWalker::Create(root).status(),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       "The chances of the branches do not sum to 1: root"));
+}
+
+TEST(ModelWalkerTest, NodeIndexNotFound) {
+  CompiledNode root;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(
+      R"pb(
+        name: "root"
+        branch_node { branches { node_index: 1 chance: 1 } }
+      )pb",
+      &root));
+  EXPECT_THAT(ModelWalker::Create(root).status(),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       "The node_index is not found: 1"));
+}
+
+std::vector<CompiledNode> ParseNodes(const std::vector<std::string>& nodes) {
+  std::vector<CompiledNode> parsed(nodes.size());
+  for (int i = 0; i < nodes.size(); ++i) {
+    EXPECT_TRUE(
+        google::protobuf::TextFormat::ParseFromString(nodes[i], &parsed[i]));
+  }
+  return parsed;
+}
+
+TEST(ModelWalkerTest, IndexedNodes) {
+  // The root is the last node, and both branches share the population node.
+  std::vector<CompiledNode> nodes = ParseNodes({
+      R"pb(
+        name: "pool"
+        index: 2
+        population_node {
+          pools { population_offset: 100 total_population: 10 }
+        }
+      )pb",
+      R"pb(
+        name: "us"
+        index: 1
+        branch_node {
+          branches {
+            node_index: 2
+            condition {
+              op: EQUAL
+              name: "label.demo.gender"
+              value: "GENDER_MALE"
+            }
+          }
+          branches {
+            node { name: "stop" stop_node {} }
+            condition { op: TRUE }
+          }
+        }
+      )pb",
+      R"pb(
+        name: "root"
+        index: 0
+        branch_node {
+          branches {
+            node_index: 1
+            condition {
+              op: EQUAL
+              name: "person_country_code"
+              value: "US"
+            }
+          }
+          branches {
+            node_index: 2
+            condition { op: TRUE }
+          }
+        }
+      )pb",
+  });
+  ASSERT_OK_AND_ASSIGN(ModelWalker walker, ModelWalker::Create(nodes));
+  ASSERT_EQ(walker.node_count(), 4);
+  EXPECT_EQ(walker.node_name(0), "root");
+  EXPECT_EQ(walker.node_name(1), "us");
+  EXPECT_EQ(walker.node_name(2), "pool");
+  EXPECT_EQ(walker.node_name(3), "stop");
+
+  std::vector<int64_t> visit_counts(walker.node_count());
+  ASSERT_OK_AND_ASSIGN(
+      WalkResult result,
+      walker.Walk(GetEvent("US", GENDER_MALE, 1), visit_counts));
+  ASSERT_EQ(result.leaves.size(), 1);
+  EXPECT_EQ(result.leaves[0].name, "pool");
+  EXPECT_EQ(result.depth, 3);
+  ASSERT_OK_AND_ASSIGN(
+      result, walker.Walk(GetEvent("FR", GENDER_MALE, 1), visit_counts));
+  ASSERT_EQ(result.leaves.size(), 1);
+  EXPECT_EQ(result.leaves[0].name, "pool");
+  EXPECT_EQ(result.depth, 2);
+  EXPECT_THAT(visit_counts, testing::ElementsAre(2, 1, 2, 0));
+}
+
+TEST(ModelWalkerTest, MultipleRoots) {
+  std::vector<CompiledNode> nodes = ParseNodes({
+      R"pb(name: "a" index: 0 stop_node {})pb",
+      R"pb(name: "b" index: 1 stop_node {})pb",
+  });
+  EXPECT_THAT(ModelWalker::Create(nodes).status(),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       "Only 1 root node is expected, got a and b"));
+}
+
+TEST(ModelWalkerTest, DuplicatedIndex) {
+  std::vector<CompiledNode> nodes = ParseNodes({
+      R"pb(
+        name: "root"
+        branch_node { branches { node_index: 1 chance: 1 } }
+      )pb",
+      R"pb(name: "a" index: 1 stop_node {})pb",
+      R"pb(name: "b" index: 1 stop_node {})pb",
+  });
+  EXPECT_THAT(ModelWalker::Create(nodes).status(),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       "Duplicated node index: 1"));
+}
+
+TEST(ModelWalkerTest, ReferenceCycle) {
+  std::vector<CompiledNode> nodes = ParseNodes({
+      R"pb(
+        name: "root"
+        branch_node { branches { node_index: 1 chance: 1 } }
+      )pb",
+      R"pb(
+        name: "a"
+        index: 1
+        branch_node { branches { node_index: 2 chance: 1 } }
+      )pb",
+      R"pb(
+        name: "b"
+        index: 2
+        branch_node { branches { node_index: 1 chance: 1 } }
+      )pb",
+  });
+  EXPECT_THAT(ModelWalker::Create(nodes).status(),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       "The node references have a cycle at index 1"));
+}
+
+TEST(ModelWalkerTest, UpdateMatrix) {
+  CompiledNode root;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(
+      R"pb(
+        name: "root"
+        branch_node {
+          branches {
+            node { name: "female" stop_node {} }
+            condition {
+              op: EQUAL
+              name: "label.demo.gender"
+              value: "GENDER_FEMALE"
+            }
+          }
+          branches {
+            node { name: "male" stop_node {} }
+            condition { op: TRUE }
+          }
+          updates {
+            updates {
+              update_matrix {
+                columns { person_country_code: "US" }
+                columns { person_country_code: "CA" }
+                rows { label { demo { gender: GENDER_FEMALE } } }
+                rows { label { demo { gender: GENDER_MALE } } }
+                probabilities: [ 1, 0, 0, 1 ]
+                random_seed: "matrix"
+              }
+            }
+          }
+        }
+      )pb",
+      &root));
+  ASSERT_OK_AND_ASSIGN(ModelWalker walker, ModelWalker::Create(root));
+
+  // The gender of the event is overwritten by the update.
+  ASSERT_OK_AND_ASSIGN(WalkResult result,
+                       walker.Walk(GetEvent("US", GENDER_MALE, 1)));
+  ASSERT_EQ(result.leaves.size(), 1);
+  EXPECT_EQ(result.leaves[0].name, "female");
+  ASSERT_OK_AND_ASSIGN(result, walker.Walk(GetEvent("CA", GENDER_FEMALE, 1)));
+  ASSERT_EQ(result.leaves.size(), 1);
+  EXPECT_EQ(result.leaves[0].name, "male");
+
+  EXPECT_THAT(walker.Walk(GetEvent("FR", GENDER_MALE, 1)).status(),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       "No column of the update matrix matches the event"));
+}
+
+TEST(ModelWalkerTest, ConditionalMergeAndAssignment) {
+  CompiledNode root;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(
+      R"pb(
+        name: "root"
+        branch_node {
+          branches {
+            node { name: "north_america_female" stop_node {} }
+            condition {
+              op: AND
+              sub_filters {
+                op: EQUAL
+                name: "person_region_code"
+                value: "north_america"
+              }
+              sub_filters {
+                op: EQUAL
+                name: "label.demo.gender"
+                value: "GENDER_FEMALE"
+              }
+            }
+          }
+          branches {
+            node { name: "other" stop_node {} }
+            condition { op: TRUE }
+          }
+          updates {
+            updates {
+              conditional_merge {
+                nodes {
+                  condition {
+                    op: IN
+                    name: "person_country_code"
+                    value: "US,CA"
+                  }
+                  update { person_region_code: "north_america" }
+                }
+                pass_through_non_matches: true
+              }
+            }
+            updates {
+              conditional_assignment {
+                condition { op: HAS name: "corrected_demo.gender" }
+                assignments {
+                  source_field: "corrected_demo.gender"
+                  target_field: "label.demo.gender"
+                }
+              }
+            }
+          }
+        }
+      )pb",
+      &root));
+  ASSERT_OK_AND_ASSIGN(ModelWalker walker, ModelWalker::Create(root));
+
+  LabelerEvent event = GetEvent("CA", GENDER_MALE, 1);
+  event.mutable_corrected_demo()->set_gender(GENDER_FEMALE);
+  ASSERT_OK_AND_ASSIGN(WalkResult result, walker.Walk(event));
+  ASSERT_EQ(result.leaves.size(), 1);
+  EXPECT_EQ(result.leaves[0].name, "north_america_female");
+  // The event is not changed.
+  EXPECT_EQ(event.label().demo().gender(), GENDER_MALE);
+  EXPECT_FALSE(event.has_person_region_code());
+
+  ASSERT_OK_AND_ASSIGN(result, walker.Walk(GetEvent("CA", GENDER_MALE, 1)));
+  EXPECT_EQ(result.leaves[0].name, "other");
+  event.set_person_country_code("FR");
+  ASSERT_OK_AND_ASSIGN(result, walker.Walk(event));
+  EXPECT_EQ(result.leaves[0].name, "other");
+}
+
+TEST(ModelWalkerTest, UpdateTree) {
+  CompiledNode root;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(
+      R"pb(
+        name: "root"
+        branch_node {
+          branches {
+            node {
+              name: "male"
+              population_node {
+                pools { population_offset: 100 total_population: 10 }
+              }
+            }
+            condition {
+              op: EQUAL
+              name: "label.demo.gender"
+              value: "GENDER_MALE"
+            }
+          }
+          branches {
+            node { name: "other" stop_node {} }
+            condition { op: TRUE }
+          }
+          updates {
+            updates {
+              update_tree {
+                root {
+                  name: "tree"
+                  branch_node {
+                    branches {
+                      node {
+                        name: "tree_us"
+                        branch_node {
+                          branches {
+                            node { name: "tree_us_end" stop_node {} }
+                            chance: 1
+                          }
+                          updates {
+                            updates {
+                              conditional_merge {
+                                nodes {
+                                  condition { op: TRUE }
+                                  update {
+                                    label { demo { gender: GENDER_MALE } }
+                                  }
+                                }
+                              }
+                            }
+                          }
+                        }
+                      }
+                      condition {
+                        op: EQUAL
+                        name: "person_country_code"
+                        value: "US"
+                      }
+                    }
+                    branches {
+                      node { name: "tree_end" stop_node {} }
+                      condition { op: TRUE }
+                    }
+                  }
+                }
+              }
+            }
+          }
+        }
+      )pb",
+      &root));
+  ASSERT_OK_AND_ASSIGN(ModelWalker walker, ModelWalker::Create(root));
+  // The nodes of the update tree are after the root, and before its children.
+  ASSERT_EQ(walker.node_count(), 7);
+  EXPECT_EQ(walker.node_name(1), "tree");
+  EXPECT_EQ(walker.node_name(5), "male");
+
+  std::vector<int64_t> visit_counts(walker.node_count());
+  ASSERT_OK_AND_ASSIGN(
+      WalkResult result,
+      walker.Walk(GetEvent("US", GENDER_FEMALE, 1), visit_counts));
+  ASSERT_EQ(result.leaves.size(), 1);
+  EXPECT_EQ(result.leaves[0].name, "male");
+  EXPECT_EQ(result.depth, 5);
+  ASSERT_OK_AND_ASSIGN(
+      result, walker.Walk(GetEvent("FR", GENDER_FEMALE, 1), visit_counts));
+  ASSERT_EQ(result.leaves.size(), 1);
+  EXPECT_EQ(result.leaves[0].name, "other");
+  EXPECT_EQ(result.depth, 4);
+  EXPECT_THAT(visit_counts, testing::ElementsAre(2, 2, 1, 1, 1, 1, 1));
+}
+
+TEST(ModelWalkerTest, PopulationNodeInUpdateTreeNotSupported) {
+  CompiledNode root;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(
+      R"pb(
+        name: "root"
+        branch_node {
+          branches {
+            node { name: "a" stop_node {} }
+            chance: 1
+          }
+          updates {
+            updates {
+              update_tree {
+                root {
+                  name: "tree"
+                  population_node {
+                    pools { population_offset: 100 total_population: 10 }
+                  }
+                }
+              }
+            }
+          }
+        }
+      )pb",
+      &root));
+  EXPECT_THAT(
+      ModelWalker::Create(root).status(),
+      StatusIs(absl::StatusCode::kUnimplemented,
+               "Population node in an update tree is not supported: tree"));
+}
+
+TEST(ModelWalkerTest, InvalidUpdateMatrix) {
+  CompiledNode root;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(
+      R"pb(
+        name: "root"
+        branch_node {
+          branches {
+            node { name: "a" stop_node {} }
+            chance: 1
+          }
+          updates { updates { update_matrix {} } }
+        }
+      )pb",
+      &root));
+  EXPECT_THAT(ModelWalker::Create(root).status(),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       "UpdateMatrix must have columns and rows. at root"));
+}
+
+// Return a model cloning each event by the expected_multiplicity field of the
+// event, where the clone 0 reaches the node first, and the other clones reach
+// the node others.
+CompiledNode GetMultiplicityModel(const std::string& multiplicity) {
+  CompiledNode root;
+  EXPECT_TRUE(google::protobuf::TextFormat::ParseFromString(
+      absl::StrCat(R"pb(
+                     name: "root"
+                     branch_node {
+                       branches {
+                         node {
+                           name: "first"
+                           population_node {
+                             pools {
+                               population_offset: 0
+                               total_population: 1000000
+                             }
+                             random_seed: "first"
+                           }
+                         }
+                         condition {
+                           op: EQUAL
+                           name: "multiplicity_person_index"
+                           value: "0"
+                         }
+                       }
+                       branches {
+                         node {
+                           name: "others"
+                           population_node {
+                             pools {
+                               population_offset: 0
+                               total_population: 1000000
+                             }
+                             random_seed: "others"
+                           }
+                         }
+                         condition { op: TRUE }
+                       }
+                       multiplicity {
+                     )pb",
+                   multiplicity, "}}"),
+      &root));
+  return root;
+}
+
+TEST(ModelWalkerTest, Multiplicity) {
+  ASSERT_OK_AND_ASSIGN(ModelWalker walker,
+                       ModelWalker::Create(GetMultiplicityModel(R"pb(
+                         expected_multiplicity_field: "expected_multiplicity"
+                         person_index_field: "multiplicity_person_index"
+                         random_seed: "multiplicity"
+                       )pb")));
+  LabelerEvent event = GetEvent("US", GENDER_MALE, 1);
+  event.set_expected_multiplicity(3);
+  ASSERT_OK_AND_ASSIGN(WalkResult result, walker.Walk(event));
+  ASSERT_EQ(result.leaves.size(), 3);
+  EXPECT_EQ(result.leaves[0].name, "first");
+  EXPECT_EQ(result.leaves[1].name, "others");
+  EXPECT_EQ(result.leaves[2].name, "others");
+  // The clones have their own acting_fingerprint.
+  EXPECT_NE(result.leaves[1].virtual_person_id,
+            result.leaves[2].virtual_person_id);
+  EXPECT_EQ(result.depth, 4);
+
+  // The fractional part is the chance of an extra clone.
+  event.set_expected_multiplicity(0.25);
+  int clone_count = 0;
+  constexpr int kEventCount = 10000;
+  for (uint64_t fingerprint = 0; fingerprint < kEventCount; ++fingerprint) {
+    event.set_acting_fingerprint(fingerprint);
+    ASSERT_OK_AND_ASSIGN(result, walker.Walk(event));
+    clone_count += result.leaves.size();
+  }
+  EXPECT_NEAR(clone_count, kEventCount * 0.25, kEventCount * 0.02);
+
+  event.clear_expected_multiplicity();
+  EXPECT_THAT(walker.Walk(event).status(),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       "The expected multiplicity field is not set"));
+}
+
+TEST(ModelWalkerTest, MultiplicityMaxValue) {
+  ASSERT_OK_AND_ASSIGN(ModelWalker walker,
+                       ModelWalker::Create(GetMultiplicityModel(R"pb(
+                         expected_multiplicity: 3
+                         max_value: 2
+                         person_index_field: "multiplicity_person_index"
+                       )pb")));
+  EXPECT_THAT(walker.Walk(GetEvent("US", GENDER_MALE, 1)).status(),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       "The expected multiplicity 3 is greater than "
+                       "max_value 2"));
+
+  ASSERT_OK_AND_ASSIGN(walker, ModelWalker::Create(GetMultiplicityModel(R"pb(
+                         expected_multiplicity: 3
+                         max_value: 2
+                         cap_at_max: true
+                         person_index_field: "multiplicity_person_index"
+                       )pb")));
+  ASSERT_OK_AND_ASSIGN(WalkResult result,
+                       walker.Walk(GetEvent("US", GENDER_MALE, 1)));
+  EXPECT_EQ(result.leaves.size(), 2);
+}
+
+TEST(ModelWalkerTest, InvalidMultiplicity) {
+  EXPECT_THAT(ModelWalker::Create(GetMultiplicityModel(R"pb(
+                expected_multiplicity: 1
+                person_index_field: "person_country_code"
+              )pb"))
+                  .status(),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       "person_index_field must be an integer: "
+                       "person_country_code at root"));
+}
+
+}  // namespace
+}  // namespace wfa_virtual_people
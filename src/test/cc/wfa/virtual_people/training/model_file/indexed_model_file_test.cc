@@ -0,0 +1,181 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "wfa/virtual_people/training/model_file/indexed_model_file.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "common_cpp/protobuf_util/riegeli_io.h"
+#include "common_cpp/testing/common_matchers.h"
+#include "common_cpp/testing/status_macros.h"
+#include "common_cpp/testing/status_matchers.h"
+#include "gmock/gmock.h"
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+#include "wfa/virtual_people/common/model.pb.h"
+
+namespace wfa_virtual_people {
+namespace {
+
+using ::testing::Not;
+using ::wfa::EqualsProto;
+using ::wfa::IsOk;
+using ::wfa::IsOkAndHolds;
+using ::wfa::StatusIs;
+
+// A model with the child nodes before their parents.
+constexpr const char* kNodes[] = {
+    R"pb(name: "leaf_1" index: 0 stop_node {})pb",
+    R"pb(name: "leaf_2" index: 1 stop_node {})pb",
+    R"pb(name: "country_1"
+         index: 2
+         branch_node {
+           branches { node_index: 0 chance: 0.5 }
+           branches { node_index: 1 chance: 0.5 }
+           random_seed: "seed"
+         })pb",
+    R"pb(name: "leaf_3" index: 3 stop_node {})pb",
+    R"pb(name: "root"
+         index: 4
+         branch_node {
+           branches {
+             node_index: 2
+             condition { op: EQUAL name: "person_country_code" value: "1" }
+           }
+           branches {
+             node_index: 3
+             condition { op: TRUE }
+           }
+         })pb",
+};
+
+std::vector<CompiledNode> GetNodes() {
+  std::vector<CompiledNode> nodes;
+  for (const char* node : kNodes) {
+    EXPECT_TRUE(google::protobuf::TextFormat::ParseFromString(
+        node, &nodes.emplace_back()));
+  }
+  return nodes;
+}
+
+std::string GetTempPath(absl::string_view name) {
+  return absl::StrCat(::testing::TempDir(), "/", name);
+}
+
+TEST(IndexedModelFileTest, ReadNodes) {
+  std::vector<CompiledNode> nodes = GetNodes();
+  std::string path = GetTempPath("read_nodes.riegeli");
+  ASSERT_THAT(WriteIndexedModelFile(path, nodes), IsOk());
+
+  ASSERT_OK_AND_ASSIGN(std::unique_ptr<IndexedModelReader> reader,
+                       IndexedModelReader::Open(path));
+  EXPECT_EQ(reader->node_count(), 5);
+  EXPECT_EQ(reader->root_index(), 4);
+  // Read out of order.
+  for (int index : {3, 0, 4, 2, 1, 2}) {
+    EXPECT_THAT(reader->ReadNode(index),
+                IsOkAndHolds(EqualsProto(nodes[index])));
+  }
+  EXPECT_THAT(reader->ReadNode(5).status(),
+              StatusIs(absl::StatusCode::kOutOfRange,
+                       "Node index 5 is out of range [0, 5)"));
+}
+
+TEST(IndexedModelFileTest, ReadableAsRiegeliFile) {
+  std::vector<CompiledNode> nodes = GetNodes();
+  std::string path = GetTempPath("readable.riegeli");
+  ASSERT_THAT(WriteIndexedModelFile(path, nodes), IsOk());
+
+  std::vector<CompiledNode> read_nodes;
+  ASSERT_THAT(wfa::ReadRiegeliFile(path, read_nodes), IsOk());
+  ASSERT_EQ(read_nodes.size(), nodes.size());
+  for (int i = 0; i < nodes.size(); ++i) {
+    EXPECT_THAT(read_nodes[i], EqualsProto(nodes[i]));
+  }
+}
+
+TEST(IndexedModelFileTest, ReadSubtree) {
+  std::string path = GetTempPath("read_subtree.riegeli");
+  ASSERT_THAT(WriteIndexedModelFile(path, GetNodes()), IsOk());
+  ASSERT_OK_AND_ASSIGN(std::unique_ptr<IndexedModelReader> reader,
+                       IndexedModelReader::Open(path));
+
+  CompiledNode expected;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(
+      R"pb(
+        name: "country_1"
+        index: 2
+        branch_node {
+          branches {
+            node { name: "leaf_1" index: 0 stop_node {} }
+            chance: 0.5
+          }
+          branches {
+            node { name: "leaf_2" index: 1 stop_node {} }
+            chance: 0.5
+          }
+          random_seed: "seed"
+        }
+      )pb",
+      &expected));
+  EXPECT_THAT(reader->ReadSubtree(2), IsOkAndHolds(EqualsProto(expected)));
+
+  ASSERT_OK_AND_ASSIGN(CompiledNode root, reader->ReadSubtree(4));
+  EXPECT_THAT(root.branch_node().branches(0).node(), EqualsProto(expected));
+}
+
+TEST(IndexedModelFileTest, ReadSubtreeMaxDepth) {
+  std::string path = GetTempPath("max_depth.riegeli");
+  ASSERT_THAT(WriteIndexedModelFile(path, GetNodes()), IsOk());
+  ASSERT_OK_AND_ASSIGN(std::unique_ptr<IndexedModelReader> reader,
+                       IndexedModelReader::Open(path));
+
+  ASSERT_OK_AND_ASSIGN(CompiledNode root, reader->ReadSubtree(4, 1));
+  const CompiledNode& country = root.branch_node().branches(0).node();
+  EXPECT_EQ(country.name(), "country_1");
+  EXPECT_EQ(country.branch_node().branches(0).node_index(), 0);
+  EXPECT_EQ(root.branch_node().branches(1).node().name(), "leaf_3");
+}
+
+TEST(IndexedModelFileTest, IndexNotPosition) {
+  std::vector<CompiledNode> nodes = GetNodes();
+  nodes[1].set_index(7);
+  EXPECT_THAT(
+      WriteIndexedModelFile(GetTempPath("index_not_position.riegeli"), nodes),
+      StatusIs(absl::StatusCode::kInvalidArgument,
+               "The index of node leaf_2 is not its position 1"));
+}
+
+TEST(IndexedModelFileTest, MultipleRoots) {
+  std::vector<CompiledNode> nodes = GetNodes();
+  nodes.pop_back();
+  EXPECT_THAT(
+      WriteIndexedModelFile(GetTempPath("multiple_roots.riegeli"), nodes),
+      StatusIs(absl::StatusCode::kInvalidArgument,
+               "Multiple root nodes: country_1 and leaf_3"));
+}
+
+TEST(IndexedModelFileTest, IndexNotFound) {
+  EXPECT_THAT(
+      IndexedModelReader::Open(GetTempPath("not_exist.riegeli")).status(),
+      Not(IsOk()));
+}
+
+}  // namespace
+}  // namespace wfa_virtual_people
@@ -0,0 +1,286 @@
+// Copyright 2023 The Cross-Media Measurement Authors
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+
+#include "absl/status/status.h"
+#include "common_cpp/protobuf_util/textproto_io.h"
+#include "common_cpp/testing/common_matchers.h"
+#include "common_cpp/testing/status_macros.h"
+#include "common_cpp/testing/status_matchers.h"
+#include "gmock/gmock.h"
+#include "google/protobuf/text_format.h"
+#include "gtest/gtest.h"
+#include "wfa/virtual_people/common/event.pb.h"
+#include "wfa/virtual_people/common/model.pb.h"
+#include "wfa/virtual_people/training/model_evaluator/field_filter_program.h"
+#include "wfa/virtual_people/training/model_image/model_image_format.h"
+#include "wfa/virtual_people/training/model_image/model_image_reader.h"
+#include "wfa/virtual_people/training/model_image/model_image_writer.h"
+
+namespace wfa_virtual_people {
+namespace {
+
+using ::wfa::EqualsProto;
+using ::wfa::IsOk;
+using ::wfa::IsOkAndHolds;
+using ::wfa::ReadTextProtoFile;
+using ::wfa::StatusIs;
+
+// A model using all the kinds of nodes, branches and actions.
+constexpr char kModel[] = R"pb(
+  name: "root"
+  index: 0
+  branch_node {
+    branches {
+      node {
+        name: "country_1"
+        branch_node {
+          branches {
+            node {
+              name: "pool_1"
+              population_node {
+                pools { population_offset: 1000 total_population: 2000 }
+                pools { population_offset: 5000 total_population: 1000 }
+                random_seed: "pool_1"
+              }
+            }
+            condition { op: EQUAL name: "label.demo.gender" value: "1" }
+          }
+          branches {
+            node { name: "stop" stop_node {} }
+            condition { op: TRUE }
+          }
+          multiplicity {
+            expected_multiplicity: 1.5
+            max_value: 2
+            cap_at_max: true
+            person_index_field: "acting_fields.multiplicity_person_index"
+            random_seed: "multiplicity"
+          }
+        }
+      }
+      condition { op: EQUAL name: "person_country_code" value: "1" }
+    }
+    branches {
+      node_index: 3
+      condition { op: EQUAL name: "person_country_code" value: "2" }
+    }
+    branches {
+      node {
+        name: "chance"
+        branch_node {
+          branches {
+            node {
+              name: "pool_2"
+              population_node {
+                pools { population_offset: 0 total_population: 1000 }
+              }
+            }
+            chance: 0.25
+          }
+          branches {
+            node { name: "empty" }
+            chance: 0.75
+          }
+          random_seed: "chance"
+        }
+      }
+      condition { op: TRUE }
+    }
+    updates {
+      updates {
+        conditional_merge {
+          nodes {
+            condition { op: EQUAL name: "person_country_code" value: "1" }
+            update { person_region_code: "1" }
+          }
+          pass_through_non_matches: true
+        }
+      }
+    }
+  }
+)pb";
+
+TEST(ModelImageTest, RoundTrip) {
+  CompiledNode model;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(kModel, &model));
+  ASSERT_OK_AND_ASSIGN(std::string data, BuildModelImage(model));
+  ASSERT_OK_AND_ASSIGN(ModelImage image, ModelImage::Create(data));
+  EXPECT_THAT(image.Validate(), IsOk());
+  EXPECT_EQ(image.node_count(), 7);
+  EXPECT_THAT(image.ToCompiledNode(), IsOkAndHolds(EqualsProto(model)));
+}
+
+TEST(ModelImageTest, RoundTripCompiledPopulationNode) {
+  CompiledNode model;
+  ASSERT_THAT(
+      ReadTextProtoFile(
+          "src/test/cc/wfa/virtual_people/training/model_compiler/test_data/"
+          "compiled_node_for_population_node.textproto",
+          model),
+      IsOk());
+  ASSERT_OK_AND_ASSIGN(std::string data, BuildModelImage(model));
+  ASSERT_OK_AND_ASSIGN(ModelImage image, ModelImage::Create(data));
+  EXPECT_THAT(image.ToCompiledNode(), IsOkAndHolds(EqualsProto(model)));
+}
+
+TEST(ModelImageTest, ReadInPlace) {
+  CompiledNode model;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(kModel, &model));
+  ASSERT_OK_AND_ASSIGN(std::string data, BuildModelImage(model));
+  ASSERT_OK_AND_ASSIGN(ModelImage image, ModelImage::Create(data));
+
+  const ImageNode& root = image.root();
+  EXPECT_EQ(root.type, ImageNodeType::kBranch);
+  EXPECT_EQ(image.blob(root.name), "root");
+  ASSERT_EQ(image.branches(root).size(), 3);
+  EXPECT_EQ(image.branches(root)[1].child_type, ImageChildType::kNodeIndex);
+  EXPECT_EQ(image.branches(root)[1].child, 3);
+
+  const ImageNode& country = image.node(image.branches(root)[0].child);
+  EXPECT_EQ(image.blob(country.name), "country_1");
+  const ImageNode& pool = image.node(image.branches(country)[0].child);
+  EXPECT_EQ(pool.type, ImageNodeType::kPopulation);
+  ASSERT_EQ(image.pools(pool).size(), 2);
+  EXPECT_EQ(image.pools(pool)[1].population_offset, 5000);
+  EXPECT_EQ(image.pools(pool)[1].total_population, 1000);
+
+  // Identical conditions are interned.
+  EXPECT_EQ(image.branches(root)[2].select_type, ImageSelectType::kCondition);
+  EXPECT_EQ(image.branches(root)[2].condition,
+            image.branches(country)[1].condition);
+  // "pool_1" is both a name and a random seed.
+  EXPECT_EQ(pool.name, pool.random_seed);
+}
+
+TEST(ModelImageTest, GetCondition) {
+  CompiledNode model;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(kModel, &model));
+  ASSERT_OK_AND_ASSIGN(std::string data, BuildModelImage(model));
+  ASSERT_OK_AND_ASSIGN(ModelImage image, ModelImage::Create(data));
+  ASSERT_THAT(image.Validate(), IsOk());
+
+  const ImageBranch& country_branch = image.branches(image.root())[0];
+  EXPECT_NE(country_branch.program, kNoBlob);
+  ASSERT_OK_AND_ASSIGN(FieldFilterProgram condition,
+                       image.GetCondition(country_branch));
+  LabelerEvent event;
+  event.set_person_country_code("1");
+  EXPECT_TRUE(condition.IsMatch(event));
+  event.set_person_country_code("2");
+  EXPECT_FALSE(condition.IsMatch(event));
+
+  // FieldFilterProgram requires the names of enum values, so the condition on
+  // the gender is stored only as FieldFilterProto.
+  const ImageNode& country = image.node(country_branch.child);
+  const ImageBranch& gender_branch = image.branches(country)[0];
+  EXPECT_EQ(gender_branch.select_type, ImageSelectType::kCondition);
+  EXPECT_EQ(gender_branch.program, kNoBlob);
+  EXPECT_THAT(image.GetCondition(gender_branch).status(),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       "Invalid value 1 for "
+                       "wfa_virtual_people.DemoBucket.gender"));
+}
+
+TEST(ModelImageTest, MappedFile) {
+  CompiledNode model;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(kModel, &model));
+  std::string path = ::testing::TempDir() + "/model_image_test.bin";
+  ASSERT_THAT(WriteModelImageFile(path, model), IsOk());
+  ASSERT_OK_AND_ASSIGN(std::unique_ptr<MappedModelImage> mapped,
+                       MappedModelImage::Open(path));
+  EXPECT_THAT(mapped->image().ToCompiledNode(),
+              IsOkAndHolds(EqualsProto(model)));
+}
+
+TEST(ModelImageTest, MappedFileNotFound) {
+  EXPECT_THAT(MappedModelImage::Open(::testing::TempDir() + "/not_exist.bin")
+                  .status(),
+              StatusIs(absl::StatusCode::kNotFound, "Failed to open"));
+}
+
+TEST(ModelImageTest, TooSmall) {
+  std::string data(sizeof(ModelImageHeader) - 8, '\0');
+  EXPECT_THAT(ModelImage::Create(data).status(),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       "The data is smaller than the header"));
+}
+
+TEST(ModelImageTest, WrongMagic) {
+  CompiledNode model;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(kModel, &model));
+  ASSERT_OK_AND_ASSIGN(std::string data, BuildModelImage(model));
+  data[0] = 'X';
+  EXPECT_THAT(ModelImage::Create(data).status(),
+              StatusIs(absl::StatusCode::kInvalidArgument, "Wrong magic"));
+}
+
+TEST(ModelImageTest, TruncatedTables) {
+  CompiledNode model;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(kModel, &model));
+  ASSERT_OK_AND_ASSIGN(std::string data, BuildModelImage(model));
+  data.resize(sizeof(ModelImageHeader) + sizeof(ImageNode));
+  EXPECT_THAT(ModelImage::Create(data).status(),
+              StatusIs(absl::StatusCode::kInvalidArgument, "out of bounds"));
+}
+
+TEST(ModelImageTest, ChildBeforeParent) {
+  CompiledNode model;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(kModel, &model));
+  ASSERT_OK_AND_ASSIGN(std::string data, BuildModelImage(model));
+  ModelImageHeader header;
+  std::memcpy(&header, data.data(), sizeof(header));
+  // Point the first branch of the root to the root itself.
+  ImageBranch branch;
+  std::memcpy(&branch, data.data() + header.branches.offset, sizeof(branch));
+  branch.child = 0;
+  std::memcpy(data.data() + header.branches.offset, &branch, sizeof(branch));
+  // The nodes are only checked when validating or converting the image.
+  ASSERT_OK_AND_ASSIGN(ModelImage image, ModelImage::Create(data));
+  EXPECT_THAT(image.Validate(),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       "Invalid child in node 0"));
+  EXPECT_THAT(image.ToCompiledNode().status(),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       "Invalid child in node 0"));
+}
+
+TEST(ModelImageTest, InvalidProgram) {
+  CompiledNode model;
+  ASSERT_TRUE(google::protobuf::TextFormat::ParseFromString(kModel, &model));
+  ASSERT_OK_AND_ASSIGN(std::string data, BuildModelImage(model));
+  ModelImageHeader header;
+  std::memcpy(&header, data.data(), sizeof(header));
+  ImageBranch branch;
+  std::memcpy(&branch, data.data() + header.branches.offset, sizeof(branch));
+  // Truncate the program of the first branch of the root.
+  ImageBlob blob;
+  const size_t blob_offset =
+      header.blobs.offset + branch.program * sizeof(ImageBlob);
+  std::memcpy(&blob, data.data() + blob_offset, sizeof(blob));
+  --blob.size;
+  std::memcpy(data.data() + blob_offset, &blob, sizeof(blob));
+  ASSERT_OK_AND_ASSIGN(ModelImage image, ModelImage::Create(data));
+  EXPECT_THAT(image.GetCondition(image.branches(image.root())[0]).status(),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       "Invalid FieldFilterProgram data: Truncated."));
+}
+
+}  // namespace
+}  // namespace wfa_virtual_people